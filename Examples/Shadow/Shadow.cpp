@@ -4,6 +4,11 @@
 
 #include <vulkanexamplebase.h>
 #include <ModelParser.h>
+#include <TextureStreamer.h>
+#include <ClusterCuller.h>
+#include <ComputeSkinning.h>
+#include <thread>
+#include <atomic>
 
 #define ENABLE_VALIDATION true
 
@@ -32,22 +37,47 @@ public:
 
     std::vector<Model*> demoModels;
 
+    // Model loaded on a worker thread while the frame loop keeps running, it is added to demoModels once its uploads completed
+    Model* streamedModel = nullptr;
+    std::thread loaderThread;
+    std::atomic<bool> streamedModelLoaded{ false };
+
+    // Meshlet culling of the camera pass, one culler per entry of demoModels
+    std::vector<ClusterCuller*> cullers;
+    bool clusterCullingSupported = false;
+    bool clusterCulling = true;
+
+    // Animated model skinned on the GPU, both passes draw the vertices written by the skinning pass of their command buffer
+    Model* skinnedModel = nullptr;
+    ComputeSkinning* skinning = nullptr;
+    float animationTime = 0.0f;
+
+    // Levels of detail are selected from the camera distance, a level is used while its error projects to less than lodThreshold pixels
+    bool useLods = true;
+    float lodThreshold = 1.0f;
+
     VkPipelineLayout pipelineLayout;
     VkDescriptorSetLayout descriptorSetLayout;
 
     VkPipelineLayout objPipelineLayout;
 
-    struct {
-        VkDescriptorSet offscreen;
-        VkDescriptorSet scene;
-        VkDescriptorSet debug;
-    } descriptorSets;
-
     glm::vec4 lightPos = glm::vec4(9.0f, 9.0f, 9.0f, 1.0f);
     float lightFOV = 55.0f;
 
-    Buffer offscreenUBO;
-    Buffer sceneUBO;
+    // Uniform buffers and descriptor sets are duplicated per command buffer, so the uniforms of
+    // the next frame can be written while the GPU is still reading those of a frame in flight
+    struct FrameResources {
+        Buffer offscreenUBO;
+        Buffer sceneUBO;
+        struct {
+            VkDescriptorSet offscreen;
+            VkDescriptorSet scene;
+            VkDescriptorSet debug;
+        } descriptorSets;
+    };
+    std::vector<FrameResources> frames;
+    // Command buffers whose recorded draws are outdated, each is re-recorded in draw() once its image has been acquired
+    std::vector<bool> commandBuffersDirty;
     struct {
         glm::mat4 depthMVP;
     } uboOffscreenVS;
@@ -67,6 +97,16 @@ public:
     VkPipeline offscreenPipeline;
     VkPipeline debugPipeline;
 
+    // The shadow pass fetches only the positions of the models, the pipeline reading the full vertices is kept to compare both
+    VkPipeline offscreenInterleavedPipeline;
+    bool positionOnlyShadowPass = true;
+
+    // GPU time of the shadow pass, measured with two timestamps per command buffer
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    // Valid bits of the timestamps written on the graphics queue, zero if its family doesn't support timestamps
+    uint64_t timestampMask = 0;
+    float shadowPassTime = 0.0f;
+
     // Framebuffer for offscreen rendering
     struct FrameBufferAttachment {
         VkImage image;
@@ -113,16 +153,55 @@ public:
         vkDestroyPipeline(device, objPipeline, nullptr);
         vkDestroyPipeline(device, offscreenPipeline, nullptr);
         vkDestroyPipeline(device, debugPipeline, nullptr);
+        vkDestroyPipeline(device, offscreenInterleavedPipeline, nullptr);
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
 
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
+        if (loaderThread.joinable()) {
+            loaderThread.join();
+        }
+        textureStreamer.releaseRetired();
+        delete streamedModel;
+        for (auto culler : cullers) {
+            delete culler;
+        }
+        delete skinning;
+        delete skinnedModel;
         for (auto demoModel : demoModels) {
             delete demoModel;
         }
 
-        sceneUBO.destroy();
-        offscreenUBO.destroy();
+        destroyFrameResources();
+    }
+
+    void destroyFrameResources()
+    {
+        for (auto& frame : frames) {
+            frame.sceneUBO.destroy();
+            frame.offscreenUBO.destroy();
+        }
+        frames.clear();
+    }
+
+    // Culling writes indirect draw lists with a draw count, which needs the extension and multi draw indirect
+    virtual void getEnabledFeatures()
+    {
+        clusterCullingSupported = ClusterCuller::supported(physicalDevice) && deviceFeatures.multiDrawIndirect;
+        if (clusterCullingSupported) {
+            enabledDeviceExtensions.push_back(ClusterCuller::requiredExtension);
+            enabledFeatures.multiDrawIndirect = VK_TRUE;
+        } else {
+            clusterCulling = false;
+        }
+    }
+
+    void addCuller(Model* model)
+    {
+        if (clusterCullingSupported) {
+            cullers.push_back(new ClusterCuller(model, static_cast<uint32_t>(drawCmdBuffers.size()), queue));
+        }
     }
 
     // Set up a separate render pass for the offscreen frame buffer
@@ -259,15 +338,99 @@ public:
 
     void loadAssets()
     {
-        std::vector<std::string> modelFiles = { "Marry", "floor" };
-        for (auto i = 0; i < modelFiles.size(); i++) {
-            auto* model = new Model();
-            model->loadFromFile(getAssetPath() + "models/Shadow/" + modelFiles[i] + "/" + modelFiles[i] + ".obj", vulkanDevice, queue);
-            demoModels.push_back(model);
+        // The floor is loaded up front, it also creates the descriptor set layouts shared by all models
+        // Node uniform buffers are written per frame like the palettes, every model gets one copy per command buffer
+        const uint32_t frameCount = static_cast<uint32_t>(drawCmdBuffers.size());
+        auto* floor = new Model();
+        floor->frameCount = frameCount;
+        floor->loadFromFile(getAssetPath() + "models/Shadow/floor/floor.obj", vulkanDevice, queue);
+        demoModels.push_back(floor);
+        addCuller(floor);
+
+        // Skinned column swaying next to the character, its pose is copied to the palettes of every frame in draw()
+        skinnedModel = new Model();
+        skinnedModel->frameCount = frameCount;
+        skinnedModel->loadFromFile(getAssetPath() + "models/Shadow/Column/Column.gltf", vulkanDevice, queue);
+        skinning = new ComputeSkinning(skinnedModel, frameCount, queue);
+
+        // The character is streamed in while the scene is already being rendered, starting with the mip tails of its textures
+        streamedModel = new Model();
+        streamedModel->frameCount = frameCount;
+        loaderThread = std::thread([this]() {
+            streamedModel->loadFromFileAsync(getAssetPath() + "models/Shadow/Marry/Marry.obj", vulkanDevice, FileLoadingFlags::StreamTextures | FileLoadingFlags::GenerateLods);
+            streamedModelLoaded = true;
+        });
+    }
+
+    // Add the streamed model to the scene once it has been loaded and uploaded
+    void updateStreamedModel()
+    {
+        if (!streamedModel || !streamedModelLoaded || !streamedModel->isReady()) {
+            return;
+        }
+        loaderThread.join();
+        // Nothing recorded so far uses the model, its resources can be changed without waiting for frames in flight
+        // The swap chain may have changed its image count while the model was loading
+        if (streamedModel->frameCount != drawCmdBuffers.size()) {
+            streamedModel->setFrameCount(static_cast<uint32_t>(drawCmdBuffers.size()));
+        }
+        demoModels.push_back(streamedModel);
+        addCuller(streamedModel);
+        streamedModel = nullptr;
+        invalidateCommandBuffers();
+    }
+
+    // Stream texture levels for the current view, switched textures are bound with new material descriptor sets
+    // The previous images are released in draw() once every command buffer has been re-recorded
+    void updateTextureStreaming()
+    {
+        textureStreamer.update(camera.matrices.view, camera.matrices.perspective, (float)height);
+        if (textureStreamer.hasPendingChanges() && textureStreamer.applyPendingChanges()) {
+            invalidateCommandBuffers();
+        }
+    }
+
+    // Advance the skinned model's animation, draw() hands the pose to the skinning pass
+    void updateAnimation()
+    {
+        if (paused || skinnedModel->animations.empty()) {
+            return;
+        }
+        animationTime = fmod(animationTime + frameTimer, skinnedModel->animations[0]->end);
+        skinnedModel->updateAnimation(0, animationTime);
+    }
+
+    // Pick the levels of detail for the current view, the draws are re-recorded with the selected levels
+    void updateLods()
+    {
+        // Levels are selected in model space, like the culling in draw()
+        const glm::vec3 viewPosition = glm::vec3(glm::inverse(camera.matrices.view * uboVS.model)[3]);
+        const float pixelsPerUnit = camera.matrices.perspective[1][1] * 0.5f * static_cast<float>(height);
+        bool changed = false;
+        for (auto model : demoModels) {
+            // The meshlets of the culled camera pass are built from the full meshes, both passes draw those while culling is on
+            changed |= model->selectLods(viewPosition, pixelsPerUnit, (useLods && !clusterCulling) ? lodThreshold : 0.0f);
+        }
+        if (changed) {
+            invalidateCommandBuffers();
         }
     }
 
     void buildCommandBuffers()
+    {
+        for (uint32_t i = 0; i < drawCmdBuffers.size(); ++i) {
+            recordCommandBuffer(i);
+        }
+        commandBuffersDirty.assign(drawCmdBuffers.size(), false);
+    }
+
+    // Request all command buffers to be re-recorded, draw() records each one once its previous submission has completed
+    void invalidateCommandBuffers()
+    {
+        commandBuffersDirty.assign(drawCmdBuffers.size(), true);
+    }
+
+    void recordCommandBuffer(uint32_t i)
     {
         VkCommandBufferBeginInfo cmdBufInfo = initializers::commandBufferBeginInfo();
 
@@ -275,111 +438,137 @@ public:
         VkViewport viewport;
         VkRect2D scissor;
 
-        for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
+        VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+
+        // Skinned vertices for both passes, read by the shadow pass like the vertices of the other models
+        skinning->skin(drawCmdBuffers[i], i);
+
+        if (timestampMask != 0) {
+            vkCmdResetQueryPool(drawCmdBuffers[i], timestampQueryPool, i * 2, 2);
+            vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, i * 2);
+        }
+
+        // First render pass: Generate shadow map by rendering the scene from light's POV
         {
-            VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+            clearValues[0].depthStencil = { 1.0f, 0 };
 
-            // First render pass: Generate shadow map by rendering the scene from light's POV
-            {
-                clearValues[0].depthStencil = { 1.0f, 0 };
+            VkRenderPassBeginInfo renderPassBeginInfo = initializers::renderPassBeginInfo();
+            renderPassBeginInfo.renderPass = offscreenPass.renderPass;
+            renderPassBeginInfo.framebuffer = offscreenPass.framebuffer;
+            renderPassBeginInfo.renderArea.extent.width = offscreenPass.width;
+            renderPassBeginInfo.renderArea.extent.height = offscreenPass.height;
+            renderPassBeginInfo.clearValueCount = 1;
+            renderPassBeginInfo.pClearValues = clearValues;
 
-                VkRenderPassBeginInfo renderPassBeginInfo = initializers::renderPassBeginInfo();
-                renderPassBeginInfo.renderPass = offscreenPass.renderPass;
-                renderPassBeginInfo.framebuffer = offscreenPass.framebuffer;
-                renderPassBeginInfo.renderArea.extent.width = offscreenPass.width;
-                renderPassBeginInfo.renderArea.extent.height = offscreenPass.height;
-                renderPassBeginInfo.clearValueCount = 1;
-                renderPassBeginInfo.pClearValues = clearValues;
+            vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-                vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            viewport = initializers::viewport((float)offscreenPass.width, (float)offscreenPass.height, 0.0f, 1.0f);
+            vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
 
-                viewport = initializers::viewport((float)offscreenPass.width, (float)offscreenPass.height, 0.0f, 1.0f);
-                vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+            scissor = initializers::rect2D(offscreenPass.width, offscreenPass.height, 0, 0);
+            vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-                scissor = initializers::rect2D(offscreenPass.width, offscreenPass.height, 0, 0);
-                vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+            // Set depth bias (aka "Polygon offset")
+            // Required to avoid shadow mapping artifacts
+            vkCmdSetDepthBias(
+                    drawCmdBuffers[i],
+                    depthBiasConstant,
+                    0.0f,
+                    depthBiasSlope);
 
-                // Set depth bias (aka "Polygon offset")
-                // Required to avoid shadow mapping artifacts
-                vkCmdSetDepthBias(
-                        drawCmdBuffers[i],
-                        depthBiasConstant,
-                        0.0f,
-                        depthBiasSlope);
+            vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, positionOnlyShadowPass ? offscreenPipeline : offscreenInterleavedPipeline);
+            vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frames[i].descriptorSets.offscreen, 0, nullptr);
 
-                vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipeline);
-                vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.offscreen, 0, nullptr);
+            for (auto model : demoModels) {
+                model->draw(drawCmdBuffers[i], positionOnlyShadowPass ? RenderFlags::PositionsOnly : 0, pipelineLayout);
+            }
+            skinning->bindBuffers(drawCmdBuffers[i], positionOnlyShadowPass ? RenderFlags::PositionsOnly : 0);
+            skinnedModel->draw(drawCmdBuffers[i], RenderFlags::ExternalBuffers | (positionOnlyShadowPass ? RenderFlags::PositionsOnly : 0), pipelineLayout);
 
-                for (auto model : demoModels) {
-                    model->draw(drawCmdBuffers[i], 0, pipelineLayout);
-                }
+            vkCmdEndRenderPass(drawCmdBuffers[i]);
+        }
+
+        if (timestampMask != 0) {
+            vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, i * 2 + 1);
+        }
 
-                vkCmdEndRenderPass(drawCmdBuffers[i]);
+        // Build the draw lists of the camera pass, the view is set per frame in draw()
+        // Recorded after the shadow pass, which neither waits for the culling nor has it included in its measured time
+        if (clusterCulling) {
+            for (auto culler : cullers) {
+                culler->cull(drawCmdBuffers[i], i);
             }
+        }
 
-            // Note: Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
-            // Second pass: Scene rendering with applied shadow map
-            {
-                clearValues[0].color = defaultClearColor;
-                clearValues[1].depthStencil = { 1.0f, 0 };
-
-                VkRenderPassBeginInfo renderPassBeginInfo = initializers::renderPassBeginInfo();
-                renderPassBeginInfo.renderPass = renderPass;
-                renderPassBeginInfo.framebuffer = frameBuffers[i];
-                renderPassBeginInfo.renderArea.extent.width = width;
-                renderPassBeginInfo.renderArea.extent.height = height;
-                renderPassBeginInfo.clearValueCount = 2;
-                renderPassBeginInfo.pClearValues = clearValues;
-
-                vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-                viewport = initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-                vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-                scissor = initializers::rect2D(width, height, 0, 0);
-                vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-                if (displayShadowMap) {
-                    vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.debug, 0,
-                                            nullptr);
-                    vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, debugPipeline);
-                    vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
-
-                } else {
-                    vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, objPipeline);
-
-                    vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, objPipelineLayout, 0, 1,
-                                            &descriptorSets.scene, 0, NULL);
-                    
-                    vkCmdPushConstants(drawCmdBuffers[i], objPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstant), &pushConstant);
-                    for (auto model: demoModels) {
-                        model->draw(drawCmdBuffers[i], RenderFlags::BindImages, objPipelineLayout);
+        // Note: Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
+        // Second pass: Scene rendering with applied shadow map
+        {
+            clearValues[0].color = defaultClearColor;
+            clearValues[1].depthStencil = { 1.0f, 0 };
+
+            VkRenderPassBeginInfo renderPassBeginInfo = initializers::renderPassBeginInfo();
+            renderPassBeginInfo.renderPass = renderPass;
+            renderPassBeginInfo.framebuffer = frameBuffers[i];
+            renderPassBeginInfo.renderArea.extent.width = width;
+            renderPassBeginInfo.renderArea.extent.height = height;
+            renderPassBeginInfo.clearValueCount = 2;
+            renderPassBeginInfo.pClearValues = clearValues;
+
+            vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            viewport = initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+            vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+
+            scissor = initializers::rect2D(width, height, 0, 0);
+            vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+
+            if (displayShadowMap) {
+                vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frames[i].descriptorSets.debug, 0,
+                                        nullptr);
+                vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, debugPipeline);
+                vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+
+            } else {
+                vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, objPipeline);
+
+                vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, objPipelineLayout, 0, 1,
+                                        &frames[i].descriptorSets.scene, 0, NULL);
+                
+                vkCmdPushConstants(drawCmdBuffers[i], objPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstant), &pushConstant);
+                for (size_t m = 0; m < demoModels.size(); m++) {
+                    if (clusterCulling) {
+                        cullers[m]->draw(drawCmdBuffers[i], i, RenderFlags::BindImages, objPipelineLayout);
+                    } else {
+                        demoModels[m]->draw(drawCmdBuffers[i], RenderFlags::BindImages, objPipelineLayout);
                     }
                 }
+                skinning->bindBuffers(drawCmdBuffers[i]);
+                skinnedModel->draw(drawCmdBuffers[i], RenderFlags::BindImages | RenderFlags::ExternalBuffers, objPipelineLayout);
+            }
 
-                drawUI(drawCmdBuffers[i]);
-
-                vkCmdEndRenderPass(drawCmdBuffers[i]);
+            drawUI(drawCmdBuffers[i]);
 
-            }
+            vkCmdEndRenderPass(drawCmdBuffers[i]);
 
-            VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
         }
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
     }
 
     void setupDescriptorPool()
     {
-        // for global uniform buffer
+        // for global uniform buffer, three sets per frame resource
+        const uint32_t setCount = 3 * static_cast<uint32_t>(frames.size());
         std::vector<VkDescriptorPoolSize> poolSizes =
                 {
-                        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3),
-                        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3)
+                        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount),
+                        initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount)
                 };
 
         VkDescriptorPoolCreateInfo descriptorPoolInfo = initializers::descriptorPoolCreateInfo(
                         poolSizes.size(),
                         poolSizes.data(),
-                        3);
+                        setCount);
         VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
     }
 
@@ -438,45 +627,48 @@ public:
                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
                         );
 
-        // DebugDisplay
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.debug));
-        writeDescriptorSets = {
-                initializers::writeDescriptorSet(descriptorSets.debug, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &sceneUBO.descriptor),
-                initializers::writeDescriptorSet(descriptorSets.debug, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &shadowMapDescriptor)
-        };
-        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
-
-        // Offscreen shadow map generation
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.offscreen));
-        writeDescriptorSets = {
-                // Binding 0 : Vertex shader Uniform buffer
-                initializers::writeDescriptorSet(
-                        descriptorSets.offscreen,
-                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                        0,
-                        &offscreenUBO.descriptor
-                        )
-        };
-        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
-
-
-        // Scene rendering with shadowmap applied
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.scene));
-        writeDescriptorSets = {
-                // Binding 0 : Vertex shader uniform buffer
-                initializers::writeDescriptorSet(
-                        descriptorSets.scene,
-                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                        0,
-                        &sceneUBO.descriptor),
-                initializers::writeDescriptorSet(
-                        descriptorSets.scene,
-                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                        1,
-                        &shadowMapDescriptor
-                        )
-        };
-        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+        for (auto& frame : frames)
+        {
+            // DebugDisplay
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSets.debug));
+            writeDescriptorSets = {
+                    initializers::writeDescriptorSet(frame.descriptorSets.debug, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &frame.sceneUBO.descriptor),
+                    initializers::writeDescriptorSet(frame.descriptorSets.debug, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &shadowMapDescriptor)
+            };
+            vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+
+            // Offscreen shadow map generation
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSets.offscreen));
+            writeDescriptorSets = {
+                    // Binding 0 : Vertex shader Uniform buffer
+                    initializers::writeDescriptorSet(
+                            frame.descriptorSets.offscreen,
+                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                            0,
+                            &frame.offscreenUBO.descriptor
+                            )
+            };
+            vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+
+
+            // Scene rendering with shadowmap applied
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSets.scene));
+            writeDescriptorSets = {
+                    // Binding 0 : Vertex shader uniform buffer
+                    initializers::writeDescriptorSet(
+                            frame.descriptorSets.scene,
+                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                            0,
+                            &frame.sceneUBO.descriptor),
+                    initializers::writeDescriptorSet(
+                            frame.descriptorSets.scene,
+                            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                            1,
+                            &shadowMapDescriptor
+                            )
+            };
+            vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+        }
     }
 
     void preparePipelines()
@@ -555,27 +747,57 @@ public:
 
         pipelineCreateInfo.layout = pipelineLayout;
         pipelineCreateInfo.renderPass = offscreenPass.renderPass;
+        pipelineCreateInfo.pVertexInputState = Vertex::getPipelinePositionInputState();
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &offscreenPipeline));
+
+        // Same pass reading the positions from the full vertices
+        const VkVertexInputAttributeDescription interleavedPositionAttribute = initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos));
+        vertexInputInfo.vertexAttributeDescriptionCount = 1;
+        vertexInputInfo.pVertexAttributeDescriptions = &interleavedPositionAttribute;
+        pipelineCreateInfo.pVertexInputState = &vertexInputInfo;
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &offscreenInterleavedPipeline));
+    }
+
+    void prepareTimestampQueries()
+    {
+        const uint32_t validBits = vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits;
+        timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(drawCmdBuffers.size()) * 2;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool));
+        // Queries have to be reset before their results are read, draw() reads them before the first submission of a command buffer
+        VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0, queryPoolInfo.queryCount);
+        vulkanDevice->flushCommandBuffer(commandBuffer, queue);
     }
 
     // Prepare and initialize uniform buffer containing shader uniforms
     void prepareUniformBuffers()
     {
-        // Offscreen vertex shader uniform buffer block
-        VK_CHECK_RESULT(vulkanDevice->createBuffer(
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                &offscreenUBO,
-                sizeof(uboOffscreenVS)));
-
-        vulkanDevice->createBuffer(
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                &sceneUBO,
-                sizeof(uboVS));
-        VK_CHECK_RESULT(offscreenUBO.map());
-        VK_CHECK_RESULT(sceneUBO.map());
+        frames.resize(drawCmdBuffers.size());
+        for (auto& frame : frames)
+        {
+            // Offscreen vertex shader uniform buffer block
+            VK_CHECK_RESULT(vulkanDevice->createBuffer(
+                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &frame.offscreenUBO,
+                    sizeof(uboOffscreenVS)));
+
+            VK_CHECK_RESULT(vulkanDevice->createBuffer(
+                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &frame.sceneUBO,
+                    sizeof(uboVS)));
+            VK_CHECK_RESULT(frame.offscreenUBO.map());
+            VK_CHECK_RESULT(frame.sceneUBO.map());
+        }
         updateUniformBuffers();
+        for (uint32_t i = 0; i < frames.size(); i++) {
+            copyUniformBuffers(i);
+        }
     }
 
     void updateUniformBuffers()
@@ -591,7 +813,6 @@ public:
         glm::mat4 depthModelMatrix = glm::mat4(1.0f);
 
         uboOffscreenVS.depthMVP = depthProjectionMatrix * depthViewMatrix * depthModelMatrix;
-        memcpy(offscreenUBO.mapped, &uboOffscreenVS, sizeof(uboOffscreenVS));
 
         uboVS.projection = camera.matrices.perspective;
         uboVS.view = camera.matrices.view;
@@ -601,15 +822,51 @@ public:
         uboVS.lightSpace = uboOffscreenVS.depthMVP;
         uboVS.zNear = zNear;
         uboVS.zFar = zFar;
-        memcpy(sceneUBO.mapped, &uboVS, sizeof(uboVS));
+    }
+
+    // Write the current uniform values into the buffers used by the given command buffer
+    void copyUniformBuffers(uint32_t frameIndex)
+    {
+        memcpy(frames[frameIndex].offscreenUBO.mapped, &uboOffscreenVS, sizeof(uboOffscreenVS));
+        memcpy(frames[frameIndex].sceneUBO.mapped, &uboVS, sizeof(uboVS));
     }
 
     void draw()
     {
-        VulkanExampleBase::prepareFrame();
+        if (!VulkanExampleBase::prepareFrame()) {
+            return;
+        }
+        // prepareFrame made sure the GPU is done with this image's command buffer and uniform buffers
+        if (commandBuffersDirty[currentBuffer]) {
+            recordCommandBuffer(currentBuffer);
+            commandBuffersDirty[currentBuffer] = false;
+        }
+        // Every command buffer recorded with the images replaced by texture streaming has completed and been re-recorded
+        if (std::find(commandBuffersDirty.begin(), commandBuffersDirty.end(), true) == commandBuffersDirty.end()) {
+            textureStreamer.releaseRetired();
+        }
+        copyUniformBuffers(currentBuffer);
+        for (auto model : demoModels) {
+            model->updateUniformBuffers(currentBuffer);
+        }
+        skinnedModel->updateUniformBuffers(currentBuffer);
+        skinning->update(currentBuffer);
+        // Culling happens in model space, the camera position is moved there
+        const glm::vec3 eye = glm::vec3(glm::inverse(uboVS.view * uboVS.model)[3]);
+        for (auto culler : cullers) {
+            culler->update(currentBuffer, uboVS.projection * uboVS.view * uboVS.model, eye);
+        }
+        // Timestamps of the last submission of this command buffer, each followed by its availability. Not waited for, they
+        // stay unavailable if the command buffer has been re-recorded (and the queries reset) without being submitted since
+        uint64_t results[4];
+        if ((timestampMask != 0) && (vkGetQueryPoolResults(device, timestampQueryPool, currentBuffer * 2, 2, sizeof(results), results, 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) == VK_SUCCESS)) {
+            // Only the valid bits are written, the masked difference stays correct if the counter wrapped in between
+            const uint64_t ticks = (results[2] - results[0]) & timestampMask;
+            shadowPassTime = static_cast<float>(ticks) * vulkanDevice->properties.limits.timestampPeriod / 1000000.0f;
+        }
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
         VulkanExampleBase::presentFrame();
     }
 
@@ -621,6 +878,7 @@ public:
         prepareUniformBuffers();
         setupDescriptorSetLayout();
         preparePipelines();
+        prepareTimestampQueries();
         setupDescriptorPool();
         setupDescriptorSet();
         buildCommandBuffers();
@@ -631,6 +889,10 @@ public:
     {
         if (!prepared)
             return;
+        updateStreamedModel();
+        updateTextureStreaming();
+        updateLods();
+        updateAnimation();
         draw();
     }
 
@@ -638,6 +900,31 @@ public:
     {
         updateUniformBuffers();
     }
+
+    // Everything duplicated per command buffer has to follow a change of the swap chain's image count
+    virtual void windowResized()
+    {
+        const uint32_t frameCount = static_cast<uint32_t>(drawCmdBuffers.size());
+        if (frames.size() == frameCount) {
+            return;
+        }
+        // The base class has waited for the device before recreating the swap chain
+        destroyFrameResources();
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+        prepareUniformBuffers();
+        prepareTimestampQueries();
+        setupDescriptorPool();
+        setupDescriptorSet();
+        for (auto culler : cullers) {
+            culler->setFrameCount(frameCount);
+        }
+        skinning->setFrameCount(frameCount);
+        for (auto model : demoModels) {
+            model->setFrameCount(frameCount);
+        }
+        skinnedModel->setFrameCount(frameCount);
+    }
     
     virtual void OnUpdateUIOverlay(UIOverlay *overlay)
     {
@@ -663,6 +950,60 @@ public:
             overlay->checkBox("enablePCSS", &pushConstant.enablePcss);
             
         }
+        if (overlay->header("Shadow pass")) {
+            overlay->checkBox("Position-only vertex stream", &positionOnlyShadowPass);
+            // Vertex data read at least once per shadow pass, the shadow map is 2048x2048
+            VkDeviceSize vertexBytes = 0;
+            for (auto model : demoModels) {
+                vertexBytes += static_cast<VkDeviceSize>(model->vertices.count) * (positionOnlyShadowPass ? sizeof(glm::vec3) : model->vertices.stride);
+            }
+            vertexBytes += static_cast<VkDeviceSize>(skinnedModel->vertices.count) * (positionOnlyShadowPass ? sizeof(glm::vec3) : skinnedModel->vertices.stride);
+            overlay->text("%.2f MiB vertex data", vertexBytes / (1024.0f * 1024.0f));
+            if (timestampMask != 0) {
+                overlay->text("%.3f ms GPU time", shadowPassTime);
+            } else {
+                overlay->text("GPU time not supported by the queue");
+            }
+        }
+        if (clusterCullingSupported && overlay->header("Cluster culling")) {
+            overlay->checkBox("Cull meshlets on the GPU", &clusterCulling);
+            uint32_t clusterCount = 0;
+            uint32_t visibleCount = 0;
+            for (auto culler : cullers) {
+                clusterCount += culler->getClusterCount();
+                visibleCount += culler->getVisibleCount(currentBuffer);
+            }
+            overlay->text("%d of %d meshlets drawn", visibleCount, clusterCount);
+        }
+        if (overlay->header("Skinning")) {
+            overlay->checkBox("Pause animation", &paused);
+            overlay->text("%d vertices skinned on the GPU", skinning->getSkinnedVertexCount());
+        }
+        if (overlay->header("Level of detail")) {
+            if (clusterCulling) {
+                overlay->text("Not available with cluster culling");
+            } else {
+                overlay->checkBox("Select by distance", &useLods);
+                overlay->sliderFloat("Error (pixels)", &lodThreshold, 0.25f, 8.0f);
+            }
+            uint32_t triangleCount = 0;
+            for (auto model : demoModels) {
+                for (auto node : model->linearNodes) {
+                    if (node->geo) {
+                        for (auto mesh : node->geo->meshes) {
+                            triangleCount += ((mesh->lod > 0) ? mesh->lods[mesh->lod - 1].indexCount : mesh->indexCount) / 3;
+                        }
+                    }
+                }
+            }
+            overlay->text("%d triangles per pass", triangleCount);
+        }
+        if (overlay->header("Texture streaming")) {
+            TextureStreamer::Stats stats = textureStreamer.getStats();
+            overlay->text("%d textures, %d partially resident", stats.textureCount, stats.partialCount);
+            overlay->text("%.1f MiB resident", stats.residentBytes / (1024.0f * 1024.0f));
+            overlay->text("%d levels streamed in, %d evicted", (int)stats.streamedIn, (int)stats.evicted);
+        }
     }
 
 };
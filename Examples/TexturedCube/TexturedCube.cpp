@@ -36,17 +36,20 @@ public:
     } vertices;
 
     // Uniform buffer block object
-    struct {
+    struct UniformBuffer {
         VkDeviceMemory memory;
         VkBuffer buffer;
         VkDescriptorBufferInfo descriptor;
-    } uniformBufferVS;
+    };
 
-    struct {
-        VkDeviceMemory memory;
-        VkBuffer buffer;
-        VkDescriptorBufferInfo descriptor;
-    } uniformBufferFS;
+    // Uniform buffers and descriptor sets are duplicated per command buffer, so the uniforms of
+    // the next frame can be written while the GPU is still reading those of a frame in flight
+    struct FrameResources {
+        UniformBuffer uniformBufferVS;
+        UniformBuffer uniformBufferFS;
+        VkDescriptorSet descriptorSet;
+    };
+    std::vector<FrameResources> frames;
 
     struct {
         glm::mat4 projectionMatrix;
@@ -70,9 +73,10 @@ public:
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
     VkDescriptorSetLayout descriptorSetLayout;
-    VkDescriptorSet descriptorSet;
 
     glm::vec4 lightPos = glm::vec4(.2f, 1.0f, 2.0f, 1.0f);
+    // Animation start time (glfwGetTime isn't available without a window in headless mode)
+    std::chrono::time_point<std::chrono::high_resolution_clock> tStart = std::chrono::high_resolution_clock::now();
 
     TexturedCube() : VulkanExampleBase(ENABLE_VALIDATION)
     {
@@ -97,11 +101,19 @@ public:
         vkDestroyBuffer(device, vertices.buffer, nullptr);
         vkFreeMemory(device, vertices.memory, nullptr);
 
-        vkDestroyBuffer(device, uniformBufferVS.buffer, nullptr);
-        vkFreeMemory(device, uniformBufferVS.memory, nullptr);
+        destroyUniformBuffers();
+    }
+
+    void destroyUniformBuffers()
+    {
+        for (auto& frame : frames) {
+            vkDestroyBuffer(device, frame.uniformBufferVS.buffer, nullptr);
+            vkFreeMemory(device, frame.uniformBufferVS.memory, nullptr);
 
-        vkDestroyBuffer(device, uniformBufferFS.buffer, nullptr);
-        vkFreeMemory(device, uniformBufferFS.memory, nullptr);
+            vkDestroyBuffer(device, frame.uniformBufferFS.buffer, nullptr);
+            vkFreeMemory(device, frame.uniformBufferFS.memory, nullptr);
+        }
+        frames.clear();
     }
 
     void loadAssets()
@@ -300,16 +312,18 @@ public:
         // We need to tell the API the number of max. requested descriptors per type
         VkDescriptorPoolSize typeCounts[4];
         // This example only uses one descriptor type (uniform buffer) and only requests one descriptor of this type
+        // One descriptor set per command buffer
+        const uint32_t setCount = static_cast<uint32_t>(frames.size());
         typeCounts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        typeCounts[0].descriptorCount = 1;
+        typeCounts[0].descriptorCount = setCount;
         // For additional types you need to add new entries in the type count list
         // E.g. for two combined image samplers :
         typeCounts[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        typeCounts[1].descriptorCount = 1;
+        typeCounts[1].descriptorCount = setCount;
         typeCounts[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        typeCounts[2].descriptorCount = 1;
+        typeCounts[2].descriptorCount = setCount;
         typeCounts[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        typeCounts[3].descriptorCount = 1;
+        typeCounts[3].descriptorCount = setCount;
 
         // Create the global descriptor pool
         // All descriptors used in this example are allocated from this pool
@@ -319,7 +333,7 @@ public:
         descriptorPoolInfo.poolSizeCount = 4;
         descriptorPoolInfo.pPoolSizes = typeCounts;
         // Set the max. number of descriptor sets that can be requested from this pool (requesting beyond this limit will result in an error)
-        descriptorPoolInfo.maxSets = 1;
+        descriptorPoolInfo.maxSets = setCount;
 
         VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
     }
@@ -381,7 +395,14 @@ public:
         VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
     }
 
-    void setupDescriptorSet()
+    void setupDescriptorSets()
+    {
+        for (auto& frame : frames) {
+            setupDescriptorSet(frame);
+        }
+    }
+
+    void setupDescriptorSet(FrameResources& frame)
     {
         // Allocate a new descriptor set from the global descriptor pool
         VkDescriptorSetAllocateInfo allocInfo = {};
@@ -390,7 +411,7 @@ public:
         allocInfo.descriptorSetCount = 1;
         allocInfo.pSetLayouts = &descriptorSetLayout;
 
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSet));
 
         // Update the descriptor set determining the shader binding points
         // For every binding point used in a shader there needs to be one
@@ -400,15 +421,15 @@ public:
 
         // Binding 0 : Uniform buffer
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = descriptorSet;
+        descriptorWrites[0].dstSet = frame.descriptorSet;
         descriptorWrites[0].descriptorCount = 1;
         descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].pBufferInfo = &uniformBufferVS.descriptor;
+        descriptorWrites[0].pBufferInfo = &frame.uniformBufferVS.descriptor;
         descriptorWrites[0].dstBinding = 0;
 
         // Binding 1: diffuse
         descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSet;
+        descriptorWrites[1].dstSet = frame.descriptorSet;
         descriptorWrites[1].dstBinding = 1;
         descriptorWrites[1].dstArrayElement = 0;
         descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -417,7 +438,7 @@ public:
 
         // Binding 2: specular
         descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[2].dstSet = descriptorSet;
+        descriptorWrites[2].dstSet = frame.descriptorSet;
         descriptorWrites[2].dstBinding = 2;
         descriptorWrites[2].dstArrayElement = 0;
         descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -426,10 +447,10 @@ public:
 
         // Binding 3 : Uniform buffer
         descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[3].dstSet = descriptorSet;
+        descriptorWrites[3].dstSet = frame.descriptorSet;
         descriptorWrites[3].descriptorCount = 1;
         descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[3].pBufferInfo = &uniformBufferFS.descriptor;
+        descriptorWrites[3].pBufferInfo = &frame.uniformBufferFS.descriptor;
         descriptorWrites[3].dstBinding = 3;
 
         vkUpdateDescriptorSets(device, 4, descriptorWrites.data(), 0, nullptr);
@@ -604,13 +625,12 @@ public:
         vkDestroyShaderModule(device, shaderStages[1].module, nullptr);
     }
 
-    void prepareUniformBuffers()
+    void prepareUniformBuffer(UniformBuffer& uniformBuffer, VkDeviceSize size)
     {
         // Prepare and initialize a uniform buffer block containing shader uniforms
         // Single uniforms like in OpenGL are no longer present in Vulkan. All Shader uniforms are passed via uniform buffer blocks
         VkMemoryRequirements memReqs;
 
-        // Vertex shader uniform buffer block
         VkBufferCreateInfo bufferInfo = {};
         VkMemoryAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -619,14 +639,14 @@ public:
         allocInfo.memoryTypeIndex = 0;
 
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(uboVS);
+        bufferInfo.size = size;
         // This buffer will be used as a uniform buffer
         bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
         // Create a new buffer
-        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &uniformBufferVS.buffer));
+        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &uniformBuffer.buffer));
         // Get memory requirements including size, alignment and memory type
-        vkGetBufferMemoryRequirements(device, uniformBufferVS.buffer, &memReqs);
+        vkGetBufferMemoryRequirements(device, uniformBuffer.buffer, &memReqs);
         allocInfo.allocationSize = memReqs.size;
         // Get the memory type index that supports host visible memory access
         // Most implementations offer multiple memory types and selecting the correct one to allocate memory from is crucial
@@ -634,28 +654,30 @@ public:
         // Note: This may affect performance so you might not want to do this in a real world application that updates buffers on a regular base
         allocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
         // Allocate memory for the uniform buffer
-        VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &(uniformBufferVS.memory)));
+        VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &(uniformBuffer.memory)));
         // Bind memory to buffer
-        VK_CHECK_RESULT(vkBindBufferMemory(device, uniformBufferVS.buffer, uniformBufferVS.memory, 0));
+        VK_CHECK_RESULT(vkBindBufferMemory(device, uniformBuffer.buffer, uniformBuffer.memory, 0));
 
         // Store information in the uniform's descriptor that is used by the descriptor set
-        uniformBufferVS.descriptor.buffer = uniformBufferVS.buffer;
-        uniformBufferVS.descriptor.offset = 0;
-        uniformBufferVS.descriptor.range = sizeof(uboVS);
-
-        bufferInfo.size = sizeof(uboFS);
-        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &uniformBufferFS.buffer));
-        vkGetBufferMemoryRequirements(device, uniformBufferFS.buffer, &memReqs);
-        allocInfo.allocationSize = memReqs.size;
-        allocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &(uniformBufferFS.memory)));
-        VK_CHECK_RESULT(vkBindBufferMemory(device, uniformBufferFS.buffer, uniformBufferFS.memory, 0));
+        uniformBuffer.descriptor.buffer = uniformBuffer.buffer;
+        uniformBuffer.descriptor.offset = 0;
+        uniformBuffer.descriptor.range = size;
+    }
 
-        uniformBufferFS.descriptor.buffer = uniformBufferFS.buffer;
-        uniformBufferFS.descriptor.offset = 0;
-        uniformBufferFS.descriptor.range = sizeof(uboFS);
+    void prepareUniformBuffers()
+    {
+        frames.resize(drawCmdBuffers.size());
+        for (auto& frame : frames) {
+            // Vertex shader uniform buffer block
+            prepareUniformBuffer(frame.uniformBufferVS, sizeof(uboVS));
+            // Fragment shader uniform buffer block
+            prepareUniformBuffer(frame.uniformBufferFS, sizeof(uboFS));
+        }
 
         updateUniformBuffers();
+        for (uint32_t i = 0; i < frames.size(); i++) {
+            copyUniformBuffers(i);
+        }
     }
 
     void updateUniformBuffers()
@@ -665,26 +687,33 @@ public:
         uboVS.viewMatrix = camera.matrices.view;
         uboVS.modelMatrix = glm::mat4(1.0f);
 
-        // Map uniform buffer and update it
-        uint8_t *pData;
-        VK_CHECK_RESULT(vkMapMemory(device, uniformBufferVS.memory, 0, sizeof(uboVS), 0, (void **)&pData));
-        memcpy(pData, &uboVS, sizeof(uboVS));
-        // Unmap after data has been copied
-        // Note: Since we requested a host coherent memory type for the uniform buffer, the write is instantly visible to the GPU
-        vkUnmapMemory(device, uniformBufferVS.memory);
-
-        lightPos.x = 1.0f + sin(glfwGetTime()) * 2.0f;
-        lightPos.y = sin(glfwGetTime() / 2.0f) * 1.0f;
+        double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+        lightPos.x = 1.0f + sin(time) * 2.0f;
+        lightPos.y = sin(time / 2.0f) * 1.0f;
 
         uboFS.position = lightPos;
         uboFS.viewPos = glm::vec4(camera.position, 1.0f);
         uboFS.ambient = glm::vec4(.2f);
         uboFS.diffuse = glm::vec4(.5f);
         uboFS.specular = glm::vec4(1.0f);
+    }
+
+    // Copy the current uniform values into the buffers of the given command buffer, which must not be in flight
+    void copyUniformBuffers(uint32_t frameIndex)
+    {
+        FrameResources& frame = frames[frameIndex];
+
+        // Map uniform buffer and update it
+        uint8_t *pData;
+        VK_CHECK_RESULT(vkMapMemory(device, frame.uniformBufferVS.memory, 0, sizeof(uboVS), 0, (void **)&pData));
+        memcpy(pData, &uboVS, sizeof(uboVS));
+        // Unmap after data has been copied
+        // Note: Since we requested a host coherent memory type for the uniform buffer, the write is instantly visible to the GPU
+        vkUnmapMemory(device, frame.uniformBufferVS.memory);
 
-        VK_CHECK_RESULT(vkMapMemory(device, uniformBufferFS.memory, 0, sizeof(uboFS), 0, (void**)&pData));
+        VK_CHECK_RESULT(vkMapMemory(device, frame.uniformBufferFS.memory, 0, sizeof(uboFS), 0, (void**)&pData));
         memcpy(pData, &uboFS, sizeof(uboFS));
-        vkUnmapMemory(device, uniformBufferFS.memory);
+        vkUnmapMemory(device, frame.uniformBufferFS.memory);
     }
 
     // BUild separate command buffers for every framebuffer image
@@ -741,7 +770,7 @@ public:
             vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
             // Bind descriptor sets describing shader binding points
-            vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+            vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frames[i].descriptorSet, 0, nullptr);
 
             // Bind the rendering pipeline
             // The pipeline (state object) contains all states of the rendering pipeline,
@@ -778,18 +807,19 @@ public:
         setupDescriptorSetLayout();
         preparePipelines();
         setupDescriptorPool();
-        setupDescriptorSet();
-        // buildCommandBuffers();
+        setupDescriptorSets();
+        buildCommandBuffers();
         prepared = true;
     }
 
     void draw()
     {
-        VulkanExampleBase::prepareFrame();
-
-        // Use a fence to wait until the command buffer has finished execution before using it again
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentBuffer], VK_TRUE, UINT64_MAX));
-        VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentBuffer]));
+        // Waits (on the frame's fence) until the command buffer has finished execution before using it again
+        if (!VulkanExampleBase::prepareFrame()) {
+            return;
+        }
+        // prepareFrame made sure the GPU is done with this image's command buffer and uniform buffers
+        copyUniformBuffers(currentBuffer);
 
         VkPipelineStageFlags waitStageMask[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
@@ -802,7 +832,7 @@ public:
         submitInfo.signalSemaphoreCount = 1;
         submitInfo.pWaitSemaphores = &semaphores.presentComplete;
         submitInfo.pSignalSemaphores = &semaphores.renderComplete;
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentBuffer]));
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
         VulkanExampleBase::presentFrame();
     }
 
@@ -810,7 +840,8 @@ public:
     {
         if (!prepared)
             return;
-        buildCommandBuffers();
+        // Command buffers are recorded once (and rebuilt by the base class on overlay changes),
+        // re-recording them here would touch command buffers of frames still in flight
         draw();
     }
 
@@ -819,6 +850,19 @@ public:
     {
         updateUniformBuffers();
     }
+
+    // The uniform buffers and descriptor sets are duplicated per command buffer, whose number follows the swap chain
+    virtual void windowResized()
+    {
+        if (frames.size() == drawCmdBuffers.size()) {
+            return;
+        }
+        destroyUniformBuffers();
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        prepareUniformBuffers();
+        setupDescriptorPool();
+        setupDescriptorSets();
+    }
 };
 
 int main(const int argc, const char *argv[])
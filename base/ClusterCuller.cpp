@@ -0,0 +1,368 @@
+#include "ClusterCuller.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "MeshOptimizer.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+
+namespace MParser
+{
+    const char* ClusterCuller::requiredExtension = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+
+    /** @brief Size of a VkDrawIndexedIndirectCommand as written by clustercull.comp */
+    static const uint32_t drawCommandStride = sizeof(VkDrawIndexedIndirectCommand);
+
+    /**
+    * Build the meshlets of a model and create the culling pipeline
+    *
+    * @param model Loaded model, its host copies of the vertices and indices are used to build the meshlets
+    * @param frameCount Number of frames that may be in flight, every frame gets its own draw lists
+    * @param queue Queue the meshlet data is uploaded on, blocks until the upload has finished
+    */
+    ClusterCuller::ClusterCuller(Model* model, uint32_t frameCount, VkQueue queue) : model(model), device(model->device)
+    {
+        vkCmdDrawIndexedIndirectCountKHR = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(device->logicalDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+        if (!vkCmdDrawIndexedIndirectCountKHR) {
+            tools::exitFatal("ClusterCuller: " + std::string(requiredExtension) + " has not been enabled", -1);
+        }
+        buildClusters(queue);
+        preparePipeline();
+        prepareFrames(frameCount);
+    }
+
+    ClusterCuller::~ClusterCuller()
+    {
+        destroyFrames();
+        vkDestroyBuffer(device->logicalDevice, clusters, nullptr);
+        device->allocator->free(clustersAllocation);
+        vkDestroyBuffer(device->logicalDevice, regionOffsets, nullptr);
+        device->allocator->free(regionOffsetsAllocation);
+        vkDestroyPipeline(device->logicalDevice, pipeline, nullptr);
+        vkDestroyPipelineLayout(device->logicalDevice, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
+    }
+
+    bool ClusterCuller::supported(VkPhysicalDevice physicalDevice)
+    {
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+        for (auto& extension : extensions) {
+            if (strcmp(extension.extensionName, requiredExtension) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+    * Split all meshes into meshlets and upload them grouped by material
+    *
+    * The meshlets are built from the index order of the loaded meshes, which is already optimized for the vertex
+    * cache, so consecutive triangles are spatially close and the meshlets stay compact.
+    */
+    void ClusterCuller::buildClusters(VkQueue queue)
+    {
+        std::vector<Cluster> clusterData;
+        std::vector<uint32_t> localIndices;
+        for (Node* node : model->linearNodes) {
+            if (!node->geo) {
+                continue;
+            }
+            for (auto* mesh : node->geo->meshes) {
+                auto material = std::find(model->materials.begin(), model->materials.end(), mesh->material);
+                if ((mesh->indexCount == 0) || (mesh->indexCount % 3 != 0) || (material == model->materials.end())) {
+                    continue;
+                }
+                // The host indices address the whole vertex buffer, meshlets are built per mesh
+                localIndices.resize(mesh->indexCount);
+                for (uint32_t i = 0; i < mesh->indexCount; i++) {
+                    localIndices[i] = model->indexBuffer[mesh->firstIndex + i] - mesh->firstVertex;
+                }
+                const float* positions = glm::value_ptr(model->vertexBuffer[mesh->firstVertex].pos);
+                auto meshlets = MeshOptimizer::buildMeshlets(localIndices.data(), localIndices.size(), positions, sizeof(Vertex), mesh->vertexCount);
+
+                const uint32_t region = static_cast<uint32_t>(std::distance(model->materials.begin(), material));
+                for (auto& meshlet : meshlets) {
+                    Cluster cluster;
+                    cluster.sphere = glm::vec4(meshlet.center[0], meshlet.center[1], meshlet.center[2], meshlet.radius);
+                    cluster.cone = glm::vec4(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2], meshlet.coneCutoff);
+                    cluster.apex = glm::vec4(meshlet.coneApex[0], meshlet.coneApex[1], meshlet.coneApex[2], 0.0f);
+                    cluster.firstIndex = mesh->firstIndex + meshlet.firstTriangle * 3;
+                    cluster.indexCount = meshlet.triangleCount * 3;
+                    cluster.vertexOffset = static_cast<int32_t>(mesh->firstVertex);
+                    cluster.region = region;
+                    clusterData.push_back(cluster);
+                }
+            }
+        }
+        if (clusterData.empty()) {
+            tools::exitFatal("ClusterCuller: " + model->path + " has no triangles to cull", -1);
+        }
+
+        // Every material gets a contiguous range of draw commands, sized for the case that all its meshlets are visible
+        std::stable_sort(clusterData.begin(), clusterData.end(), [](const Cluster& a, const Cluster& b) { return a.region < b.region; });
+        std::vector<uint32_t> offsets(model->materials.size() + 1, 0);
+        for (auto& cluster : clusterData) {
+            offsets[cluster.region + 1]++;
+        }
+        for (size_t i = 0; i < model->materials.size(); i++) {
+            if (offsets[i + 1] > 0) {
+                regions.push_back({ model->materials[i], offsets[i], offsets[i + 1] });
+            }
+            offsets[i + 1] += offsets[i];
+        }
+        // Regions without meshlets are dropped, the shader addresses the compacted list
+        std::vector<uint32_t> regionIndex(model->materials.size(), 0);
+        for (size_t i = 0; i < regions.size(); i++) {
+            regionIndex[std::distance(model->materials.begin(), std::find(model->materials.begin(), model->materials.end(), regions[i].material))] = static_cast<uint32_t>(i);
+        }
+        for (auto& cluster : clusterData) {
+            cluster.region = regionIndex[cluster.region];
+        }
+        std::vector<uint32_t> regionOffsetData(regions.size());
+        for (size_t i = 0; i < regions.size(); i++) {
+            regionOffsetData[i] = regions[i].firstDraw;
+        }
+        clusterCount = static_cast<uint32_t>(clusterData.size());
+
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                clusterData.size() * sizeof(Cluster),
+                &clusters,
+                &clustersAllocation));
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                regionOffsetData.size() * sizeof(uint32_t),
+                &regionOffsets,
+                &regionOffsetsAllocation));
+        UploadBatch uploadBatch;
+        uploadBatch.uploadBuffer(clusters, clusterData.data(), clusterData.size() * sizeof(Cluster));
+        uploadBatch.uploadBuffer(regionOffsets, regionOffsetData.data(), regionOffsetData.size() * sizeof(uint32_t));
+        device->flushUploadBatch(uploadBatch, queue);
+    }
+
+    void ClusterCuller::preparePipeline()
+    {
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+        };
+        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCI = initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &pipelineLayout));
+
+        VkPipelineShaderStageCreateInfo shaderStage = {};
+        shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        shaderStage.module = tools::loadShader((getBaseShaderPath() + "clustercull.comp.spv").c_str(), device->logicalDevice);
+        shaderStage.pName = "main";
+        assert(shaderStage.module != VK_NULL_HANDLE);
+
+        VkComputePipelineCreateInfo pipelineCI = initializers::computePipelineCreateInfo(pipelineLayout);
+        pipelineCI.stage = shaderStage;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+        vkDestroyShaderModule(device->logicalDevice, shaderStage.module, nullptr);
+    }
+
+    void ClusterCuller::prepareFrames(uint32_t frameCount)
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes = {
+            initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frameCount),
+            initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * frameCount),
+        };
+        VkDescriptorPoolCreateInfo descriptorPoolCI = initializers::descriptorPoolCreateInfo(poolSizes, frameCount);
+        VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+
+        const VkDeviceSize commandsSize = clusterCount * drawCommandStride;
+        const VkDeviceSize countsSize = regions.size() * sizeof(uint32_t);
+        frames.resize(frameCount);
+        for (auto& frame : frames) {
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &frame.uniformBuffer,
+                    sizeof(UniformData)));
+            VK_CHECK_RESULT(frame.uniformBuffer.map());
+            memset(frame.uniformBuffer.mapped, 0, sizeof(UniformData));
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    commandsSize,
+                    &frame.commands,
+                    &frame.commandsAllocation));
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    countsSize,
+                    &frame.counts,
+                    &frame.countsAllocation));
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &frame.readback,
+                    countsSize));
+            VK_CHECK_RESULT(frame.readback.map());
+            memset(frame.readback.mapped, 0, countsSize);
+
+            VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &frame.descriptorSet));
+            VkDescriptorBufferInfo clustersDescriptor = { clusters, 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo regionOffsetsDescriptor = { regionOffsets, 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo commandsDescriptor = { frame.commands, 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo countsDescriptor = { frame.counts, 0, VK_WHOLE_SIZE };
+            std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &frame.uniformBuffer.descriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &clustersDescriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &regionOffsetsDescriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &commandsDescriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &countsDescriptor),
+            };
+            vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+        }
+    }
+
+    void ClusterCuller::destroyFrames()
+    {
+        for (auto& frame : frames) {
+            frame.uniformBuffer.destroy();
+            frame.readback.destroy();
+            vkDestroyBuffer(device->logicalDevice, frame.commands, nullptr);
+            device->allocator->free(frame.commandsAllocation);
+            vkDestroyBuffer(device->logicalDevice, frame.counts, nullptr);
+            device->allocator->free(frame.countsAllocation);
+        }
+        frames.clear();
+        vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+        descriptorPool = VK_NULL_HANDLE;
+    }
+
+    /**
+    * Recreate the draw lists for a different number of frames in flight, e.g. after the swap chain changed its image count
+    *
+    * @note None of the frames may be executing
+    */
+    void ClusterCuller::setFrameCount(uint32_t frameCount)
+    {
+        destroyFrames();
+        prepareFrames(frameCount);
+    }
+
+    /**
+    * Set the view the meshlets of a frame are culled against
+    *
+    * @param frameIndex Frame whose command buffer is not executing
+    * @param viewProjection Projection * view * model, the frustum planes are extracted from it in model space
+    * @param eye Camera position in model space, for the cone test
+    */
+    void ClusterCuller::update(uint32_t frameIndex, const glm::mat4& viewProjection, const glm::vec3& eye)
+    {
+        // Gribb/Hartmann plane extraction, with a [0, 1] depth range for the near plane
+        const glm::mat4 m = glm::transpose(viewProjection);
+        UniformData uniformData;
+        uniformData.frustumPlanes[0] = m[3] + m[0];
+        uniformData.frustumPlanes[1] = m[3] - m[0];
+        uniformData.frustumPlanes[2] = m[3] + m[1];
+        uniformData.frustumPlanes[3] = m[3] - m[1];
+        uniformData.frustumPlanes[4] = m[2];
+        uniformData.frustumPlanes[5] = m[3] - m[2];
+        for (auto& plane : uniformData.frustumPlanes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        uniformData.eye = glm::vec4(eye, 1.0f);
+        uniformData.clusterCount = clusterCount;
+        memcpy(frames[frameIndex].uniformBuffer.mapped, &uniformData, sizeof(UniformData));
+    }
+
+    void ClusterCuller::cull(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+    {
+        Frame& frame = frames[frameIndex];
+        vkCmdFillBuffer(commandBuffer, frame.counts, 0, VK_WHOLE_SIZE, 0);
+
+        // The reset has to land before the shader appends, and the previous indirect reads of the lists have to be done
+        VkBufferMemoryBarrier resetBarrier = initializers::bufferMemoryBarrier();
+        resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        resetBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        resetBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        resetBarrier.buffer = frame.counts;
+        resetBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &resetBarrier, 0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+        vkCmdDispatch(commandBuffer, (clusterCount + 63) / 64, 1, 1);
+
+        VkBufferMemoryBarrier bufferBarriers[2];
+        bufferBarriers[0] = initializers::bufferMemoryBarrier();
+        bufferBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        bufferBarriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        bufferBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[0].buffer = frame.commands;
+        bufferBarriers[0].size = VK_WHOLE_SIZE;
+        bufferBarriers[1] = bufferBarriers[0];
+        bufferBarriers[1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        bufferBarriers[1].buffer = frame.counts;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 2, bufferBarriers, 0, nullptr);
+
+        // Visible counts for statistics, read on the host once the frame has completed
+        VkBufferCopy copyRegion = { 0, 0, regions.size() * sizeof(uint32_t) };
+        vkCmdCopyBuffer(commandBuffer, frame.counts, frame.readback.buffer, 1, &copyRegion);
+    }
+
+    void ClusterCuller::draw(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet)
+    {
+        assert(!(renderFlags & RenderFlags::PushQuantization));
+        const VkDeviceSize offsets[1] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, (renderFlags & RenderFlags::PositionsOnly) ? &model->positions.buffer : &model->vertices.buffer, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, model->indices.buffer, 0, model->indices.type);
+
+        const Frame& frame = frames[frameIndex];
+        for (size_t i = 0; i < regions.size(); i++) {
+            const Region& region = regions[i];
+            bool skip = false;
+            if (renderFlags & RenderFlags::RenderOpaqueNodes) {
+                skip = (region.material->alphaMode != Material::ALPHAMODE_OPAQUE);
+            }
+            if (renderFlags & RenderFlags::RenderAlphaMaskedNodes) {
+                skip = (region.material->alphaMode != Material::ALPHAMODE_MASK);
+            }
+            if (renderFlags & RenderFlags::RenderAlphaBlendedNodes) {
+                skip = (region.material->alphaMode != Material::ALPHAMODE_BLEND);
+            }
+            if (skip) {
+                continue;
+            }
+            if (renderFlags & RenderFlags::BindImages) {
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &region.material->descriptorSet, 0, nullptr);
+            }
+            vkCmdDrawIndexedIndirectCountKHR(commandBuffer, frame.commands, region.firstDraw * drawCommandStride, frame.counts, i * sizeof(uint32_t), region.drawCount, drawCommandStride);
+        }
+    }
+
+    uint32_t ClusterCuller::getClusterCount() const
+    {
+        return clusterCount;
+    }
+
+    uint32_t ClusterCuller::getVisibleCount(uint32_t frameIndex) const
+    {
+        const uint32_t* counts = static_cast<const uint32_t*>(frames[frameIndex].readback.mapped);
+        uint32_t visible = 0;
+        for (size_t i = 0; i < regions.size(); i++) {
+            visible += counts[i];
+        }
+        return visible;
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#include "ModelParser.h"
+#include "VulkanBuffer.h"
+
+namespace MParser
+{
+    /**
+    * GPU culling of the meshlets of a model
+    *
+    * The index range of every mesh is split into meshlets (MeshOptimizer::buildMeshlets) with a bounding sphere and
+    * a normal cone. cull() records a compute pass that tests all meshlets against the view frustum and their cone,
+    * and appends an indirect draw for every visible one to the list of its material. draw() then issues one
+    * vkCmdDrawIndexedIndirectCount per material, so geometry outside the view or facing away from the camera is
+    * rejected below the granularity of Model::drawNode, which submits every mesh.
+    *
+    * Culling happens in model space, with the vertices as loaded (node transforms are not applied, as in Model::draw).
+    * Requires VK_KHR_draw_indirect_count to be enabled on the device.
+    */
+    class ClusterCuller
+    {
+    public:
+        /**
+        * @param frameCount Number of frames that may be in flight, every frame gets its own draw lists
+        * @param queue Queue the meshlet data is uploaded on, blocks until the upload has finished
+        */
+        ClusterCuller(Model* model, uint32_t frameCount, VkQueue queue);
+        ~ClusterCuller();
+
+        /** @brief Device extension the indirect draws depend on */
+        static const char* requiredExtension;
+        static bool supported(VkPhysicalDevice physicalDevice);
+
+        void setFrameCount(uint32_t frameCount);
+        /** @brief Set the view to cull against for a frame, viewProjection has to include the model matrix and eye is in model space */
+        void update(uint32_t frameIndex, const glm::mat4& viewProjection, const glm::vec3& eye);
+        /** @brief Record the culling pass, must be outside of a render pass */
+        void cull(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+        /** @brief Record the indirect draws of the visible meshlets, renderFlags as for Model::draw (RenderFlags::PushQuantization is not supported) */
+        void draw(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
+
+        uint32_t getClusterCount() const;
+        /** @brief Number of meshlets that passed the culling in the last completed submission of a frame */
+        uint32_t getVisibleCount(uint32_t frameIndex) const;
+
+    private:
+        /** @brief Meshlet as read by clustercull.comp */
+        struct Cluster {
+            /** @brief xyz center, w radius */
+            glm::vec4 sphere;
+            /** @brief xyz axis, w cutoff */
+            glm::vec4 cone;
+            glm::vec4 apex;
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            int32_t vertexOffset;
+            uint32_t region;
+        };
+
+        struct UniformData {
+            glm::vec4 frustumPlanes[6];
+            glm::vec4 eye;
+            uint32_t clusterCount;
+        };
+
+        /** @brief Draws of one material, written to its own range of the command buffer */
+        struct Region {
+            Material* material;
+            uint32_t firstDraw;
+            uint32_t drawCount;
+        };
+
+        struct Frame {
+            Buffer uniformBuffer;
+            VkBuffer commands;
+            Allocation commandsAllocation;
+            VkBuffer counts;
+            Allocation countsAllocation;
+            /** @brief Host visible copy of the counts, read once the frame has completed */
+            Buffer readback;
+            VkDescriptorSet descriptorSet;
+        };
+
+        Model* model;
+        VulkanDevice* device;
+        std::vector<Region> regions;
+        uint32_t clusterCount = 0;
+
+        VkBuffer clusters;
+        Allocation clustersAllocation;
+        VkBuffer regionOffsets;
+        Allocation regionOffsetsAllocation;
+        std::vector<Frame> frames;
+
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCountKHR = nullptr;
+
+        void buildClusters(VkQueue queue);
+        void prepareFrames(uint32_t frameCount);
+        void destroyFrames();
+        void preparePipeline();
+    };
+}
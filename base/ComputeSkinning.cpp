@@ -0,0 +1,268 @@
+#include "ComputeSkinning.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+
+namespace MParser
+{
+    // skinning.comp addresses the vertices as floats, the layout is passed as specialization constants
+    static_assert(offsetof(Vertex, pos) == 0, "skinning.comp expects the position at the start of MParser::Vertex");
+    static_assert((sizeof(Vertex) % sizeof(float) == 0) && (offsetof(Vertex, normal) % sizeof(float) == 0) && (offsetof(Vertex, tangent) % sizeof(float) == 0),
+        "skinning.comp addresses MParser::Vertex in floats");
+
+    /**
+    * Upload the bind pose of the skinned vertices and create the skinning pipeline
+    *
+    * @param model Loaded model with skins, its host copy of the vertices is the bind pose and the initial content of the skinned copy
+    * @param frameCount Number of frames that may be in flight
+    * @param queue Queue the buffers are uploaded on, blocks until the upload has finished
+    */
+    ComputeSkinning::ComputeSkinning(Model* model, uint32_t frameCount, VkQueue queue) : model(model), device(model->device)
+    {
+        if (model->packedVertices) {
+            tools::exitFatal("ComputeSkinning: " + model->path + " has packed vertices, which can't be skinned", -1);
+        }
+        buildBuffers(queue);
+        preparePipeline();
+        prepareFrames(frameCount);
+    }
+
+    ComputeSkinning::~ComputeSkinning()
+    {
+        vkDestroyBuffer(device->logicalDevice, bindPose, nullptr);
+        device->allocator->free(bindPoseAllocation);
+        vkDestroyBuffer(device->logicalDevice, vertices, nullptr);
+        device->allocator->free(verticesAllocation);
+        vkDestroyBuffer(device->logicalDevice, positions, nullptr);
+        device->allocator->free(positionsAllocation);
+        destroyFrames();
+        vkDestroyPipeline(device->logicalDevice, pipeline, nullptr);
+        vkDestroyPipelineLayout(device->logicalDevice, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
+    }
+
+    /**
+    * Collect the bind pose of the vertices of all skinned meshes and create the skinned copies of the vertex streams
+    *
+    * Joint indices are offset to the palette of their skin, so one dispatch covers all skins of the model.
+    */
+    void ComputeSkinning::buildBuffers(VkQueue queue)
+    {
+        std::vector<SkinVertex> bindPoseData;
+        for (Node* node : model->linearNodes) {
+            if (!node->geo || !node->skin) {
+                continue;
+            }
+            const glm::uvec4 firstJoint(node->skin->firstJoint);
+            for (auto* mesh : node->geo->meshes) {
+                for (uint32_t i = 0; i < mesh->vertexCount; i++) {
+                    const Vertex& vertex = model->vertexBuffer[mesh->firstVertex + i];
+                    SkinVertex skinVertex{};
+                    skinVertex.position = vertex.pos;
+                    skinVertex.normal = glm::vec4(vertex.normal, 0.0f);
+                    skinVertex.tangent = vertex.tangent;
+                    skinVertex.weights = vertex.weight0;
+                    skinVertex.joints = glm::uvec4(vertex.joint0) + firstJoint;
+                    skinVertex.target = mesh->firstVertex + i;
+                    bindPoseData.push_back(skinVertex);
+                }
+            }
+        }
+        if (bindPoseData.empty()) {
+            tools::exitFatal("ComputeSkinning: " + model->path + " has no skinned meshes", -1);
+        }
+        skinnedVertexCount = static_cast<uint32_t>(bindPoseData.size());
+
+        // Vertices that aren't skinned are only written here, the skinned ones are overwritten by every pass
+        std::vector<glm::vec3> positionData(model->vertexBuffer.size());
+        for (size_t i = 0; i < model->vertexBuffer.size(); i++) {
+            positionData[i] = glm::vec3(model->vertexBuffer[i].pos);
+        }
+        const VkDeviceSize vertexBufferSize = model->vertexBuffer.size() * sizeof(Vertex);
+        const VkDeviceSize positionBufferSize = positionData.size() * sizeof(glm::vec3);
+
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                bindPoseData.size() * sizeof(SkinVertex),
+                &bindPose,
+                &bindPoseAllocation));
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                vertexBufferSize,
+                &vertices,
+                &verticesAllocation));
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                positionBufferSize,
+                &positions,
+                &positionsAllocation));
+        UploadBatch uploadBatch;
+        uploadBatch.uploadBuffer(bindPose, bindPoseData.data(), bindPoseData.size() * sizeof(SkinVertex));
+        uploadBatch.uploadBuffer(vertices, model->vertexBuffer.data(), vertexBufferSize);
+        uploadBatch.uploadBuffer(positions, positionData.data(), positionBufferSize);
+        device->flushUploadBatch(uploadBatch, queue);
+    }
+
+    void ComputeSkinning::preparePipeline()
+    {
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+        };
+        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayout));
+
+        // Number of skinned vertices
+        VkPushConstantRange pushConstantRange = initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t), 0);
+        VkPipelineLayoutCreateInfo pipelineLayoutCI = initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+        pipelineLayoutCI.pushConstantRangeCount = 1;
+        pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCI, nullptr, &pipelineLayout));
+
+        VkPipelineShaderStageCreateInfo shaderStage = {};
+        shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        shaderStage.module = tools::loadShader((getBaseShaderPath() + "skinning.comp.spv").c_str(), device->logicalDevice);
+        shaderStage.pName = "main";
+        assert(shaderStage.module != VK_NULL_HANDLE);
+
+        // Vertex stride, normal and tangent offset in floats
+        const uint32_t vertexLayout[3] = {
+            static_cast<uint32_t>(sizeof(Vertex) / sizeof(float)),
+            static_cast<uint32_t>(offsetof(Vertex, normal) / sizeof(float)),
+            static_cast<uint32_t>(offsetof(Vertex, tangent) / sizeof(float)),
+        };
+        std::vector<VkSpecializationMapEntry> specializationMapEntries = {
+            initializers::specializationMapEntry(0, 0, sizeof(uint32_t)),
+            initializers::specializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t)),
+            initializers::specializationMapEntry(2, 2 * sizeof(uint32_t), sizeof(uint32_t)),
+        };
+        VkSpecializationInfo specializationInfo = initializers::specializationInfo(specializationMapEntries, sizeof(vertexLayout), vertexLayout);
+        shaderStage.pSpecializationInfo = &specializationInfo;
+
+        VkComputePipelineCreateInfo pipelineCI = initializers::computePipelineCreateInfo(pipelineLayout);
+        pipelineCI.stage = shaderStage;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+        vkDestroyShaderModule(device->logicalDevice, shaderStage.module, nullptr);
+    }
+
+    /**
+    * Create the palette buffer and descriptor set of every frame, the skinned vertex streams are shared by all frames
+    *
+    * The palettes are written by the host while other frames execute, the skinned vertices are only written by the
+    * GPU, in submission order (see skin()).
+    */
+    void ComputeSkinning::prepareFrames(uint32_t frameCount)
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes = {
+            initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * frameCount),
+        };
+        VkDescriptorPoolCreateInfo descriptorPoolCI = initializers::descriptorPoolCreateInfo(poolSizes, frameCount);
+        VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+
+        const VkDeviceSize palettesSize = model->jointMatrices.size() * sizeof(glm::mat4);
+        frames.resize(frameCount);
+        for (auto& frame : frames) {
+            VK_CHECK_RESULT(device->createBuffer(
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &frame.palettes,
+                    palettesSize));
+            VK_CHECK_RESULT(frame.palettes.map());
+            memcpy(frame.palettes.mapped, model->jointMatrices.data(), palettesSize);
+
+            VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &frame.descriptorSet));
+            VkDescriptorBufferInfo bindPoseDescriptor = { bindPose, 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo verticesDescriptor = { vertices, 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo positionsDescriptor = { positions, 0, VK_WHOLE_SIZE };
+            std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bindPoseDescriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &frame.palettes.descriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &verticesDescriptor),
+                initializers::writeDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &positionsDescriptor),
+            };
+            vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+        }
+    }
+
+    void ComputeSkinning::destroyFrames()
+    {
+        for (auto& frame : frames) {
+            frame.palettes.destroy();
+        }
+        frames.clear();
+        vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+        descriptorPool = VK_NULL_HANDLE;
+    }
+
+    /**
+    * Recreate the palettes for a different number of frames in flight, e.g. after the swap chain changed its image count
+    *
+    * @note None of the frames may be executing
+    */
+    void ComputeSkinning::setFrameCount(uint32_t frameCount)
+    {
+        destroyFrames();
+        prepareFrames(frameCount);
+    }
+
+    /**
+    * Copy the pose of the model into the palettes of a frame, call after Model::updateTransforms
+    *
+    * @param frameIndex Frame whose command buffer is not executing
+    */
+    void ComputeSkinning::update(uint32_t frameIndex)
+    {
+        memcpy(frames[frameIndex].palettes.mapped, model->jointMatrices.data(), model->jointMatrices.size() * sizeof(glm::mat4));
+    }
+
+    void ComputeSkinning::skin(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+    {
+        // The draws of the previous submission have to be done reading the vertices before they are overwritten
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frames[frameIndex].descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &skinnedVertexCount);
+        vkCmdDispatch(commandBuffer, (skinnedVertexCount + 63) / 64, 1, 1);
+
+        VkBufferMemoryBarrier bufferBarriers[2];
+        bufferBarriers[0] = initializers::bufferMemoryBarrier();
+        bufferBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        bufferBarriers[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        bufferBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[0].buffer = vertices;
+        bufferBarriers[0].size = VK_WHOLE_SIZE;
+        bufferBarriers[1] = bufferBarriers[0];
+        bufferBarriers[1].buffer = positions;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 2, bufferBarriers, 0, nullptr);
+    }
+
+    /**
+    * Bind the skinned vertex streams in place of the model's own
+    *
+    * @param renderFlags RenderFlags::PositionsOnly binds the skinned positions, has to match the flags passed to draw
+    * @note The following Model::draw calls have to pass RenderFlags::ExternalBuffers to keep them bound
+    */
+    void ComputeSkinning::bindBuffers(VkCommandBuffer commandBuffer, uint32_t renderFlags)
+    {
+        const VkDeviceSize offsets[1] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, (renderFlags & RenderFlags::PositionsOnly) ? &positions : &vertices, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, model->indices.buffer, 0, model->indices.type);
+    }
+
+    uint32_t ComputeSkinning::getSkinnedVertexCount() const
+    {
+        return skinnedVertexCount;
+    }
+}
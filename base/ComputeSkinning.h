@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+
+#include "ModelParser.h"
+#include "VulkanBuffer.h"
+
+namespace MParser
+{
+    /**
+    * GPU skinning of the skinned meshes of a model
+    *
+    * The bind pose of every skinned vertex is uploaded once. skin() records a compute pass that blends the joint
+    * matrices of Model::jointMatrices with the weights of the vertices and writes the skinned positions, normals and
+    * tangents into a copy of the model's vertices and positions owned by this instance. Every pass drawing the model
+    * after bindBuffers() (shadow, depth prepass, main pass) reads the same skinned result, instead of each one skinning
+    * in its vertex shader. Meshes without a skin are copied unchanged.
+    *
+    * Skinned vertices stay in the space of their mesh, node matrices are applied as for the model's own buffers. Every
+    * frame has its own palette buffer, update() copies the joint matrices of the current pose (Model::updateTransforms)
+    * into it. Packed vertices (FileLoadingFlags::PackVertices) are not supported.
+    */
+    class ComputeSkinning
+    {
+    public:
+        /**
+        * @param frameCount Number of frames that may be in flight, every frame gets its own palette buffer
+        * @param queue Queue the bind pose and the initial vertices are uploaded on, blocks until the upload has finished
+        */
+        ComputeSkinning(Model* model, uint32_t frameCount, VkQueue queue);
+        ~ComputeSkinning();
+
+        void setFrameCount(uint32_t frameCount);
+        /** @brief Copy the current joint matrices of the model into the palettes of a frame whose command buffer is not executing */
+        void update(uint32_t frameIndex);
+        /** @brief Record the skinning pass, must be outside of a render pass and before the draws reading the skinned vertices */
+        void skin(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+        /** @brief Bind the skinned vertices (or positions with RenderFlags::PositionsOnly) and the model's indices for Model::draw with RenderFlags::ExternalBuffers */
+        void bindBuffers(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0);
+
+        uint32_t getSkinnedVertexCount() const;
+
+    private:
+        /** @brief Bind pose of a skinned vertex as read by skinning.comp */
+        struct SkinVertex {
+            glm::vec4 position;
+            glm::vec4 normal;
+            glm::vec4 tangent;
+            glm::vec4 weights;
+            /** @brief Indices into Model::jointMatrices */
+            glm::uvec4 joints;
+            /** @brief Index of the vertex in the model */
+            uint32_t target;
+            uint32_t padding[3];
+        };
+
+        struct Frame {
+            /** @brief Host visible copy of Model::jointMatrices */
+            Buffer palettes;
+            VkDescriptorSet descriptorSet;
+        };
+
+        Model* model;
+        VulkanDevice* device;
+        uint32_t skinnedVertexCount = 0;
+
+        VkBuffer bindPose;
+        Allocation bindPoseAllocation;
+        VkBuffer vertices;
+        Allocation verticesAllocation;
+        VkBuffer positions;
+        Allocation positionsAllocation;
+        std::vector<Frame> frames;
+
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+
+        void buildBuffers(VkQueue queue);
+        void preparePipeline();
+        void prepareFrames(uint32_t frameCount);
+        void destroyFrames();
+    };
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+* Read-only view of a whole file, memory mapped where available
+*
+* The mapping is advised for sequential access, as the readers go through their files front to back.
+* Platforms without mmap read the file into memory instead.
+*/
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+#if defined(_WIN32)
+        std::ifstream file(path, std::ios::binary);
+        if (file.is_open()) {
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            data = buffer.data();
+            size = buffer.size();
+            valid = true;
+        }
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0) {
+            size = static_cast<size_t>(info.st_size);
+            valid = true;
+            if (size > 0) {
+                void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping == MAP_FAILED) {
+                    valid = false;
+                } else {
+                    data = static_cast<const char*>(mapping);
+                    madvise(mapping, size, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if !defined(_WIN32)
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    bool valid = false;
+
+private:
+#if defined(_WIN32)
+    std::vector<char> buffer;
+#endif
+};
@@ -0,0 +1,707 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+namespace
+{
+    // FIFO post-transform cache, entries are tagged with the time they were inserted
+    struct FifoCache {
+        std::vector<uint32_t> insertedAt;
+        uint32_t size;
+        uint32_t time;
+
+        FifoCache(size_t vertexCount, uint32_t size) : insertedAt(vertexCount, 0), size(size), time(size + 1) {}
+
+        // Returns true on a miss
+        bool access(uint32_t vertex)
+        {
+            if (time - insertedAt[vertex] > size) {
+                insertedAt[vertex] = time++;
+                return true;
+            }
+            return false;
+        }
+
+        void reset()
+        {
+            // Moving the clock past all entries empties the cache
+            time += size + 1;
+        }
+    };
+
+    struct Vec3 {
+        float x, y, z;
+    };
+
+    Vec3 position(const float* positions, size_t vertexStride, uint32_t vertex)
+    {
+        const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * vertexStride);
+        return { p[0], p[1], p[2] };
+    }
+
+    Vec3 sub(const Vec3& a, const Vec3& b)
+    {
+        return { a.x - b.x, a.y - b.y, a.z - b.z };
+    }
+
+    Vec3 cross(const Vec3& a, const Vec3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    float dot(const Vec3& a, const Vec3& b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    float length(const Vec3& a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    // Sum of squared distances to a set of planes (Garland and Heckbert 1997), Q(p) = p'Ap + 2b'p + c
+    // The planes are weighted by triangle area, the error is divided by the total weight to stay a squared distance
+    struct Quadric {
+        double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+        double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+        double c = 0.0;
+        double weight = 0.0;
+
+        void addPlane(const Vec3& n, float d, float w)
+        {
+            a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+            a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+            b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void add(const Quadric& q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        double error(const Vec3& p) const
+        {
+            const double e = p.x * (a00 * p.x + 2.0 * (a01 * p.y + a02 * p.z + b0))
+                + p.y * (a11 * p.y + 2.0 * (a12 * p.z + b1))
+                + p.z * (a22 * p.z + 2.0 * b2) + c;
+            return (weight > 0.0) ? std::max(e / weight, 0.0) : 0.0;
+        }
+    };
+}
+
+namespace MeshOptimizer
+{
+    /**
+    * Simulate the post-transform cache for an index buffer
+    *
+    * @param vertexCount Number of vertices the indices refer to, ATVR is relative to the ones that are referenced
+    */
+    CacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+    {
+        CacheStats stats;
+        if (indexCount < 3) {
+            return stats;
+        }
+        FifoCache cache(vertexCount, cacheSize);
+        std::vector<bool> referenced(vertexCount, false);
+        size_t misses = 0;
+        size_t referencedCount = 0;
+        for (size_t i = 0; i < indexCount; i++) {
+            assert(indices[i] < vertexCount);
+            if (cache.access(indices[i])) {
+                misses++;
+            }
+            if (!referenced[indices[i]]) {
+                referenced[indices[i]] = true;
+                referencedCount++;
+            }
+        }
+        stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+        stats.atvr = static_cast<float>(misses) / static_cast<float>(referencedCount);
+        return stats;
+    }
+
+    /**
+    * Reorder triangles for the post-transform cache with Tipsify
+    *
+    * Triangles are emitted as fans around a vertex, the next fan is chosen among the vertices of the last one
+    * that are still in the cache. If there is none, the search continues with the most recent dead end or the
+    * next vertex in input order, which starts a new cluster.
+    *
+    * @param clusters Receives the index of the first triangle of every cluster
+    */
+    void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters, uint32_t cacheSize)
+    {
+        assert(destination != indices);
+        assert(indexCount % 3 == 0);
+        const size_t triangleCount = indexCount / 3;
+        if (clusters) {
+            clusters->clear();
+        }
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // Triangles adjacent to each vertex
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < indexCount; i++) {
+            liveTriangles[indices[i]]++;
+        }
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        }
+        std::vector<uint32_t> adjacency(indexCount);
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < indexCount; i++) {
+                adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> candidates;
+        FifoCache cache(vertexCount, cacheSize);
+        size_t cursor = 0;
+        size_t outputTriangles = 0;
+
+        // Next vertex with live triangles, from the dead end stack or in input order
+        auto skipDeadEnd = [&]() -> int64_t {
+            while (!deadEnds.empty()) {
+                const uint32_t vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex] > 0) {
+                    return vertex;
+                }
+            }
+            while (cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) {
+                    return static_cast<int64_t>(cursor);
+                }
+                cursor++;
+            }
+            return -1;
+        };
+
+        int64_t fanning = skipDeadEnd();
+        if (clusters) {
+            clusters->push_back(0);
+        }
+        while (fanning >= 0) {
+            candidates.clear();
+            const uint32_t vertex = static_cast<uint32_t>(fanning);
+            for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                const uint32_t triangle = adjacency[a];
+                if (emitted[triangle]) {
+                    continue;
+                }
+                for (uint32_t k = 0; k < 3; k++) {
+                    const uint32_t v = indices[triangle * 3 + k];
+                    destination[outputTriangles * 3 + k] = v;
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    cache.access(v);
+                }
+                emitted[triangle] = true;
+                outputTriangles++;
+            }
+
+            // Prefer the candidate that stays in the cache while its remaining triangles are emitted, and is the oldest of those
+            // Candidates that would be evicted have priority 0 and are never taken, the dead end stack picks the next vertex then
+            int64_t next = -1;
+            uint32_t bestPriority = 0;
+            for (uint32_t candidate : candidates) {
+                if (liveTriangles[candidate] == 0) {
+                    continue;
+                }
+                uint32_t priority = 0;
+                const uint32_t age = cache.time - cache.insertedAt[candidate];
+                if (age + 2 * liveTriangles[candidate] <= cacheSize) {
+                    priority = age;
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = candidate;
+                }
+            }
+            if (next < 0) {
+                next = skipDeadEnd();
+                // A vertex that has left the cache starts a new cluster
+                if ((next >= 0) && clusters && (cache.time - cache.insertedAt[static_cast<uint32_t>(next)] > cacheSize)) {
+                    clusters->push_back(static_cast<uint32_t>(outputTriangles));
+                }
+            }
+            fanning = next;
+        }
+        assert(outputTriangles == triangleCount);
+    }
+
+    /**
+    * Order the clusters of a cache optimized index buffer to reduce overdraw
+    *
+    * Clusters are split further wherever their cache miss ratio has dropped to threshold times that of the whole
+    * mesh, which keeps the cache efficiency close to the input while giving finer clusters to sort. Clusters whose
+    * average normal points away from the mesh center the most are drawn first (Sander et al. 2007).
+    *
+    * @param clusters First triangle of every cluster, as returned by optimizeVertexCache
+    */
+    void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold, uint32_t cacheSize)
+    {
+        assert(destination != indices);
+        const size_t triangleCount = indexCount / 3;
+        if ((triangleCount == 0) || clusters.empty()) {
+            std::copy(indices, indices + indexCount, destination);
+            return;
+        }
+
+        // Soft boundaries
+        const float meshAcmr = analyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr;
+        std::vector<uint32_t> splitClusters;
+        FifoCache cache(vertexCount, cacheSize);
+        for (size_t c = 0; c < clusters.size(); c++) {
+            const uint32_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : static_cast<uint32_t>(triangleCount);
+            uint32_t start = clusters[c];
+            splitClusters.push_back(start);
+            cache.reset();
+            size_t misses = 0;
+            for (uint32_t triangle = start; triangle < end; triangle++) {
+                for (uint32_t k = 0; k < 3; k++) {
+                    misses += cache.access(indices[triangle * 3 + k]) ? 1 : 0;
+                }
+                const uint32_t clusterTriangles = triangle - start + 1;
+                if ((triangle + 1 < end) && (static_cast<float>(misses) / clusterTriangles <= threshold * meshAcmr)) {
+                    start = triangle + 1;
+                    splitClusters.push_back(start);
+                    cache.reset();
+                    misses = 0;
+                }
+            }
+        }
+
+        // Mesh centroid
+        Vec3 meshCenter = { 0.0f, 0.0f, 0.0f };
+        for (size_t i = 0; i < indexCount; i++) {
+            const Vec3 p = position(positions, vertexStride, indices[i]);
+            meshCenter.x += p.x;
+            meshCenter.y += p.y;
+            meshCenter.z += p.z;
+        }
+        meshCenter.x /= indexCount;
+        meshCenter.y /= indexCount;
+        meshCenter.z /= indexCount;
+
+        struct Cluster {
+            uint32_t start;
+            uint32_t end;
+            float sortKey;
+        };
+        std::vector<Cluster> sorted(splitClusters.size());
+        for (size_t c = 0; c < splitClusters.size(); c++) {
+            Cluster& cluster = sorted[c];
+            cluster.start = splitClusters[c];
+            cluster.end = (c + 1 < splitClusters.size()) ? splitClusters[c + 1] : static_cast<uint32_t>(triangleCount);
+            // Area weighted centroid and normal
+            Vec3 center = { 0.0f, 0.0f, 0.0f }, normal = { 0.0f, 0.0f, 0.0f };
+            float area = 0.0f;
+            for (uint32_t triangle = cluster.start; triangle < cluster.end; triangle++) {
+                const Vec3 p0 = position(positions, vertexStride, indices[triangle * 3 + 0]);
+                const Vec3 p1 = position(positions, vertexStride, indices[triangle * 3 + 1]);
+                const Vec3 p2 = position(positions, vertexStride, indices[triangle * 3 + 2]);
+                const Vec3 e1 = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+                const Vec3 e2 = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+                const Vec3 n = { e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+                const float triangleArea = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+                center.x += (p0.x + p1.x + p2.x) / 3.0f * triangleArea;
+                center.y += (p0.y + p1.y + p2.y) / 3.0f * triangleArea;
+                center.z += (p0.z + p1.z + p2.z) / 3.0f * triangleArea;
+                normal.x += n.x;
+                normal.y += n.y;
+                normal.z += n.z;
+                area += triangleArea;
+            }
+            const float normalLength = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+            if ((area > 0.0f) && (normalLength > 0.0f)) {
+                center.x /= area;
+                center.y /= area;
+                center.z /= area;
+                cluster.sortKey = ((center.x - meshCenter.x) * normal.x + (center.y - meshCenter.y) * normal.y + (center.z - meshCenter.z) * normal.z) / normalLength;
+            } else {
+                cluster.sortKey = 0.0f;
+            }
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+        size_t offset = 0;
+        for (auto& cluster : sorted) {
+            std::copy(indices + cluster.start * 3, indices + cluster.end * 3, destination + offset);
+            offset += (cluster.end - cluster.start) * 3;
+        }
+    }
+
+    /**
+    * Renumber vertices in the order the indices first reference them, so vertex fetches walk memory linearly
+    *
+    * @param remap Receives the new index of every vertex, UINT32_MAX for vertices that aren't referenced
+    * @param indices Rewritten to the new vertex numbers
+    * @return Number of referenced vertices
+    */
+    size_t optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount)
+    {
+        remap.assign(vertexCount, UINT32_MAX);
+        uint32_t next = 0;
+        for (size_t i = 0; i < indexCount; i++) {
+            uint32_t& target = remap[indices[i]];
+            if (target == UINT32_MAX) {
+                target = next++;
+            }
+            indices[i] = target;
+        }
+        return next;
+    }
+
+    /**
+    * Compute the bounding sphere and normal cone of a meshlet
+    *
+    * The sphere is centered on the bounding box of the vertices. The cone axis is the average triangle normal,
+    * its apex is moved back along the axis until all triangle planes are in front of it (Kapoulkine, meshoptimizer).
+    */
+    static void computeMeshletBounds(Meshlet& meshlet, const uint32_t* indices, const float* positions, size_t vertexStride)
+    {
+        Vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX }, max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        Vec3 axis = { 0.0f, 0.0f, 0.0f };
+        std::vector<Vec3> normals;
+        normals.reserve(meshlet.triangleCount);
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+            const uint32_t* triangle = indices + (meshlet.firstTriangle + t) * 3;
+            Vec3 p[3];
+            for (uint32_t k = 0; k < 3; k++) {
+                p[k] = position(positions, vertexStride, triangle[k]);
+                min = { std::min(min.x, p[k].x), std::min(min.y, p[k].y), std::min(min.z, p[k].z) };
+                max = { std::max(max.x, p[k].x), std::max(max.y, p[k].y), std::max(max.z, p[k].z) };
+            }
+            Vec3 n = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+            const float area = length(n);
+            // Degenerate triangles don't restrict the cone
+            n = (area > 0.0f) ? Vec3{ n.x / area, n.y / area, n.z / area } : Vec3{ 0.0f, 0.0f, 0.0f };
+            normals.push_back(n);
+            axis = { axis.x + n.x, axis.y + n.y, axis.z + n.z };
+        }
+
+        const Vec3 center = { (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
+        float radius = 0.0f;
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                radius = std::max(radius, length(sub(position(positions, vertexStride, indices[(meshlet.firstTriangle + t) * 3 + k]), center)));
+            }
+        }
+        meshlet.center[0] = center.x;
+        meshlet.center[1] = center.y;
+        meshlet.center[2] = center.z;
+        meshlet.radius = radius;
+
+        meshlet.coneApex[0] = center.x;
+        meshlet.coneApex[1] = center.y;
+        meshlet.coneApex[2] = center.z;
+        meshlet.coneAxis[0] = 0.0f;
+        meshlet.coneAxis[1] = 0.0f;
+        meshlet.coneAxis[2] = 0.0f;
+        meshlet.coneCutoff = 2.0f;
+
+        const float axisLength = length(axis);
+        if (axisLength == 0.0f) {
+            return;
+        }
+        axis = { axis.x / axisLength, axis.y / axisLength, axis.z / axisLength };
+        float minDot = 1.0f;
+        for (const Vec3& n : normals) {
+            if (dot(n, n) > 0.0f) {
+                minDot = std::min(minDot, dot(n, axis));
+            }
+        }
+        // Cones wider than about 84 degrees cull too rarely to be worth testing
+        if (minDot <= 0.1f) {
+            return;
+        }
+        float maxT = 0.0f;
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+            const Vec3& n = normals[t];
+            if (dot(n, n) == 0.0f) {
+                continue;
+            }
+            const Vec3 p0 = position(positions, vertexStride, indices[(meshlet.firstTriangle + t) * 3]);
+            maxT = std::max(maxT, dot(sub(center, p0), n) / dot(axis, n));
+        }
+        meshlet.coneApex[0] = center.x - axis.x * maxT;
+        meshlet.coneApex[1] = center.y - axis.y * maxT;
+        meshlet.coneApex[2] = center.z - axis.z * maxT;
+        meshlet.coneAxis[0] = axis.x;
+        meshlet.coneAxis[1] = axis.y;
+        meshlet.coneAxis[2] = axis.z;
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+
+    /**
+    * Split a triangle list into meshlets of consecutive triangles
+    *
+    * A meshlet is closed when the next triangle would exceed maxVertices or maxTriangles, so each meshlet is a
+    * contiguous range of the index buffer and can be drawn with a single indexed draw. Run on a cache optimized
+    * list, whose consecutive triangles share most of their vertices.
+    */
+    std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount, size_t maxVertices, size_t maxTriangles)
+    {
+        assert(indexCount % 3 == 0);
+        assert(maxVertices >= 3);
+        std::vector<Meshlet> meshlets;
+        // Meshlet that last used every vertex, offset by one so zero means none
+        std::vector<uint32_t> usedBy(vertexCount, 0);
+        Meshlet meshlet;
+        for (size_t t = 0; t < indexCount / 3; t++) {
+            const uint32_t* triangle = indices + t * 3;
+            uint32_t newVertices = 0;
+            for (uint32_t k = 0; k < 3; k++) {
+                newVertices += (usedBy[triangle[k]] != meshlets.size() + 1) ? 1 : 0;
+            }
+            if ((meshlet.triangleCount > 0) && ((meshlet.vertexCount + newVertices > maxVertices) || (meshlet.triangleCount + 1 > maxTriangles))) {
+                computeMeshletBounds(meshlet, indices, positions, vertexStride);
+                meshlets.push_back(meshlet);
+                meshlet = Meshlet();
+                meshlet.firstTriangle = static_cast<uint32_t>(t);
+            }
+            for (uint32_t k = 0; k < 3; k++) {
+                if (usedBy[triangle[k]] != meshlets.size() + 1) {
+                    usedBy[triangle[k]] = static_cast<uint32_t>(meshlets.size() + 1);
+                    meshlet.vertexCount++;
+                }
+            }
+            meshlet.triangleCount++;
+        }
+        if (meshlet.triangleCount > 0) {
+            computeMeshletBounds(meshlet, indices, positions, vertexStride);
+            meshlets.push_back(meshlet);
+        }
+        return meshlets;
+    }
+
+    /** @brief Largest extent of the bounding box of the referenced vertices, simplify() reports its error relative to it */
+    float simplifyScale(const float* positions, size_t vertexStride, size_t vertexCount)
+    {
+        Vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX }, max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t i = 0; i < vertexCount; i++) {
+            const Vec3 p = position(positions, vertexStride, static_cast<uint32_t>(i));
+            min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+            max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+        }
+        return (vertexCount > 0) ? std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z)) : 0.0f;
+    }
+
+    /**
+    * Reduce the triangle count of a list by collapsing edges onto one of their vertices
+    *
+    * Collapses are ordered by quadric error and applied in passes, every pass collapses each one-ring at most once
+    * and rejects collapses that would flip a triangle. The vertex buffer is not modified: vertices only move onto
+    * existing ones, so all levels of detail can share it. Vertices on open borders and on attribute seams (several
+    * vertices at the same position) are locked, which keeps the silhouette of split meshes and the UV layout intact.
+    *
+    * @param destination Receives the simplified triangle list, at most indexCount indices, may be equal to indices
+    * @param targetIndexCount Stop once the list has at most this many indices
+    * @param targetError Largest error allowed relative to simplifyScale(), e.g. 0.01 for 1% of the mesh extent
+    * @param resultError Receives the relative error of the result, optional
+    * @return Number of indices written to destination
+    */
+    size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount,
+        size_t targetIndexCount, float targetError, float* resultError)
+    {
+        assert(indexCount % 3 == 0);
+        if (destination != indices) {
+            std::copy(indices, indices + indexCount, destination);
+        }
+        if (resultError) {
+            *resultError = 0.0f;
+        }
+        const float scale = simplifyScale(positions, vertexStride, vertexCount);
+        if ((indexCount <= targetIndexCount) || (scale == 0.0f)) {
+            return indexCount;
+        }
+
+        // Work on positions normalized to the mesh extent, so the error limit doesn't depend on the model units
+        std::vector<Vec3> points(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            const Vec3 p = position(positions, vertexStride, static_cast<uint32_t>(i));
+            points[i] = { p.x / scale, p.y / scale, p.z / scale };
+        }
+
+        std::vector<uint8_t> locked(vertexCount, 0);
+        // Seams, vertices that share their position with another vertex
+        std::vector<uint32_t> order(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        std::sort(order.begin(), order.end(), [&points](uint32_t a, uint32_t b) {
+            const Vec3& pa = points[a];
+            const Vec3& pb = points[b];
+            return (pa.x != pb.x) ? (pa.x < pb.x) : ((pa.y != pb.y) ? (pa.y < pb.y) : (pa.z < pb.z));
+        });
+        for (size_t i = 1; i < vertexCount; i++) {
+            const Vec3& pa = points[order[i - 1]];
+            const Vec3& pb = points[order[i]];
+            if ((pa.x == pb.x) && (pa.y == pb.y) && (pa.z == pb.z)) {
+                locked[order[i - 1]] = 1;
+                locked[order[i]] = 1;
+            }
+        }
+        // Open borders, edges without a triangle using them in the opposite direction
+        {
+            std::vector<std::pair<uint32_t, uint32_t>> edges;
+            edges.reserve(indexCount);
+            for (size_t i = 0; i < indexCount; i += 3) {
+                for (uint32_t k = 0; k < 3; k++) {
+                    edges.emplace_back(indices[i + k], indices[i + (k + 1) % 3]);
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            for (auto& edge : edges) {
+                if (!std::binary_search(edges.begin(), edges.end(), std::make_pair(edge.second, edge.first))) {
+                    locked[edge.first] = 1;
+                    locked[edge.second] = 1;
+                }
+            }
+        }
+
+        std::vector<Quadric> quadrics(vertexCount);
+        for (size_t i = 0; i < indexCount; i += 3) {
+            const Vec3& p0 = points[indices[i]];
+            Vec3 n = cross(sub(points[indices[i + 1]], p0), sub(points[indices[i + 2]], p0));
+            const float area = length(n);
+            if (area == 0.0f) {
+                continue;
+            }
+            n = { n.x / area, n.y / area, n.z / area };
+            for (uint32_t k = 0; k < 3; k++) {
+                quadrics[indices[i + k]].addPlane(n, -dot(n, p0), area);
+            }
+        }
+
+        struct Collapse {
+            uint32_t from;
+            uint32_t to;
+            double error;
+        };
+        const double maxError = static_cast<double>(targetError) * targetError;
+        double worstError = 0.0;
+        size_t resultCount = indexCount;
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+        std::vector<uint32_t> adjacency;
+        std::vector<Collapse> collapses;
+        std::vector<uint32_t> remap(vertexCount);
+        std::vector<uint8_t> touched(vertexCount);
+        while (resultCount > targetIndexCount) {
+            // Triangles around every vertex
+            std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+            for (size_t i = 0; i < resultCount; i++) {
+                adjacencyOffsets[destination[i] + 1]++;
+            }
+            for (size_t v = 0; v < vertexCount; v++) {
+                adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            }
+            adjacency.resize(resultCount);
+            {
+                std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+                for (size_t i = 0; i < resultCount; i++) {
+                    adjacency[fill[destination[i]]++] = static_cast<uint32_t>(i / 3);
+                }
+            }
+
+            // Cheaper direction of every edge, interior edges are listed twice which the touched flags sort out
+            collapses.clear();
+            for (size_t i = 0; i < resultCount; i += 3) {
+                for (uint32_t k = 0; k < 3; k++) {
+                    const uint32_t a = destination[i + k];
+                    const uint32_t b = destination[i + (k + 1) % 3];
+                    Quadric q = quadrics[a];
+                    q.add(quadrics[b]);
+                    const double errorAB = locked[a] ? DBL_MAX : q.error(points[b]);
+                    const double errorBA = locked[b] ? DBL_MAX : q.error(points[a]);
+                    if (std::min(errorAB, errorBA) <= maxError) {
+                        collapses.push_back((errorAB <= errorBA) ? Collapse{ a, b, errorAB } : Collapse{ b, a, errorBA });
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+            // Most collapses remove two triangles
+            const size_t triangleGoal = (resultCount - targetIndexCount) / 3;
+            size_t removed = 0;
+            for (size_t v = 0; v < vertexCount; v++) {
+                remap[v] = static_cast<uint32_t>(v);
+            }
+            std::fill(touched.begin(), touched.end(), 0);
+            for (const Collapse& collapse : collapses) {
+                if (removed >= triangleGoal) {
+                    break;
+                }
+                if (touched[collapse.from] || touched[collapse.to]) {
+                    continue;
+                }
+                bool flips = false;
+                for (uint32_t t = adjacencyOffsets[collapse.from]; (t < adjacencyOffsets[collapse.from + 1]) && !flips; t++) {
+                    const uint32_t* triangle = destination + adjacency[t] * 3;
+                    if ((triangle[0] == collapse.to) || (triangle[1] == collapse.to) || (triangle[2] == collapse.to)) {
+                        continue;
+                    }
+                    Vec3 before[3], after[3];
+                    for (uint32_t k = 0; k < 3; k++) {
+                        before[k] = points[triangle[k]];
+                        after[k] = (triangle[k] == collapse.from) ? points[collapse.to] : before[k];
+                    }
+                    const Vec3 n0 = cross(sub(before[1], before[0]), sub(before[2], before[0]));
+                    const Vec3 n1 = cross(sub(after[1], after[0]), sub(after[2], after[0]));
+                    // Also rejects collapses that turn a triangle by more than about 75 degrees
+                    flips = dot(n0, n1) <= 0.25f * length(n0) * length(n1);
+                }
+                if (flips) {
+                    continue;
+                }
+                // The one-ring changes, later collapses of this pass must not rely on the flip test above
+                for (uint32_t t = adjacencyOffsets[collapse.from]; t < adjacencyOffsets[collapse.from + 1]; t++) {
+                    const uint32_t* triangle = destination + adjacency[t] * 3;
+                    touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+                }
+                remap[collapse.from] = collapse.to;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                worstError = std::max(worstError, collapse.error);
+                removed += 2;
+            }
+            if (removed == 0) {
+                break;
+            }
+
+            size_t write = 0;
+            for (size_t i = 0; i < resultCount; i += 3) {
+                const uint32_t a = remap[destination[i]];
+                const uint32_t b = remap[destination[i + 1]];
+                const uint32_t c = remap[destination[i + 2]];
+                if ((a != b) && (b != c) && (a != c)) {
+                    destination[write++] = a;
+                    destination[write++] = b;
+                    destination[write++] = c;
+                }
+            }
+            resultCount = write;
+        }
+
+        if (resultError) {
+            *resultError = static_cast<float>(std::sqrt(worstError));
+        }
+        return resultCount;
+    }
+}
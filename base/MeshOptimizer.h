@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+* Load time optimisation of indexed triangle lists
+*
+* optimize() runs the three passes in the order they depend on each other:
+* - Tipsify vertex cache reordering (Sander et al. 2007), which also yields the cluster boundaries
+* - overdraw ordering, clusters facing away from the mesh center are drawn first so they occlude the inner ones
+* - vertex fetch remapping, vertices are renumbered in order of first use and unused ones are dropped
+*
+* buildMeshlets() splits the optimized triangle list into clusters for GPU culling, simplify() reduces it for
+* levels of detail that share the vertices of the full mesh.
+*/
+namespace MeshOptimizer
+{
+    /** @brief Post-transform cache efficiency of an index buffer, simulated with a FIFO cache */
+    struct CacheStats {
+        /** @brief Average cache miss ratio, transformed vertices per triangle (0.5 is ideal for a regular grid, 3 is the worst case) */
+        float acmr = 0.0f;
+        /** @brief Average transformed vertex ratio, transformed vertices per referenced vertex (1 is ideal) */
+        float atvr = 0.0f;
+    };
+
+    struct Report {
+        CacheStats before;
+        CacheStats after;
+        size_t vertexCount = 0;
+        size_t triangleCount = 0;
+    };
+
+    const uint32_t defaultCacheSize = 16;
+    /** @brief Number of vertices that can be addressed with 16-bit indices */
+    const size_t maxVertices16 = 65536;
+
+    /** @brief Cluster of consecutive triangles of a mesh with the bounds used for culling */
+    struct Meshlet {
+        /** @brief First triangle of the meshlet in the index buffer it was built from */
+        uint32_t firstTriangle = 0;
+        uint32_t triangleCount = 0;
+        uint32_t vertexCount = 0;
+        /** @brief Bounding sphere */
+        float center[3];
+        float radius;
+        /** @brief Normal cone, all triangles face away from viewers for which dot(normalize(coneApex - eye), coneAxis) >= coneCutoff */
+        float coneApex[3];
+        float coneAxis[3];
+        /** @brief Larger than one if the normals spread too far for the cone to ever cull */
+        float coneCutoff;
+    };
+
+    const size_t maxMeshletVertices = 64;
+    const size_t maxMeshletTriangles = 124;
+
+    CacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = defaultCacheSize);
+    void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* clusters = nullptr, uint32_t cacheSize = defaultCacheSize);
+    void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold = 1.05f, uint32_t cacheSize = defaultCacheSize);
+    size_t optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount);
+    float simplifyScale(const float* positions, size_t vertexStride, size_t vertexCount);
+    size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount,
+        size_t targetIndexCount, float targetError, float* resultError = nullptr);
+    std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount, size_t maxVertices = maxMeshletVertices, size_t maxTriangles = maxMeshletTriangles);
+
+    /**
+    * Optimize a triangle list in place
+    *
+    * @param positionOffset Byte offset of the float3 position in the vertex
+    * @param report If set, receives the cache statistics before and after the optimisation, which costs two cache simulations
+    */
+    template <typename T>
+    void optimize(std::vector<T>& vertices, std::vector<uint32_t>& indices, size_t positionOffset, Report* report = nullptr)
+    {
+        if (report) {
+            *report = Report();
+            report->vertexCount = vertices.size();
+            report->triangleCount = indices.size() / 3;
+        }
+        if (indices.empty() || (indices.size() % 3 != 0)) {
+            return;
+        }
+        if (report) {
+            report->before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+        }
+
+        std::vector<uint32_t> clusters;
+        std::vector<uint32_t> reordered(indices.size());
+        optimizeVertexCache(reordered.data(), indices.data(), indices.size(), vertices.size(), &clusters);
+        const float* positions = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(vertices.data()) + positionOffset);
+        optimizeOverdraw(indices.data(), reordered.data(), indices.size(), positions, sizeof(T), vertices.size(), clusters);
+
+        std::vector<uint32_t> remap;
+        const size_t uniqueCount = optimizeVertexFetchRemap(remap, indices.data(), indices.size(), vertices.size());
+        std::vector<T> remapped(uniqueCount);
+        for (size_t i = 0; i < vertices.size(); i++) {
+            if (remap[i] != UINT32_MAX) {
+                remapped[remap[i]] = vertices[i];
+            }
+        }
+        vertices.swap(remapped);
+
+        if (report) {
+            report->vertexCount = vertices.size();
+            report->after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+        }
+    }
+
+    /** @brief Part of a split mesh, indices are relative to its own vertices */
+    template <typename T>
+    struct Submesh {
+        std::vector<T> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    /**
+    * Split a triangle list into parts that reference at most maxVertices vertices each
+    *
+    * Triangles keep their order and a new part is started whenever the next triangle would exceed the limit.
+    * Vertices used by several parts are duplicated, after optimize() consecutive triangles mostly share recent
+    * vertices, so only few of them are.
+    */
+    template <typename T>
+    std::vector<Submesh<T>> splitSubmeshes(const std::vector<T>& vertices, const std::vector<uint32_t>& indices, size_t maxVertices = maxVertices16)
+    {
+        assert(maxVertices >= 3);
+        std::vector<Submesh<T>> submeshes;
+        // Index of every vertex in the current part, reset through the list of the vertices the part uses
+        std::vector<uint32_t> localIndex(vertices.size(), UINT32_MAX);
+        std::vector<uint32_t> used;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            size_t newVertices = 0;
+            for (size_t k = 0; k < 3; k++) {
+                newVertices += (localIndex[indices[i + k]] == UINT32_MAX) ? 1 : 0;
+            }
+            if (submeshes.empty() || (submeshes.back().vertices.size() + newVertices > maxVertices)) {
+                for (uint32_t vertex : used) {
+                    localIndex[vertex] = UINT32_MAX;
+                }
+                used.clear();
+                submeshes.emplace_back();
+            }
+            Submesh<T>& submesh = submeshes.back();
+            for (size_t k = 0; k < 3; k++) {
+                const uint32_t vertex = indices[i + k];
+                if (localIndex[vertex] == UINT32_MAX) {
+                    localIndex[vertex] = static_cast<uint32_t>(submesh.vertices.size());
+                    submesh.vertices.push_back(vertices[vertex]);
+                    used.push_back(vertex);
+                }
+                submesh.indices.push_back(localIndex[vertex]);
+            }
+        }
+        return submeshes;
+    }
+}
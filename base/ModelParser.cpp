@@ -6,6 +6,19 @@
 #include <stb_image.h>
 
 #include "ModelParser.h"
+#include "TextureStreamer.h"
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+#include "SceneFormat.h"
+#include "threadpool.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+
+#include <glm/gtc/packing.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 
@@ -15,6 +28,183 @@ VkDescriptorSetLayout MParser::descriptorSetLayoutImage = VK_NULL_HANDLE;
 VkDescriptorSetLayout MParser::descriptorSetLayoutUbo = VK_NULL_HANDLE;
 VkMemoryPropertyFlags MParser::memoryPropertyFlags = 0;
 uint32_t MParser::descriptorBindingFlags = DescriptorBindingFlags::ImageBaseColor;
+TextureCache MParser::textureCache;
+
+namespace
+{
+    /** @brief Octahedral mapping of a unit vector to [-1, 1]^2 */
+    glm::vec2 octahedralEncode(glm::vec3 n)
+    {
+        n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+        glm::vec2 p(n.x, n.y);
+        if (n.z < 0.0f) {
+            // Fold the lower hemisphere over the diagonals
+            p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return p;
+    }
+
+    void destroyKtxTexture(void* texture)
+    {
+        ktxTexture_Destroy(static_cast<ktxTexture*>(texture));
+    }
+
+    // Lexically normalize a path, so "a/./b" and "a/c/../b" resolve to the same cache key
+    std::string normalizePath(std::string path)
+    {
+        std::replace(path.begin(), path.end(), '\\', '/');
+        const bool absolute = !path.empty() && (path[0] == '/');
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+            const std::string part = path.substr(start, end - start);
+            if (part == "..") {
+                if (!parts.empty() && (parts.back() != "..")) {
+                    parts.pop_back();
+                } else if (!absolute) {
+                    parts.push_back(part);
+                }
+            } else if (!part.empty() && (part != ".")) {
+                parts.push_back(part);
+            }
+            start = end + 1;
+        }
+        std::string normalized = absolute ? "/" : "";
+        for (size_t i = 0; i < parts.size(); i++) {
+            normalized += (i > 0 ? "/" : "") + parts[i];
+        }
+        return normalized;
+    }
+
+    // Image of a scene texture, embedded data is copied so the source outlives the scene
+    TextureSource sceneTextureSource(const aiScene* scene, const std::string& fileName)
+    {
+        TextureSource source;
+        source.fileName = fileName;
+        const aiTexture* aiTexData = scene->HasTextures() ? scene->GetEmbeddedTexture(fileName.c_str()) : nullptr;
+        if (aiTexData) {
+            // Compressed images store their size in mWidth, raw ones are mWidth * mHeight texels
+            const size_t size = (aiTexData->mHeight == 0) ? aiTexData->mWidth : static_cast<size_t>(aiTexData->mWidth) * aiTexData->mHeight * sizeof(aiTexel);
+            const auto* data = reinterpret_cast<const uint8_t*>(aiTexData->pcData);
+            auto copy = std::make_shared<std::vector<uint8_t>>(data, data + size);
+            source.embeddedData = std::shared_ptr<const uint8_t>(copy, copy->data());
+            source.embeddedSize = size;
+        }
+        return source;
+    }
+
+    bool endsWith(const std::string& value, const std::string& suffix)
+    {
+        return (value.size() >= suffix.size()) && (value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0);
+    }
+
+    uint64_t alignOffset(uint64_t offset)
+    {
+        return (offset + SceneFormat::alignment - 1) / SceneFormat::alignment * SceneFormat::alignment;
+    }
+
+    // Size and modification time identifying the version of a source file
+    bool fileStamp(const std::string& fileName, uint64_t& size, int64_t& time)
+    {
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0) {
+            return false;
+        }
+        size = static_cast<uint64_t>(info.st_size);
+        time = static_cast<int64_t>(info.st_mtime);
+        return true;
+    }
+
+    /**
+    * Check that a baked scene can be used as is, so the loader can index its tables without further checks
+    *
+    * @param sourceFile Model file the scene has to be up to date with, no check if empty or if the file doesn't exist
+    * @return The reason the scene can't be used, empty if it can
+    */
+    std::string validateBakedScene(const MappedFile& file, const std::string& sourceFile, uint32_t fileLoadingFlags)
+    {
+        if (!file.valid) {
+            return "the file can't be read";
+        }
+        if (file.size < sizeof(SceneFormat::Header)) {
+            return "the file is truncated";
+        }
+        const auto& header = *reinterpret_cast<const SceneFormat::Header*>(file.data);
+        if ((header.magic != SceneFormat::magic) || (header.version != SceneFormat::version) || (header.vertexSize != sizeof(Vertex))) {
+            return "the file was written by a different version";
+        }
+        if (header.fileLoadingFlags != fileLoadingFlags) {
+            return "the file was baked with different loading flags";
+        }
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!sourceFile.empty() && fileStamp(sourceFile, sourceSize, sourceTime) && ((sourceSize != header.sourceSize) || (sourceTime != header.sourceTime))) {
+            return "the source file has changed";
+        }
+
+        const uint64_t indexSize = (header.indexType == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+        const std::pair<const SceneFormat::Range*, uint64_t> ranges[] = {
+            { &header.nodes, header.nodeCount * sizeof(SceneFormat::Node) },
+            { &header.meshes, header.meshCount * sizeof(SceneFormat::Mesh) },
+            { &header.lods, header.lodCount * sizeof(SceneFormat::Lod) },
+            { &header.materials, header.materialCount * sizeof(SceneFormat::Material) },
+            { &header.strings, header.strings.size },
+            { &header.vertices, header.vertexCount * sizeof(Vertex) },
+            { &header.positions, header.vertexCount * sizeof(glm::vec3) },
+            { &header.indices, header.indexCount * indexSize },
+            { &header.hostIndices, header.indexCount * sizeof(uint32_t) },
+            { &header.images, header.images.size },
+        };
+        for (auto& range : ranges) {
+            if ((range.first->size != range.second) || (range.first->offset % SceneFormat::alignment != 0) || (range.first->offset > file.size) || (range.first->size > file.size - range.first->offset)) {
+                return "the file is corrupt";
+            }
+        }
+
+        // References between the tables
+        const auto* nodes = reinterpret_cast<const SceneFormat::Node*>(file.data + header.nodes.offset);
+        const auto* meshes = reinterpret_cast<const SceneFormat::Mesh*>(file.data + header.meshes.offset);
+        const auto* materials = reinterpret_cast<const SceneFormat::Material*>(file.data + header.materials.offset);
+        for (uint32_t i = 0; i < header.nodeCount; i++) {
+            // Parents follow their children
+            const bool validParent = (nodes[i].parent < 0) || ((static_cast<uint32_t>(nodes[i].parent) > i) && (static_cast<uint32_t>(nodes[i].parent) < header.nodeCount));
+            if (!validParent || (nodes[i].firstMesh > header.meshCount) || (nodes[i].meshCount > header.meshCount - nodes[i].firstMesh)) {
+                return "the file is corrupt";
+            }
+        }
+        for (uint32_t i = 0; i < header.meshCount; i++) {
+            const auto& mesh = meshes[i];
+            if ((mesh.material >= header.materialCount) || (mesh.firstLod > header.lodCount) || (mesh.lodCount > header.lodCount - mesh.firstLod)
+                || (mesh.firstVertex > header.vertexCount) || (mesh.vertexCount > header.vertexCount - mesh.firstVertex)
+                || (mesh.firstIndex > header.indexCount) || (mesh.indexCount > header.indexCount - mesh.firstIndex)) {
+                return "the file is corrupt";
+            }
+        }
+        for (uint32_t i = 0; i < header.materialCount; i++) {
+            for (const auto* reference : { &materials[i].diffuseTexture, &materials[i].normalTexture }) {
+                if ((reference->nameOffset > header.strings.size) || (reference->nameSize > header.strings.size - reference->nameOffset)
+                    || (reference->imageOffset > header.images.size) || (reference->imageSize > header.images.size - reference->imageOffset)) {
+                    return "the file is corrupt";
+                }
+            }
+        }
+        return std::string();
+    }
+}
+
+TextureSource::TextureSource(const aiScene* scene, const aiMaterial* material, aiTextureType type)
+{
+    // though a material can has multiple textures of one type, here we get the first texture of each type
+    if (material->GetTextureCount(type) > 0) {
+        aiString name;
+        material->GetTexture(type, 0, &name);
+        *this = sceneTextureSource(scene, name.C_Str());
+    }
+}
 
 void Texture::destroy()
 {
@@ -22,13 +212,32 @@ void Texture::destroy()
     {
         vkDestroyImageView(device->logicalDevice, view, nullptr);
         vkDestroyImage(device->logicalDevice, image, nullptr);
-        vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
+        device->allocator->free(allocation);
         vkDestroySampler(device->logicalDevice, sampler, nullptr);
     }
 }
 
-void Texture::load(const aiScene *scene, std::string fileName, std::string filePath, VulkanDevice *device, VkQueue copyQueue) {
-    this->device = device;
+void Texture::load(const aiScene *scene, std::string fileName, std::string filePath, VulkanDevice *device, VkQueue copyQueue)
+{
+    UploadBatch uploadBatch;
+    load(scene, fileName, filePath, device, uploadBatch);
+    device->flushUploadBatch(uploadBatch, copyQueue);
+}
+
+void Texture::load(const aiScene *scene, std::string fileName, std::string filePath, VulkanDevice *device, UploadBatch &uploadBatch)
+{
+    create(decode(sceneTextureSource(scene, fileName), filePath), device, uploadBatch);
+}
+
+/**
+* Read and decode the image data of a texture on the host
+*
+* @note Doesn't touch the device, so it can run on any thread
+*/
+TextureData Texture::decode(const TextureSource& source, std::string filePath)
+{
+    TextureData textureData;
+    std::string fileName = source.fileName;
 
     bool isKtx = false;
     // Image points to an external ktx file
@@ -38,228 +247,55 @@ void Texture::load(const aiScene *scene, std::string fileName, std::string fileP
         }
     }
 
-    VkFormat format;
+    // Prefer a block compressed copy with precomputed mips written next to the source image by texture_baker
+    if (!isKtx && !source.embeddedData) {
+        std::string bakedFileName = fileName.substr(0, fileName.find_last_of('.')) + ".ktx";
+        if (tools::fileExists(filePath + '/' + bakedFileName)) {
+            fileName = bakedFileName;
+            isKtx = true;
+        }
+    }
 
     // Texture was loaded using STB_Image
     if (!isKtx) {
-        void* texData;
+        stbi_uc* texData;
         int texWidth;
         int texHeight;
         int comp;
 
-        if (scene->HasTextures()) {
+        // Most devices don't support RGB only on Vulkan, so always decode to RGBA
+        if (source.embeddedData) {
             // image data embedded in model
-            const auto* aiTexData = scene->GetEmbeddedTexture(fileName.c_str());
-            texData = stbi_load_from_memory(reinterpret_cast<unsigned char *>(aiTexData->pcData), aiTexData->mWidth, &texWidth, &texHeight, &comp, 0);
+            texData = stbi_load_from_memory(source.embeddedData.get(), static_cast<int>(source.embeddedSize), &texWidth, &texHeight, &comp, STBI_rgb_alpha);
         } else {
             // image need to be load from external
             auto path = filePath + '/' + fileName;
-            texData = stbi_load(path.c_str(), &texWidth, &texHeight, &comp, 0);
-        }
-
-        VkDeviceSize bufferSize = 0;
-        bool deleteBuffer = false;
-
-        unsigned char* buffer = nullptr;
-        if (comp == 3) {
-            // Most devices don't support RGB only on Vulkan so convert if necessary
-            // TODO: Check actual format support and transform only if required
-            bufferSize = texWidth * texHeight * 4;
-            buffer = new unsigned char[bufferSize];
-            auto* rgba = buffer;
-            auto* rgb = static_cast<unsigned char*>(texData);
-            for (size_t i = 0; i < texWidth * texHeight; ++i) {
-                for (int32_t j = 0; j < 3; ++j) {
-                    rgba[j] = rgb[j];
-                }
-                rgba += 4;
-                rgb += 3;
-            }
-            deleteBuffer = true;
-        }
-        else {
-            buffer = static_cast<unsigned char*>(texData);
-            bufferSize = texWidth * texHeight * comp;
-        }
-
-        stbi_image_free(texData);
-
-
-        format = VK_FORMAT_R8G8B8A8_UNORM;
-
-        VkFormatProperties formatProperties;
-
-        width = texWidth;
-        height = texHeight;
-        mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
-
-        vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
-        assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
-        assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
-
-        VkMemoryAllocateInfo memAllocInfo{};
-        memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        VkMemoryRequirements memReqs{};
-
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingMemory;
-
-        VkBufferCreateInfo bufferCreateInfo{};
-        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferCreateInfo.size = bufferSize;
-        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-        vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-        memAllocInfo.allocationSize = memReqs.size;
-        memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-        VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-        uint8_t* data;
-        VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-        memcpy(data, buffer, bufferSize);
-        vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-        VkImageCreateInfo imageCreateInfo{};
-        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageCreateInfo.format = format;
-        imageCreateInfo.mipLevels = mipLevels;
-        imageCreateInfo.arrayLayers = 1;
-        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-        imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageCreateInfo.extent = { width, height, 1 };
-        imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-        VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-        vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-        memAllocInfo.allocationSize = memReqs.size;
-        memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-        VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-        VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-        VkImageSubresourceRange subresourceRange = {};
-        subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subresourceRange.levelCount = 1;
-        subresourceRange.layerCount = 1;
-
-        {
-            VkImageMemoryBarrier imageMemoryBarrier{};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.image = image;
-            imageMemoryBarrier.subresourceRange = subresourceRange;
-            vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+            texData = stbi_load(path.c_str(), &texWidth, &texHeight, &comp, STBI_rgb_alpha);
+        }
+        if (!texData) {
+            tools::exitFatal("Could not load texture " + fileName + " from " + filePath, -1);
         }
 
+        textureData.data = std::shared_ptr<void>(texData, stbi_image_free);
+        textureData.pixels = texData;
+        textureData.size = static_cast<VkDeviceSize>(texWidth) * texHeight * 4;
+        textureData.format = VK_FORMAT_R8G8B8A8_UNORM;
+        textureData.width = texWidth;
+        textureData.height = texHeight;
+        textureData.mipLevels = static_cast<uint32_t>(floor(log2(std::max(textureData.width, textureData.height))) + 1.0);
+
         VkBufferImageCopy bufferCopyRegion = {};
         bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         bufferCopyRegion.imageSubresource.mipLevel = 0;
         bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
         bufferCopyRegion.imageSubresource.layerCount = 1;
-        bufferCopyRegion.imageExtent.width = width;
-        bufferCopyRegion.imageExtent.height = height;
+        bufferCopyRegion.imageExtent.width = textureData.width;
+        bufferCopyRegion.imageExtent.height = textureData.height;
         bufferCopyRegion.imageExtent.depth = 1;
+        textureData.regions.push_back(bufferCopyRegion);
 
-        vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-
-        {
-            VkImageMemoryBarrier imageMemoryBarrier{};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            imageMemoryBarrier.image = image;
-            imageMemoryBarrier.subresourceRange = subresourceRange;
-            vkCmdPipelineBarrier(copyCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-        }
-
-        device->flushCommandBuffer(copyCmd, copyQueue, true);
-
-        vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-        vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-        // Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-        VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-        for (uint32_t i = 1; i < mipLevels; i++) {
-            VkImageBlit imageBlit{};
-
-            imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageBlit.srcSubresource.layerCount = 1;
-            imageBlit.srcSubresource.mipLevel = i - 1;
-            imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
-            imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
-            imageBlit.srcOffsets[1].z = 1;
-
-            imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            imageBlit.dstSubresource.layerCount = 1;
-            imageBlit.dstSubresource.mipLevel = i;
-            imageBlit.dstOffsets[1].x = int32_t(width >> i);
-            imageBlit.dstOffsets[1].y = int32_t(height >> i);
-            imageBlit.dstOffsets[1].z = 1;
-
-            VkImageSubresourceRange mipSubRange = {};
-            mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            mipSubRange.baseMipLevel = i;
-            mipSubRange.levelCount = 1;
-            mipSubRange.layerCount = 1;
-
-            {
-                VkImageMemoryBarrier imageMemoryBarrier{};
-                imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                imageMemoryBarrier.srcAccessMask = 0;
-                imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                imageMemoryBarrier.image = image;
-                imageMemoryBarrier.subresourceRange = mipSubRange;
-                vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-            }
-
-            vkCmdBlitImage(blitCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-            {
-                VkImageMemoryBarrier imageMemoryBarrier{};
-                imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-                imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-                imageMemoryBarrier.image = image;
-                imageMemoryBarrier.subresourceRange = mipSubRange;
-                vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-            }
-        }
-
-        subresourceRange.levelCount = mipLevels;
-        imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        {
-            VkImageMemoryBarrier imageMemoryBarrier{};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            imageMemoryBarrier.image = image;
-            imageMemoryBarrier.subresourceRange = subresourceRange;
-            vkCmdPipelineBarrier(blitCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-        }
-
-        if (deleteBuffer) {
-            delete[] buffer;
-        }
-
-        device->flushCommandBuffer(blitCmd, copyQueue, true);
+        // Only the first level is uploaded, the mip chain is generated from it (glTF uses jpg and png, so we need to create this manually)
+        textureData.generateMipmaps = true;
     } else {
         // Texture is stored in an external ktx file
         std::string path = filePath + '/' + fileName;
@@ -274,46 +310,18 @@ void Texture::load(const aiScene *scene, std::string fileName, std::string fileP
         r = ktxTexture_CreateFromNamedFile(path.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &ktxTexture);
         assert(r == KTX_SUCCESS);
 
-        this->device = device;
-        width = ktxTexture->baseWidth;
-        height = ktxTexture->baseHeight;
-        mipLevels = ktxTexture->numLevels;
-
-        ktx_uint8_t* ktxTextureData = ktxTexture_GetData(ktxTexture);
-        ktx_size_t ktxTextureSize = ktxTexture_GetSize(ktxTexture);
-        // @todo: Use ktxTexture_GetVkFormat(ktxTexture)
-        format = VK_FORMAT_R8G8B8A8_UNORM;
-
-        // Get device properties for the requested texture format
-        VkFormatProperties formatProperties;
-        vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
-
-        VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingMemory;
-
-        VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo();
-        bufferCreateInfo.size = ktxTextureSize;
-        // This buffer is used as a transfer source for the buffer copy
-        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-        VkMemoryAllocateInfo memAllocInfo = initializers::memoryAllocateInfo();
-        VkMemoryRequirements memReqs;
-        vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-        memAllocInfo.allocationSize = memReqs.size;
-        memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-        VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-        uint8_t* data;
-        VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-        memcpy(data, ktxTextureData, ktxTextureSize);
-        vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-        std::vector<VkBufferImageCopy> bufferCopyRegions;
-        for (uint32_t i = 0; i < mipLevels; i++)
+        textureData.data = std::shared_ptr<void>(ktxTexture, destroyKtxTexture);
+        textureData.pixels = ktxTexture_GetData(ktxTexture);
+        textureData.size = ktxTexture_GetSize(ktxTexture);
+        textureData.format = ktxTexture_GetVkFormat(ktxTexture);
+        if (textureData.format == VK_FORMAT_UNDEFINED) {
+            tools::exitFatal("Unsupported format in texture " + path, -1);
+        }
+        textureData.width = ktxTexture->baseWidth;
+        textureData.height = ktxTexture->baseHeight;
+        textureData.mipLevels = ktxTexture->numLevels;
+
+        for (uint32_t i = 0; i < textureData.mipLevels; i++)
         {
             ktx_size_t offset;
             KTX_error_code result = ktxTexture_GetImageOffset(ktxTexture, i, 0, 0, &offset);
@@ -327,46 +335,91 @@ void Texture::load(const aiScene *scene, std::string fileName, std::string fileP
             bufferCopyRegion.imageExtent.height = std::max(1u, ktxTexture->baseHeight >> i);
             bufferCopyRegion.imageExtent.depth = 1;
             bufferCopyRegion.bufferOffset = offset;
-            bufferCopyRegions.push_back(bufferCopyRegion);
-        }
-
-        // Create optimal tiled target image
-        VkImageCreateInfo imageCreateInfo = initializers::imageCreateInfo();
-        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageCreateInfo.format = format;
-        imageCreateInfo.mipLevels = mipLevels;
-        imageCreateInfo.arrayLayers = 1;
-        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageCreateInfo.extent = { width, height, 1 };
-        imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-        VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
-
-        vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
-        memAllocInfo.allocationSize = memReqs.size;
-        memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &deviceMemory));
-        VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image, deviceMemory, 0));
-
-        VkImageSubresourceRange subresourceRange = {};
-        subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subresourceRange.baseMipLevel = 0;
-        subresourceRange.levelCount = mipLevels;
-        subresourceRange.layerCount = 1;
-
-        tools::setImageLayout(copyCmd, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-        vkCmdCopyBufferToImage(copyCmd, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
-        tools::setImageLayout(copyCmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
-        device->flushCommandBuffer(copyCmd, copyQueue);
-        this->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-        vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-        ktxTexture_Destroy(ktxTexture);
+            textureData.regions.push_back(bufferCopyRegion);
+        }
+        textureData.generateMipmaps = false;
+    }
+
+    return textureData;
+}
+
+/**
+* Create the texture from decoded image data and add its upload to a batch
+*
+* @param textureData Decoded image, its data is retained by the batch
+* @param baseMipLevel First level of the image data that is made resident, the image only holds the levels from there on (textures streamed by TextureStreamer)
+*/
+void Texture::create(const TextureData &textureData, VulkanDevice *device, UploadBatch &uploadBatch, uint32_t baseMipLevel)
+{
+    this->device = device;
+    this->baseMipLevel = baseMipLevel;
+    width = textureData.width;
+    height = textureData.height;
+    mipLevels = textureData.mipLevels;
+    const VkFormat format = textureData.format;
+    const uint32_t levelCount = mipLevels - baseMipLevel;
+    // Only levels stored in the image data can be skipped, generated ones are derived from the first level
+    assert((baseMipLevel == 0) || !textureData.generateMipmaps);
+
+    // Block compressed formats from baked ktx files are optional features
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        tools::exitFatal("Texture format " + std::to_string(format) + " can't be sampled on this device", -1);
+    }
+
+    // The decoded image is referenced by the upload and released together with the batch
+    uploadBatch.retain(textureData.data);
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (textureData.generateMipmaps) {
+        usage |= device->mipGenerator->imageUsage(format);
+    }
+
+    // Create optimal tiled target image
+    VkImageCreateInfo imageCreateInfo = initializers::imageCreateInfo();
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = format;
+    imageCreateInfo.mipLevels = levelCount;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.extent = { std::max(1u, width >> baseMipLevel), std::max(1u, height >> baseMipLevel), 1 };
+    imageCreateInfo.usage = usage;
+    VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &image));
+    VK_CHECK_RESULT(device->allocator->allocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &allocation));
+    deviceMemory = allocation.memory;
+
+    VkImageSubresourceRange subresourceRange = {};
+    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresourceRange.baseMipLevel = 0;
+    subresourceRange.levelCount = levelCount;
+    subresourceRange.layerCount = 1;
+
+    if (baseMipLevel == 0) {
+        uploadBatch.uploadImage(image, textureData.pixels, textureData.size, textureData.regions, subresourceRange, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, textureData.generateMipmaps, format);
+    } else {
+        // Only stage the resident levels, smaller levels are stored last so they are a contiguous range of the data
+        std::vector<VkBufferImageCopy> regions;
+        VkDeviceSize firstOffset = textureData.size;
+        for (auto& region : textureData.regions) {
+            if (region.imageSubresource.mipLevel >= baseMipLevel) {
+                firstOffset = std::min(firstOffset, region.bufferOffset);
+            }
+        }
+        for (auto region : textureData.regions) {
+            if (region.imageSubresource.mipLevel >= baseMipLevel) {
+                region.imageSubresource.mipLevel -= baseMipLevel;
+                region.bufferOffset -= firstOffset;
+                regions.push_back(region);
+            }
+        }
+        const void* pixels = static_cast<const uint8_t*>(textureData.pixels) + firstOffset;
+        uploadBatch.uploadImage(image, pixels, textureData.size - firstOffset, regions, subresourceRange, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, format);
     }
+    imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -391,7 +444,7 @@ void Texture::load(const aiScene *scene, std::string fileName, std::string fileP
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     viewInfo.subresourceRange.layerCount = 1;
-    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.levelCount = levelCount;
     VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &view));
 
     descriptor.sampler = sampler;
@@ -399,14 +452,182 @@ void Texture::load(const aiScene *scene, std::string fileName, std::string fileP
     descriptor.imageLayout = imageLayout;
 }
 
-void Material::createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags)
+/**
+* Build the cache key of a material texture
+*
+* @return Normalized path for external files, or a hash of the image data for textures embedded in the scene
+*/
+std::string TextureCache::key(const TextureSource& source, const std::string& filePath)
+{
+    if (source.embeddedData) {
+        const uint8_t* data = source.embeddedData.get();
+        // 64 bit FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < source.embeddedSize; i++) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+        std::stringstream ss;
+        ss << "embedded:" << std::hex << hash << ":" << std::dec << source.embeddedSize;
+        return ss.str();
+    }
+    return normalizePath(filePath + '/' + source.fileName);
+}
+
+/**
+* Take a reference to a cached texture
+*
+* @param uploadToken Set to the token of the upload that created the texture, which has to complete before the texture is used
+*
+* @return The cached texture, nullptr if there is none or its upload has not been published yet
+*/
+Texture* TextureCache::acquire(const std::string& key, UploadToken* uploadToken)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(key);
+    if ((it == lookup.end()) || !entries[it->second].published) {
+        stats.misses++;
+        return nullptr;
+    }
+    Entry& entry = entries[it->second];
+    entry.refCount++;
+    stats.hits++;
+    stats.vramSaved += it->second->allocation.size;
+    *uploadToken = entry.uploadToken;
+    return it->second;
+}
+
+/**
+* Add a newly created texture with a reference held by the caller
+*
+* @note If another loader added the same key in the meantime the texture is not shared, but still released through the cache
+*/
+void TextureCache::add(const std::string& key, Texture* texture)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[texture] = { key, 1, 0, false, texture->allocation.size };
+    if (lookup.find(key) == lookup.end()) {
+        lookup[key] = texture;
+    }
+    stats.textureCount++;
+    stats.residentBytes += texture->allocation.size;
+}
+
+/**
+* Take another reference to a texture the caller already holds, e.g. for further materials of the same model using it
+*/
+void TextureCache::addReference(Texture* texture)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(texture);
+    assert(it != entries.end());
+    it->second.refCount++;
+    stats.hits++;
+    stats.vramSaved += texture->allocation.size;
+}
+
+/**
+* Make textures available to other loaders once their uploads have been flushed or submitted
+*
+* @param uploadToken Token of the submission containing the uploads, 0 if they have completed
+*/
+void TextureCache::publish(const std::vector<Texture*>& textures, UploadToken uploadToken)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto* texture : textures) {
+        auto it = entries.find(texture);
+        if ((it != entries.end()) && !it->second.published) {
+            it->second.published = true;
+            it->second.uploadToken = uploadToken;
+        }
+    }
+}
+
+/**
+* Drop a reference, the texture is destroyed once the last one is gone
+*
+* @note The caller must have waited for its uploads and must no longer use the texture on the device
+*/
+void TextureCache::release(Texture* texture)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(texture);
+    assert(it != entries.end());
+    if (--it->second.refCount > 0) {
+        return;
+    }
+    auto shared = lookup.find(it->second.key);
+    if ((shared != lookup.end()) && (shared->second == texture)) {
+        lookup.erase(shared);
+    }
+    stats.textureCount--;
+    stats.residentBytes -= it->second.size;
+    entries.erase(it);
+    texture->destroy();
+    delete texture;
+}
+
+void TextureCache::addLoadTiming(const LoadTiming& timing)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    loadTimings.push_back(timing);
+    stats.decodeMs += timing.decodeMs;
+    stats.uploadMs += timing.uploadMs;
+}
+
+TextureCache::Stats TextureCache::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::vector<TextureCache::LoadTiming> TextureCache::getLoadTimings()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return loadTimings;
+}
+
+void TextureCache::printStats()
+{
+    Stats stats = getStats();
+    const double MiB = 1024.0 * 1024.0;
+    std::cout << "Texture cache: " << stats.textureCount << " textures (" << stats.residentBytes / MiB << " MiB), "
+        << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.vramSaved / MiB << " MiB saved\n";
+    std::cout << "Texture loading: " << stats.decodeMs << " ms decode, " << stats.uploadMs << " ms upload\n";
+    // The textures that dominate the load time
+    std::vector<LoadTiming> timings = getLoadTimings();
+    std::sort(timings.begin(), timings.end(), [](const LoadTiming& a, const LoadTiming& b) { return a.decodeMs + a.uploadMs > b.decodeMs + b.uploadMs; });
+    for (size_t i = 0; i < std::min<size_t>(timings.size(), 5); i++) {
+        std::cout << "  " << timings[i].fileName << ": " << timings[i].decodeMs << " ms decode, " << timings[i].uploadMs << " ms upload\n";
+    }
+}
+
+/**
+* Allocate and write the descriptor set of the material
+*
+* @param spare Also allocate spareDescriptorSet, for materials whose textures are streamed
+*/
+void Material::createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags, bool spare)
 {
     VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
     descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     descriptorSetAllocInfo.descriptorPool = descriptorPool;
     descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
     descriptorSetAllocInfo.descriptorSetCount = 1;
+    if (spare) {
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &spareDescriptorSet));
+    }
     VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &descriptorSet));
+    updateDescriptorSet(descriptorBindingFlags);
+}
+
+/**
+* Write the current descriptors of the material's textures to its descriptor set
+*
+* @note The set must not be used by a pending command buffer, and command buffers it was bound to have to be re-recorded
+*/
+void Material::updateDescriptorSet(uint32_t descriptorBindingFlags)
+{
     std::vector<VkDescriptorImageInfo> imageDescriptors{};
     std::vector<VkWriteDescriptorSet> writeDescriptorSets{};
     if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
@@ -492,68 +713,81 @@ void Mesh::setDimensions(glm::vec3 min, glm::vec3 max) {
     dimensions.radius = glm::distance(min, max) / 2.0f;
 }
 
+uint32_t Mesh::indexEnd() const {
+    return lods.empty() ? firstIndex + indexCount : lods.back().firstIndex + lods.back().indexCount;
+}
+
 /*
 	glTF mesh
 */
 Geometry::Geometry(VulkanDevice *device, glm::mat4 matrix) {
     this->device = device;
     this->uniformBlock.matrix = matrix;
-    VK_CHECK_RESULT(device->createBuffer(
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            sizeof(uniformBlock),
-            &uniformBuffer.buffer,
-            &uniformBuffer.memory,
-            &uniformBlock));
-    VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-    uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
 };
 
 Geometry::~Geometry() {
-    vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-    vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
+    destroyUniformBuffers();
     for(auto* mesh : meshes)
     {
         delete mesh;
     }
 }
 
-glm::mat4 Node::localMatrix() {
-    return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+void Geometry::createUniformBuffers(uint32_t count) {
+    if (!device) {
+        return;
+    }
+    uniformBuffers.resize(count);
+    for (auto& uniformBuffer : uniformBuffers) {
+        VK_CHECK_RESULT(device->createBuffer(
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                sizeof(uniformBlock),
+                &uniformBuffer.buffer,
+                &uniformBuffer.allocation,
+                &uniformBlock));
+        uniformBuffer.mapped = uniformBuffer.allocation.mapped;
+        uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
+        uniformBuffer.revision = revision;
+    }
 }
 
-glm::mat4 Node::getMatrix() {
-    glm::mat4 m = localMatrix();
-    Node *p = parent;
-    while (p) {
-        m = p->localMatrix() * m;
-        p = p->parent;
+void Geometry::destroyUniformBuffers() {
+    for (auto& uniformBuffer : uniformBuffers) {
+        vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
+        device->allocator->free(uniformBuffer.allocation);
     }
-    return m;
+    uniformBuffers.clear();
 }
 
-void Node::update() {
-    if (geo) {
-        glm::mat4 m = getMatrix();
-        if (skin) {
-            geo->uniformBlock.matrix = m;
-            // Update join matrices
-            for (size_t i = 0; i < skin->joints.size(); i++) {
-                Node *jointNode = skin->joints[i];
-                // embedded node model matrix in jointMatrix
-                glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-                geo->uniformBlock.jointMatrix[i] = jointMat;
+glm::mat4 Node::localMatrix() {
+    return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+}
+
+glm::mat4 Node::getMatrix() {
+    // Walk the parents only while the cache is out of date, e.g. during loading
+    for (Node* p = this; p; p = p->parent) {
+        if (p->dirty) {
+            glm::mat4 m = localMatrix();
+            for (Node* q = parent; q; q = q->parent) {
+                m = q->localMatrix() * m;
             }
-            geo->uniformBlock.jointcount = (float)skin->joints.size();
-            memcpy(geo->uniformBuffer.mapped, &geo->uniformBlock, sizeof(geo->uniformBlock));
-        } else {
-            memcpy(geo->uniformBuffer.mapped, &m, sizeof(glm::mat4));
+            return m;
         }
     }
+    return worldMatrix;
+}
 
-    for (auto& child : children) {
-        child->update();
+void Node::markDirty() {
+    dirty = true;
+}
+
+void Node::updateUniformBuffer() {
+    if (!geo) {
+        return;
     }
+    geo->uniformBlock.matrix = worldMatrix;
+    geo->revision++;
 }
 
 Node::~Node() {
@@ -616,64 +850,195 @@ VkPipelineVertexInputStateCreateInfo* Vertex::getPipelineVertexInputState(const
     return &pipelineVertexInputStateCreateInfo;
 }
 
-Texture* Model::getTexture(uint32_t index)
+VkPipelineVertexInputStateCreateInfo* Vertex::getPipelinePositionInputState() {
+    vertexInputBindingDescription = VkVertexInputBindingDescription({ 0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX });
+    Vertex::vertexInputAttributeDescriptions = { VkVertexInputAttributeDescription({ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 }) };
+    pipelineVertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    pipelineVertexInputStateCreateInfo.vertexBindingDescriptionCount = 1;
+    pipelineVertexInputStateCreateInfo.pVertexBindingDescriptions = &Vertex::vertexInputBindingDescription;
+    pipelineVertexInputStateCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(Vertex::vertexInputAttributeDescriptions.size());
+    pipelineVertexInputStateCreateInfo.pVertexAttributeDescriptions = Vertex::vertexInputAttributeDescriptions.data();
+    return &pipelineVertexInputStateCreateInfo;
+}
+
+PackedVertexLayout::PackedVertexLayout(const std::vector<VertexComponent>& components) : components(components)
 {
+    for (VertexComponent component : components) {
+        offsets.push_back(stride);
+        stride += componentSize(component);
+    }
+}
 
-    if (index < textures.size()) {
-        return textures[index];
+VkFormat PackedVertexLayout::componentFormat(VertexComponent component)
+{
+    switch (component) {
+        case VertexComponent::Position:
+            return VK_FORMAT_R16G16B16A16_UNORM;
+        case VertexComponent::Normal:
+            return VK_FORMAT_R16G16_SNORM;
+        case VertexComponent::UV:
+            return VK_FORMAT_R16G16_SFLOAT;
+        case VertexComponent::Color:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+        case VertexComponent::Tangent:
+            return VK_FORMAT_R16G16B16A16_SNORM;
+        case VertexComponent::Joint0:
+            return VK_FORMAT_R8G8B8A8_UINT;
+        case VertexComponent::Weight0:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+        default:
+            return VK_FORMAT_UNDEFINED;
     }
-    return nullptr;
 }
 
-void Model::createEmptyTexture(VkQueue transferQueue)
+uint32_t PackedVertexLayout::componentSize(VertexComponent component)
 {
-    emptyTexture.device = device;
-    emptyTexture.width = 4;
-    emptyTexture.height = 4;
-    emptyTexture.layerCount = 1;
-    emptyTexture.mipLevels = 1;
+    switch (component) {
+        case VertexComponent::Position:
+        case VertexComponent::Tangent:
+            return 8;
+        default:
+            return 4;
+    }
+}
 
-    size_t bufferSize = emptyTexture.width * emptyTexture.height * 4;
-    unsigned char* buffer = new unsigned char[bufferSize];
-    memset(buffer, 255, bufferSize);
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-    VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo();
-    bufferCreateInfo.size = bufferSize;
-    // This buffer is used as a transfer source for the buffer copy
-    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
-
-    VkMemoryAllocateInfo memAllocInfo = initializers::memoryAllocateInfo();
-    VkMemoryRequirements memReqs;
-    vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-    memAllocInfo.allocationSize = memReqs.size;
-    memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-    VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
-
-    // Copy texture data into staging buffer
-    uint8_t* data;
-    VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-    memcpy(data, buffer, bufferSize);
-    vkUnmapMemory(device->logicalDevice, stagingMemory);
+VkVertexInputBindingDescription PackedVertexLayout::inputBindingDescription(uint32_t binding) const
+{
+    return VkVertexInputBindingDescription({ binding, stride, VK_VERTEX_INPUT_RATE_VERTEX });
+}
 
-    VkBufferImageCopy bufferCopyRegion = {};
-    bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    bufferCopyRegion.imageSubresource.layerCount = 1;
-    bufferCopyRegion.imageExtent.width = emptyTexture.width;
-    bufferCopyRegion.imageExtent.height = emptyTexture.height;
-    bufferCopyRegion.imageExtent.depth = 1;
+std::vector<VkVertexInputAttributeDescription> PackedVertexLayout::inputAttributeDescriptions(uint32_t binding, const std::vector<VertexComponent> components) const
+{
+    std::vector<VkVertexInputAttributeDescription> result;
+    uint32_t location = 0;
+    for (VertexComponent component : components) {
+        auto it = std::find(this->components.begin(), this->components.end(), component);
+        if (it == this->components.end()) {
+            tools::exitFatal("Vertex component requested by the pipeline isn't stored in the packed vertex layout", -1);
+        }
+        result.push_back({ location, binding, componentFormat(component), offsets[it - this->components.begin()] });
+        location++;
+    }
+    return result;
+}
 
-    // Create optimal tiled target image
-    VkImageCreateInfo imageCreateInfo = initializers::imageCreateInfo();
-    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imageCreateInfo.mipLevels = 1;
-    imageCreateInfo.arrayLayers = 1;
-    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+/** @brief Returns the pipeline vertex input state create info structure for the requested subset of the packed components */
+VkPipelineVertexInputStateCreateInfo* PackedVertexLayout::getPipelineVertexInputState(const std::vector<VertexComponent> components)
+{
+    vertexInputBindingDescription = inputBindingDescription(0);
+    vertexInputAttributeDescriptions = inputAttributeDescriptions(0, components);
+    pipelineVertexInputStateCreateInfo = {};
+    pipelineVertexInputStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    pipelineVertexInputStateCreateInfo.vertexBindingDescriptionCount = 1;
+    pipelineVertexInputStateCreateInfo.pVertexBindingDescriptions = &vertexInputBindingDescription;
+    pipelineVertexInputStateCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributeDescriptions.size());
+    pipelineVertexInputStateCreateInfo.pVertexAttributeDescriptions = vertexInputAttributeDescriptions.data();
+    return &pipelineVertexInputStateCreateInfo;
+}
+
+/**
+* Write a vertex in the packed layout
+*
+* @param offset Minimum of the mesh bounding box
+* @param scale Reciprocal of the mesh bounding box size, positions are quantized to (pos - offset) * scale
+*/
+void PackedVertexLayout::pack(const Vertex& vertex, const glm::vec3& offset, const glm::vec3& scale, uint8_t* destination) const
+{
+    for (size_t i = 0; i < components.size(); i++) {
+        uint8_t* dst = destination + offsets[i];
+        switch (components[i]) {
+            case VertexComponent::Position: {
+                const glm::vec3 p = glm::clamp((glm::vec3(vertex.pos) - offset) * scale, 0.0f, 1.0f);
+                const uint64_t packed = glm::packUnorm4x16(glm::vec4(p, 0.0f));
+                memcpy(dst, &packed, sizeof(packed));
+                break;
+            }
+            case VertexComponent::Normal: {
+                const float length = glm::length(vertex.normal);
+                const glm::vec2 n = (length > 0.0f) ? octahedralEncode(vertex.normal / length) : glm::vec2(0.0f);
+                const uint32_t packed = glm::packSnorm2x16(n);
+                memcpy(dst, &packed, sizeof(packed));
+                break;
+            }
+            case VertexComponent::Tangent: {
+                const glm::vec3 t(vertex.tangent);
+                const float length = glm::length(t);
+                const glm::vec2 n = (length > 0.0f) ? octahedralEncode(t / length) : glm::vec2(0.0f);
+                const uint64_t packed = glm::packSnorm4x16(glm::vec4(n, vertex.tangent.w < 0.0f ? -1.0f : 1.0f, 0.0f));
+                memcpy(dst, &packed, sizeof(packed));
+                break;
+            }
+            case VertexComponent::UV: {
+                const uint32_t packed = glm::packHalf2x16(vertex.uv);
+                memcpy(dst, &packed, sizeof(packed));
+                break;
+            }
+            case VertexComponent::Color: {
+                const uint32_t packed = glm::packUnorm4x8(vertex.color);
+                memcpy(dst, &packed, sizeof(packed));
+                break;
+            }
+            case VertexComponent::Joint0: {
+                for (uint32_t j = 0; j < 4; j++) {
+                    assert(vertex.joint0[j] < 256.0f);
+                    dst[j] = static_cast<uint8_t>(vertex.joint0[j]);
+                }
+                break;
+            }
+            case VertexComponent::Weight0: {
+                // Quantize so the weights still sum up to one, the rounding error goes to the largest weight
+                const float sum = vertex.weight0.x + vertex.weight0.y + vertex.weight0.z + vertex.weight0.w;
+                const glm::vec4 w = (sum > 0.0f) ? vertex.weight0 / sum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+                int32_t total = 0;
+                uint32_t largest = 0;
+                for (uint32_t j = 0; j < 4; j++) {
+                    dst[j] = static_cast<uint8_t>(std::round(glm::clamp(w[j], 0.0f, 1.0f) * 255.0f));
+                    total += dst[j];
+                    largest = (w[j] > w[largest]) ? j : largest;
+                }
+                dst[largest] = static_cast<uint8_t>(dst[largest] + (255 - total));
+                break;
+            }
+        }
+    }
+}
+
+Texture* Model::getTexture(uint32_t index)
+{
+
+    if (index < textures.size()) {
+        return textures[index];
+    }
+    return nullptr;
+}
+
+void Model::createEmptyTexture(UploadBatch& uploadBatch)
+{
+    emptyTexture.device = device;
+    emptyTexture.width = 4;
+    emptyTexture.height = 4;
+    emptyTexture.layerCount = 1;
+    emptyTexture.mipLevels = 1;
+
+    size_t bufferSize = emptyTexture.width * emptyTexture.height * 4;
+    std::shared_ptr<unsigned char> buffer(new unsigned char[bufferSize], std::default_delete<unsigned char[]>());
+    memset(buffer.get(), 255, bufferSize);
+    uploadBatch.retain(buffer);
+
+    VkBufferImageCopy bufferCopyRegion = {};
+    bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    bufferCopyRegion.imageSubresource.layerCount = 1;
+    bufferCopyRegion.imageExtent.width = emptyTexture.width;
+    bufferCopyRegion.imageExtent.height = emptyTexture.height;
+    bufferCopyRegion.imageExtent.depth = 1;
+
+    // Create optimal tiled target image
+    VkImageCreateInfo imageCreateInfo = initializers::imageCreateInfo();
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -681,11 +1046,8 @@ void Model::createEmptyTexture(VkQueue transferQueue)
     imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCreateInfo, nullptr, &emptyTexture.image));
 
-    vkGetImageMemoryRequirements(device->logicalDevice, emptyTexture.image, &memReqs);
-    memAllocInfo.allocationSize = memReqs.size;
-    memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &emptyTexture.deviceMemory));
-    VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, emptyTexture.image, emptyTexture.deviceMemory, 0));
+    VK_CHECK_RESULT(device->allocator->allocateImageMemory(emptyTexture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &emptyTexture.allocation));
+    emptyTexture.deviceMemory = emptyTexture.allocation.memory;
 
     VkImageSubresourceRange subresourceRange{};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -693,17 +1055,9 @@ void Model::createEmptyTexture(VkQueue transferQueue)
     subresourceRange.levelCount = 1;
     subresourceRange.layerCount = 1;
 
-    VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-    tools::setImageLayout(copyCmd, emptyTexture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-    vkCmdCopyBufferToImage(copyCmd, stagingBuffer, emptyTexture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferCopyRegion);
-    tools::setImageLayout(copyCmd, emptyTexture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
-    device->flushCommandBuffer(copyCmd, transferQueue);
+    uploadBatch.uploadImage(emptyTexture.image, buffer.get(), bufferSize, { bufferCopyRegion }, subresourceRange);
     emptyTexture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    // Clean up staging resources
-    vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-    vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
     VkSamplerCreateInfo samplerCreateInfo = initializers::samplerCreateInfo();
     samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
     samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
@@ -733,12 +1087,21 @@ void Model::createEmptyTexture(VkQueue transferQueue)
 */
 Model::~Model()
 {
+    // Models imported for baking have no device resources
+    if (!device) {
+        return;
+    }
+    // Resources may still be written by a background upload
+    device->uploader->wait(uploadToken);
+    textureStreamer.removeModel(this);
     vkDestroyBuffer(device->logicalDevice, vertices.buffer, nullptr);
-    vkFreeMemory(device->logicalDevice, vertices.memory, nullptr);
+    device->allocator->free(vertices.allocation);
+    vkDestroyBuffer(device->logicalDevice, positions.buffer, nullptr);
+    device->allocator->free(positions.allocation);
     vkDestroyBuffer(device->logicalDevice, indices.buffer, nullptr);
-    vkFreeMemory(device->logicalDevice, indices.memory, nullptr);
+    device->allocator->free(indices.allocation);
     for (auto texture : textures) {
-        texture->destroy();
+        textureCache.release(texture);
     }
     for (auto node : nodes) {
         delete node;
@@ -746,6 +1109,9 @@ Model::~Model()
     for (auto skin : skins) {
         delete skin;
     }
+    for (auto animation : animations) {
+        delete animation;
+    }
     if (descriptorSetLayoutUbo != VK_NULL_HANDLE) {
         vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayoutUbo, nullptr);
         descriptorSetLayoutUbo = VK_NULL_HANDLE;
@@ -755,99 +1121,212 @@ Model::~Model()
         descriptorSetLayoutImage = VK_NULL_HANDLE;
     }
     vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+    vkDestroyDescriptorPool(device->logicalDevice, nodeDescriptorPool, nullptr);
     emptyTexture.destroy();
 }
 
-void Model::loadNode(const aiScene* scene, aiNode* node, Node* parent)
-{
-    auto* mNode = new Node{};
-
-    mNode->parent = parent;
-    mNode->matrix = glm::transpose(glm::make_mat4x4(&node->mTransformation.a1));
-
-    // Node with children
-    for (int m = 0; m < node->mNumChildren; m++) {
-        loadNode(scene, node->mChildren[m], mNode);
-    }
+// Levels of detail per mesh including the full one, and the error each simplification step may add relative to the mesh extent
+static const uint32_t maxLodCount = 5;
+static const float lodStepError = 0.02f;
 
-    const auto localMatrix = mNode->getMatrix();
-    // Node contains mesh data
-    if (node->mNumMeshes > 0) {
-        auto* geo = new Geometry(device, mNode->matrix);
-
-        for (int k = 0; k < node->mNumMeshes; k++) {
-            auto* mesh = scene->mMeshes[node->mMeshes[k]];
-
-            auto indexStart = static_cast<uint32_t>(indexBuffer.size());
-            auto vertexStart = static_cast<uint32_t>(vertexBuffer.size());
-            uint32_t indexCount = 0;
-            uint32_t vertexCount = 0;
+namespace
+{
+    // Part of a converted mesh, the levels of detail are appended to its indices
+    struct ConvertedPart {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        /** @brief Index count of the full mesh, the rest of indices belongs to the levels of detail */
+        uint32_t indexCount;
+        /** @brief firstIndex is relative to the part */
+        std::vector<Mesh::Lod> lods;
+        bool hasBounds;
+        glm::vec3 min;
+        glm::vec3 max;
+    };
 
-            glm::vec3 posMin {};
-            glm::vec3 posMax {};
+    struct ConvertedMesh {
+        std::vector<ConvertedPart> parts;
+    };
 
-            // mesh indices
-            {
-                auto indexOffset = static_cast<uint32_t>(indexBuffer.size());
+    /**
+    * Convert, optimize and split an Assimp mesh and generate its levels of detail
+    *
+    * @note Only reads the mesh, so the meshes of a scene can be converted concurrently
+    */
+    ConvertedMesh convertMesh(const aiMesh* mesh, const std::vector<uint32_t>& boneJoints, bool generateLods)
+    {
+        ConvertedMesh converted;
+
+        // Indices and vertices are converted into arrays sized up front, so the mesh can be optimized before it's placed in the model buffers
+        size_t indexCount = 0;
+        bool triangleList = true;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+            indexCount += mesh->mFaces[i].mNumIndices;
+            triangleList &= (mesh->mFaces[i].mNumIndices == 3);
+        }
+        std::vector<uint32_t> meshIndices(indexCount);
+        if (triangleList) {
+            for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+                const unsigned int* face = mesh->mFaces[i].mIndices;
+                meshIndices[i * 3 + 0] = face[0];
+                meshIndices[i * 3 + 1] = face[1];
+                meshIndices[i * 3 + 2] = face[2];
+            }
+        } else {
+            size_t index = 0;
+            for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+                const auto& face = mesh->mFaces[i];
+                for (unsigned int j = 0; j < face.mNumIndices; j++) {
+                    meshIndices[index++] = face.mIndices[j];
+                }
+            }
+        }
 
-                for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-                    const auto& face = mesh->mFaces[i];
-                    for (unsigned int j = 0; j < face.mNumIndices; j++) {
-                        indexBuffer.emplace_back(face.mIndices[j] + indexOffset);
-                        indexCount++;
+        // One pass per attribute over the tightly packed Assimp arrays, components that aren't present stay zero
+        const uint32_t vertexCount = static_cast<uint32_t>(mesh->mNumVertices);
+        std::vector<Vertex> meshVertices(vertexCount);
+        const aiVector3D* positions = mesh->mVertices;
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            meshVertices[i].pos = glm::vec4(positions[i].x, positions[i].y, positions[i].z, 1.0f);
+        }
+        if (mesh->HasNormals()) {
+            const aiVector3D* normals = mesh->mNormals;
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                meshVertices[i].normal = glm::vec3(normals[i].x, normals[i].y, normals[i].z);
+            }
+        }
+        if (mesh->mTextureCoords[0]) {
+            const aiVector3D* uvs = mesh->mTextureCoords[0];
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                meshVertices[i].uv = glm::vec2(uvs[i].x, uvs[i].y);
+            }
+        }
+        if (mesh->HasVertexColors(0)) {
+            const aiColor4D* colors = mesh->mColors[0];
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                meshVertices[i].color = glm::vec4(colors[i].r, colors[i].g, colors[i].b, colors[i].a);
+            }
+        } else {
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                meshVertices[i].color = glm::vec4(1.0f);
+            }
+        }
+        // Assimp stores the weights per bone, every vertex keeps its four largest ones with the bones mapped to the joints of the node's skin
+        if (!boneJoints.empty()) {
+            for (unsigned int b = 0; b < mesh->mNumBones; b++) {
+                const aiBone* bone = mesh->mBones[b];
+                for (unsigned int w = 0; w < bone->mNumWeights; w++) {
+                    const aiVertexWeight& weight = bone->mWeights[w];
+                    if (weight.mVertexId >= vertexCount) {
+                        continue;
+                    }
+                    Vertex& vertex = meshVertices[weight.mVertexId];
+                    int smallest = 0;
+                    for (int k = 1; k < 4; k++) {
+                        if (vertex.weight0[k] < vertex.weight0[smallest]) {
+                            smallest = k;
+                        }
+                    }
+                    if (weight.mWeight > vertex.weight0[smallest]) {
+                        vertex.weight0[smallest] = weight.mWeight;
+                        vertex.joint0[smallest] = static_cast<float>(boneJoints[b]);
                     }
                 }
             }
+            for (auto& vertex : meshVertices) {
+                const float sum = vertex.weight0.x + vertex.weight0.y + vertex.weight0.z + vertex.weight0.w;
+                if (sum > 0.0f) {
+                    vertex.weight0 /= sum;
+                }
+            }
+        }
 
-            // mesh vertices
-            {
-                vertexCount = static_cast<uint32_t>(mesh->mNumVertices);
-
-                for (uint32_t i = 0; i < vertexCount; i++) {
-                    Vertex vert {};
-                    glm::vec3 vector;
+        // Point and line primitives are left in their original order
+        if (triangleList && !meshIndices.empty()) {
+            MeshOptimizer::optimize(meshVertices, meshIndices, offsetof(Vertex, pos));
+        }
 
-                    // pos
-                    vector.x = mesh->mVertices[i].x;
-                    vector.y = mesh->mVertices[i].y;
-                    vector.z = mesh->mVertices[i].z;
+        // Meshes are drawn with their first vertex as vertex offset, larger meshes are split so they can still use 16-bit indices
+        std::vector<MeshOptimizer::Submesh<Vertex>> submeshes;
+        if (triangleList && (meshVertices.size() > MeshOptimizer::maxVertices16)) {
+            submeshes = MeshOptimizer::splitSubmeshes(meshVertices, meshIndices);
+        } else {
+            submeshes.resize(1);
+            submeshes[0].vertices.swap(meshVertices);
+            submeshes[0].indices.swap(meshIndices);
+        }
 
-                    vert.pos = glm::vec4(vector, 1.0f);
+        converted.parts.resize(submeshes.size());
+        for (size_t s = 0; s < submeshes.size(); s++) {
+            auto& submesh = submeshes[s];
+            ConvertedPart& part = converted.parts[s];
+            part.indexCount = static_cast<uint32_t>(submesh.indices.size());
+
+            // mAABB is only filled with aiProcess_GenBoundingBoxes, the bounds are taken from the vertices instead
+            part.hasBounds = !submesh.vertices.empty();
+            part.min = glm::vec3(FLT_MAX);
+            part.max = glm::vec3(-FLT_MAX);
+            for (const auto& vertex : submesh.vertices) {
+                part.min = glm::min(part.min, glm::vec3(vertex.pos));
+                part.max = glm::max(part.max, glm::vec3(vertex.pos));
+            }
 
-                    // normal
-                    if (mesh->HasNormals()) {
-                        vector.x = mesh->mNormals[i].x;
-                        vector.y = mesh->mNormals[i].y;
-                        vector.z = mesh->mNormals[i].z;
-                        vert.normal = vector;
+            // Every level is simplified from the previous one to half its triangles, its indices are appended right after the mesh
+            if (generateLods && triangleList && (part.indexCount > 0)) {
+                const float* lodPositions = glm::value_ptr(submesh.vertices[0].pos);
+                const float scale = MeshOptimizer::simplifyScale(lodPositions, sizeof(Vertex), submesh.vertices.size());
+                std::vector<uint32_t> lodIndices = submesh.indices;
+                for (uint32_t level = 1; level < maxLodCount; level++) {
+                    std::vector<uint32_t> simplified(lodIndices.size());
+                    float error = 0.0f;
+                    const size_t count = MeshOptimizer::simplify(simplified.data(), lodIndices.data(), lodIndices.size(), lodPositions, sizeof(Vertex), submesh.vertices.size(), lodIndices.size() / 2, lodStepError, &error);
+                    // Locked borders and seams or the error limit stop the simplification, a level that is barely smaller isn't worth keeping
+                    if ((count == 0) || (count > lodIndices.size() * 3 / 4)) {
+                        break;
                     }
+                    std::vector<uint32_t> optimized(count);
+                    MeshOptimizer::optimizeVertexCache(optimized.data(), simplified.data(), count, submesh.vertices.size());
+
+                    Mesh::Lod lod;
+                    lod.firstIndex = static_cast<uint32_t>(submesh.indices.size());
+                    lod.indexCount = static_cast<uint32_t>(count);
+                    lod.error = (part.lods.empty() ? 0.0f : part.lods.back().error) + error * scale;
+                    submesh.indices.insert(submesh.indices.end(), optimized.begin(), optimized.end());
+                    part.lods.push_back(lod);
+                    lodIndices.swap(optimized);
+                }
+            }
+            part.vertices.swap(submesh.vertices);
+            part.indices.swap(submesh.indices);
+        }
+        return converted;
+    }
+}
 
-                    if (mesh->mTextureCoords[0]) {
-                        vert.uv.x = mesh->mTextureCoords[0][i].x;
-                        vert.uv.y = mesh->mTextureCoords[0][i].y;
-                    }
+/**
+* Create the node hierarchy of an Assimp node, the meshes are only collected and converted by loadMeshes
+*
+* Nodes are added to linearNodes after their children, meshImports receives the meshes in the same order.
+*/
+void Model::loadNode(const aiScene* scene, aiNode* node, Node* parent, std::vector<MeshImport>& meshImports)
+{
+    auto* mNode = new Node{};
 
-                    if (mesh->HasVertexColors(0)) {
-                        vert.color.r = mesh->mColors[0][i].r;
-                        vert.color.g = mesh->mColors[0][i].g;
-                        vert.color.b = mesh->mColors[0][i].b;
-                        vert.color.a = mesh->mColors[0][i].a;
-                    } else {
-                        vert.color = glm::vec4(1.0f);
-                    }
+    mNode->parent = parent;
+    mNode->name = node->mName.C_Str();
+    mNode->matrix = glm::transpose(glm::make_mat4x4(&node->mTransformation.a1));
 
-                    vertexBuffer.emplace_back(vert);
-                }
-            }
+    // Node with children
+    for (int m = 0; m < node->mNumChildren; m++) {
+        loadNode(scene, node->mChildren[m], mNode, meshImports);
+    }
 
-            auto* mMesh = new Mesh(indexStart, indexCount, vertexStart, vertexCount, materials[mesh->mMaterialIndex]);
-            mMesh->setDimensions(
-                glm::make_vec3(&mesh->mAABB.mMin.x),
-                glm::make_vec3(&mesh->mAABB.mMax.x)
-            );
-            geo->meshes.emplace_back(mMesh);
+    // Node contains mesh data
+    if (node->mNumMeshes > 0) {
+        auto* geo = new Geometry(device, mNode->matrix);
+        for (int k = 0; k < node->mNumMeshes; k++) {
+            meshImports.push_back({ geo, scene->mMeshes[node->mMeshes[k]] });
         }
-
         mNode->geo = geo;
     }
 
@@ -855,200 +1334,400 @@ void Model::loadNode(const aiScene* scene, aiNode* node, Node* parent)
     parent->children.emplace_back(mNode);
 }
 
-//void Model::loadSkins(const aiScene* scene)
-//{
-//    for (tinygltf::Skin &source : gltfModel.skins) {
-//        Skin *newSkin = new Skin{};
-//        newSkin->name = source.name;
-//
-//        // Find skeleton root node
-//        if (source.skeleton > -1) {
-//            newSkin->skeletonRoot = nodeFromIndex(source.skeleton);
-//        }
-//
-//        // Find joint nodes
-//        for (int jointIndex : source.joints) {
-//            Node* node = nodeFromIndex(jointIndex);
-//            if (node) {
-//                newSkin->joints.push_back(nodeFromIndex(jointIndex));
-//            }
-//        }
-//
-//        // Get inverse bind matrices from buffer
-//        if (source.inverseBindMatrices > -1) {
-//            const tinygltf::Accessor &accessor = gltfModel.accessors[source.inverseBindMatrices];
-//            const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-//            const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-//            newSkin->inverseBindMatrices.resize(accessor.count);
-//            memcpy(newSkin->inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
-//        }
-//
-//        skins.push_back(newSkin);
-//    }
-//}
+/**
+* Convert the meshes collected by loadNode and place them in the model buffers
+*
+* The meshes are converted on the shared thread pool, then their offsets are assigned in mesh order and the buffers are
+* filled in parallel after being sized once. The result is the same as converting the meshes one after another.
+*
+* @note Blocks on the thread pool, so it must not be called from a job of ThreadPool::shared()
+*/
+void Model::loadMeshes(const std::vector<MeshImport>& meshImports)
+{
+    std::vector<ConvertedMesh> converted(meshImports.size());
+    const bool lods = generateLods;
+    ThreadPool::shared().parallelFor(meshImports.size(), [&](size_t i) {
+        converted[i] = convertMesh(meshImports[i].mesh, meshImports[i].boneJoints, lods);
+    });
+
+    // Offsets of every part in mesh order
+    struct Placement {
+        uint32_t firstVertex;
+        uint32_t firstIndex;
+    };
+    std::vector<std::vector<Placement>> placements(converted.size());
+    size_t vertexCount = vertexBuffer.size();
+    size_t indexCount = indexBuffer.size();
+    for (size_t i = 0; i < converted.size(); i++) {
+        for (auto& part : converted[i].parts) {
+            placements[i].push_back({ static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(indexCount) });
+            vertexCount += part.vertices.size();
+            indexCount += part.indices.size();
+        }
+    }
+    vertexBuffer.resize(vertexCount);
+    indexBuffer.resize(indexCount);
+
+    ThreadPool::shared().parallelFor(converted.size(), [&](size_t i) {
+        for (size_t p = 0; p < converted[i].parts.size(); p++) {
+            const ConvertedPart& part = converted[i].parts[p];
+            const Placement& placement = placements[i][p];
+            std::copy(part.vertices.begin(), part.vertices.end(), vertexBuffer.begin() + placement.firstVertex);
+            for (size_t j = 0; j < part.indices.size(); j++) {
+                indexBuffer[placement.firstIndex + j] = part.indices[j] + placement.firstVertex;
+            }
+        }
+    });
+
+    for (size_t i = 0; i < converted.size(); i++) {
+        Material* material = materials[meshImports[i].mesh->mMaterialIndex];
+        for (size_t p = 0; p < converted[i].parts.size(); p++) {
+            const ConvertedPart& part = converted[i].parts[p];
+            const Placement& placement = placements[i][p];
+            auto* mMesh = new Mesh(placement.firstIndex, part.indexCount, placement.firstVertex, static_cast<uint32_t>(part.vertices.size()), material);
+            if (part.hasBounds) {
+                mMesh->setDimensions(part.min, part.max);
+            }
+            for (Mesh::Lod lod : part.lods) {
+                lod.firstIndex += placement.firstIndex;
+                mMesh->lods.push_back(lod);
+            }
+            meshImports[i].geometry->meshes.emplace_back(mMesh);
+        }
+    }
+}
 
-Texture* Model::loadMaterialTexture(const aiScene* scene, const aiMaterial* mat, aiTextureType type, VkQueue transferQueue) const
+namespace
 {
-    if (mat->GetTextureCount(type) == 0) {
-        return nullptr;
+    /** @brief Imported nodes by their Assimp name, the first of several nodes with the same name wins */
+    std::map<std::string, Node*> nodesByName(const std::vector<Node*>& nodes)
+    {
+        std::map<std::string, Node*> names;
+        for (Node* node : nodes) {
+            if (!node->name.empty()) {
+                names.emplace(node->name, node);
+            }
+        }
+        return names;
     }
 
-    // though a material can has multiple textures of one type, here we get the first texture of each type
-    aiString fileName;
-    mat->GetTexture(type, 0, &fileName);
+    glm::vec4 keyValue(const aiVector3D& value)
+    {
+        return glm::vec4(value.x, value.y, value.z, 0.0f);
+    }
 
-    auto* tex = new Texture();
-    tex->load(scene, std::string(fileName.C_Str()), path, device, transferQueue);
+    glm::vec4 keyValue(const aiQuaternion& value)
+    {
+        return glm::vec4(value.x, value.y, value.z, value.w);
+    }
 
-    return tex;
+    /** @brief Sampler of Assimp position, rotation or scaling keys, key times are converted from ticks to seconds */
+    template <typename Key>
+    AnimationSampler importSampler(const Key* keys, unsigned int keyCount, double ticksPerSecond)
+    {
+        AnimationSampler sampler;
+        sampler.interpolation = AnimationSampler::InterpolationType::LINEAR;
+        sampler.inputs.resize(keyCount);
+        sampler.outputsVec4.resize(keyCount);
+        for (unsigned int i = 0; i < keyCount; i++) {
+            sampler.inputs[i] = static_cast<float>(keys[i].mTime / ticksPerSecond);
+            sampler.outputsVec4[i] = keyValue(keys[i].mValue);
+        }
+        return sampler;
+    }
 }
 
-void Model::loadMaterials(const aiScene *scene, VkQueue transferQueue)
+/**
+* Create a skin for every node with skinned meshes and map the bones of its meshes to the joints of the skin
+*
+* The joints of a skin are the bones of all meshes of the node, found by name among the imported nodes. A bone without
+* a node of its name is bound to the skinned node itself with an identity inverse bind matrix, so its vertices keep
+* their bind pose.
+*
+* @note Has to be called before loadMeshes, which reads the bone mapping when it converts the weights
+*/
+void Model::loadSkins(std::vector<MeshImport>& meshImports)
 {
-    // Create an empty texture to be used for empty material images
-    createEmptyTexture(transferQueue);
+    const std::map<std::string, Node*> names = nodesByName(linearNodes);
+    std::map<const Geometry*, Node*> geometryNodes;
+    for (Node* node : linearNodes) {
+        if (node->geo) {
+            geometryNodes[node->geo] = node;
+        }
+    }
 
+    // Joint index of every bone name, per skin
+    std::map<const Skin*, std::map<std::string, uint32_t>> skinJoints;
+    for (auto& meshImport : meshImports) {
+        const aiMesh* mesh = meshImport.mesh;
+        if (!mesh->HasBones()) {
+            continue;
+        }
+        Node* node = geometryNodes[meshImport.geometry];
+        if (!node->skin) {
+            node->skin = new Skin{};
+            node->skin->name = node->name;
+            node->skinIndex = static_cast<int32_t>(skins.size());
+            skins.push_back(node->skin);
+        }
+        Skin* skin = node->skin;
+        auto& jointIndices = skinJoints[skin];
+
+        meshImport.boneJoints.resize(mesh->mNumBones);
+        for (unsigned int b = 0; b < mesh->mNumBones; b++) {
+            const aiBone* bone = mesh->mBones[b];
+            auto joint = jointIndices.emplace(bone->mName.C_Str(), static_cast<uint32_t>(skin->joints.size()));
+            if (joint.second) {
+                auto jointNode = names.find(bone->mName.C_Str());
+                if (jointNode != names.end()) {
+                    skin->joints.push_back(jointNode->second);
+                    skin->inverseBindMatrices.push_back(glm::transpose(glm::make_mat4x4(&bone->mOffsetMatrix.a1)));
+                } else {
+                    std::cerr << "Bone " << bone->mName.C_Str() << " of mesh " << mesh->mName.C_Str() << " has no node\n";
+                    skin->joints.push_back(node);
+                    skin->inverseBindMatrices.push_back(glm::mat4(1.0f));
+                }
+            }
+            meshImport.boneJoints[b] = joint.first->second;
+        }
+    }
+}
+
+/**
+* Create the materials of a scene with the images they reference, without loading any textures
+*/
+void Model::importMaterials(const aiScene *scene)
+{
     for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
         auto* material = scene->mMaterials[i];
 
         auto* mMaterial = new Material(device, &emptyTexture);
+        materials.push_back(mMaterial);
+
+        mMaterial->diffuseSource = TextureSource(scene, material, aiTextureType_DIFFUSE);
+        mMaterial->normalSource = TextureSource(scene, material, aiTextureType_NORMALS);
+    }
+}
+
+/**
+* Load the textures referenced by the materials
+*
+* @note Textures are decoded in parallel on the shared thread pool, each one is created and added to the batch on the calling thread as soon as its decode has finished
+*/
+void Model::loadMaterials(UploadBatch& uploadBatch)
+{
+    // Create an empty texture to be used for empty material images
+    createEmptyTexture(uploadBatch);
+
+    struct TextureJob {
+        std::string key;
+        std::vector<Texture**> targets;
+        TextureSource source;
+        TextureData textureData;
+        double decodeMs;
+    };
+    std::vector<TextureJob> jobs;
+    std::map<std::string, size_t> jobIndices;
+    // Jobs are only added before decoding starts, so the pointers into the vector stay valid
+    auto addJob = [&](const TextureSource& source, Texture** target) {
+        if (source.used()) {
+            // Streamed textures change their image at runtime, so they are only shared with other streaming models
+            const std::string key = TextureCache::key(source, path) + (streamTextures ? "#streamed" : "");
+            // Several materials of this model using the same image share one job
+            auto jobIndex = jobIndices.find(key);
+            if (jobIndex != jobIndices.end()) {
+                jobs[jobIndex->second].targets.push_back(target);
+                return;
+            }
+            // Images already loaded by another model are taken from the cache
+            UploadToken cacheToken = 0;
+            if (Texture* cached = textureCache.acquire(key, &cacheToken)) {
+                *target = cached;
+                textures.push_back(cached);
+                textureCacheToken = std::max(textureCacheToken, cacheToken);
+                return;
+            }
+            jobIndices[key] = jobs.size();
+            jobs.push_back({ key, { target }, source, TextureData(), 0.0 });
+        }
+    };
+
+    for (auto* mMaterial : materials) {
         if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
-            mMaterial->diffuseTexture = loadMaterialTexture(scene, material, aiTextureType_DIFFUSE, transferQueue);
+            addJob(mMaterial->diffuseSource, &mMaterial->diffuseTexture);
         }
         
         if (descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap) {
-            mMaterial->normalTexture = loadMaterialTexture(scene, material, aiTextureType_NORMALS, transferQueue);
-            
+            addJob(mMaterial->normalSource, &mMaterial->normalTexture);
         }
         
         if (descriptorBindingFlags & DescriptorBindingFlags::ImagePbr) {
             // TODO prb image
         }
+    }
+
+    if (jobs.empty()) {
+        return;
+    }
 
-        materials.emplace_back(std::move(mMaterial));
+    // Workers push the index of every decoded job, the calling thread picks them up in completion order
+    std::mutex completedMutex;
+    std::condition_variable completedCondition;
+    std::deque<size_t> completed;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        TextureJob* job = &jobs[i];
+        const std::string filePath = path;
+        const bool stream = streamTextures;
+        ThreadPool::shared().enqueue([=, &completedMutex, &completedCondition, &completed]() {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            job->textureData = Texture::decode(job->source, filePath);
+            if (stream) {
+                job->textureData = TextureStreamer::expandMipChain(job->textureData);
+            }
+            job->decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+            std::lock_guard<std::mutex> lock(completedMutex);
+            completed.push_back(i);
+            completedCondition.notify_one();
+        });
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(completedMutex);
+            completedCondition.wait(lock, [&] { return !completed.empty(); });
+            index = completed.front();
+            completed.pop_front();
+        }
+        TextureJob& job = jobs[index];
+        auto tStart = std::chrono::high_resolution_clock::now();
+        auto* tex = new Texture();
+        if (streamTextures) {
+            tex->create(job.textureData, device, uploadBatch, textureStreamer.tailLevel(job.textureData));
+            textureStreamer.addTexture(tex, job.textureData);
+        } else {
+            tex->create(job.textureData, device, uploadBatch);
+        }
+        textureCache.add(job.key, tex);
+        for (size_t t = 0; t < job.targets.size(); t++) {
+            if (t > 0) {
+                textureCache.addReference(tex);
+            }
+            *job.targets[t] = tex;
+            textures.push_back(tex);
+        }
+        const double uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+        // The batch holds its own reference to the decoded image
+        job.textureData = TextureData();
+        textureCache.addLoadTiming({ job.source.fileName, job.decodeMs, uploadMs });
     }
 }
 
-//void Model::loadAnimations(tinygltf::Model &gltfModel)
-//{
-//    for (tinygltf::Animation &anim : gltfModel.animations) {
-//        Animation animation{};
-//        animation.name = anim.name;
-//        if (anim.name.empty()) {
-//            animation.name = std::to_string(animations.size());
-//        }
-//
-//        // Samplers
-//        for (auto &samp : anim.samplers) {
-//            AnimationSampler sampler{};
-//
-//            if (samp.interpolation == "LINEAR") {
-//                sampler.interpolation = AnimationSampler::InterpolationType::LINEAR;
-//            }
-//            if (samp.interpolation == "STEP") {
-//                sampler.interpolation = AnimationSampler::InterpolationType::STEP;
-//            }
-//            if (samp.interpolation == "CUBICSPLINE") {
-//                sampler.interpolation = AnimationSampler::InterpolationType::CUBICSPLINE;
-//            }
-//
-//            // Read sampler input time values
-//            {
-//                const tinygltf::Accessor &accessor = gltfModel.accessors[samp.input];
-//                const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-//                const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-//
-//                assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-//
-//                float *buf = new float[accessor.count];
-//                memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(float));
-//                for (size_t index = 0; index < accessor.count; index++) {
-//                    sampler.inputs.push_back(buf[index]);
-//                }
-//                delete[] buf;
-//                for (auto input : sampler.inputs) {
-//                    if (input < animation.start) {
-//                        animation.start = input;
-//                    };
-//                    if (input > animation.end) {
-//                        animation.end = input;
-//                    }
-//                }
-//            }
-//
-//            // Read sampler output T/R/S values
-//            {
-//                const tinygltf::Accessor &accessor = gltfModel.accessors[samp.output];
-//                const tinygltf::BufferView &bufferView = gltfModel.bufferViews[accessor.bufferView];
-//                const tinygltf::Buffer &buffer = gltfModel.buffers[bufferView.buffer];
-//
-//                assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-//
-//                switch (accessor.type) {
-//                    case TINYGLTF_TYPE_VEC3: {
-//                        glm::vec3 *buf = new glm::vec3[accessor.count];
-//                        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec3));
-//                        for (size_t index = 0; index < accessor.count; index++) {
-//                            sampler.outputsVec4.push_back(glm::vec4(buf[index], 0.0f));
-//                        }
-//                        delete[] buf;
-//                        break;
-//                    }
-//                    case TINYGLTF_TYPE_VEC4: {
-//                        glm::vec4 *buf = new glm::vec4[accessor.count];
-//                        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::vec4));
-//                        for (size_t index = 0; index < accessor.count; index++) {
-//                            sampler.outputsVec4.push_back(buf[index]);
-//                        }
-//                        delete[] buf;
-//                        break;
-//                    }
-//                    default: {
-//                        std::cout << "unknown type" << std::endl;
-//                        break;
-//                    }
-//                }
-//            }
-//
-//            animation.samplers.push_back(sampler);
-//        }
-//
-//        // Channels
-//        for (auto &source: anim.channels) {
-//            AnimationChannel channel{};
-//
-//            if (source.target_path == "rotation") {
-//                channel.path = AnimationChannel::PathType::ROTATION;
-//            }
-//            if (source.target_path == "translation") {
-//                channel.path = AnimationChannel::PathType::TRANSLATION;
-//            }
-//            if (source.target_path == "scale") {
-//                channel.path = AnimationChannel::PathType::SCALE;
-//            }
-//            if (source.target_path == "weights") {
-//                std::cout << "weights not yet supported, skipping channel" << std::endl;
-//                continue;
-//            }
-//            channel.samplerIndex = source.sampler;
-//            channel.node = nodeFromIndex(source.target_node);
-//            if (!channel.node) {
-//                continue;
-//            }
-//
-//            animation.channels.push_back(channel);
-//        }
-//
-//        animations.push_back(animation);
-//    }
-//}
+/**
+* Import the animations of an Assimp scene, every node channel gets a sampler for each of its translation, rotation and scaling keys
+*
+* Assimp channels replace the whole local transform of their node, so the imported matrix of an animated node is
+* decomposed into its translation, rotation and scale, which the channels then overwrite, and the matrix is reset.
+* Animations keep the index they have in the scene, channels of nodes that weren't imported are dropped.
+*/
+void Model::loadAnimations(const aiScene* scene)
+{
+    const std::map<std::string, Node*> names = nodesByName(linearNodes);
+    for (unsigned int a = 0; a < scene->mNumAnimations; a++) {
+        const aiAnimation* source = scene->mAnimations[a];
+        // Files without a tick rate use the Assimp default
+        const double ticksPerSecond = (source->mTicksPerSecond > 0.0) ? source->mTicksPerSecond : 25.0;
+
+        auto* animation = new Animation{};
+        animation->name = source->mName.C_Str();
+        for (unsigned int c = 0; c < source->mNumChannels; c++) {
+            const aiNodeAnim* channel = source->mChannels[c];
+            auto found = names.find(channel->mNodeName.C_Str());
+            if (found == names.end()) {
+                continue;
+            }
+            Node* node = found->second;
+            if (node->matrix != glm::mat4(1.0f)) {
+                const aiNode* sourceNode = scene->mRootNode->FindNode(channel->mNodeName);
+                aiVector3D scaling, position;
+                aiQuaternion rotation;
+                sourceNode->mTransformation.Decompose(scaling, rotation, position);
+                node->translation = glm::vec3(position.x, position.y, position.z);
+                node->rotation = glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+                node->scale = glm::vec3(scaling.x, scaling.y, scaling.z);
+                node->matrix = glm::mat4(1.0f);
+                node->markDirty();
+            }
 
+            auto addChannel = [&](AnimationChannel::PathType path, const AnimationSampler& sampler) {
+                if (sampler.inputs.empty()) {
+                    return;
+                }
+                animation->start = std::min(animation->start, sampler.inputs.front());
+                animation->end = std::max(animation->end, sampler.inputs.back());
+                animation->channels.push_back({ path, node, static_cast<uint32_t>(animation->samplers.size()) });
+                animation->samplers.push_back(sampler);
+            };
+            addChannel(AnimationChannel::PathType::TRANSLATION, importSampler(channel->mPositionKeys, channel->mNumPositionKeys, ticksPerSecond));
+            addChannel(AnimationChannel::PathType::ROTATION, importSampler(channel->mRotationKeys, channel->mNumRotationKeys, ticksPerSecond));
+            addChannel(AnimationChannel::PathType::SCALE, importSampler(channel->mScalingKeys, channel->mNumScalingKeys, ticksPerSecond));
+        }
+        animations.push_back(animation);
+    }
+}
+
+/**
+* Load a model and upload its buffers and textures, blocking until the uploads have finished
+*
+* @param transferQueue Graphics queue the uploads are submitted to
+*/
 void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue transferQueue, uint32_t fileLoadingFlags)
+{
+    UploadBatch uploadBatch;
+    loadFromFile(filename, device, uploadBatch, fileLoadingFlags);
+    device->flushUploadBatch(uploadBatch, transferQueue);
+    // Textures shared with a model that is still streaming in have to be complete as well
+    device->uploader->wait(textureCacheToken);
+    textureCache.publish(textures, 0);
+    if (streamTextures) {
+        textureStreamer.addModel(this);
+    }
+}
+
+/**
+* Load a model and upload its buffers and textures in the background through the device's AsyncUploader
+*
+* @note Can be called from a loader thread, the model must not be drawn before isReady() returns true
+*/
+void Model::loadFromFileAsync(std::string filename, VulkanDevice *device, uint32_t fileLoadingFlags)
+{
+    UploadBatch uploadBatch;
+    loadFromFile(filename, device, uploadBatch, fileLoadingFlags);
+    // Tokens complete in order, so waiting for the latest one covers the shared cached textures as well
+    uploadToken = std::max(device->uploader->submit(uploadBatch), textureCacheToken);
+    textureCache.publish(textures, uploadToken);
+    // The streamer reads isReady() on the render thread, it must only see the model once its token is set
+    if (streamTextures) {
+        textureStreamer.addModel(this);
+    }
+}
+
+bool Model::isReady() const
+{
+    return device->uploader->isComplete(uploadToken);
+}
+
+/**
+* Import the host side of a model with Assimp: the materials with the images they reference, the node hierarchy and the optimized vertex and index data
+*
+* @note Device resources (the uniform buffers of the nodes) are only created if the model has a device, scene_baker imports without one
+*/
+void Model::importScene(std::string filename, uint32_t fileLoadingFlags)
 {
     Assimp::Importer importer;
     const auto* scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs);
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        std::cerr << "failed to load model file: " << path << std::endl;
+        std::cerr << "failed to load model file: " << filename << std::endl;
         exit(-1);
     }
 
@@ -1057,31 +1736,24 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
     size_t pos = filename.find_last_of('/');
     path = filename.substr(0, pos);
 
-    this->device = device;
+    generateLods = fileLoadingFlags & FileLoadingFlags::GenerateLods;
 
-    loadMaterials(scene, transferQueue);
+    importMaterials(scene);
 
     rootNode = new Node();
+    std::vector<MeshImport> meshImports;
     for (int i = 0; i < scene->mRootNode->mNumChildren; i++) {
-        loadNode(scene, scene->mRootNode->mChildren[i], rootNode);
+        loadNode(scene, scene->mRootNode->mChildren[i], rootNode, meshImports);
+    }
+    // Skinning starts from the vertices in their bind pose, which pre-transforming or flipping them would change
+    if (!(fileLoadingFlags & (FileLoadingFlags::PreTransformVertices | FileLoadingFlags::FlipY))) {
+        loadSkins(meshImports);
+    }
+    loadMeshes(meshImports);
+    // Pre-transformed vertices already have the node transforms applied
+    if (!(fileLoadingFlags & FileLoadingFlags::PreTransformVertices)) {
+        loadAnimations(scene);
     }
-
-//    if (gltfModel.animations.size() > 0) {
-//        loadAnimations(gltfModel);
-//    }
-//    loadSkins(gltfModel);
-
-//    for (auto node : linearNodes) {
-//        // Assign skins
-//        if (node->skinIndex > -1) {
-//            node->skin = skins[node->skinIndex];
-//        }
-//        // Initial pose
-//        if (node->mesh) {
-//            node->update();
-//        }
-//    }
-
 
     // Pre-Calculations for requested features
     if ((fileLoadingFlags & FileLoadingFlags::PreTransformVertices) || (fileLoadingFlags & FileLoadingFlags::PreMultiplyVertexColors) || (fileLoadingFlags & FileLoadingFlags::FlipY)) {
@@ -1113,37 +1785,146 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
             }
         }
     }
+}
+
+/**
+* Indices in the form they are uploaded in, relative to the first vertex of their mesh and 16 bits wide if all meshes allow it
+*
+* @note Sets indices.type
+*/
+std::shared_ptr<void> Model::createUploadIndices()
+{
+    // Meshes are drawn with their first vertex as vertex offset, so the uploaded indices (including their levels of detail) are made relative to it
+    indices.type = VK_INDEX_TYPE_UINT16;
+    for (Node* node : linearNodes) {
+        if (node->geo) {
+            for (auto* mesh : node->geo->meshes) {
+                if (mesh->vertexCount > MeshOptimizer::maxVertices16) {
+                    indices.type = VK_INDEX_TYPE_UINT32;
+                }
+            }
+        }
+    }
+    if (indices.type == VK_INDEX_TYPE_UINT16) {
+        auto indices16 = std::make_shared<std::vector<uint16_t>>(indexBuffer.size());
+        for (Node* node : linearNodes) {
+            if (node->geo) {
+                for (auto* mesh : node->geo->meshes) {
+                    for (uint32_t i = mesh->firstIndex; i < mesh->indexEnd(); i++) {
+                        (*indices16)[i] = static_cast<uint16_t>(indexBuffer[i] - mesh->firstVertex);
+                    }
+                }
+            }
+        }
+        return std::shared_ptr<void>(indices16, indices16->data());
+    }
+    auto indices32 = std::make_shared<std::vector<uint32_t>>(indexBuffer.size());
+    for (Node* node : linearNodes) {
+        if (node->geo) {
+            for (auto* mesh : node->geo->meshes) {
+                for (uint32_t i = mesh->firstIndex; i < mesh->indexEnd(); i++) {
+                    (*indices32)[i] = indexBuffer[i] - mesh->firstVertex;
+                }
+            }
+        }
+    }
+    return std::shared_ptr<void>(indices32, indices32->data());
+}
 
-    size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-    size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
+/**
+* Position-only stream for depth passes (vec3 per vertex), in the same order as the vertices so the index buffer is shared
+*/
+std::shared_ptr<void> Model::createPositions() const
+{
+    auto positionData = std::make_shared<std::vector<glm::vec3>>(vertexBuffer.size());
+    for (size_t i = 0; i < vertexBuffer.size(); i++) {
+        (*positionData)[i] = glm::vec3(vertexBuffer[i].pos);
+    }
+    return std::shared_ptr<void>(positionData, positionData->data());
+}
+
+/**
+* Load a model, the uploads of all buffers and textures are added to the given batch
+*
+* A baked scene (see SceneFormat) next to the file is used instead of importing the file with Assimp, if it is up to date
+* and was baked with the same geometry flags (bakedLoadingFlags). Baked scenes can also be loaded directly.
+*
+* @param uploadBatch Batch the uploads are recorded to, the model must not be used before it has been flushed or submitted and completed
+*
+* @note Textures taken from the cache may depend on textureCacheToken, new textures are only shared with other models once published to the cache
+* @note Models with FileLoadingFlags::StreamTextures are handed to the texture streamer by the overloads that submit the batch
+*/
+void Model::loadFromFile(std::string filename, VulkanDevice *device, UploadBatch &uploadBatch, uint32_t fileLoadingFlags)
+{
+    size_t pos = filename.find_last_of('/');
+    path = filename.substr(0, pos);
+
+    this->device = device;
+    streamTextures = fileLoadingFlags & FileLoadingFlags::StreamTextures;
+
+    // Vertex, position and index data as uploaded, baked scenes are uploaded straight from the mapped file, which the retained blobs keep alive
+    const void* vertexData = nullptr;
+    std::shared_ptr<void> positionData;
+    std::shared_ptr<void> indexData;
+    std::shared_ptr<MappedFile> bakedScene = openBakedScene(filename, fileLoadingFlags);
+    if (bakedScene) {
+        loadBakedScene(bakedScene);
+        const auto* header = reinterpret_cast<const SceneFormat::Header*>(bakedScene->data);
+        char* data = const_cast<char*>(bakedScene->data);
+        vertexData = data + header->vertices.offset;
+        positionData = std::shared_ptr<void>(bakedScene, data + header->positions.offset);
+        indexData = std::shared_ptr<void>(bakedScene, data + header->indices.offset);
+    } else {
+        importScene(filename, fileLoadingFlags);
+        vertexData = vertexBuffer.data();
+        positionData = createPositions();
+        indexData = createUploadIndices();
+    }
+    uploadBatch.retain(positionData);
+    uploadBatch.retain(indexData);
+
+    loadMaterials(uploadBatch);
+
+    // Packed vertices are quantized per mesh, the host copy in vertexBuffer keeps the full precision
+    packedVertices = fileLoadingFlags & FileLoadingFlags::PackVertices;
+    std::shared_ptr<std::vector<uint8_t>> packedVertexData;
+    if (packedVertices) {
+        packedLayout = PackedVertexLayout(packedVertexComponents);
+        vertices.stride = packedLayout.stride;
+        packedVertexData = std::make_shared<std::vector<uint8_t>>(vertexBuffer.size() * packedLayout.stride);
+        for (Node* node : linearNodes) {
+            if (!node->geo) {
+                continue;
+            }
+            for (auto* mesh : node->geo->meshes) {
+                glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+                for (uint32_t i = 0; i < mesh->vertexCount; i++) {
+                    min = glm::min(min, glm::vec3(vertexBuffer[mesh->firstVertex + i].pos));
+                    max = glm::max(max, glm::vec3(vertexBuffer[mesh->firstVertex + i].pos));
+                }
+                // Flat meshes get a non-zero extent so the scale stays finite
+                const glm::vec3 extent = glm::max(max - min, glm::vec3(1e-6f));
+                mesh->quantization.offset = glm::vec4(min, 0.0f);
+                mesh->quantization.scale = glm::vec4(extent, 0.0f);
+                const glm::vec3 scale = 1.0f / extent;
+                for (uint32_t i = 0; i < mesh->vertexCount; i++) {
+                    const uint32_t index = mesh->firstVertex + i;
+                    packedLayout.pack(vertexBuffer[index], min, scale, packedVertexData->data() + index * packedLayout.stride);
+                }
+            }
+        }
+        uploadBatch.retain(packedVertexData);
+        vertexData = packedVertexData->data();
+    }
+
+    size_t vertexBufferSize = vertexBuffer.size() * vertices.stride;
+    size_t positionBufferSize = vertexBuffer.size() * sizeof(glm::vec3);
+    size_t indexBufferSize = indexBuffer.size() * ((indices.type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t));
     indices.count = static_cast<uint32_t>(indexBuffer.size());
     vertices.count = static_cast<uint32_t>(vertexBuffer.size());
 
     assert((vertexBufferSize > 0) && (indexBufferSize > 0));
 
-    struct StagingBuffer {
-        VkBuffer buffer;
-        VkDeviceMemory memory;
-    } vertexStaging, indexStaging;
-
-    // Create staging buffers
-    // Vertex data
-    VK_CHECK_RESULT(device->createBuffer(
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            vertexBufferSize,
-            &vertexStaging.buffer,
-            &vertexStaging.memory,
-            vertexBuffer.data()));
-    // Index data
-    VK_CHECK_RESULT(device->createBuffer(
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            indexBufferSize,
-            &indexStaging.buffer,
-            &indexStaging.memory,
-            indexBuffer.data()));
-
     // Create device local buffers
     // Vertex buffer
     VK_CHECK_RESULT(device->createBuffer(
@@ -1151,32 +1932,49 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             vertexBufferSize,
             &vertices.buffer,
-            &vertices.memory));
+            &vertices.allocation));
+    // Position buffer
+    VK_CHECK_RESULT(device->createBuffer(
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            positionBufferSize,
+            &positions.buffer,
+            &positions.allocation));
     // Index buffer
     VK_CHECK_RESULT(device->createBuffer(
             VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             indexBufferSize,
             &indices.buffer,
-            &indices.memory));
-
-    // Copy from staging buffers
-    VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-    VkBufferCopy copyRegion = {};
-
-    copyRegion.size = vertexBufferSize;
-    vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
-
-    copyRegion.size = indexBufferSize;
-    vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
-
-    device->flushCommandBuffer(copyCmd, transferQueue, true);
-
-    vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-    vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
-    vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-    vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+            &indices.allocation));
+
+    // Vertex and index data share the staging buffer and submission with the textures
+    uploadBatch.uploadBuffer(vertices.buffer, vertexData, vertexBufferSize);
+    uploadBatch.uploadBuffer(positions.buffer, positionData.get(), positionBufferSize);
+    uploadBatch.uploadBuffer(indices.buffer, indexData.get(), indexBufferSize);
+
+    // Joint palettes of all skins share one array, written by updateTransforms
+    uint32_t jointCount = 0;
+    for (Skin* skin : skins) {
+        skin->firstJoint = jointCount;
+        jointCount += static_cast<uint32_t>(skin->joints.size());
+    }
+    jointMatrices.assign(jointCount, glm::mat4(1.0f));
+
+    // Parents come after their children in linearNodes
+    sortedNodes.assign(1, rootNode);
+    sortedNodes.insert(sortedNodes.end(), linearNodes.rbegin(), linearNodes.rend());
+    std::map<const Node*, int32_t> sortedIndices;
+    std::vector<int32_t> parents(sortedNodes.size(), -1);
+    for (size_t i = 0; i < sortedNodes.size(); i++) {
+        auto parent = sortedIndices.find(sortedNodes[i]->parent);
+        if (parent != sortedIndices.end()) {
+            parents[i] = parent->second;
+        }
+        sortedIndices[sortedNodes[i]] = static_cast<int32_t>(i);
+    }
+    transformBatch.build(parents);
+    updateTransforms();
 
     getSceneDimensions();
 
@@ -1190,7 +1988,8 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
         }
     }
     for (auto material : materials) {
-        matCnt++;
+        // Materials with streamed textures have a spare set
+        matCnt += streamTextures ? 2 : 1;
         if (descriptorBindingFlags & DescriptorBindingFlags::ImagePbr) {
             imageCount += 4;
             continue;
@@ -1238,9 +2037,7 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
             descriptorLayoutCI.pBindings = setLayoutBindings.data();
             VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutUbo));
         }
-        for (auto node : nodes) {
-            prepareNodeDescriptor(node, descriptorSetLayoutUbo);
-        }
+        prepareNodeUniformBuffers();
     }
 
     // Descriptors for per-material images
@@ -1270,26 +2067,308 @@ void Model::loadFromFile(std::string filename, VulkanDevice *device, VkQueue tra
         }
         for (auto& material : materials) {
             if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
-                material->createDescriptorSet(descriptorPool, descriptorSetLayoutImage, descriptorBindingFlags);
+                material->createDescriptorSet(descriptorPool, descriptorSetLayoutImage, descriptorBindingFlags, streamTextures);
             }
         }
     }
 }
 
-void Model::bindBuffers(VkCommandBuffer commandBuffer)
+/**
+* Returns the path of the baked scene of a model file, the file name with its extension replaced by SceneFormat::extension
+*/
+std::string Model::bakedSceneFile(const std::string& filename)
+{
+    const size_t slash = filename.find_last_of("/\\");
+    const size_t dot = filename.find_last_of('.');
+    const bool hasExtension = (dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash));
+    return (hasExtension ? filename.substr(0, dot) : filename) + SceneFormat::extension;
+}
+
+/**
+* Map the baked scene of a model file, if there is one that can be used for the requested flags
+*
+* @param filename Model file, or a baked scene itself
+* @return nullptr if the model has to be imported with Assimp
+*
+* @note Fails fatally if a baked scene is loaded directly and can't be used
+*/
+std::shared_ptr<MappedFile> Model::openBakedScene(const std::string& filename, uint32_t fileLoadingFlags)
+{
+    const bool direct = endsWith(filename, SceneFormat::extension);
+    if (!direct && (fileLoadingFlags & FileLoadingFlags::IgnoreBakedScene)) {
+        return nullptr;
+    }
+    const std::string bakedFile = direct ? filename : bakedSceneFile(filename);
+    if (!direct && !tools::fileExists(bakedFile)) {
+        return nullptr;
+    }
+
+    auto file = std::make_shared<MappedFile>(bakedFile);
+    const std::string error = validateBakedScene(*file, direct ? std::string() : filename, fileLoadingFlags & bakedLoadingFlags);
+    if (!error.empty()) {
+        if (direct) {
+            tools::exitFatal("Could not load baked scene " + bakedFile + ": " + error, -1);
+        }
+        std::cout << "Ignoring baked scene " << bakedFile << ": " << error << "\n";
+        return nullptr;
+    }
+    return file;
+}
+
+/**
+* Create the host side of a model from a validated baked scene, as importScene would, but with block copies only
+*
+* @note Embedded images keep a reference to the mapping
+*/
+void Model::loadBakedScene(const std::shared_ptr<MappedFile>& file)
+{
+    const char* data = file->data;
+    const auto& header = *reinterpret_cast<const SceneFormat::Header*>(data);
+    generateLods = header.fileLoadingFlags & FileLoadingFlags::GenerateLods;
+    indices.type = static_cast<VkIndexType>(header.indexType);
+
+    auto textureSource = [&](const SceneFormat::TextureReference& reference) {
+        TextureSource source;
+        source.fileName.assign(data + header.strings.offset + reference.nameOffset, reference.nameSize);
+        if (reference.imageSize > 0) {
+            source.embeddedData = std::shared_ptr<const uint8_t>(file, reinterpret_cast<const uint8_t*>(data + header.images.offset + reference.imageOffset));
+            source.embeddedSize = static_cast<size_t>(reference.imageSize);
+        }
+        return source;
+    };
+    const auto* bakedMaterials = reinterpret_cast<const SceneFormat::Material*>(data + header.materials.offset);
+    for (uint32_t i = 0; i < header.materialCount; i++) {
+        const auto& bakedMaterial = bakedMaterials[i];
+        auto* material = new Material(device, &emptyTexture);
+        material->alphaMode = static_cast<Material::AlphaMode>(bakedMaterial.alphaMode);
+        material->alphaCutoff = bakedMaterial.alphaCutoff;
+        material->metallicFactor = bakedMaterial.metallicFactor;
+        material->roughnessFactor = bakedMaterial.roughnessFactor;
+        material->baseColorFactor = glm::make_vec4(bakedMaterial.baseColorFactor);
+        material->diffuseSource = textureSource(bakedMaterial.diffuseTexture);
+        material->normalSource = textureSource(bakedMaterial.normalTexture);
+        materials.push_back(material);
+    }
+
+    // Nodes are stored in the order of linearNodes, so appending every node to its parent restores the order of the children
+    const auto* bakedNodes = reinterpret_cast<const SceneFormat::Node*>(data + header.nodes.offset);
+    const auto* bakedMeshes = reinterpret_cast<const SceneFormat::Mesh*>(data + header.meshes.offset);
+    const auto* bakedLods = reinterpret_cast<const SceneFormat::Lod*>(data + header.lods.offset);
+    rootNode = new Node();
+    std::vector<Node*> loadedNodes(header.nodeCount);
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        loadedNodes[i] = new Node{};
+    }
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        const auto& bakedNode = bakedNodes[i];
+        Node* node = loadedNodes[i];
+        Node* parent = (bakedNode.parent < 0) ? rootNode : loadedNodes[bakedNode.parent];
+        node->parent = parent;
+        node->matrix = glm::make_mat4(bakedNode.matrix);
+        if (bakedNode.meshCount > 0) {
+            auto* geo = new Geometry(device, node->matrix);
+            for (uint32_t m = 0; m < bakedNode.meshCount; m++) {
+                const auto& bakedMesh = bakedMeshes[bakedNode.firstMesh + m];
+                auto* mesh = new Mesh(bakedMesh.firstIndex, bakedMesh.indexCount, bakedMesh.firstVertex, bakedMesh.vertexCount, materials[bakedMesh.material]);
+                if (bakedMesh.hasDimensions) {
+                    mesh->setDimensions(glm::make_vec3(bakedMesh.min), glm::make_vec3(bakedMesh.max));
+                }
+                for (uint32_t l = 0; l < bakedMesh.lodCount; l++) {
+                    const auto& bakedLod = bakedLods[bakedMesh.firstLod + l];
+                    Mesh::Lod lod;
+                    lod.firstIndex = bakedLod.firstIndex;
+                    lod.indexCount = bakedLod.indexCount;
+                    lod.error = bakedLod.error;
+                    mesh->lods.push_back(lod);
+                }
+                geo->meshes.push_back(mesh);
+            }
+            node->geo = geo;
+        }
+        linearNodes.push_back(node);
+        parent->children.push_back(node);
+    }
+
+    const auto* bakedVertices = reinterpret_cast<const Vertex*>(data + header.vertices.offset);
+    vertexBuffer.assign(bakedVertices, bakedVertices + header.vertexCount);
+    const auto* bakedIndices = reinterpret_cast<const uint32_t*>(data + header.hostIndices.offset);
+    indexBuffer.assign(bakedIndices, bakedIndices + header.indexCount);
+}
+
+/**
+* Write the model as a baked scene, after it has been imported with importScene
+*
+* @param sourceFile File the model was imported from, a baked scene is stale once the source has been changed
+* @param fileLoadingFlags Flags the model was imported with
+* @param error Receives the reason if the file can't be written
+* @return False on failure
+*/
+bool Model::saveBakedScene(const std::string& filename, const std::string& sourceFile, uint32_t fileLoadingFlags, std::string& error)
+{
+    SceneFormat::Header header{};
+    header.magic = SceneFormat::magic;
+    header.version = SceneFormat::version;
+    header.vertexSize = sizeof(Vertex);
+    header.fileLoadingFlags = fileLoadingFlags & bakedLoadingFlags;
+    if (!fileStamp(sourceFile, header.sourceSize, header.sourceTime)) {
+        error = "Could not read " + sourceFile;
+        return false;
+    }
+    // Skins and animations reference nodes by name, which the format doesn't store
+    if (!skins.empty() || !animations.empty()) {
+        error = sourceFile + " has skins or animations, which can't be baked";
+        return false;
+    }
+
+    std::string strings;
+    std::vector<uint8_t> images;
+    auto textureReference = [&](const TextureSource& source) {
+        SceneFormat::TextureReference reference{};
+        reference.nameOffset = static_cast<uint32_t>(strings.size());
+        reference.nameSize = static_cast<uint32_t>(source.fileName.size());
+        strings += source.fileName;
+        if (source.embeddedData) {
+            reference.imageOffset = images.size();
+            reference.imageSize = source.embeddedSize;
+            images.insert(images.end(), source.embeddedData.get(), source.embeddedData.get() + source.embeddedSize);
+        }
+        return reference;
+    };
+
+    std::vector<SceneFormat::Material> bakedMaterials;
+    std::map<const Material*, uint32_t> materialIndices;
+    for (auto* material : materials) {
+        SceneFormat::Material bakedMaterial{};
+        bakedMaterial.alphaMode = material->alphaMode;
+        bakedMaterial.alphaCutoff = material->alphaCutoff;
+        bakedMaterial.metallicFactor = material->metallicFactor;
+        bakedMaterial.roughnessFactor = material->roughnessFactor;
+        memcpy(bakedMaterial.baseColorFactor, glm::value_ptr(material->baseColorFactor), sizeof(bakedMaterial.baseColorFactor));
+        bakedMaterial.diffuseTexture = textureReference(material->diffuseSource);
+        bakedMaterial.normalTexture = textureReference(material->normalSource);
+        materialIndices[material] = static_cast<uint32_t>(bakedMaterials.size());
+        bakedMaterials.push_back(bakedMaterial);
+    }
+
+    std::map<const Node*, int32_t> nodeIndices;
+    for (size_t i = 0; i < linearNodes.size(); i++) {
+        nodeIndices[linearNodes[i]] = static_cast<int32_t>(i);
+    }
+    std::vector<SceneFormat::Node> bakedNodes;
+    std::vector<SceneFormat::Mesh> bakedMeshes;
+    std::vector<SceneFormat::Lod> bakedLods;
+    for (Node* node : linearNodes) {
+        SceneFormat::Node bakedNode{};
+        bakedNode.parent = (node->parent == rootNode) ? -1 : nodeIndices[node->parent];
+        bakedNode.firstMesh = static_cast<uint32_t>(bakedMeshes.size());
+        memcpy(bakedNode.matrix, glm::value_ptr(node->matrix), sizeof(bakedNode.matrix));
+        if (node->geo) {
+            for (auto* mesh : node->geo->meshes) {
+                SceneFormat::Mesh bakedMesh{};
+                bakedMesh.firstIndex = mesh->firstIndex;
+                bakedMesh.indexCount = mesh->indexCount;
+                bakedMesh.firstVertex = mesh->firstVertex;
+                bakedMesh.vertexCount = mesh->vertexCount;
+                bakedMesh.material = materialIndices[mesh->material];
+                bakedMesh.firstLod = static_cast<uint32_t>(bakedLods.size());
+                bakedMesh.lodCount = static_cast<uint32_t>(mesh->lods.size());
+                bakedMesh.hasDimensions = (mesh->vertexCount > 0) ? 1 : 0;
+                memcpy(bakedMesh.min, glm::value_ptr(mesh->dimensions.min), sizeof(bakedMesh.min));
+                memcpy(bakedMesh.max, glm::value_ptr(mesh->dimensions.max), sizeof(bakedMesh.max));
+                for (auto& lod : mesh->lods) {
+                    bakedLods.push_back({ lod.firstIndex, lod.indexCount, lod.error });
+                }
+                bakedMeshes.push_back(bakedMesh);
+            }
+            bakedNode.meshCount = static_cast<uint32_t>(node->geo->meshes.size());
+        }
+        bakedNodes.push_back(bakedNode);
+    }
+
+    const std::shared_ptr<void> indexData = createUploadIndices();
+    const std::shared_ptr<void> positionData = createPositions();
+    header.indexType = indices.type;
+    header.vertexCount = static_cast<uint32_t>(vertexBuffer.size());
+    header.indexCount = static_cast<uint32_t>(indexBuffer.size());
+    header.nodeCount = static_cast<uint32_t>(bakedNodes.size());
+    header.meshCount = static_cast<uint32_t>(bakedMeshes.size());
+    header.lodCount = static_cast<uint32_t>(bakedLods.size());
+    header.materialCount = static_cast<uint32_t>(bakedMaterials.size());
+
+    // Every table and blob starts at an aligned offset after the header
+    struct Block {
+        SceneFormat::Range* range;
+        const void* data;
+    };
+    const Block blocks[] = {
+        { &header.nodes, bakedNodes.data() },
+        { &header.meshes, bakedMeshes.data() },
+        { &header.lods, bakedLods.data() },
+        { &header.materials, bakedMaterials.data() },
+        { &header.strings, strings.data() },
+        { &header.vertices, vertexBuffer.data() },
+        { &header.positions, positionData.get() },
+        { &header.indices, indexData.get() },
+        { &header.hostIndices, indexBuffer.data() },
+        { &header.images, images.data() },
+    };
+    header.nodes.size = bakedNodes.size() * sizeof(SceneFormat::Node);
+    header.meshes.size = bakedMeshes.size() * sizeof(SceneFormat::Mesh);
+    header.lods.size = bakedLods.size() * sizeof(SceneFormat::Lod);
+    header.materials.size = bakedMaterials.size() * sizeof(SceneFormat::Material);
+    header.strings.size = strings.size();
+    header.vertices.size = vertexBuffer.size() * sizeof(Vertex);
+    header.positions.size = vertexBuffer.size() * sizeof(glm::vec3);
+    header.indices.size = indexBuffer.size() * ((indices.type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t));
+    header.hostIndices.size = indexBuffer.size() * sizeof(uint32_t);
+    header.images.size = images.size();
+    uint64_t offset = alignOffset(sizeof(header));
+    for (auto& block : blocks) {
+        block.range->offset = offset;
+        offset = alignOffset(offset + block.range->size);
+    }
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        error = "Could not create " + filename;
+        return false;
+    }
+    const char padding[SceneFormat::alignment] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+    for (auto& block : blocks) {
+        out.write(padding, static_cast<std::streamsize>(block.range->offset - position));
+        out.write(static_cast<const char*>(block.data), static_cast<std::streamsize>(block.range->size));
+        position = block.range->offset + block.range->size;
+    }
+    // Empty blocks at the end point to the aligned end of the file
+    out.write(padding, static_cast<std::streamsize>(offset - position));
+    if (!out.good()) {
+        error = "Could not write " + filename;
+        return false;
+    }
+    return true;
+}
+
+/**
+* Bind the vertex and index buffers for all following draws of the model
+*
+* @param renderFlags RenderFlags::PositionsOnly binds the position-only stream, has to match the flags passed to draw
+*/
+void Model::bindBuffers(VkCommandBuffer commandBuffer, uint32_t renderFlags)
 {
     const VkDeviceSize offsets[1] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, (renderFlags & RenderFlags::PositionsOnly) ? &positions.buffer : &vertices.buffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indices.type);
     buffersBound = true;
 }
 
-void Model::drawNode(Node *node, VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet)
+void Model::drawNode(Node *node, VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t frameIndex)
 {
     if (node->geo) {
         if (renderFlags & RenderFlags::RenderAnimation) {
-            // descriptorset of jointMatrices put in set 2
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &node->geo->uniformBuffer.descriptorSet, 0, nullptr);
+            // Node matrix in set 2
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &node->geo->uniformBuffers[frameIndex].descriptorSet, 0, nullptr);
         }
 
         for (auto* mesh : node->geo->meshes) {
@@ -1308,35 +2387,78 @@ void Model::drawNode(Node *node, VkCommandBuffer commandBuffer, uint32_t renderF
                 if (renderFlags & RenderFlags::BindImages) {
                     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &material->descriptorSet, 0, nullptr);
                 }
+                if (renderFlags & RenderFlags::PushQuantization) {
+                    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, quantizationPushConstantOffset, sizeof(Mesh::Quantization), &mesh->quantization);
+                }
 
-                vkCmdDrawIndexed(commandBuffer, mesh->indexCount, 1, mesh->firstIndex, 0, 0);
+                const uint32_t firstIndex = (mesh->lod > 0) ? mesh->lods[mesh->lod - 1].firstIndex : mesh->firstIndex;
+                const uint32_t indexCount = (mesh->lod > 0) ? mesh->lods[mesh->lod - 1].indexCount : mesh->indexCount;
+                vkCmdDrawIndexed(commandBuffer, indexCount, 1, firstIndex, static_cast<int32_t>(mesh->firstVertex), 0);
             }
         }
     }
     for (auto& child : node->children) {
-        drawNode(child, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
+        drawNode(child, commandBuffer, renderFlags, pipelineLayout, bindImageSet, frameIndex);
     }
 }
 
-void Model::draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet)
+void Model::draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t frameIndex)
 {
-    if (!buffersBound) {
+    if (!buffersBound && !(renderFlags & RenderFlags::ExternalBuffers)) {
         const VkDeviceSize offsets[1] = {0};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-        vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, (renderFlags & RenderFlags::PositionsOnly) ? &positions.buffer : &vertices.buffer, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, indices.type);
     }
 
     if (rootNode) {
-        drawNode(rootNode, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
+        drawNode(rootNode, commandBuffer, renderFlags, pipelineLayout, bindImageSet, frameIndex);
+    }
+}
+
+/**
+* Select the level of detail of every mesh for a view
+*
+* The coarsest level whose error, projected at the closest point of the mesh bounding sphere, stays below threshold pixels is used.
+* Bounds and errors are in the space of their mesh, they are moved into model space with the world matrix of their node, and
+* scaled by its largest axis scale.
+*
+* @param viewPosition Camera position in model space
+* @param pixelsPerUnit Size in pixels of one unit at distance one, projection[1][1] * viewport height / 2 for a perspective projection
+* @param threshold Largest projected error in pixels, zero or less selects the full meshes
+* @return True if the level of any mesh changed, recorded draws have to be rebuilt
+*/
+bool Model::selectLods(const glm::vec3& viewPosition, float pixelsPerUnit, float threshold)
+{
+    bool changed = false;
+    for (Node* node : linearNodes) {
+        if (!node->geo) {
+            continue;
+        }
+        const glm::mat4 matrix = node->getMatrix();
+        const float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+        for (auto* mesh : node->geo->meshes) {
+            uint32_t lod = 0;
+            if ((threshold > 0.0f) && !mesh->lods.empty()) {
+                const glm::vec3 center = glm::vec3(matrix * glm::vec4(mesh->dimensions.center, 1.0f));
+                const float distance = std::max(glm::distance(viewPosition, center) - mesh->dimensions.radius * scale, 0.0f);
+                while ((lod < mesh->lods.size()) && (mesh->lods[lod].error * scale * pixelsPerUnit <= threshold * distance)) {
+                    lod++;
+                }
+            }
+            changed |= (lod != mesh->lod);
+            mesh->lod = lod;
+        }
     }
+    return changed;
 }
 
 void Model::getNodeDimensions(Node *node, glm::vec3 &min, glm::vec3 &max)
 {
     if (node->geo) {
+        const glm::mat4 matrix = node->getMatrix();
         for (auto* mesh : node->geo->meshes) {
-            glm::vec4 locMin = glm::vec4(mesh->dimensions.min, 1.0f) * node->getMatrix();
-            glm::vec4 locMax = glm::vec4(mesh->dimensions.max, 1.0f) * node->getMatrix();
+            glm::vec4 locMin = glm::vec4(mesh->dimensions.min, 1.0f) * matrix;
+            glm::vec4 locMax = glm::vec4(mesh->dimensions.max, 1.0f) * matrix;
             if (locMin.x < min.x) { min.x = locMin.x; }
             if (locMin.y < min.y) { min.y = locMin.y; }
             if (locMin.z < min.z) { min.z = locMin.z; }
@@ -1362,6 +2484,100 @@ void Model::getSceneDimensions()
     dimensions.radius = glm::distance(dimensions.min, dimensions.max) / 2.0f;
 }
 
+namespace
+{
+    glm::vec4 interpolateKeys(const glm::vec4& a, const glm::vec4& b, float u, bool rotation)
+    {
+        if (!rotation) {
+            return glm::mix(a, b, u);
+        }
+        const glm::quat q = glm::normalize(glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), u));
+        return glm::vec4(q.x, q.y, q.z, q.w);
+    }
+}
+
+/**
+* Find the key interval containing a time
+*
+* The interval of the last lookup and the one after it are tested first, so playing forward costs O(1). Seeks, loops
+* and playing backwards fall back to a binary search.
+*
+* @param time Has to be within [inputs.front(), inputs.back()], there have to be at least two keys
+* @return Index i of the interval [inputs[i], inputs[i + 1]]
+*/
+uint32_t AnimationSampler::findKey(float time)
+{
+    const uint32_t last = static_cast<uint32_t>(inputs.size()) - 2;
+    if ((cursor <= last) && (inputs[cursor] <= time)) {
+        if (time <= inputs[cursor + 1]) {
+            return cursor;
+        }
+        if ((cursor < last) && (time <= inputs[cursor + 2])) {
+            return ++cursor;
+        }
+    }
+    const auto next = std::upper_bound(inputs.begin(), inputs.end(), time);
+    const uint32_t key = static_cast<uint32_t>(std::max<ptrdiff_t>(next - inputs.begin() - 1, 0));
+    cursor = std::min(key, last);
+    return cursor;
+}
+
+/**
+* Interpolate the outputs at a time, linearly or with a spherical interpolation for rotations
+*
+* Resampled samplers compute the key from the time, the others look it up with findKey.
+*
+* @param time Has to be within [inputs.front(), inputs.back()], there have to be at least two keys
+*/
+glm::vec4 AnimationSampler::sample(float time, bool rotation)
+{
+    if (!uniformOutputs.empty()) {
+        const float position = (time - inputs.front()) * uniformRate;
+        const uint32_t key = std::min(static_cast<uint32_t>(std::max(position, 0.0f)), static_cast<uint32_t>(uniformOutputs.size()) - 2);
+        const float u = std::min(std::max(position - static_cast<float>(key), 0.0f), 1.0f);
+        return interpolateKeys(uniformOutputs[key], uniformOutputs[key + 1], u, rotation);
+    }
+    const uint32_t key = findKey(time);
+    const float duration = inputs[key + 1] - inputs[key];
+    const float u = (duration > 0.0f) ? std::min(std::max(time - inputs[key], 0.0f) / duration, 1.0f) : 0.0f;
+    return interpolateKeys(outputsVec4[key], outputsVec4[key + 1], u, rotation);
+}
+
+/**
+* Sample the keys at a uniform rate
+*
+* The rate is rounded up so the samples end exactly at the last key. Keys between two samples are lost, so the rate
+* should be at least that of the source clip.
+*
+* @param rate Samples per second
+* @param rotation The outputs are quaternions
+*/
+void AnimationSampler::resample(float rate, bool rotation)
+{
+    uniformOutputs.clear();
+    if ((inputs.size() < 2) || (outputsVec4.size() < inputs.size()) || (rate <= 0.0f)) {
+        return;
+    }
+    const float duration = inputs.back() - inputs.front();
+    if (duration <= 0.0f) {
+        return;
+    }
+    const uint32_t intervals = std::max(1u, static_cast<uint32_t>(std::ceil(duration * rate)));
+    uniformRate = static_cast<float>(intervals) / duration;
+    std::vector<glm::vec4> outputs(intervals + 1);
+    for (uint32_t i = 0; i <= intervals; i++) {
+        const float time = std::min(inputs.front() + static_cast<float>(i) / uniformRate, inputs.back());
+        outputs[i] = sample(time, rotation);
+    }
+    uniformOutputs.swap(outputs);
+}
+
+/**
+* Apply an animation at a time, which wraps around at the end of every sampler
+*
+* Samplers keep a cursor to their current key (AnimationSampler::findKey), so long clips cost O(1) per channel and
+* frame. The time is wrapped once for all samplers that last as long as the animation.
+*/
 void Model::updateAnimation(uint32_t index, float inTime)
 {
     if (index > static_cast<uint32_t>(animations.size()) - 1) {
@@ -1370,57 +2586,150 @@ void Model::updateAnimation(uint32_t index, float inTime)
     }
     auto* animation = animations[index];
 
+    const float animationTime = fmod(inTime, animation->end);
     bool updated = false;
     for (auto& channel : animation->channels) {
         AnimationSampler &sampler = animation->samplers[channel.samplerIndex];
-        if (sampler.inputs.size() > sampler.outputsVec4.size()) {
+        if ((sampler.inputs.size() < 2) || (sampler.inputs.size() > sampler.outputsVec4.size())) {
             continue;
         }
 
-        float time = fmod(inTime, sampler.inputs.back());
+        const float end = sampler.inputs.back();
+        const float time = (end == animation->end) ? animationTime : fmod(inTime, end);
+        if (!(time >= sampler.inputs.front()) || !(time <= end)) {
+            continue;
+        }
 
-        for (auto i = 0; i < sampler.inputs.size() - 1; i++) {
-            if ((time >= sampler.inputs[i]) && (time <= sampler.inputs[i + 1])) {
-                float u = std::max(0.0f, time - sampler.inputs[i]) / (sampler.inputs[i + 1] - sampler.inputs[i]);
-                if (u <= 1.0f) {
-                    switch (channel.path) {
-                        case AnimationChannel::PathType::TRANSLATION: {
-                            glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-                            channel.node->translation = glm::vec3(trans);
-                            break;
-                        }
-                        case AnimationChannel::PathType::SCALE: {
-                            glm::vec4 trans = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], u);
-                            channel.node->scale = glm::vec3(trans);
-                            break;
-                        }
-                        case AnimationChannel::PathType::ROTATION: {
-                            glm::quat q1;
-                            q1.x = sampler.outputsVec4[i].x;
-                            q1.y = sampler.outputsVec4[i].y;
-                            q1.z = sampler.outputsVec4[i].z;
-                            q1.w = sampler.outputsVec4[i].w;
-                            glm::quat q2;
-                            q2.x = sampler.outputsVec4[i + 1].x;
-                            q2.y = sampler.outputsVec4[i + 1].y;
-                            q2.z = sampler.outputsVec4[i + 1].z;
-                            q2.w = sampler.outputsVec4[i + 1].w;
-                            channel.node->rotation = glm::normalize(glm::slerp(q1, q2, u));
-                            break;
-                        }
-                    }
-                    updated = true;
-                }
-            }
+        const glm::vec4 value = sampler.sample(time, channel.path == AnimationChannel::PathType::ROTATION);
+        switch (channel.path) {
+            case AnimationChannel::PathType::TRANSLATION:
+                channel.node->translation = glm::vec3(value);
+                break;
+            case AnimationChannel::PathType::SCALE:
+                channel.node->scale = glm::vec3(value);
+                break;
+            case AnimationChannel::PathType::ROTATION:
+                channel.node->rotation = glm::quat(value.w, value.x, value.y, value.z);
+                break;
         }
+        channel.node->markDirty();
+        updated = true;
     }
     if (updated) {
-        for (auto &node : nodes) {
-            node->update();
+        updateTransforms();
+    }
+}
+
+void Model::resampleAnimations(float rate)
+{
+    for (auto* animation : animations) {
+        for (auto& channel : animation->channels) {
+            AnimationSampler& sampler = animation->samplers[channel.samplerIndex];
+            sampler.resample(rate, channel.path == AnimationChannel::PathType::ROTATION);
         }
     }
 }
 
+/**
+* Propagate changed node transforms top-down and rewrite the uniform blocks of the nodes whose world matrix changed
+*
+* The joint palettes of skinned nodes are rewritten if the node or one of its joints moved.
+*
+* The local transforms of the changed nodes are copied into transformBatch, which composes them and multiplies them by
+* their parents' world matrices for the whole hierarchy with its SIMD kernels. World matrices are only read back for
+* the changed nodes and their descendants. Has to be called once per frame after node transforms were changed
+* (markDirty).
+*
+* @return True if any world matrix changed
+*/
+bool Model::updateTransforms()
+{
+    bool dirty = false;
+    for (size_t i = 0; i < sortedNodes.size(); i++) {
+        const Node* node = sortedNodes[i];
+        if (node->dirty) {
+            const float rotation[4] = { node->rotation.x, node->rotation.y, node->rotation.z, node->rotation.w };
+            transformBatch.setTransform(i, glm::value_ptr(node->translation), rotation, glm::value_ptr(node->scale));
+            transformBatch.setMatrix(i, glm::value_ptr(node->matrix));
+            dirty = true;
+        }
+    }
+    if (!dirty) {
+        return false;
+    }
+    transformBatch.update();
+
+    bool changed = false;
+    for (size_t i = 0; i < sortedNodes.size(); i++) {
+        Node* node = sortedNodes[i];
+        const Node* parent = node->parent;
+        node->worldChanged = false;
+        if (!node->dirty && !(parent && parent->worldChanged)) {
+            continue;
+        }
+        node->dirty = false;
+        glm::mat4 world;
+        transformBatch.getWorldMatrix(i, glm::value_ptr(world));
+        if (world != node->worldMatrix) {
+            node->worldMatrix = world;
+            node->worldChanged = true;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return false;
+    }
+
+    // Skinned nodes also depend on their joints, which may come after them
+    for (Node* node : sortedNodes) {
+        bool update = node->worldChanged;
+        if (node->skin && !update) {
+            for (Node* joint : node->skin->joints) {
+                update |= joint->worldChanged;
+            }
+        }
+        if (update) {
+            node->updateUniformBuffer();
+            if (node->skin) {
+                updateJointPalette(node);
+            }
+        }
+    }
+    return true;
+}
+
+void Model::updateUniformBuffers(uint32_t frameIndex)
+{
+    for (Node* node : linearNodes) {
+        if (!node->geo || (frameIndex >= node->geo->uniformBuffers.size())) {
+            continue;
+        }
+        Geometry::UniformBuffer& uniformBuffer = node->geo->uniformBuffers[frameIndex];
+        if (uniformBuffer.revision != node->geo->revision) {
+            memcpy(uniformBuffer.mapped, &node->geo->uniformBlock, sizeof(node->geo->uniformBlock));
+            uniformBuffer.revision = node->geo->revision;
+        }
+    }
+}
+
+/**
+* Write the joint matrices of a skinned node to its range of jointMatrices
+*
+* Joint matrices are relative to the skinned node, so skinned vertices stay in the space of their mesh and are
+* transformed by the node matrix like those of meshes without a skin.
+*/
+void Model::updateJointPalette(Node* node)
+{
+    if (jointMatrices.empty()) {
+        return;
+    }
+    const Skin* skin = node->skin;
+    const glm::mat4 inverseNodeMatrix = glm::inverse(node->worldMatrix);
+    for (size_t i = 0; i < skin->joints.size(); i++) {
+        jointMatrices[skin->firstJoint + i] = inverseNodeMatrix * skin->joints[i]->worldMatrix * skin->inverseBindMatrices[i];
+    }
+}
+
 /*
 	Helper functions
 */
@@ -1451,24 +2760,66 @@ Node* Model::nodeFromIndex(uint32_t index) {
 
 void Model::prepareNodeDescriptor(Node* node, VkDescriptorSetLayout descriptorSetLayout) {
     if (node->geo) {
-        VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-        descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        descriptorSetAllocInfo.descriptorPool = descriptorPool;
-        descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-        descriptorSetAllocInfo.descriptorSetCount = 1;
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &node->geo->uniformBuffer.descriptorSet));
-
-        VkWriteDescriptorSet writeDescriptorSet{};
-        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        writeDescriptorSet.descriptorCount = 1;
-        writeDescriptorSet.dstSet = node->geo->uniformBuffer.descriptorSet;
-        writeDescriptorSet.dstBinding = 0;
-        writeDescriptorSet.pBufferInfo = &node->geo->uniformBuffer.descriptor;
-
-        vkUpdateDescriptorSets(device->logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+        node->geo->createUniformBuffers(frameCount);
+        for (auto& uniformBuffer : node->geo->uniformBuffers) {
+            VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+            descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            descriptorSetAllocInfo.descriptorPool = nodeDescriptorPool;
+            descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
+            descriptorSetAllocInfo.descriptorSetCount = 1;
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &uniformBuffer.descriptorSet));
+
+            VkWriteDescriptorSet writeDescriptorSet{};
+            writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            writeDescriptorSet.descriptorCount = 1;
+            writeDescriptorSet.dstSet = uniformBuffer.descriptorSet;
+            writeDescriptorSet.dstBinding = 0;
+            writeDescriptorSet.pBufferInfo = &uniformBuffer.descriptor;
+
+            vkUpdateDescriptorSets(device->logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+        }
     }
     for (auto& child : node->children) {
         prepareNodeDescriptor(child, descriptorSetLayout);
     }
 }
+
+/**
+* Create the uniform buffers of all nodes with meshes for frameCount frames, with their descriptor sets in a pool of their own
+*/
+void Model::prepareNodeUniformBuffers()
+{
+    uint32_t uboCount = 0;
+    for (auto node : linearNodes) {
+        if (node->geo) {
+            uboCount += frameCount;
+        }
+    }
+    if (uboCount == 0) {
+        return;
+    }
+    VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uboCount };
+    VkDescriptorPoolCreateInfo descriptorPoolCI{};
+    descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCI.poolSizeCount = 1;
+    descriptorPoolCI.pPoolSizes = &poolSize;
+    descriptorPoolCI.maxSets = uboCount;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &nodeDescriptorPool));
+    for (auto node : nodes) {
+        prepareNodeDescriptor(node, descriptorSetLayoutUbo);
+    }
+}
+
+void Model::setFrameCount(uint32_t frameCount)
+{
+    this->frameCount = frameCount;
+    for (auto node : linearNodes) {
+        if (node->geo) {
+            node->geo->destroyUniformBuffers();
+        }
+    }
+    vkDestroyDescriptorPool(device->logicalDevice, nodeDescriptorPool, nullptr);
+    nodeDescriptorPool = VK_NULL_HANDLE;
+    prepareNodeUniformBuffers();
+}
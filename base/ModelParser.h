@@ -8,9 +8,15 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.h"
+#include "VulkanAsyncUploader.h"
+#include "TransformBatch.h"
 
 #include <ktx.h>
 #include <ktxvulkan.h>
@@ -25,6 +31,8 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+class MappedFile;
+
 namespace MParser
 {
     enum DescriptorBindingFlags {
@@ -40,24 +48,117 @@ namespace MParser
 
     struct Node;
 
+    /** @brief Image data of a texture decoded on the host, ready to be uploaded */
+    struct TextureData {
+        /** @brief Owner of the decoded image, pixels points into it */
+        std::shared_ptr<void> data;
+        const void* pixels = nullptr;
+        VkDeviceSize size = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t width = 0, height = 0;
+        uint32_t mipLevels = 1;
+        std::vector<VkBufferImageCopy> regions;
+        /** @brief Only the first level is stored, the mip chain is generated on upload */
+        bool generateMipmaps = false;
+    };
+
+    /** @brief Image of a material slot as referenced by the scene, an external file or encoded data embedded in the scene */
+    struct TextureSource {
+        /** @brief Relative to the model folder for external files, empty for unused slots */
+        std::string fileName;
+        std::shared_ptr<const uint8_t> embeddedData;
+        size_t embeddedSize = 0;
+
+        TextureSource() {};
+        /** @brief The first texture of a type in an Assimp material, embedded data is copied so it outlives the scene */
+        TextureSource(const aiScene* scene, const aiMaterial* material, aiTextureType type);
+        bool used() const { return !fileName.empty(); }
+    };
+
     struct Texture {
         VulkanDevice* device = nullptr;
         VkImage image;
         VkImageLayout imageLayout;
         VkDeviceMemory deviceMemory;
+        Allocation allocation;
         VkImageView view;
         uint32_t width, height;
         uint32_t mipLevels;
+        /** @brief First level of the mip chain held by the image, non-zero while a streamed texture isn't fully resident */
+        uint32_t baseMipLevel = 0;
         uint32_t layerCount;
         VkDescriptorImageInfo descriptor;
         VkSampler sampler;
 
         void load(const aiScene* scene, std::string fileName, std::string filePath, VulkanDevice* device, VkQueue copyQueue);
+        /** @brief Create the texture and add its upload to a batch, the texture must not be used before the batch has been flushed or submitted and completed */
+        void load(const aiScene* scene, std::string fileName, std::string filePath, VulkanDevice* device, UploadBatch& uploadBatch);
+        static TextureData decode(const TextureSource& source, std::string filePath);
+        void create(const TextureData& textureData, VulkanDevice* device, UploadBatch& uploadBatch, uint32_t baseMipLevel = 0);
 
         void destroy();
 
     };
 
+    /**
+    * Refcounted cache of the textures loaded by models
+    *
+    * Textures are keyed by their resolved file path, or by a hash of the image data for textures embedded in
+    * the scene, so materials and models referencing the same image share one decode and upload. A cached texture
+    * is only handed out once the upload that created it has been published with the token to wait for.
+    */
+    class TextureCache {
+    public:
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            /** @brief Device memory that would have been allocated for duplicate textures */
+            VkDeviceSize vramSaved = 0;
+            uint32_t textureCount = 0;
+            VkDeviceSize residentBytes = 0;
+            /** @brief Host side load times of all textures added to the cache, decodes run in parallel so the sum exceeds the wall time */
+            double decodeMs = 0.0;
+            double uploadMs = 0.0;
+        };
+
+        /** @brief Host side load times of a texture, upload covers image creation and recording its upload */
+        struct LoadTiming {
+            std::string fileName;
+            double decodeMs;
+            double uploadMs;
+        };
+
+        static std::string key(const TextureSource& source, const std::string& filePath);
+        Texture* acquire(const std::string& key, UploadToken* uploadToken);
+        void add(const std::string& key, Texture* texture);
+        void addReference(Texture* texture);
+        void publish(const std::vector<Texture*>& textures, UploadToken uploadToken);
+        void release(Texture* texture);
+        void addLoadTiming(const LoadTiming& timing);
+
+        Stats getStats();
+        std::vector<LoadTiming> getLoadTimings();
+        void printStats();
+
+    private:
+        struct Entry {
+            std::string key;
+            uint32_t refCount;
+            UploadToken uploadToken;
+            bool published;
+            /** @brief Size accounted in the stats, the allocation of streamed textures changes over time */
+            VkDeviceSize size;
+        };
+        // All textures handed out by the cache, and the one texture that is shared per key
+        std::map<Texture*, Entry> entries;
+        std::map<std::string, Texture*> lookup;
+        std::vector<LoadTiming> loadTimings;
+        Stats stats;
+        std::mutex mutex;
+    };
+
+    extern TextureCache textureCache;
+
     struct Material {
         VulkanDevice* device = nullptr;
         
@@ -78,10 +179,18 @@ namespace MParser
 
         Texture* emptyTexture = nullptr;
 
+        /** @brief Images referenced by the scene, loaded into the texture slots by Model::loadMaterials */
+        TextureSource diffuseSource;
+        TextureSource normalSource;
+
         VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        /** @brief Second set of materials with streamed textures, TextureStreamer writes the new images to it and swaps it with descriptorSet */
+        VkDescriptorSet spareDescriptorSet = VK_NULL_HANDLE;
 
         Material(VulkanDevice* device, Texture* emptyTex) : device(device), emptyTexture(emptyTex) {};
-        void createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags);
+        void createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags, bool spare = false);
+        /** @brief Rewrite the image descriptors, e.g. after a streamed texture changed its image */
+        void updateDescriptorSet(uint32_t descriptorBindingFlags);
     };
 
     struct Mesh {
@@ -91,6 +200,12 @@ namespace MParser
         uint32_t vertexCount;
         Material* material;
 
+        /** @brief Dequantization of packed positions, pos = offset + scale * packedPos */
+        struct Quantization {
+            glm::vec4 offset = glm::vec4(0.0f);
+            glm::vec4 scale = glm::vec4(1.0f);
+        } quantization;
+
         struct Dimensions {
             glm::vec3 min = glm::vec3(FLT_MAX);
             glm::vec3 max = glm::vec3(-FLT_MAX);
@@ -99,7 +214,21 @@ namespace MParser
             float radius;
         } dimensions;
 
+        /** @brief Simplified index range sharing the vertices of the mesh */
+        struct Lod {
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            /** @brief Geometric error in model units, how far the simplified surface may deviate from the full mesh */
+            float error;
+        };
+        /** @brief Levels of detail from FileLoadingFlags::GenerateLods, coarser with every entry, their indices follow the ones of the mesh */
+        std::vector<Lod> lods;
+        /** @brief Level drawn by Model::drawNode, 0 is the full mesh and n is lods[n - 1] */
+        uint32_t lod = 0;
+
         void setDimensions(glm::vec3 min, glm::vec3 max);
+        /** @brief End of the indices of the mesh including its levels of detail */
+        uint32_t indexEnd() const;
 
         Mesh(uint32_t firstIndex, uint32_t indexCount, uint32_t firstVertex, uint32_t vertexCount, Material* material)
             : firstIndex(firstIndex),
@@ -117,20 +246,28 @@ namespace MParser
 
         struct UniformBuffer {
             VkBuffer buffer;
-            VkDeviceMemory memory;
+            Allocation allocation;
             VkDescriptorBufferInfo descriptor;
             VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-            void* mapped;
-        } uniformBuffer;
-
+            void* mapped = nullptr;
+            /** @brief Revision of uniformBlock the buffer holds */
+            uint32_t revision = 0;
+        };
+        /** @brief One uniform buffer per frame in flight (Model::frameCount), frames in flight keep reading their own copy */
+        std::vector<UniformBuffer> uniformBuffers;
+
+        /** @brief Joint matrices of skinned nodes are in Model::jointMatrices */
         struct UniformBlock {
             glm::mat4 matrix;
-            glm::mat4 jointMatrix[64]{};
-            float jointcount{ 0 };
         } uniformBlock;
+        /** @brief Incremented on every change of uniformBlock, Model::updateUniformBuffers rewrites the buffers holding an older one */
+        uint32_t revision = 1;
 
         Geometry(VulkanDevice* device, glm::mat4 matrix);
         ~Geometry();
+        /** @brief Create the uniform buffers initialized with uniformBlock, without a device (models imported for baking) none are created */
+        void createUniformBuffers(uint32_t count);
+        void destroyUniformBuffers();
     };
 
     /*
@@ -141,6 +278,8 @@ namespace MParser
         Node* skeletonRoot = nullptr;
         std::vector<glm::mat4> inverseBindMatrices;
         std::vector<Node*> joints;
+        /** @brief Offset of the skin's joint matrices in Model::jointMatrices */
+        uint32_t firstJoint = 0;
     };
 
     /*
@@ -150,17 +289,29 @@ namespace MParser
         Node* parent;
         uint32_t index;
         std::vector<Node*> children;
-        glm::mat4 matrix;
+        glm::mat4 matrix = glm::mat4(1.0f);
         std::string name;
         Geometry* geo;
         Skin* skin;
         int32_t skinIndex = -1;
+        /** @brief Changes to translation, scale, rotation or matrix have to be followed by markDirty() */
         glm::vec3 translation{};
         glm::vec3 scale{ 1.0f };
         glm::quat rotation{};
+
+        /** @brief World transform cached by Model::updateTransforms, zero until the first propagation so that always counts as a change */
+        glm::mat4 worldMatrix = glm::mat4(0.0f);
+        /** @brief The local transform changed since the last propagation */
+        bool dirty = true;
+        /** @brief The world matrix changed in the last propagation */
+        bool worldChanged = false;
+
         glm::mat4 localMatrix();
+        /** @brief World matrix, the cached one unless the node or one of its parents is dirty */
         glm::mat4 getMatrix();
-        void update();
+        void markDirty();
+        /** @brief Write the cached world matrix to the uniform block, the buffers of the frames are updated by Model::updateUniformBuffers */
+        void updateUniformBuffer();
         ~Node();
     };
 
@@ -182,6 +333,19 @@ namespace MParser
         InterpolationType interpolation;
         std::vector<float> inputs;
         std::vector<glm::vec4> outputsVec4;
+
+        /** @brief Key interval of the last lookup, playback usually stays in it or moves on to the next one */
+        uint32_t cursor = 0;
+        /** @brief Outputs at a uniform rate from inputs.front() to inputs.back(), empty unless resample() was called */
+        std::vector<glm::vec4> uniformOutputs;
+        float uniformRate = 0.0f;
+
+        /** @brief Index of the key interval containing time, which has to be within the inputs */
+        uint32_t findKey(float time);
+        /** @brief Interpolated output at a time within the inputs, rotations are interpolated as quaternions */
+        glm::vec4 sample(float time, bool rotation);
+        /** @brief Sample the keys at a uniform rate, so sample() computes the key of a time instead of looking it up */
+        void resample(float rate, bool rotation);
     };
 
     /*
@@ -216,6 +380,41 @@ namespace MParser
         static std::vector<VkVertexInputAttributeDescription> inputAttributeDescriptions(uint32_t binding, const std::vector<VertexComponent> components);
         /** @brief Returns the default pipeline vertex input state create info structure for the requested vertex components */
         static VkPipelineVertexInputStateCreateInfo* getPipelineVertexInputState(const std::vector<VertexComponent> components);
+        /** @brief Returns the pipeline vertex input state for the position-only stream (RenderFlags::PositionsOnly), the position is at location 0 */
+        static VkPipelineVertexInputStateCreateInfo* getPipelinePositionInputState();
+    };
+
+    /**
+    * Compact vertex layout of models loaded with FileLoadingFlags::PackVertices
+    *
+    * Only the components the layout was created with are stored, in the order given:
+    * - Position: R16G16B16A16_UNORM, quantized to the bounding box of the mesh, see Mesh::Quantization
+    * - Normal: R16G16_SNORM, octahedral encoding
+    * - Tangent: R16G16B16A16_SNORM, octahedral encoding in xy and the handedness in z
+    * - UV: R16G16_SFLOAT
+    * - Color, Weight0: R8G8B8A8_UNORM
+    * - Joint0: R8G8B8A8_UINT
+    * The decoding functions for the vertex shader are in data/shaders/base/packedvertex.glsl
+    */
+    struct PackedVertexLayout {
+        std::vector<VertexComponent> components;
+        /** @brief Byte offset of every component in the vertex, in the order of components */
+        std::vector<uint32_t> offsets;
+        uint32_t stride = 0;
+
+        VkVertexInputBindingDescription vertexInputBindingDescription;
+        std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
+        VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo;
+
+        PackedVertexLayout() {};
+        PackedVertexLayout(const std::vector<VertexComponent>& components);
+        static VkFormat componentFormat(VertexComponent component);
+        static uint32_t componentSize(VertexComponent component);
+        VkVertexInputBindingDescription inputBindingDescription(uint32_t binding) const;
+        /** @brief Attributes for a subset of the stored components, assigned to consecutive locations in the requested order */
+        std::vector<VkVertexInputAttributeDescription> inputAttributeDescriptions(uint32_t binding, const std::vector<VertexComponent> components) const;
+        VkPipelineVertexInputStateCreateInfo* getPipelineVertexInputState(const std::vector<VertexComponent> components);
+        void pack(const Vertex& vertex, const glm::vec3& offset, const glm::vec3& scale, uint8_t* destination) const;
     };
 
     enum FileLoadingFlags {
@@ -223,7 +422,15 @@ namespace MParser
         PreTransformVertices = 0x00000001,
         PreMultiplyVertexColors = 0x00000002,
         FlipY = 0x00000004,
-        DontLoadImages = 0x00000008
+        DontLoadImages = 0x00000008,
+        /** @brief Only upload the mip tail of material textures, higher levels are streamed in by textureStreamer */
+        StreamTextures = 0x00000010,
+        /** @brief Upload the vertices in the compact layout given by Model::packedVertexComponents */
+        PackVertices = 0x00000020,
+        /** @brief Simplify every triangle mesh into a chain of levels of detail, selected by Model::selectLods */
+        GenerateLods = 0x00000040,
+        /** @brief Always import with Assimp, even if a baked scene (SceneFormat) is found next to the file */
+        IgnoreBakedScene = 0x00000080
     };
 
     enum RenderFlags {
@@ -232,6 +439,12 @@ namespace MParser
         RenderAlphaMaskedNodes = 0x00000004,
         RenderAlphaBlendedNodes = 0x00000008,
         RenderAnimation = 0x00000010,
+        /** @brief Push the Mesh::Quantization of every mesh to the vertex stage, at Model::quantizationPushConstantOffset */
+        PushQuantization = 0x00000020,
+        /** @brief Bind the position-only vertex stream instead of the full vertices, for depth-only passes */
+        PositionsOnly = 0x00000040,
+        /** @brief Draw with the vertex and index buffers the caller has bound, e.g. with ComputeSkinning::bindBuffers */
+        ExternalBuffers = 0x00000080,
     };
 
     /*
@@ -241,25 +454,59 @@ namespace MParser
     private:
         Texture* getTexture(uint32_t index);
         Texture emptyTexture;
-        void createEmptyTexture(VkQueue transferQueue);
+        void createEmptyTexture(UploadBatch& uploadBatch);
 
         Node* rootNode;
+        /** @brief rootNode followed by linearNodes reversed, so every node comes after its parent */
+        std::vector<Node*> sortedNodes;
+        /** @brief Local transforms of sortedNodes, node i of the batch is sortedNodes[i] */
+        TransformBatch transformBatch;
+        void updateJointPalette(Node* node);
+
+        std::shared_ptr<MappedFile> openBakedScene(const std::string& filename, uint32_t fileLoadingFlags);
+        void loadBakedScene(const std::shared_ptr<MappedFile>& file);
+        std::shared_ptr<void> createUploadIndices();
+        std::shared_ptr<void> createPositions() const;
     public:
-        VulkanDevice* device;
+        VulkanDevice* device = nullptr;
         VkDescriptorPool descriptorPool;
+        /** @brief Descriptor sets of the node uniform buffers, recreated by setFrameCount */
+        VkDescriptorPool nodeDescriptorPool = VK_NULL_HANDLE;
+        /** @brief Frames that may be in flight, every node with meshes gets a uniform buffer per frame. Has to be set before loading, setFrameCount changes it afterwards */
+        uint32_t frameCount = 1;
 
         struct Vertices {
             uint32_t count;
+            /** @brief Size of a vertex in the buffer, sizeof(Vertex) unless the vertices are packed */
+            uint32_t stride = sizeof(Vertex);
             VkBuffer buffer;
-            VkDeviceMemory memory;
+            Allocation allocation;
         } vertices;
 
+        /** @brief Tightly packed copy of the vertex positions (vec3), depth-only passes fetch 12 bytes per vertex instead of the full vertex */
+        struct Positions {
+            VkBuffer buffer;
+            Allocation allocation;
+        } positions;
+
+        /** @brief Indices in the buffer are relative to the first vertex of their mesh, 16 bits wide unless a mesh couldn't be split */
         struct Indices {
             uint32_t count;
+            VkIndexType type = VK_INDEX_TYPE_UINT32;
             VkBuffer buffer;
-            VkDeviceMemory memory;
+            Allocation allocation;
         } indices;
 
+        /**
+        * Joint matrices of all skins, the palette of a skin starts at Skin::firstJoint
+        *
+        * Host only and rewritten by updateTransforms, ComputeSkinning copies them into the palette buffer of the frame it
+        * skins, so frames in flight keep reading their own pose. A joint matrix moves a vertex from its bind pose to the
+        * pose of the joint, in the space of the skinned node.
+        */
+        std::vector<glm::mat4> jointMatrices;
+
+        /** @brief Host copy of the indices, these index the whole vertexBuffer */
         std::vector<uint32_t> indexBuffer {};
         std::vector<Vertex> vertexBuffer {};
 
@@ -282,24 +529,69 @@ namespace MParser
 
         bool metallicRoughnessWorkflow = true;
         bool buffersBound = false;
+        /** @brief Material textures are managed by textureStreamer (FileLoadingFlags::StreamTextures) */
+        bool streamTextures = false;
+        /** @brief Meshes have levels of detail (FileLoadingFlags::GenerateLods) */
+        bool generateLods = false;
+        /** @brief Components stored with FileLoadingFlags::PackVertices, has to be set before loading and cover all pipelines the model is drawn with */
+        std::vector<VertexComponent> packedVertexComponents = { VertexComponent::Position, VertexComponent::Normal, VertexComponent::UV };
+        /** @brief Layout of the vertex buffer if the vertices are packed, pipelines get their vertex input state from it */
+        PackedVertexLayout packedLayout;
+        bool packedVertices = false;
+        /** @brief Push constant offset of the Mesh::Quantization pushed by RenderFlags::PushQuantization */
+        uint32_t quantizationPushConstantOffset = 0;
         std::string path;
+        /** @brief Token of the uploads issued by loadFromFileAsync, set on the loader thread and read by isReady() on the render thread */
+        std::atomic<UploadToken> uploadToken{ 0 };
+        /** @brief Latest upload token of the cached textures shared with other models */
+        UploadToken textureCacheToken = 0;
+
+        /** @brief FileLoadingFlags applied to the geometry before it is baked, a baked scene is only used if it was baked with the requested ones */
+        static const uint32_t bakedLoadingFlags = FileLoadingFlags::PreTransformVertices | FileLoadingFlags::PreMultiplyVertexColors | FileLoadingFlags::FlipY | FileLoadingFlags::GenerateLods;
 
         Model() {};
         ~Model();
-        void loadNode(const aiScene* scene, aiNode* node, Node* parent);
-//        void loadSkins(const aiScene* scene);
-        Texture* loadMaterialTexture(const aiScene* scene, const aiMaterial* mat, aiTextureType type, VkQueue queue) const;
-        void loadMaterials(const aiScene* scene, VkQueue transferQueue);
-//        void loadAnimations(const aiScene* scene);
+        /** @brief Assimp mesh of a node, converted by loadMeshes */
+        struct MeshImport {
+            Geometry* geometry;
+            const aiMesh* mesh;
+            /** @brief Joint of the node's skin every bone of the mesh is mapped to, set by loadSkins */
+            std::vector<uint32_t> boneJoints;
+        };
+        void loadNode(const aiScene* scene, aiNode* node, Node* parent, std::vector<MeshImport>& meshImports);
+        void loadMeshes(const std::vector<MeshImport>& meshImports);
+        void loadSkins(std::vector<MeshImport>& meshImports);
+        void importMaterials(const aiScene* scene);
+        void loadMaterials(UploadBatch& uploadBatch);
+        /** @brief Import the host side of a model with Assimp (nodes, meshes, materials, vertexBuffer and indexBuffer), doesn't need a device */
+        void importScene(std::string filename, uint32_t fileLoadingFlags = FileLoadingFlags::None);
+        bool saveBakedScene(const std::string& filename, const std::string& sourceFile, uint32_t fileLoadingFlags, std::string& error);
+        /** @brief Returns the path of the baked scene placed next to a model file */
+        static std::string bakedSceneFile(const std::string& filename);
+        void loadAnimations(const aiScene* scene);
         void loadFromFile(std::string filename, VulkanDevice* device, VkQueue transferQueue, uint32_t fileLoadingFlags = FileLoadingFlags::None);
-        void bindBuffers(VkCommandBuffer commandBuffer);
-        void drawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
-        void draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
+        void loadFromFile(std::string filename, VulkanDevice* device, UploadBatch& uploadBatch, uint32_t fileLoadingFlags = FileLoadingFlags::None);
+        void loadFromFileAsync(std::string filename, VulkanDevice* device, uint32_t fileLoadingFlags = FileLoadingFlags::None);
+        /** @brief Returns true once the uploads of loadFromFileAsync have completed and the model can be drawn */
+        bool isReady() const;
+        void bindBuffers(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0);
+        void drawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1, uint32_t frameIndex = 0);
+        /** @param frameIndex Frame whose node uniform buffers are bound with RenderFlags::RenderAnimation */
+        void draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1, uint32_t frameIndex = 0);
+        bool selectLods(const glm::vec3& viewPosition, float pixelsPerUnit, float threshold = 1.0f);
         void getNodeDimensions(Node* node, glm::vec3& min, glm::vec3& max);
         void getSceneDimensions();
         void updateAnimation(uint32_t index, float time);
+        /** @brief Resample all animation channels to a uniform rate (keys per second), for long clips with many keys */
+        void resampleAnimations(float rate);
+        bool updateTransforms();
+        /** @brief Copy the node matrices changed since the last update of a frame into its uniform buffers, the frame's command buffer must not be executing */
+        void updateUniformBuffers(uint32_t frameIndex);
+        /** @brief Recreate the node uniform buffers for a different number of frames in flight, none of them may be executing */
+        void setFrameCount(uint32_t frameCount);
         Node* findNode(Node* parent, uint32_t index);
         Node* nodeFromIndex(uint32_t index);
         void prepareNodeDescriptor(Node* node, VkDescriptorSetLayout descriptorSetLayout);
+        void prepareNodeUniformBuffers();
     };
 }
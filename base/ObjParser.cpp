@@ -0,0 +1,662 @@
+#include "ObjParser.h"
+#include "MappedFile.h"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define OBJ_PARSER_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace
+{
+    // Relative indices are resolved against the attributes parsed before them, which may lie in earlier chunks
+    const uint8_t relativePosition = 0x1;
+    const uint8_t relativeTexcoord = 0x2;
+    const uint8_t relativeNormal = 0x4;
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        std::vector<float> positions;
+        std::vector<float> texcoords;
+        std::vector<float> normals;
+        std::vector<ObjParser::Index> indices;
+        /** @brief Flags per face corner, relative indices are stored relative to the first attribute of the chunk */
+        std::vector<uint8_t> relative;
+        /** @brief usemtl statements with the first triangle of the chunk they apply to */
+        std::vector<std::pair<uint32_t, std::string>> materialChanges;
+        std::vector<std::string> libraries;
+        std::string error;
+        size_t errorLine = 0;
+    };
+
+    inline bool isSpace(char c)
+    {
+        return (c == ' ') || (c == '\t') || (c == '\r');
+    }
+
+    inline bool isDigit(char c)
+    {
+        return (c >= '0') && (c <= '9');
+    }
+
+    const char* skipSpace(const char* p, const char* end)
+    {
+        while ((p < end) && isSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    const char* parseInt(const char* p, const char* end, int32_t& value)
+    {
+        bool negative = false;
+        if ((p < end) && ((*p == '-') || (*p == '+'))) {
+            negative = (*p == '-');
+            p++;
+        }
+        int64_t result = 0;
+        while ((p < end) && isDigit(*p)) {
+            result = std::min<int64_t>(result * 10 + (*p - '0'), INT32_MAX);
+            p++;
+        }
+        value = static_cast<int32_t>(negative ? -result : result);
+        return p;
+    }
+
+    const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+#if defined(OBJ_PARSER_SSE2)
+    inline uint32_t bitScanForward(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+    }
+
+    /**
+    * Parse an unsigned decimal without exponent ("12.3456") that ends within the next 16 bytes
+    *
+    * All 16 bytes are classified as digits at once, the integer digits are moved one lane up over the decimal point
+    * so the digits are contiguous, and the lanes are summed with their powers of ten by three multiply-adds. This
+    * covers the fixed point numbers OBJ exporters write. The sum has at most 15 digits, so it is exact in a double
+    * and dividing it by a power of ten rounds exactly like the scalar path.
+    *
+    * @return End of the number, nullptr if it needs the scalar path (longer, exponent, no digits, end of the range)
+    */
+    const char* parseDecimal16(const char* p, const char* end, double& value)
+    {
+        if (end - p < 16) {
+            return nullptr;
+        }
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i digits = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+        const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_set1_epi8(-1)), _mm_cmplt_epi8(digits, _mm_set1_epi8(10)));
+        const uint32_t digitMask = static_cast<uint32_t>(_mm_movemask_epi8(isDigit));
+
+        const uint32_t integerDigits = bitScanForward(~digitMask);
+        uint32_t fractionDigits = 0;
+        uint32_t length = integerDigits;
+        if ((integerDigits < 16) && (p[integerDigits] == '.')) {
+            fractionDigits = bitScanForward(~(digitMask >> (integerDigits + 1)));
+            length = integerDigits + 1 + fractionDigits;
+        }
+        if ((length >= 16) || (integerDigits + fractionDigits == 0) || (p[length] == 'e') || (p[length] == 'E')) {
+            return nullptr;
+        }
+
+        // Lanes 1 to integerDigits take the integer digits, the fraction digits follow in place
+        const __m128i lane = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const __m128i integerLanes = _mm_cmplt_epi8(lane, _mm_set1_epi8(static_cast<char>(integerDigits + 1)));
+        const __m128i numberLanes = _mm_and_si128(_mm_cmpgt_epi8(lane, _mm_setzero_si128()), _mm_cmplt_epi8(lane, _mm_set1_epi8(static_cast<char>(integerDigits + fractionDigits + 1))));
+        __m128i number = _mm_or_si128(_mm_and_si128(integerLanes, _mm_slli_si128(digits, 1)), _mm_andnot_si128(integerLanes, digits));
+        number = _mm_and_si128(number, numberLanes);
+
+        // Lane i is worth 10^(15 - i): pairs, groups of four, then two groups of eight digits
+        const __m128i pairs0 = _mm_madd_epi16(_mm_unpacklo_epi8(number, _mm_setzero_si128()), _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1));
+        const __m128i pairs1 = _mm_madd_epi16(_mm_unpackhi_epi8(number, _mm_setzero_si128()), _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1));
+        const __m128i quads = _mm_madd_epi16(_mm_packs_epi32(pairs0, pairs1), _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+        const __m128i octs = _mm_madd_epi16(_mm_packs_epi32(quads, quads), _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+        const uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si32(octs)) * 100000000 + static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(octs, 4)));
+
+        value = static_cast<double>(sum) / powersOfTen[15 - integerDigits];
+        return p + length;
+    }
+#endif
+
+    // Rest of the line without surrounding white space
+    std::string lineArgument(const char* p, const char* end)
+    {
+        p = skipSpace(p, end);
+        while ((end > p) && isSpace(end[-1])) {
+            end--;
+        }
+        return std::string(p, end);
+    }
+
+    std::vector<std::string> splitArguments(const char* p, const char* end)
+    {
+        std::vector<std::string> arguments;
+        while (true) {
+            p = skipSpace(p, end);
+            if (p >= end) {
+                return arguments;
+            }
+            const char* start = p;
+            while ((p < end) && !isSpace(*p)) {
+                p++;
+            }
+            arguments.emplace_back(start, p);
+        }
+    }
+
+    // Resolve an OBJ index (one based, negative counts back from the last attribute) to a zero based one
+    bool resolveIndex(int32_t index, size_t localCount, uint8_t relativeFlag, int32_t& resolved, uint8_t& relative)
+    {
+        if (index > 0) {
+            resolved = index - 1;
+            return true;
+        }
+        if (index < 0) {
+            resolved = static_cast<int32_t>(localCount) + index;
+            relative |= relativeFlag;
+            return true;
+        }
+        return false;
+    }
+
+    void parseChunk(Chunk& chunk)
+    {
+        std::vector<ObjParser::Index> polygon;
+        std::vector<uint8_t> polygonRelative;
+        size_t line = 0;
+        const char* p = chunk.begin;
+        while (p < chunk.end) {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+            if (!lineEnd) {
+                lineEnd = chunk.end;
+            }
+            line++;
+            p = skipSpace(p, lineEnd);
+            if ((lineEnd - p >= 2) && (p[0] == 'v') && isSpace(p[1])) {
+                float v[3] = { 0.0f, 0.0f, 0.0f };
+                const char* q = p + 1;
+                for (uint32_t i = 0; i < 3; i++) {
+                    q = ObjParser::parseFloat(skipSpace(q, lineEnd), lineEnd, v[i]);
+                }
+                chunk.positions.insert(chunk.positions.end(), v, v + 3);
+            } else if ((lineEnd - p >= 3) && (p[0] == 'v') && (p[1] == 't') && isSpace(p[2])) {
+                float v[2] = { 0.0f, 0.0f };
+                const char* q = p + 2;
+                for (uint32_t i = 0; i < 2; i++) {
+                    q = ObjParser::parseFloat(skipSpace(q, lineEnd), lineEnd, v[i]);
+                }
+                chunk.texcoords.insert(chunk.texcoords.end(), v, v + 2);
+            } else if ((lineEnd - p >= 3) && (p[0] == 'v') && (p[1] == 'n') && isSpace(p[2])) {
+                float v[3] = { 0.0f, 0.0f, 0.0f };
+                const char* q = p + 2;
+                for (uint32_t i = 0; i < 3; i++) {
+                    q = ObjParser::parseFloat(skipSpace(q, lineEnd), lineEnd, v[i]);
+                }
+                chunk.normals.insert(chunk.normals.end(), v, v + 3);
+            } else if ((lineEnd - p >= 2) && (p[0] == 'f') && isSpace(p[1])) {
+                polygon.clear();
+                polygonRelative.clear();
+                const char* q = skipSpace(p + 1, lineEnd);
+                while (q < lineEnd) {
+                    ObjParser::Index corner = { -1, -1, -1 };
+                    uint8_t relative = 0;
+                    int32_t value = 0;
+                    q = parseInt(q, lineEnd, value);
+                    bool valid = resolveIndex(value, chunk.positions.size() / 3, relativePosition, corner.position, relative);
+                    if ((q < lineEnd) && (*q == '/')) {
+                        q++;
+                        if ((q < lineEnd) && (*q != '/')) {
+                            q = parseInt(q, lineEnd, value);
+                            valid &= resolveIndex(value, chunk.texcoords.size() / 2, relativeTexcoord, corner.texcoord, relative);
+                        }
+                        if ((q < lineEnd) && (*q == '/')) {
+                            q++;
+                            q = parseInt(q, lineEnd, value);
+                            valid &= resolveIndex(value, chunk.normals.size() / 3, relativeNormal, corner.normal, relative);
+                        }
+                    }
+                    if (!valid || ((q < lineEnd) && !isSpace(*q))) {
+                        chunk.error = "invalid face index";
+                        chunk.errorLine = line;
+                        return;
+                    }
+                    polygon.push_back(corner);
+                    polygonRelative.push_back(relative);
+                    q = skipSpace(q, lineEnd);
+                }
+                // Fan triangulation, as tinyobj's default
+                for (size_t i = 1; i + 1 < polygon.size(); i++) {
+                    const size_t corners[3] = { 0, i, i + 1 };
+                    for (size_t k : corners) {
+                        chunk.indices.push_back(polygon[k]);
+                        chunk.relative.push_back(polygonRelative[k]);
+                    }
+                }
+            } else if ((lineEnd - p >= 7) && (strncmp(p, "usemtl", 6) == 0) && isSpace(p[6])) {
+                chunk.materialChanges.emplace_back(static_cast<uint32_t>(chunk.indices.size() / 3), lineArgument(p + 6, lineEnd));
+            } else if ((lineEnd - p >= 7) && (strncmp(p, "mtllib", 6) == 0) && isSpace(p[6])) {
+                auto names = splitArguments(p + 6, lineEnd);
+                chunk.libraries.insert(chunk.libraries.end(), names.begin(), names.end());
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    inline uint32_t hashIndex(const ObjParser::Index& index)
+    {
+        // Multiplicative mixing of the three indices, finished with the murmur3 avalanche
+        uint32_t h = static_cast<uint32_t>(index.position) * 0x9e3779b1u;
+        h ^= static_cast<uint32_t>(index.texcoord) * 0x85ebca77u;
+        h ^= static_cast<uint32_t>(index.normal) * 0xc2b2ae3du;
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    inline bool equalIndex(const ObjParser::Index& a, const ObjParser::Index& b)
+    {
+        return (a.position == b.position) && (a.texcoord == b.texcoord) && (a.normal == b.normal);
+    }
+
+    // Open addressing table with linear probing from index triples to the first corner using them
+    class CornerTable
+    {
+    public:
+        explicit CornerTable(size_t expectedCount)
+        {
+            size_t capacity = 16;
+            while (capacity < expectedCount * 2) {
+                capacity *= 2;
+            }
+            slots.assign(capacity, emptySlot());
+        }
+
+        /** @brief Returns the first corner inserted with the same key, or corner itself if it is the first */
+        uint32_t insert(const ObjParser::Index& key, uint32_t hash, uint32_t corner)
+        {
+            if ((count + 1) * 10 > slots.size() * 7) {
+                grow();
+            }
+            const size_t mask = slots.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                Slot& slot = slots[i];
+                if (slot.corner == UINT32_MAX) {
+                    slot.key = key;
+                    slot.corner = corner;
+                    count++;
+                    return corner;
+                }
+                if (equalIndex(slot.key, key)) {
+                    return slot.corner;
+                }
+            }
+        }
+
+    private:
+        struct Slot {
+            ObjParser::Index key;
+            uint32_t corner;
+        };
+        std::vector<Slot> slots;
+        size_t count = 0;
+
+        static Slot emptySlot()
+        {
+            Slot slot;
+            slot.key = { -1, -1, -1 };
+            slot.corner = UINT32_MAX;
+            return slot;
+        }
+
+        void grow()
+        {
+            std::vector<Slot> previous(slots.size() * 2, emptySlot());
+            previous.swap(slots);
+            const size_t mask = slots.size() - 1;
+            for (const Slot& slot : previous) {
+                if (slot.corner == UINT32_MAX) {
+                    continue;
+                }
+                size_t i = hashIndex(slot.key) & mask;
+                while (slots[i].corner != UINT32_MAX) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+    };
+
+    void loadMaterialLibrary(const std::string& path, std::vector<ObjParser::Material>& materials)
+    {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cerr << "ObjParser: Could not open material library " << path << "\n";
+            return;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            const char* begin = line.data();
+            const char* end = begin + line.size();
+            auto arguments = splitArguments(begin, end);
+            if (arguments.size() < 2) {
+                continue;
+            }
+            const std::string& key = arguments[0];
+            // Texture statements may carry options in front of the file name
+            const std::string& fileName = arguments.back();
+            if (key == "newmtl") {
+                materials.emplace_back();
+                materials.back().name = lineArgument(strstr(begin, "newmtl") + 6, end);
+            } else if (materials.empty()) {
+                continue;
+            } else if (key == "map_Kd") {
+                materials.back().diffuseTexture = fileName;
+            } else if (key == "norm") {
+                materials.back().normalTexture = fileName;
+            } else if ((key == "map_Bump") || (key == "map_bump") || (key == "bump")) {
+                materials.back().bumpTexture = fileName;
+            }
+        }
+    }
+}
+
+namespace ObjParser
+{
+    /**
+    * Parse a floating point number in decimal or scientific notation
+    *
+    * Up to 19 significant digits are accumulated in an integer and scaled by a power of ten once, which is exact
+    * for the short decimals OBJ exporters write. With SSE2, decimals that end within 16 bytes take parseDecimal16
+    * instead of the loop over the characters. Other input (inf, nan, hex) falls back to strtod.
+    */
+    const char* parseFloat(const char* p, const char* end, float& value)
+    {
+        const char* start = p;
+        bool negative = false;
+        if ((p < end) && ((*p == '-') || (*p == '+'))) {
+            negative = (*p == '-');
+            p++;
+        }
+#if defined(OBJ_PARSER_SSE2)
+        double decimal;
+        const char* decimalEnd = parseDecimal16(p, end, decimal);
+        if (decimalEnd) {
+            value = static_cast<float>(negative ? -decimal : decimal);
+            return decimalEnd;
+        }
+#endif
+        uint64_t mantissa = 0;
+        int32_t exponent = 0;
+        uint32_t significantDigits = 0;
+        bool anyDigits = false;
+        while ((p < end) && isDigit(*p)) {
+            anyDigits = true;
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits += (mantissa != 0) ? 1 : 0;
+            } else {
+                exponent++;
+            }
+            p++;
+        }
+        if ((p < end) && (*p == '.')) {
+            p++;
+            while ((p < end) && isDigit(*p)) {
+                anyDigits = true;
+                if (significantDigits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    significantDigits += (mantissa != 0) ? 1 : 0;
+                    exponent--;
+                }
+                p++;
+            }
+        }
+        if (!anyDigits) {
+            // Not a plain decimal, strtod needs a terminated string
+            char buffer[64];
+            const size_t length = std::min<size_t>(end - start, sizeof(buffer) - 1);
+            memcpy(buffer, start, length);
+            buffer[length] = '\0';
+            char* parsedEnd = nullptr;
+            value = static_cast<float>(strtod(buffer, &parsedEnd));
+            return start + (parsedEnd - buffer);
+        }
+        if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+            int32_t exponentValue = 0;
+            p = parseInt(p + 1, end, exponentValue);
+            exponent += exponentValue;
+        }
+        double result = static_cast<double>(mantissa);
+        if ((exponent >= 0) && (exponent <= 22)) {
+            result *= powersOfTen[exponent];
+        } else if ((exponent < 0) && (exponent >= -22)) {
+            result /= powersOfTen[-exponent];
+        } else {
+            result *= std::pow(10.0, static_cast<double>(exponent));
+        }
+        value = static_cast<float>(negative ? -result : result);
+        return p;
+    }
+
+    bool load(const std::string& path, ObjData& data, std::string& error)
+    {
+        MappedFile file(path);
+        if (!file.valid) {
+            error = "Could not open " + path;
+            return false;
+        }
+
+        // Chunks of at least 1 MiB, a few per worker so uneven lines balance out
+        ThreadPool& pool = ThreadPool::shared();
+        const size_t minChunkSize = 1 << 20;
+        const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(file.size / minChunkSize, pool.threadCount() * 4));
+        std::vector<Chunk> chunks(chunkCount);
+        const char* fileEnd = file.data + file.size;
+        const char* begin = file.data;
+        for (size_t i = 0; i < chunkCount; i++) {
+            const char* end = (i + 1 == chunkCount) ? fileEnd : file.data + file.size / chunkCount * (i + 1);
+            // Move the split behind the next line break
+            if ((end < fileEnd) && (end > begin)) {
+                const char* lineBreak = static_cast<const char*>(memchr(end, '\n', fileEnd - end));
+                end = lineBreak ? lineBreak + 1 : fileEnd;
+            }
+            end = std::max(end, begin);
+            chunks[i].begin = begin;
+            chunks[i].end = end;
+            begin = end;
+        }
+
+        pool.parallelFor(chunkCount, [&chunks](size_t i) {
+            parseChunk(chunks[i]);
+        });
+
+        // Offsets of every chunk in the merged arrays, lines are numbered per chunk while parsing
+        size_t lineOffset = 0;
+        std::vector<size_t> positionOffsets(chunkCount + 1, 0);
+        std::vector<size_t> texcoordOffsets(chunkCount + 1, 0);
+        std::vector<size_t> normalOffsets(chunkCount + 1, 0);
+        std::vector<size_t> indexOffsets(chunkCount + 1, 0);
+        for (size_t i = 0; i < chunkCount; i++) {
+            const Chunk& chunk = chunks[i];
+            if (!chunk.error.empty()) {
+                error = path + ":" + std::to_string(lineOffset + chunk.errorLine) + ": " + chunk.error;
+                return false;
+            }
+            lineOffset += std::count(chunk.begin, chunk.end, '\n');
+            positionOffsets[i + 1] = positionOffsets[i] + chunk.positions.size();
+            texcoordOffsets[i + 1] = texcoordOffsets[i] + chunk.texcoords.size();
+            normalOffsets[i + 1] = normalOffsets[i] + chunk.normals.size();
+            indexOffsets[i + 1] = indexOffsets[i] + chunk.indices.size();
+        }
+
+        // Material libraries in order of their first mention
+        data.materials.clear();
+        std::vector<std::string> libraries;
+        for (const Chunk& chunk : chunks) {
+            for (const auto& library : chunk.libraries) {
+                if (std::find(libraries.begin(), libraries.end(), library) == libraries.end()) {
+                    libraries.push_back(library);
+                }
+            }
+        }
+        const std::string folder = path.substr(0, path.find_last_of("/\\") + 1);
+        for (const auto& library : libraries) {
+            loadMaterialLibrary(folder + library, data.materials);
+        }
+        std::map<std::string, int32_t> materialIds;
+        for (size_t i = 0; i < data.materials.size(); i++) {
+            materialIds.emplace(data.materials[i].name, static_cast<int32_t>(i));
+        }
+        auto materialId = [&materialIds](const std::string& name) {
+            auto it = materialIds.find(name);
+            return (it != materialIds.end()) ? it->second : -1;
+        };
+        // Material active at the start of every chunk, carried over from the last usemtl before it
+        std::vector<int32_t> initialMaterials(chunkCount, -1);
+        for (size_t i = 1; i < chunkCount; i++) {
+            const Chunk& previous = chunks[i - 1];
+            initialMaterials[i] = previous.materialChanges.empty() ? initialMaterials[i - 1] : materialId(previous.materialChanges.back().second);
+        }
+
+        data.positions.resize(positionOffsets.back());
+        data.texcoords.resize(texcoordOffsets.back());
+        data.normals.resize(normalOffsets.back());
+        data.indices.resize(indexOffsets.back());
+        data.materialIds.resize(indexOffsets.back() / 3);
+        std::vector<uint8_t> invalid(chunkCount, 0);
+        pool.parallelFor(chunkCount, [&](size_t i) {
+            Chunk& chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), data.positions.begin() + positionOffsets[i]);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), data.texcoords.begin() + texcoordOffsets[i]);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + normalOffsets[i]);
+
+            const int32_t positionBase = static_cast<int32_t>(positionOffsets[i] / 3);
+            const int32_t texcoordBase = static_cast<int32_t>(texcoordOffsets[i] / 2);
+            const int32_t normalBase = static_cast<int32_t>(normalOffsets[i] / 3);
+            const int32_t positionCount = static_cast<int32_t>(data.positions.size() / 3);
+            const int32_t texcoordCount = static_cast<int32_t>(data.texcoords.size() / 2);
+            const int32_t normalCount = static_cast<int32_t>(data.normals.size() / 3);
+            Index* destination = data.indices.data() + indexOffsets[i];
+            for (size_t c = 0; c < chunk.indices.size(); c++) {
+                Index index = chunk.indices[c];
+                const uint8_t relative = chunk.relative[c];
+                index.position += (relative & relativePosition) ? positionBase : 0;
+                index.texcoord += (relative & relativeTexcoord) ? texcoordBase : 0;
+                index.normal += (relative & relativeNormal) ? normalBase : 0;
+                if ((index.position < 0) || (index.position >= positionCount) || (index.texcoord >= texcoordCount) || (index.normal >= normalCount)
+                    || (index.texcoord < -1) || (index.normal < -1)) {
+                    invalid[i] = 1;
+                }
+                destination[c] = index;
+            }
+
+            int32_t* triangleMaterials = data.materialIds.data() + indexOffsets[i] / 3;
+            const uint32_t triangleCount = static_cast<uint32_t>(chunk.indices.size() / 3);
+            int32_t material = initialMaterials[i];
+            size_t change = 0;
+            for (uint32_t t = 0; t < triangleCount; t++) {
+                while ((change < chunk.materialChanges.size()) && (chunk.materialChanges[change].first == t)) {
+                    material = materialId(chunk.materialChanges[change].second);
+                    change++;
+                }
+                triangleMaterials[t] = material;
+            }
+
+            // Release the chunk's arrays early, large scans would otherwise hold everything twice
+            chunk = Chunk();
+        });
+        if (std::find(invalid.begin(), invalid.end(), 1) != invalid.end()) {
+            error = path + ": face index out of range";
+            return false;
+        }
+        return true;
+    }
+
+    void deduplicate(const Index* corners, size_t cornerCount, Deduplication& result, bool parallel)
+    {
+        assert(cornerCount < UINT32_MAX);
+        // Corner that first used the key of every corner, the vertices are numbered from those in corner order
+        std::vector<uint32_t> firstCorners(cornerCount);
+        ThreadPool& pool = ThreadPool::shared();
+        const uint32_t partitionBits = 4;
+        if (!parallel || (pool.threadCount() < 2) || (cornerCount < (1u << 16))) {
+            // Meshes share most vertices between about six triangles, sizing for a quarter of the corners avoids most rehashes
+            CornerTable table(cornerCount / 4);
+            for (size_t c = 0; c < cornerCount; c++) {
+                firstCorners[c] = table.insert(corners[c], hashIndex(corners[c]), static_cast<uint32_t>(c));
+            }
+        } else {
+            // Partition by the top bits of the hash, so every key lives in exactly one table, corners stay sorted within a partition
+            const uint32_t partitionCount = 1u << partitionBits;
+            std::vector<uint32_t> hashes(cornerCount);
+            const size_t blockSize = 1 << 16;
+            const size_t blockCount = (cornerCount + blockSize - 1) / blockSize;
+            pool.parallelFor(blockCount, [&](size_t block) {
+                const size_t end = std::min(cornerCount, (block + 1) * blockSize);
+                for (size_t c = block * blockSize; c < end; c++) {
+                    hashes[c] = hashIndex(corners[c]);
+                }
+            });
+            std::vector<size_t> partitionOffsets(partitionCount + 1, 0);
+            for (size_t c = 0; c < cornerCount; c++) {
+                partitionOffsets[(hashes[c] >> (32 - partitionBits)) + 1]++;
+            }
+            for (uint32_t p = 0; p < partitionCount; p++) {
+                partitionOffsets[p + 1] += partitionOffsets[p];
+            }
+            std::vector<uint32_t> partitioned(cornerCount);
+            {
+                std::vector<size_t> fill(partitionOffsets.begin(), partitionOffsets.end() - 1);
+                for (size_t c = 0; c < cornerCount; c++) {
+                    partitioned[fill[hashes[c] >> (32 - partitionBits)]++] = static_cast<uint32_t>(c);
+                }
+            }
+            pool.parallelFor(partitionCount, [&](size_t p) {
+                CornerTable table((partitionOffsets[p + 1] - partitionOffsets[p]) / 4);
+                for (size_t i = partitionOffsets[p]; i < partitionOffsets[p + 1]; i++) {
+                    const uint32_t c = partitioned[i];
+                    firstCorners[c] = table.insert(corners[c], hashes[c], c);
+                }
+            });
+        }
+
+        result.cornerVertices.resize(cornerCount);
+        result.vertexCorners.clear();
+        for (size_t c = 0; c < cornerCount; c++) {
+            if (firstCorners[c] == c) {
+                result.cornerVertices[c] = static_cast<uint32_t>(result.vertexCorners.size());
+                result.vertexCorners.push_back(static_cast<uint32_t>(c));
+            } else {
+                // The first corner precedes this one, so its vertex is already numbered
+                result.cornerVertices[c] = result.cornerVertices[firstCorners[c]];
+            }
+        }
+    }
+}
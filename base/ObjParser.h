@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+* Wavefront OBJ/MTL reader for large scans
+*
+* The file is memory mapped and split into line aligned chunks that are parsed on the shared thread pool. The chunks
+* are merged in file order, so the result doesn't depend on the thread count or scheduling. Relative (negative)
+* indices and usemtl statements spanning chunk borders are resolved during the merge.
+*
+* Supported statements: v, vt, vn, f (polygons are fan triangulated), usemtl, mtllib. Everything else is skipped.
+*/
+namespace ObjParser
+{
+    /** @brief Zero based attribute indices of a face corner, -1 if the attribute is not given */
+    struct Index {
+        int32_t position;
+        int32_t texcoord;
+        int32_t normal;
+    };
+
+    struct Material {
+        std::string name;
+        /** @brief Texture file names as written in the MTL file, relative to its folder */
+        std::string diffuseTexture;
+        std::string normalTexture;
+        std::string bumpTexture;
+    };
+
+    struct ObjData {
+        /** @brief xyz per position */
+        std::vector<float> positions;
+        /** @brief uv per texture coordinate */
+        std::vector<float> texcoords;
+        /** @brief xyz per normal */
+        std::vector<float> normals;
+        /** @brief Three corners per triangle */
+        std::vector<Index> indices;
+        /** @brief Index into materials per triangle, -1 for faces without a (known) material */
+        std::vector<int32_t> materialIds;
+        std::vector<Material> materials;
+    };
+
+    /** @brief Unique vertices of a list of face corners */
+    struct Deduplication {
+        /** @brief Vertex of every corner */
+        std::vector<uint32_t> cornerVertices;
+        /** @brief First corner of every vertex, vertices are numbered in order of first use */
+        std::vector<uint32_t> vertexCorners;
+    };
+
+    /**
+    * Parse an OBJ file and the MTL libraries it references
+    *
+    * @param error Receives the reason if the file can't be read or has invalid indices
+    * @return False on failure
+    * @note Blocks until the worker jobs completed, so it must not be called from a job of ThreadPool::shared()
+    */
+    bool load(const std::string& path, ObjData& data, std::string& error);
+
+    /**
+    * Find the unique vertices of a list of face corners by their index triple
+    *
+    * Corners are equal if they reference the same position, texture coordinate and normal, so no attribute values are
+    * hashed or compared. Uses a flat open addressing table. The parallel mode partitions the corners by hash and builds
+    * one table per partition on the shared thread pool, the result is identical to the serial one.
+    *
+    * @note The parallel mode blocks on the thread pool, so it must not be used from a job of ThreadPool::shared()
+    */
+    void deduplicate(const Index* corners, size_t cornerCount, Deduplication& result, bool parallel = false);
+
+    /** @brief Parse a decimal floating point number, returns the position after it */
+    const char* parseFloat(const char* p, const char* end, float& value);
+}
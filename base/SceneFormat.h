@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+* Baked scene files (.vlscene) written by tools/scene_baker and loaded by MParser::Model without Assimp
+*
+* A baked file holds a model in the form it is uploaded in, after mesh optimization, 16-bit splitting and LOD
+* generation, so loading it is a memory map and a few block copies. All tables and blobs are at the offsets given by
+* the header, aligned to 16 bytes:
+* - nodes, in the order of Model::linearNodes, children come before their parent
+* - meshes, consecutive per node
+* - lods, consecutive per mesh
+* - materials, with their texture references
+* - strings, texture file names referenced by offset and size
+* - vertices (MParser::Vertex), positions (vec3) and upload indices (relative to their mesh, 16 or 32 bit)
+* - host indices (32 bit, into the whole vertex blob) for Model::indexBuffer
+* - images, the encoded data of textures embedded in the source scene
+*
+* Skins and animations are not stored, scenes that have them are always imported with Assimp.
+* The file stores the size and modification time of the source it was baked from, a file is stale once they differ.
+* Values are stored in host byte order, baked files are not meant to be moved between platforms.
+*/
+namespace SceneFormat
+{
+    /** @brief "VLSC" */
+    const uint32_t magic = 0x43534c56;
+    /** @brief Has to be raised whenever the layout of the file or of MParser::Vertex changes */
+    const uint32_t version = 1;
+    const uint64_t alignment = 16;
+    const char* const extension = ".vlscene";
+
+    struct Range {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        /** @brief sizeof(MParser::Vertex) at bake time */
+        uint32_t vertexSize;
+        /** @brief The MParser::FileLoadingFlags that change the geometry (Model::bakedLoadingFlags) the scene was baked with */
+        uint32_t fileLoadingFlags;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        /** @brief VkIndexType of the upload indices */
+        uint32_t indexType;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t nodeCount;
+        uint32_t meshCount;
+        uint32_t lodCount;
+        uint32_t materialCount;
+        uint32_t reserved;
+        Range nodes;
+        Range meshes;
+        Range lods;
+        Range materials;
+        Range strings;
+        Range vertices;
+        Range positions;
+        Range indices;
+        Range hostIndices;
+        Range images;
+    };
+
+    struct Node {
+        /** @brief Index of the parent node, -1 for the children of the root */
+        int32_t parent;
+        uint32_t firstMesh;
+        /** @brief Nodes without meshes have no geometry */
+        uint32_t meshCount;
+        uint32_t reserved;
+        /** @brief Column major local matrix */
+        float matrix[16];
+    };
+
+    struct Mesh {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t material;
+        uint32_t firstLod;
+        uint32_t lodCount;
+        /** @brief Zero for meshes without vertices, their bounds are left unset */
+        uint32_t hasDimensions;
+        float min[3];
+        float max[3];
+    };
+
+    struct Lod {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float error;
+    };
+
+    /** @brief Image of a material slot, the name is empty for unused slots */
+    struct TextureReference {
+        uint32_t nameOffset;
+        uint32_t nameSize;
+        /** @brief Encoded image in the images blob if it was embedded in the scene, size is zero for external files */
+        uint64_t imageOffset;
+        uint64_t imageSize;
+    };
+
+    struct Material {
+        uint32_t alphaMode;
+        float alphaCutoff;
+        float metallicFactor;
+        float roughnessFactor;
+        float baseColorFactor[4];
+        TextureReference diffuseTexture;
+        TextureReference normalTexture;
+    };
+}
@@ -0,0 +1,442 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace MParser;
+
+TextureStreamer MParser::textureStreamer;
+
+namespace
+{
+    // Textures of a material that can be streamed, in descriptor binding order
+    std::vector<Texture*> materialTextures(const Material* material)
+    {
+        std::vector<Texture*> textures;
+        for (Texture* texture : { material->diffuseTexture, material->normalTexture, material->occlusionTexture,
+                                  material->metallicRoughnessTexture, material->emissiveTexture, material->specularGlossinessTexture }) {
+            if (texture && (std::find(textures.begin(), textures.end(), texture) == textures.end())) {
+                textures.push_back(texture);
+            }
+        }
+        return textures;
+    }
+}
+
+/**
+* Generate the mip chain of an image whose levels would otherwise be generated on the device
+*
+* Streaming uploads arbitrary level ranges, so all levels have to be available on the host.
+* Levels are box filtered, odd sizes clamp the last row/column.
+*
+* @return Image data with all levels stored, or textureData itself if it already has them
+*/
+TextureData TextureStreamer::expandMipChain(const TextureData& textureData)
+{
+    if (!textureData.generateMipmaps) {
+        return textureData;
+    }
+    // Decoded images that need generated mips are always RGBA8
+    assert(textureData.format == VK_FORMAT_R8G8B8A8_UNORM);
+
+    TextureData expanded = textureData;
+    expanded.generateMipmaps = false;
+    expanded.regions.clear();
+
+    std::vector<VkExtent2D> extents;
+    VkDeviceSize size = 0;
+    for (uint32_t level = 0; level < textureData.mipLevels; level++) {
+        const VkExtent2D extent = { std::max(1u, textureData.width >> level), std::max(1u, textureData.height >> level) };
+        VkBufferImageCopy region = {};
+        region.bufferOffset = size;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { extent.width, extent.height, 1 };
+        expanded.regions.push_back(region);
+        extents.push_back(extent);
+        size += static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+    }
+
+    auto levels = std::make_shared<std::vector<uint8_t>>(size);
+    uint8_t* dst = levels->data();
+    memcpy(dst, textureData.pixels, static_cast<size_t>(extents[0].width) * extents[0].height * 4);
+    for (uint32_t level = 1; level < textureData.mipLevels; level++) {
+        const VkExtent2D src = extents[level - 1];
+        const VkExtent2D dstExtent = extents[level];
+        const uint8_t* srcTexels = dst + expanded.regions[level - 1].bufferOffset;
+        uint8_t* dstTexels = dst + expanded.regions[level].bufferOffset;
+        for (uint32_t y = 0; y < dstExtent.height; y++) {
+            const uint32_t y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+            for (uint32_t x = 0; x < dstExtent.width; x++) {
+                const uint32_t x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                for (uint32_t c = 0; c < 4; c++) {
+                    const uint32_t sum = srcTexels[(y0 * src.width + x0) * 4 + c] + srcTexels[(y0 * src.width + x1) * 4 + c]
+                        + srcTexels[(y1 * src.width + x0) * 4 + c] + srcTexels[(y1 * src.width + x1) * 4 + c];
+                    dstTexels[(y * dstExtent.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    expanded.pixels = levels->data();
+    expanded.size = size;
+    expanded.data = levels;
+    return expanded;
+}
+
+/**
+* First level of the mip tail that is made resident when a streamed texture is created
+*/
+uint32_t TextureStreamer::tailLevel(const TextureData& textureData) const
+{
+    uint32_t level = 0;
+    while ((level + 1 < textureData.mipLevels) && ((std::max(textureData.width, textureData.height) >> level) > settings.tailSize)) {
+        level++;
+    }
+    return level;
+}
+
+/**
+* Register a texture created with its mip tail resident
+*
+* @param textureData Image data with all levels stored (see expandMipChain), a reference is kept to stream in higher levels
+*/
+void TextureStreamer::addTexture(Texture* texture, const TextureData& textureData)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StreamedTexture streamed;
+    streamed.data = textureData;
+    streamed.tailLevel = texture->baseMipLevel;
+    streamed.targetLevel = texture->baseMipLevel;
+    // The size of a level is the distance to the next one in the data
+    streamed.levelSizes.resize(textureData.mipLevels, 0);
+    std::vector<VkBufferImageCopy> regions = textureData.regions;
+    std::sort(regions.begin(), regions.end(), [](const VkBufferImageCopy& a, const VkBufferImageCopy& b) { return a.bufferOffset < b.bufferOffset; });
+    for (size_t i = 0; i < regions.size(); i++) {
+        const VkDeviceSize end = (i + 1 < regions.size()) ? regions[i + 1].bufferOffset : textureData.size;
+        streamed.levelSizes[regions[i].imageSubresource.mipLevel] = end - regions[i].bufferOffset;
+    }
+    textures[texture] = streamed;
+    stats.textureCount++;
+    stats.residentBytes += texture->allocation.size;
+}
+
+/**
+* Start streaming the textures of a model, once its materials have their descriptor sets
+*/
+void TextureStreamer::addModel(Model* model)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    models.push_back(model);
+    for (auto* texture : model->textures) {
+        auto it = textures.find(texture);
+        if (it != textures.end()) {
+            it->second.references++;
+        }
+    }
+    for (auto* material : model->materials) {
+        for (auto* texture : materialTextures(material)) {
+            auto it = textures.find(texture);
+            if (it != textures.end()) {
+                it->second.materials.push_back(material);
+            }
+        }
+    }
+}
+
+/**
+* Stop streaming the textures of a model, must be called before the model releases its textures
+*
+* @note Waits for pending uploads of textures no other registered model uses
+*/
+void TextureStreamer::removeModel(Model* model)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto modelIt = std::find(models.begin(), models.end(), model);
+    if (modelIt == models.end()) {
+        return;
+    }
+    models.erase(modelIt);
+    for (auto* material : model->materials) {
+        for (auto& texture : textures) {
+            auto& materials = texture.second.materials;
+            materials.erase(std::remove(materials.begin(), materials.end(), material), materials.end());
+        }
+    }
+    for (auto* texture : model->textures) {
+        auto it = textures.find(texture);
+        if ((it == textures.end()) || (--it->second.references > 0)) {
+            continue;
+        }
+        // The texture is destroyed by the cache, so drop a pending change before it can be applied
+        for (auto change = pending.begin(); change != pending.end();) {
+            if (change->texture == texture) {
+                texture->device->uploader->wait(change->uploadToken);
+                change->staged.destroy();
+                change = pending.erase(change);
+            } else {
+                ++change;
+            }
+        }
+        stats.textureCount--;
+        stats.residentBytes -= texture->allocation.size;
+        textures.erase(it);
+    }
+}
+
+/** @brief Size of the levels from baseLevel on, estimated from the host data */
+VkDeviceSize TextureStreamer::residentSize(const StreamedTexture& streamed, uint32_t baseLevel) const
+{
+    VkDeviceSize size = 0;
+    for (uint32_t level = baseLevel; level < streamed.levelSizes.size(); level++) {
+        size += streamed.levelSizes[level];
+    }
+    return size;
+}
+
+/** @brief Base level that matches the screen size of the texture, assuming it covers its meshes once */
+uint32_t TextureStreamer::wantedLevel(const Texture* texture, const StreamedTexture& streamed) const
+{
+    const float maxDimension = static_cast<float>(std::max(texture->width, texture->height));
+    if (streamed.screenSize >= maxDimension) {
+        return 0;
+    }
+    const float level = std::floor(std::log2(maxDimension / std::max(streamed.screenSize, 1.0f)));
+    return std::min(static_cast<uint32_t>(level), streamed.tailLevel);
+}
+
+/**
+* Estimate the screen size of the streamed textures and upload new images for the ones whose resident levels don't match
+*
+* Undersampled textures are served first, largest deficit first. If an upload would exceed the budget, textures
+* that haven't been visible for settings.evictionDelay updates drop back to their mip tail, least recently used first.
+* All uploads of an update share one background submission.
+*
+* @param viewportHeight Height of the viewport in pixels
+*/
+void TextureStreamer::update(const glm::mat4& view, const glm::mat4& projection, float viewportHeight)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    updateIndex++;
+    for (auto& texture : textures) {
+        texture.second.screenSize = 0.0f;
+    }
+
+    // Frustum planes of the view projection matrix (Vulkan depth range)
+    const glm::mat4 viewProjection = projection * view;
+    const glm::mat4 rows = glm::transpose(viewProjection);
+    glm::vec4 planes[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2] };
+    for (auto& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    for (auto* model : models) {
+        if (!model->isReady()) {
+            continue;
+        }
+        for (auto* node : model->linearNodes) {
+            if (!node->geo) {
+                continue;
+            }
+            const glm::mat4 matrix = node->getMatrix();
+            const float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+            for (auto* mesh : node->geo->meshes) {
+                if (!mesh->material || (mesh->vertexCount == 0)) {
+                    continue;
+                }
+                const glm::vec3 center = glm::vec3(matrix * glm::vec4(mesh->dimensions.center, 1.0f));
+                const float radius = mesh->dimensions.radius * scale;
+                bool visible = true;
+                for (auto& plane : planes) {
+                    if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                        visible = false;
+                        break;
+                    }
+                }
+                if (!visible) {
+                    continue;
+                }
+                // Projected diameter in pixels, a camera inside the bounds needs the full resolution
+                const float distance = glm::length(glm::vec3(view * glm::vec4(center, 1.0f)));
+                const float screenSize = (distance > radius) ? radius * std::fabs(projection[1][1]) * viewportHeight / distance : FLT_MAX;
+                for (auto* texture : materialTextures(mesh->material)) {
+                    auto it = textures.find(texture);
+                    if (it != textures.end()) {
+                        it->second.lastVisible = updateIndex;
+                        it->second.screenSize = std::max(it->second.screenSize, screenSize);
+                    }
+                }
+            }
+        }
+    }
+
+    // Memory of all textures once the pending changes have been applied
+    VkDeviceSize committed = 0;
+    std::vector<std::pair<float, Texture*>> requests;
+    std::vector<Texture*> evictable;
+    for (auto& texture : textures) {
+        StreamedTexture& streamed = texture.second;
+        committed += residentSize(streamed, streamed.targetLevel);
+        if (streamed.pending) {
+            continue;
+        }
+        if (streamed.lastVisible == updateIndex) {
+            if (wantedLevel(texture.first, streamed) < streamed.targetLevel) {
+                // Ratio of screen size to the resident resolution
+                const float resident = static_cast<float>(std::max(1u, std::max(texture.first->width, texture.first->height) >> streamed.targetLevel));
+                requests.push_back({ streamed.screenSize / resident, texture.first });
+            }
+        } else if ((streamed.targetLevel < streamed.tailLevel) && (updateIndex - streamed.lastVisible >= settings.evictionDelay)) {
+            evictable.push_back(texture.first);
+        }
+    }
+    std::sort(requests.begin(), requests.end(), [](const std::pair<float, Texture*>& a, const std::pair<float, Texture*>& b) { return a.first > b.first; });
+    std::sort(evictable.begin(), evictable.end(), [this](Texture* a, Texture* b) { return textures[a].lastVisible < textures[b].lastVisible; });
+
+    UploadBatch uploadBatch;
+    std::vector<PendingChange> changes;
+    VulkanDevice* device = nullptr;
+    auto change = [&](Texture* texture, uint32_t level) {
+        StreamedTexture& streamed = textures[texture];
+        PendingChange pendingChange;
+        pendingChange.texture = texture;
+        pendingChange.staged.create(streamed.data, texture->device, uploadBatch, level);
+        pendingChange.uploadToken = 0;
+        changes.push_back(pendingChange);
+        streamed.targetLevel = level;
+        streamed.pending = true;
+        device = texture->device;
+    };
+
+    size_t evicted = 0;
+    for (auto& request : requests) {
+        if (changes.size() >= settings.maxUploadsPerUpdate) {
+            break;
+        }
+        Texture* texture = request.second;
+        StreamedTexture& streamed = textures[texture];
+        const uint32_t level = wantedLevel(texture, streamed);
+        const VkDeviceSize growth = residentSize(streamed, level) - residentSize(streamed, streamed.targetLevel);
+        while ((settings.budget > 0) && (committed + growth > settings.budget) && (evicted < evictable.size()) && (changes.size() + 1 < settings.maxUploadsPerUpdate)) {
+            StreamedTexture& victim = textures[evictable[evicted]];
+            committed -= residentSize(victim, victim.targetLevel) - residentSize(victim, victim.tailLevel);
+            change(evictable[evicted], victim.tailLevel);
+            evicted++;
+        }
+        if ((settings.budget > 0) && (committed + growth > settings.budget)) {
+            continue;
+        }
+        committed += growth;
+        change(texture, level);
+    }
+
+    if (!changes.empty()) {
+        const UploadToken uploadToken = device->uploader->submit(uploadBatch);
+        for (auto& pendingChange : changes) {
+            pendingChange.uploadToken = uploadToken;
+            pending.push_back(pendingChange);
+        }
+    }
+}
+
+/** @brief True if applyPendingChanges() has textures to switch, which is not the case until the previous switch has been released */
+bool TextureStreamer::hasPendingChanges()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!retired.empty()) {
+        return false;
+    }
+    for (auto& change : pending) {
+        if (change.texture->device->uploader->isComplete(change.uploadToken)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Switch the textures whose new images have been uploaded, their materials get their spare descriptor set with the new images
+*
+* The previous images and descriptor sets are left as they are for command buffers recorded before, nothing is switched
+* until releaseRetired() has been called for the previous switch.
+*
+* @return True if textures have been switched, command buffers using the materials have to be re-recorded
+*/
+bool TextureStreamer::applyPendingChanges()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!retired.empty()) {
+        return false;
+    }
+    std::vector<Material*> materials;
+    for (auto change = pending.begin(); change != pending.end();) {
+        Texture* texture = change->texture;
+        if (!texture->device->uploader->isComplete(change->uploadToken)) {
+            ++change;
+            continue;
+        }
+        Texture previous = *texture;
+        *texture = change->staged;
+        retired.push_back(previous);
+
+        StreamedTexture& streamed = textures[texture];
+        streamed.pending = false;
+        stats.residentBytes += texture->allocation.size;
+        stats.residentBytes -= previous.allocation.size;
+        if (texture->baseMipLevel < previous.baseMipLevel) {
+            stats.streamedIn += previous.baseMipLevel - texture->baseMipLevel;
+        } else {
+            stats.evicted += texture->baseMipLevel - previous.baseMipLevel;
+        }
+        for (auto* material : streamed.materials) {
+            if (std::find(materials.begin(), materials.end(), material) == materials.end()) {
+                materials.push_back(material);
+            }
+        }
+        change = pending.erase(change);
+    }
+    for (auto* material : materials) {
+        assert(material->spareDescriptorSet != VK_NULL_HANDLE);
+        std::swap(material->descriptorSet, material->spareDescriptorSet);
+        material->updateDescriptorSet(descriptorBindingFlags);
+    }
+    return !retired.empty();
+}
+
+/**
+* Destroy the images replaced by the last applyPendingChanges(), the spare descriptor sets can be written again
+*
+* @note No command buffer recorded before that switch may be pending or be submitted again
+*/
+void TextureStreamer::releaseRetired()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& texture : retired) {
+        texture.destroy();
+    }
+    retired.clear();
+}
+
+TextureStreamer::Stats TextureStreamer::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats current = stats;
+    current.partialCount = 0;
+    for (auto& texture : textures) {
+        if (texture.first->baseMipLevel > 0) {
+            current.partialCount++;
+        }
+    }
+    return current;
+}
+
+void TextureStreamer::printStats()
+{
+    Stats stats = getStats();
+    std::cout << "Texture streaming: " << stats.textureCount << " textures (" << stats.partialCount << " partially resident, "
+        << stats.residentBytes / (1024.0 * 1024.0) << " MiB), " << stats.streamedIn << " levels streamed in, "
+        << stats.evicted << " levels evicted\n";
+}
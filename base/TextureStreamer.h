@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "ModelParser.h"
+
+namespace MParser
+{
+    /**
+    * Residency streaming of material textures
+    *
+    * Models loaded with FileLoadingFlags::StreamTextures only upload the mip tail of their textures, so they can
+    * be drawn as soon as the geometry is in place. update() estimates the screen size of every mesh from its
+    * dimensions and the camera, and uploads images with more levels for the textures that are undersampled the
+    * most. Once the budget is reached the higher levels of textures that haven't been visible for a while are
+    * dropped again.
+    *
+    * Without sparse residency a texture changes its level range by switching to a new image uploaded from the
+    * decoded data kept on the host. applyPendingChanges() writes the new images to the spare descriptor set of the
+    * materials using them and swaps it in, so the sets and images bound by pending command buffers stay untouched.
+    * The caller re-records its command buffers and calls releaseRetired() once none recorded before the switch can
+    * be executed anymore, which destroys the previous images and frees the spare sets for the next switch.
+    */
+    class TextureStreamer
+    {
+    public:
+        struct Settings {
+            /** @brief Device memory the streamed textures may use, 0 for no limit */
+            VkDeviceSize budget = 256 * 1024 * 1024;
+            /** @brief Largest dimension of the mip tail that is made resident when a texture is loaded */
+            uint32_t tailSize = 64;
+            /** @brief Number of updates a texture has to be invisible before its higher levels may be evicted */
+            uint32_t evictionDelay = 120;
+            /** @brief Upper limit of the textures whose residency is changed per update */
+            uint32_t maxUploadsPerUpdate = 4;
+        } settings;
+
+        struct Stats {
+            uint32_t textureCount = 0;
+            /** @brief Textures that don't have all their levels resident */
+            uint32_t partialCount = 0;
+            VkDeviceSize residentBytes = 0;
+            uint64_t streamedIn = 0;
+            uint64_t evicted = 0;
+        };
+
+        static TextureData expandMipChain(const TextureData& textureData);
+        uint32_t tailLevel(const TextureData& textureData) const;
+        void addTexture(Texture* texture, const TextureData& textureData);
+        void addModel(Model* model);
+        void removeModel(Model* model);
+
+        void update(const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+        bool hasPendingChanges();
+        bool applyPendingChanges();
+        void releaseRetired();
+
+        Stats getStats();
+        void printStats();
+
+    private:
+        struct StreamedTexture {
+            /** @brief Host copy of all levels, new images are uploaded from it */
+            TextureData data;
+            std::vector<VkDeviceSize> levelSizes;
+            uint32_t tailLevel;
+            std::vector<Material*> materials;
+            /** @brief Number of references held by registered models */
+            uint32_t references = 0;
+            uint64_t lastVisible = 0;
+            /** @brief Largest projected size in pixels of the meshes using the texture in the current update */
+            float screenSize = 0.0f;
+            /** @brief Base level the texture will have once its pending change has been applied */
+            uint32_t targetLevel;
+            bool pending = false;
+        };
+
+        struct PendingChange {
+            Texture* texture;
+            /** @brief Image with the new level range, swapped into the texture once its upload has completed */
+            Texture staged;
+            UploadToken uploadToken;
+        };
+
+        std::map<Texture*, StreamedTexture> textures;
+        std::vector<Model*> models;
+        std::vector<PendingChange> pending;
+        /** @brief Images replaced by applyPendingChanges, possibly still read by command buffers recorded before */
+        std::vector<Texture> retired;
+        uint64_t updateIndex = 0;
+        Stats stats;
+        std::mutex mutex;
+
+        VkDeviceSize residentSize(const StreamedTexture& streamed, uint32_t baseLevel) const;
+        uint32_t wantedLevel(const Texture* texture, const StreamedTexture& streamed) const;
+    };
+
+    extern TextureStreamer textureStreamer;
+}
@@ -0,0 +1,296 @@
+#include "TransformBatch.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#define TRANSFORM_BATCH_AVX2
+#define TRANSFORM_BATCH_SSE2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TRANSFORM_BATCH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSFORM_BATCH_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    // Lane types the kernel is instantiated with, one node per lane
+    struct ScalarLanes {
+        typedef float type;
+        static const uint32_t width = 1;
+        static type load(const float* p) { return *p; }
+        static void store(float* p, type v) { *p = v; }
+        static type set(float f) { return f; }
+        static type add(type a, type b) { return a + b; }
+        static type sub(type a, type b) { return a - b; }
+        static type mul(type a, type b) { return a * b; }
+        static type gather(const float* array, const int32_t* index) { return array[index[0]]; }
+    };
+
+#if defined(TRANSFORM_BATCH_SSE2)
+    struct Lanes4 {
+        typedef __m128 type;
+        static const uint32_t width = 4;
+        static type load(const float* p) { return _mm_loadu_ps(p); }
+        static void store(float* p, type v) { _mm_storeu_ps(p, v); }
+        static type set(float f) { return _mm_set1_ps(f); }
+        static type add(type a, type b) { return _mm_add_ps(a, b); }
+        static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+        static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+        static type gather(const float* array, const int32_t* index)
+        {
+            return _mm_set_ps(array[index[3]], array[index[2]], array[index[1]], array[index[0]]);
+        }
+    };
+#elif defined(TRANSFORM_BATCH_NEON)
+    struct Lanes4 {
+        typedef float32x4_t type;
+        static const uint32_t width = 4;
+        static type load(const float* p) { return vld1q_f32(p); }
+        static void store(float* p, type v) { vst1q_f32(p, v); }
+        static type set(float f) { return vdupq_n_f32(f); }
+        static type add(type a, type b) { return vaddq_f32(a, b); }
+        static type sub(type a, type b) { return vsubq_f32(a, b); }
+        static type mul(type a, type b) { return vmulq_f32(a, b); }
+        static type gather(const float* array, const int32_t* index)
+        {
+            const float values[4] = { array[index[0]], array[index[1]], array[index[2]], array[index[3]] };
+            return vld1q_f32(values);
+        }
+    };
+#endif
+
+#if defined(TRANSFORM_BATCH_AVX2)
+    struct Lanes8 {
+        typedef __m256 type;
+        static const uint32_t width = 8;
+        static type load(const float* p) { return _mm256_loadu_ps(p); }
+        static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+        static type set(float f) { return _mm256_set1_ps(f); }
+        static type add(type a, type b) { return _mm256_add_ps(a, b); }
+        static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+        static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+        static type gather(const float* array, const int32_t* index)
+        {
+            return _mm256_i32gather_ps(array, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index)), 4);
+        }
+    };
+#endif
+
+    // Compose the local matrices of L::width consecutive slots and multiply them by the world matrices of their parents.
+    // block points to the translation x of the first slot, parents to the parent offsets of the slots
+    template <typename L>
+    inline void composeNodes(float* block, const float* blocks, const int32_t* parents)
+    {
+        typedef typename L::type V;
+        const uint32_t width = TransformBatch::blockWidth;
+        const V one = L::set(1.0f);
+        const V two = L::set(2.0f);
+
+        // Rotation matrix of the quaternion, as glm::mat3_cast
+        const V qx = L::load(block + TransformBatch::Rotation * width);
+        const V qy = L::load(block + (TransformBatch::Rotation + 1) * width);
+        const V qz = L::load(block + (TransformBatch::Rotation + 2) * width);
+        const V qw = L::load(block + (TransformBatch::Rotation + 3) * width);
+        const V xx = L::mul(qx, qx), yy = L::mul(qy, qy), zz = L::mul(qz, qz);
+        const V xy = L::mul(qx, qy), xz = L::mul(qx, qz), yz = L::mul(qy, qz);
+        const V wx = L::mul(qw, qx), wy = L::mul(qw, qy), wz = L::mul(qw, qz);
+
+        // translate * rotate * scale, columns 0 to 2 are the scaled rotation, the last row is 0 0 0 1
+        const V sx = L::load(block + TransformBatch::Scale * width);
+        const V sy = L::load(block + (TransformBatch::Scale + 1) * width);
+        const V sz = L::load(block + (TransformBatch::Scale + 2) * width);
+        V trs[4][3];
+        trs[0][0] = L::mul(L::sub(one, L::mul(two, L::add(yy, zz))), sx);
+        trs[0][1] = L::mul(L::mul(two, L::add(xy, wz)), sx);
+        trs[0][2] = L::mul(L::mul(two, L::sub(xz, wy)), sx);
+        trs[1][0] = L::mul(L::mul(two, L::sub(xy, wz)), sy);
+        trs[1][1] = L::mul(L::sub(one, L::mul(two, L::add(xx, zz))), sy);
+        trs[1][2] = L::mul(L::mul(two, L::add(yz, wx)), sy);
+        trs[2][0] = L::mul(L::mul(two, L::add(xz, wy)), sz);
+        trs[2][1] = L::mul(L::mul(two, L::sub(yz, wx)), sz);
+        trs[2][2] = L::mul(L::sub(one, L::mul(two, L::add(xx, yy))), sz);
+        for (int r = 0; r < 3; r++) {
+            trs[3][r] = L::load(block + (TransformBatch::Translation + r) * width);
+        }
+
+        // local = trs * matrix
+        const float* matrix = block + TransformBatch::Matrix * width;
+        float* localOut = block + TransformBatch::Local * width;
+        V local[16];
+        for (int c = 0; c < 4; c++) {
+            const V m0 = L::load(matrix + (c * 4 + 0) * width);
+            const V m1 = L::load(matrix + (c * 4 + 1) * width);
+            const V m2 = L::load(matrix + (c * 4 + 2) * width);
+            const V m3 = L::load(matrix + (c * 4 + 3) * width);
+            for (int r = 0; r < 3; r++) {
+                local[c * 4 + r] = L::add(L::add(L::mul(trs[0][r], m0), L::mul(trs[1][r], m1)), L::add(L::mul(trs[2][r], m2), L::mul(trs[3][r], m3)));
+            }
+            local[c * 4 + 3] = m3;
+        }
+        for (int e = 0; e < 16; e++) {
+            L::store(localOut + e * width, local[e]);
+        }
+
+        // world = parent world * local, the parents of a group differ so their matrices are gathered
+        const float* parentWorld = blocks + TransformBatch::World * width;
+        float* worldOut = block + TransformBatch::World * width;
+        V parent[16];
+        for (int e = 0; e < 16; e++) {
+            parent[e] = L::gather(parentWorld + e * width, parents);
+        }
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                const V sum = L::add(L::add(L::mul(parent[r], local[c * 4]), L::mul(parent[4 + r], local[c * 4 + 1])),
+                    L::add(L::mul(parent[8 + r], local[c * 4 + 2]), L::mul(parent[12 + r], local[c * 4 + 3])));
+                L::store(worldOut + (c * 4 + r) * width, sum);
+            }
+        }
+    }
+
+    // Process the slots [first, end) of one level with L while at least L::width of them are left
+    template <typename L>
+    inline uint32_t composeLevel(float* blocks, const int32_t* parentOffsets, uint32_t first, uint32_t end)
+    {
+        for (; first + L::width <= end; first += L::width) {
+            const uint32_t offset = (first / TransformBatch::blockWidth) * TransformBatch::blockSize + first % TransformBatch::blockWidth;
+            composeNodes<L>(blocks + offset, blocks, parentOffsets + first);
+        }
+        return first;
+    }
+}
+
+void TransformBatch::build(const std::vector<int32_t>& parents)
+{
+    count = parents.size();
+
+    // Depth of every node, parents come first so one pass is enough
+    std::vector<uint32_t> depths(count);
+    uint32_t levelCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        depths[i] = (parents[i] < 0) ? 0 : depths[parents[i]] + 1;
+        levelCount = std::max(levelCount, depths[i] + 1);
+    }
+
+    // Counting sort by depth, nodes of a level keep their order and every level starts a new block
+    levels.assign(levelCount, Level{ 0, 0 });
+    for (size_t i = 0; i < count; i++) {
+        levels[depths[i]].count++;
+    }
+    uint32_t slotCount = 0;
+    for (auto& level : levels) {
+        level.firstSlot = slotCount;
+        slotCount += (level.count + blockWidth - 1) / blockWidth * blockWidth;
+    }
+    slots.resize(count);
+    std::vector<uint32_t> next(levelCount);
+    for (size_t i = 0; i < count; i++) {
+        const Level& level = levels[depths[i]];
+        slots[i] = level.firstSlot + next[depths[i]]++;
+    }
+
+    // The identity slot starts a block of its own after the last level
+    const uint32_t identitySlot = slotCount;
+    slotCount += blockWidth;
+    parentOffsets.assign(slotCount, static_cast<int32_t>(offset(identitySlot, 0)));
+    for (size_t i = 0; i < count; i++) {
+        if (parents[i] >= 0) {
+            parentOffsets[slots[i]] = static_cast<int32_t>(offset(slots[parents[i]], 0));
+        }
+    }
+
+    const size_t alignment = 32 / sizeof(float);
+    storage.assign(slotCount / blockWidth * blockSize + alignment, 0.0f);
+    firstBlock = (alignment - (reinterpret_cast<uintptr_t>(storage.data()) / sizeof(float)) % alignment) % alignment;
+
+    // Identity transforms everywhere, including padding and the identity slot
+    float* data = blocks();
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        data[offset(slot, Rotation + 3)] = 1.0f;
+        for (uint32_t i = 0; i < 3; i++) {
+            data[offset(slot, Scale + i)] = 1.0f;
+        }
+        for (uint32_t i = 0; i < 4; i++) {
+            data[offset(slot, Matrix + i * 5)] = 1.0f;
+            data[offset(slot, Local + i * 5)] = 1.0f;
+            data[offset(slot, World + i * 5)] = 1.0f;
+        }
+    }
+}
+
+void TransformBatch::setTransform(size_t node, const float translation[3], const float rotation[4], const float scale[3])
+{
+    float* slot = blocks() + offset(slots[node], 0);
+    for (uint32_t i = 0; i < 3; i++) {
+        slot[(Translation + i) * blockWidth] = translation[i];
+        slot[(Scale + i) * blockWidth] = scale[i];
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        slot[(Rotation + i) * blockWidth] = rotation[i];
+    }
+}
+
+void TransformBatch::setMatrix(size_t node, const float matrix[16])
+{
+    float* slot = blocks() + offset(slots[node], 0);
+    for (uint32_t i = 0; i < 16; i++) {
+        slot[(Matrix + i) * blockWidth] = matrix[i];
+    }
+}
+
+/**
+* Recompute the local and world matrices of all nodes
+*
+* Levels are processed in order of depth. Within a level the nodes are independent, so they are computed in groups of
+* the widest available kernel, the remainder of a level falls back to narrower kernels.
+*
+* @param simd False runs the scalar kernel regardless of what the build supports
+*/
+void TransformBatch::update(bool simd)
+{
+    float* data = blocks();
+    for (const Level& level : levels) {
+        uint32_t first = level.firstSlot;
+        const uint32_t end = level.firstSlot + level.count;
+        if (simd) {
+#if defined(TRANSFORM_BATCH_AVX2)
+            first = composeLevel<Lanes8>(data, parentOffsets.data(), first, end);
+#endif
+#if defined(TRANSFORM_BATCH_SSE2) || defined(TRANSFORM_BATCH_NEON)
+            first = composeLevel<Lanes4>(data, parentOffsets.data(), first, end);
+#endif
+        }
+        composeLevel<ScalarLanes>(data, parentOffsets.data(), first, end);
+    }
+}
+
+void TransformBatch::getLocalMatrix(size_t node, float matrix[16]) const
+{
+    const float* slot = blocks() + offset(slots[node], 0);
+    for (uint32_t i = 0; i < 16; i++) {
+        matrix[i] = slot[(Local + i) * blockWidth];
+    }
+}
+
+void TransformBatch::getWorldMatrix(size_t node, float matrix[16]) const
+{
+    const float* slot = blocks() + offset(slots[node], 0);
+    for (uint32_t i = 0; i < 16; i++) {
+        matrix[i] = slot[(World + i) * blockWidth];
+    }
+}
+
+const char* TransformBatch::simdPath()
+{
+#if defined(TRANSFORM_BATCH_AVX2)
+    return "AVX2";
+#elif defined(TRANSFORM_BATCH_SSE2)
+    return "SSE2";
+#elif defined(TRANSFORM_BATCH_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
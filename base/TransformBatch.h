@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Structure-of-arrays store of the local transforms of a node hierarchy
+*
+* Every component (translation x, y, z, rotation x, y, z, w, scale x, y, z and the 16 elements of the static node
+* matrix) is kept in its own array, so update() can compose translate * rotate * scale * matrix and multiply by the
+* parent's world matrix for several nodes at once: eight with AVX2, four with SSE2 or NEON, one with the scalar
+* fallback. The kernels are selected at compile time, AVX2 is only used if the build targets it (BASE_AVX2 in
+* base/CMakeLists.txt).
+*
+* The arrays are split into blocks of eight nodes, a block holds the eight values of every component followed by
+* those of the next one. A group of nodes then reads all its inputs from one contiguous block, separate arrays over
+* the whole hierarchy would stream from dozens of places in memory at once.
+*
+* Nodes are stored grouped by their depth in the hierarchy, every level starting at a new block, so the parents of a
+* group of nodes are always complete before the group is computed. Node indices of the public interface are those
+* passed to build(), the reordering is internal. Matrices are column major, as in glm.
+*
+* MParser::Model keeps the transforms of its nodes in a batch, Model::updateTransforms only copies in the nodes that
+* changed and reads back the world matrices below them. Copying every node in and out each frame costs about as much
+* as composing them with glm (tools/transform_benchmark).
+*/
+class TransformBatch
+{
+public:
+    /**
+    * Set up the store for a hierarchy, all transforms start as identity
+    *
+    * @param parents Parent of every node, -1 for roots. Parents have to come before their children
+    */
+    void build(const std::vector<int32_t>& parents);
+    size_t size() const { return count; }
+
+    /** @brief Set the animated part of a node's local transform, rotation is a quaternion as x, y, z, w */
+    void setTransform(size_t node, const float translation[3], const float rotation[4], const float scale[3]);
+    /** @brief Set the static matrix a node's translation, rotation and scale are applied to */
+    void setMatrix(size_t node, const float matrix[16]);
+
+    /**
+    * Recompute the local and world matrices of all nodes
+    *
+    * @param simd False runs the scalar kernel regardless of what the build supports, for comparison
+    */
+    void update(bool simd = true);
+
+    /** @brief Local matrix (translate * rotate * scale * matrix) of the last update */
+    void getLocalMatrix(size_t node, float matrix[16]) const;
+    /** @brief World matrix of the last update */
+    void getWorldMatrix(size_t node, float matrix[16]) const;
+
+    /** @brief Name of the SIMD path update() was compiled with */
+    static const char* simdPath();
+
+    /** @brief Nodes per block */
+    static const uint32_t blockWidth = 8;
+    /** @brief Offsets of the components in a block, in units of blockWidth */
+    enum Component {
+        Translation = 0,
+        Rotation = 3,
+        Scale = 7,
+        Matrix = 10,
+        Local = 26,
+        World = 42,
+        ComponentCount = 58
+    };
+    static const uint32_t blockSize = ComponentCount * blockWidth;
+
+private:
+    /** @brief Nodes of one depth, in consecutive slots */
+    struct Level {
+        uint32_t firstSlot;
+        uint32_t count;
+    };
+
+    /** @brief Offset of a slot's value of a component from the start of the blocks */
+    static uint32_t offset(uint32_t slot, uint32_t component)
+    {
+        return (slot / blockWidth) * blockSize + component * blockWidth + slot % blockWidth;
+    }
+    float* blocks() { return storage.data() + firstBlock; }
+    const float* blocks() const { return storage.data() + firstBlock; }
+
+    size_t count = 0;
+    std::vector<float> storage;
+    /** @brief Start of the first block in storage, aligned to 32 bytes */
+    size_t firstBlock = 0;
+    /** @brief Slot of every node */
+    std::vector<uint32_t> slots;
+    /** @brief offset(parent slot, 0) of every slot, roots and padding reference an identity slot after the last level */
+    std::vector<int32_t> parentOffsets;
+    std::vector<Level> levels;
+};
@@ -0,0 +1,696 @@
+#include "VulkanAllocator.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // Every power of two size class is split into 2^TLSF_SL_LOG2 linear sub classes
+    const uint32_t TLSF_SL_LOG2 = 5;
+    const uint32_t TLSF_SL_COUNT = 1u << TLSF_SL_LOG2;
+    const uint32_t TLSF_FL_COUNT = 64;
+    const uint32_t NULL_NODE = UINT32_MAX;
+
+    inline uint32_t bitScanReverse(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return 63u - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+    }
+
+    inline uint32_t bitScanForward(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+    * Map a size to its first and second level TLSF size class
+    */
+    inline void tlsfMapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+    {
+        uint32_t msb = bitScanReverse(size);
+        if (msb < TLSF_SL_LOG2) {
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+        } else {
+            fl = msb - TLSF_SL_LOG2 + 1;
+            sl = static_cast<uint32_t>(size >> (msb - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+        }
+    }
+}
+
+/**
+* Two-level segregated fit bookkeeping for the ranges of a single memory block
+*
+* Free ranges are kept in per size class lists that are looked up through two bitmaps,
+* neighbouring ranges are linked so that freed ranges are merged immediately.
+*/
+class TlsfMetadata
+{
+public:
+    void init(VkDeviceSize size)
+    {
+        nodes.clear();
+        unusedNodes.clear();
+        flBitmap = 0;
+        memset(slBitmaps, 0, sizeof(slBitmaps));
+        for (uint32_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+            for (uint32_t sl = 0; sl < TLSF_SL_COUNT; sl++) {
+                heads[fl][sl] = NULL_NODE;
+            }
+        }
+        totalFree = 0;
+        freeRangeCount = 0;
+        uint32_t index = newNode();
+        nodes[index].offset = 0;
+        nodes[index].size = size;
+        insertFree(index);
+    }
+
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset, uint32_t* handle)
+    {
+        // Over-request by the alignment so that any range of the found class can be aligned
+        VkDeviceSize request = size + alignment - 1;
+        if (request >= TLSF_SL_COUNT) {
+            request += (VkDeviceSize(1) << (bitScanReverse(request) - TLSF_SL_LOG2)) - 1;
+        }
+        uint32_t fl, sl;
+        tlsfMapping(request, fl, sl);
+        uint32_t index = findSuitable(fl, sl);
+        if (index == NULL_NODE) {
+            return false;
+        }
+        removeFree(index);
+
+        // Return the leading alignment padding to the free lists
+        VkDeviceSize alignedOffset = alignUp(nodes[index].offset, alignment);
+        VkDeviceSize padding = alignedOffset - nodes[index].offset;
+        if (padding > 0) {
+            uint32_t front = newNode();
+            nodes[front].offset = nodes[index].offset;
+            nodes[front].size = padding;
+            nodes[front].prevPhysical = nodes[index].prevPhysical;
+            nodes[front].nextPhysical = index;
+            if (nodes[front].prevPhysical != NULL_NODE) {
+                nodes[nodes[front].prevPhysical].nextPhysical = front;
+            }
+            nodes[index].prevPhysical = front;
+            nodes[index].offset = alignedOffset;
+            nodes[index].size -= padding;
+            insertFree(front);
+        }
+        // Split off the remainder
+        if (nodes[index].size > size) {
+            uint32_t back = newNode();
+            nodes[back].offset = nodes[index].offset + size;
+            nodes[back].size = nodes[index].size - size;
+            nodes[back].prevPhysical = index;
+            nodes[back].nextPhysical = nodes[index].nextPhysical;
+            if (nodes[back].nextPhysical != NULL_NODE) {
+                nodes[nodes[back].nextPhysical].prevPhysical = back;
+            }
+            nodes[index].nextPhysical = back;
+            nodes[index].size = size;
+            insertFree(back);
+        }
+        *offset = nodes[index].offset;
+        *handle = index;
+        return true;
+    }
+
+    void free(uint32_t index)
+    {
+        uint32_t prev = nodes[index].prevPhysical;
+        if (prev != NULL_NODE && nodes[prev].free) {
+            removeFree(prev);
+            nodes[index].offset = nodes[prev].offset;
+            nodes[index].size += nodes[prev].size;
+            nodes[index].prevPhysical = nodes[prev].prevPhysical;
+            if (nodes[index].prevPhysical != NULL_NODE) {
+                nodes[nodes[index].prevPhysical].nextPhysical = index;
+            }
+            releaseNode(prev);
+        }
+        uint32_t next = nodes[index].nextPhysical;
+        if (next != NULL_NODE && nodes[next].free) {
+            removeFree(next);
+            nodes[index].size += nodes[next].size;
+            nodes[index].nextPhysical = nodes[next].nextPhysical;
+            if (nodes[index].nextPhysical != NULL_NODE) {
+                nodes[nodes[index].nextPhysical].prevPhysical = index;
+            }
+            releaseNode(next);
+        }
+        insertFree(index);
+    }
+
+    VkDeviceSize largestFree() const
+    {
+        if (flBitmap == 0) {
+            return 0;
+        }
+        uint32_t fl = bitScanReverse(flBitmap);
+        uint32_t sl = bitScanReverse(slBitmaps[fl]);
+        VkDeviceSize largest = 0;
+        for (uint32_t index = heads[fl][sl]; index != NULL_NODE; index = nodes[index].nextFree) {
+            largest = std::max(largest, nodes[index].size);
+        }
+        return largest;
+    }
+
+    VkDeviceSize totalFree = 0;
+    uint32_t freeRangeCount = 0;
+
+private:
+    struct Node {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t prevPhysical = NULL_NODE;
+        uint32_t nextPhysical = NULL_NODE;
+        uint32_t prevFree = NULL_NODE;
+        uint32_t nextFree = NULL_NODE;
+        bool free = false;
+    };
+    std::vector<Node> nodes;
+    std::vector<uint32_t> unusedNodes;
+    uint64_t flBitmap = 0;
+    uint32_t slBitmaps[TLSF_FL_COUNT];
+    uint32_t heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    uint32_t newNode()
+    {
+        uint32_t index;
+        if (!unusedNodes.empty()) {
+            index = unusedNodes.back();
+            unusedNodes.pop_back();
+            nodes[index] = Node();
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node());
+        }
+        return index;
+    }
+
+    void releaseNode(uint32_t index)
+    {
+        unusedNodes.push_back(index);
+    }
+
+    uint32_t findSuitable(uint32_t fl, uint32_t sl) const
+    {
+        if (fl >= TLSF_FL_COUNT) {
+            return NULL_NODE;
+        }
+        uint32_t slMap = slBitmaps[fl] & (~0u << sl);
+        if (slMap == 0) {
+            uint64_t flMap = (fl + 1 < TLSF_FL_COUNT) ? (flBitmap & (~uint64_t(0) << (fl + 1))) : 0;
+            if (flMap == 0) {
+                return NULL_NODE;
+            }
+            fl = bitScanForward(flMap);
+            slMap = slBitmaps[fl];
+        }
+        return heads[fl][bitScanForward(slMap)];
+    }
+
+    void insertFree(uint32_t index)
+    {
+        uint32_t fl, sl;
+        tlsfMapping(nodes[index].size, fl, sl);
+        nodes[index].free = true;
+        nodes[index].prevFree = NULL_NODE;
+        nodes[index].nextFree = heads[fl][sl];
+        if (heads[fl][sl] != NULL_NODE) {
+            nodes[heads[fl][sl]].prevFree = index;
+        }
+        heads[fl][sl] = index;
+        flBitmap |= uint64_t(1) << fl;
+        slBitmaps[fl] |= 1u << sl;
+        totalFree += nodes[index].size;
+        freeRangeCount++;
+    }
+
+    void removeFree(uint32_t index)
+    {
+        uint32_t fl, sl;
+        tlsfMapping(nodes[index].size, fl, sl);
+        if (nodes[index].prevFree != NULL_NODE) {
+            nodes[nodes[index].prevFree].nextFree = nodes[index].nextFree;
+        } else {
+            heads[fl][sl] = nodes[index].nextFree;
+        }
+        if (nodes[index].nextFree != NULL_NODE) {
+            nodes[nodes[index].nextFree].prevFree = nodes[index].prevFree;
+        }
+        if (heads[fl][sl] == NULL_NODE) {
+            slBitmaps[fl] &= ~(1u << sl);
+            if (slBitmaps[fl] == 0) {
+                flBitmap &= ~(uint64_t(1) << fl);
+            }
+        }
+        nodes[index].free = false;
+        totalFree -= nodes[index].size;
+        freeRangeCount--;
+    }
+};
+
+/** @brief Single vkAllocateMemory allocation that ranges are sub-allocated from */
+struct MemoryBlock {
+    MemoryPool* pool = nullptr;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    AllocationStrategy strategy = AllocationStrategy::TLSF;
+    bool dedicated = false;
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize wastedBytes = 0;
+    /** @brief Bump pointer of the linear strategy */
+    VkDeviceSize linearOffset = 0;
+    TlsfMetadata tlsf;
+
+    bool suballocate(VkDeviceSize allocSize, VkDeviceSize alignment, VkDeviceSize* offset, uint32_t* node, VkDeviceSize* reserved)
+    {
+        if (strategy == AllocationStrategy::Linear) {
+            VkDeviceSize alignedOffset = alignUp(linearOffset, alignment);
+            if (alignedOffset + allocSize > size) {
+                return false;
+            }
+            *offset = alignedOffset;
+            *node = NULL_NODE;
+            *reserved = alignedOffset + allocSize - linearOffset;
+            linearOffset = alignedOffset + allocSize;
+            return true;
+        }
+        if (!tlsf.allocate(allocSize, alignment, offset, node)) {
+            return false;
+        }
+        *reserved = allocSize;
+        return true;
+    }
+};
+
+/** @brief Blocks of one memory type, resource type and strategy */
+struct MemoryPool {
+    uint32_t memoryTypeIndex;
+    ResourceType resourceType;
+    AllocationStrategy strategy;
+    VkMemoryAllocateFlags allocateFlags;
+    VkDeviceSize blockSize;
+    std::vector<MemoryBlock*> blocks;
+};
+
+/**
+* Default constructor
+*
+* @param device Vulkan device the memory is allocated from, the logical device must already exist
+*/
+MemoryAllocator::MemoryAllocator(VulkanDevice* device)
+{
+    assert(device);
+    this->device = device;
+    bufferImageGranularity = std::max<VkDeviceSize>(device->properties.limits.bufferImageGranularity, 1);
+    nonCoherentAtomSize = std::max<VkDeviceSize>(device->properties.limits.nonCoherentAtomSize, 1);
+}
+
+/**
+* Default destructor
+*
+* @note Frees all memory blocks, resources that still live in them must have been destroyed by now
+*/
+MemoryAllocator::~MemoryAllocator()
+{
+    uint32_t leaked = 0;
+    for (auto pool : pools) {
+        for (auto block : pool->blocks) {
+            leaked += block->allocationCount;
+            destroyBlock(block);
+        }
+        delete pool;
+    }
+    for (auto block : dedicatedBlocks) {
+        leaked += block->allocationCount;
+        destroyBlock(block);
+    }
+    if (leaked > 0) {
+        std::cerr << "Memory allocator destroyed with " << leaked << " allocations still alive\n";
+    }
+}
+
+MemoryPool* MemoryAllocator::getPool(uint32_t memoryTypeIndex, ResourceType resourceType, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags)
+{
+    // Without a granularity restriction linear and optimal resources can share blocks
+    if (bufferImageGranularity <= 1) {
+        resourceType = ResourceType::Linear;
+    }
+    for (auto pool : pools) {
+        if (pool->memoryTypeIndex == memoryTypeIndex && pool->resourceType == resourceType && pool->strategy == strategy && pool->allocateFlags == allocateFlags) {
+            return pool;
+        }
+    }
+    MemoryPool* pool = new MemoryPool();
+    pool->memoryTypeIndex = memoryTypeIndex;
+    pool->resourceType = resourceType;
+    pool->strategy = strategy;
+    pool->allocateFlags = allocateFlags;
+    // Keep small heaps (e.g. host visible device local memory) from being consumed by a few blocks
+    const VkDeviceSize heapSize = device->memoryProperties.memoryHeaps[device->memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    pool->blockSize = std::min(preferredBlockSize, heapSize / 8);
+    pools.push_back(pool);
+    return pool;
+}
+
+MemoryBlock* MemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags, bool dedicated)
+{
+    VkMemoryAllocateInfo memAlloc = initializers::memoryAllocateInfo();
+    memAlloc.allocationSize = size;
+    memAlloc.memoryTypeIndex = memoryTypeIndex;
+    VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
+    if (allocateFlags != 0) {
+        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+        allocFlagsInfo.flags = allocateFlags;
+        memAlloc.pNext = &allocFlagsInfo;
+    }
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &memory) != VK_SUCCESS) {
+        return nullptr;
+    }
+
+    MemoryBlock* block = new MemoryBlock();
+    block->memory = memory;
+    block->size = size;
+    block->strategy = strategy;
+    block->dedicated = dedicated;
+    // Host visible blocks are mapped once for their whole lifetime
+    if (device->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+    }
+    if (!dedicated && strategy == AllocationStrategy::TLSF) {
+        block->tlsf.init(size);
+    }
+    return block;
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock* block)
+{
+    if (block->mapped) {
+        vkUnmapMemory(device->logicalDevice, block->memory);
+    }
+    vkFreeMemory(device->logicalDevice, block->memory, nullptr);
+    delete block;
+}
+
+/**
+* Allocate a range of device memory
+*
+* @param memReqs Memory requirements of the resource the memory is for
+* @param memoryPropertyFlags Memory properties the memory type has to support
+* @param resourceType Linear (buffers, linear images) or optimal (tiled images) resource
+* @param allocation Pointer to the allocation that receives the memory range
+* @param strategy (Optional) Sub-allocation strategy of the pool to allocate from
+* @param allocateFlags (Optional) Memory allocate flags (e.g. device address), allocations with different flags never share blocks
+*
+* @return VK_SUCCESS if the memory has been allocated, VK_ERROR_OUT_OF_DEVICE_MEMORY if no block could be created
+*/
+VkResult MemoryAllocator::allocate(const VkMemoryRequirements& memReqs, VkMemoryPropertyFlags memoryPropertyFlags, ResourceType resourceType, Allocation* allocation, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags)
+{
+    assert(allocation);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const uint32_t memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
+    const VkMemoryPropertyFlags typeFlags = device->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    VkDeviceSize alignment = std::max<VkDeviceSize>(memReqs.alignment, 1);
+    VkDeviceSize size = memReqs.size;
+    // Flushes and invalidates of non-coherent memory work on nonCoherentAtomSize granularity, so ranges must not share atoms
+    if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        alignment = std::max(alignment, nonCoherentAtomSize);
+        size = alignUp(size, nonCoherentAtomSize);
+    }
+
+    MemoryPool* pool = getPool(memoryTypeIndex, resourceType, strategy, allocateFlags);
+    MemoryBlock* block = nullptr;
+    VkDeviceSize offset = 0;
+    VkDeviceSize reserved = size;
+    uint32_t node = NULL_NODE;
+
+    if (size > pool->blockSize / 2) {
+        block = createBlock(memoryTypeIndex, size, strategy, allocateFlags, true);
+        if (!block) {
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+        dedicatedBlocks.push_back(block);
+    } else {
+        for (auto poolBlock : pool->blocks) {
+            if (poolBlock->suballocate(size, alignment, &offset, &node, &reserved)) {
+                block = poolBlock;
+                break;
+            }
+        }
+        if (!block) {
+            // Retry with smaller blocks if the device is running low on memory
+            for (VkDeviceSize blockSize = pool->blockSize; blockSize >= size * 2 && !block; blockSize /= 2) {
+                block = createBlock(memoryTypeIndex, blockSize, strategy, allocateFlags, false);
+            }
+            if (!block) {
+                return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+            }
+            block->pool = pool;
+            pool->blocks.push_back(block);
+            bool suballocated = block->suballocate(size, alignment, &offset, &node, &reserved);
+            assert(suballocated);
+            (void)suballocated;
+        }
+    }
+
+    block->allocationCount++;
+    block->usedBytes += reserved;
+    block->wastedBytes += reserved - memReqs.size;
+
+    allocation->memory = block->memory;
+    allocation->offset = offset;
+    allocation->size = memReqs.size;
+    allocation->mapped = block->mapped ? static_cast<uint8_t*>(block->mapped) + offset : nullptr;
+    allocation->memoryTypeIndex = memoryTypeIndex;
+    allocation->allocator = this;
+    allocation->block = block;
+    allocation->node = node;
+    allocation->reservedSize = reserved;
+    return VK_SUCCESS;
+}
+
+/**
+* Allocate memory for a buffer and bind it
+*
+* @param buffer Buffer to allocate memory for
+* @param memoryPropertyFlags Memory properties the memory type has to support
+* @param allocation Pointer to the allocation that receives the memory range
+* @param strategy (Optional) Sub-allocation strategy of the pool to allocate from
+* @param allocateFlags (Optional) Memory allocate flags (e.g. device address)
+*
+* @return VkResult of the allocation and bind calls
+*/
+VkResult MemoryAllocator::allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags memoryPropertyFlags, Allocation* allocation, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags)
+{
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(device->logicalDevice, buffer, &memReqs);
+    VkResult result = allocate(memReqs, memoryPropertyFlags, ResourceType::Linear, allocation, strategy, allocateFlags);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    result = vkBindBufferMemory(device->logicalDevice, buffer, allocation->memory, allocation->offset);
+    if (result != VK_SUCCESS) {
+        free(*allocation);
+    }
+    return result;
+}
+
+/**
+* Allocate memory for an image and bind it
+*
+* @param image Image to allocate memory for
+* @param memoryPropertyFlags Memory properties the memory type has to support
+* @param allocation Pointer to the allocation that receives the memory range
+* @param tiling (Optional) Tiling the image has been created with
+* @param strategy (Optional) Sub-allocation strategy of the pool to allocate from
+*
+* @return VkResult of the allocation and bind calls
+*/
+VkResult MemoryAllocator::allocateImageMemory(VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, Allocation* allocation, VkImageTiling tiling, AllocationStrategy strategy)
+{
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(device->logicalDevice, image, &memReqs);
+    ResourceType resourceType = (tiling == VK_IMAGE_TILING_LINEAR) ? ResourceType::Linear : ResourceType::Optimal;
+    VkResult result = allocate(memReqs, memoryPropertyFlags, resourceType, allocation, strategy);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    result = vkBindImageMemory(device->logicalDevice, image, allocation->memory, allocation->offset);
+    if (result != VK_SUCCESS) {
+        free(*allocation);
+    }
+    return result;
+}
+
+/**
+* Return a memory range to its pool
+*
+* @param allocation Allocation to free, reset to an empty allocation afterwards
+*
+* @note Empty blocks are released, except for one per pool that is kept for reuse
+*/
+void MemoryAllocator::free(Allocation& allocation)
+{
+    if (!allocation.block) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryBlock* block = allocation.block;
+    if (block->dedicated) {
+        dedicatedBlocks.erase(std::find(dedicatedBlocks.begin(), dedicatedBlocks.end(), block));
+        destroyBlock(block);
+        allocation = Allocation();
+        return;
+    }
+
+    if (block->strategy == AllocationStrategy::TLSF) {
+        block->tlsf.free(allocation.node);
+    }
+    block->allocationCount--;
+    block->usedBytes -= allocation.reservedSize;
+    block->wastedBytes -= allocation.reservedSize - allocation.size;
+    if (block->allocationCount == 0) {
+        block->linearOffset = 0;
+        MemoryPool* pool = block->pool;
+        bool otherEmptyBlock = false;
+        for (auto poolBlock : pool->blocks) {
+            if (poolBlock != block && poolBlock->allocationCount == 0) {
+                otherEmptyBlock = true;
+                break;
+            }
+        }
+        if (otherEmptyBlock) {
+            pool->blocks.erase(std::find(pool->blocks.begin(), pool->blocks.end(), block));
+            destroyBlock(block);
+        }
+    }
+    allocation = Allocation();
+}
+
+VkMappedMemoryRange MemoryAllocator::getMappedRange(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+{
+    // Ranges of non-coherent memory types are atom aligned (see allocate), so widening to atoms stays inside the allocation
+    VkDeviceSize begin = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+    VkDeviceSize end = (size == VK_WHOLE_SIZE) ? allocation.offset + allocation.size : allocation.offset + offset + size;
+    end = std::min(alignUp(end, nonCoherentAtomSize), allocation.block->size);
+    VkMappedMemoryRange mappedRange = initializers::mappedMemoryRange();
+    mappedRange.memory = allocation.memory;
+    mappedRange.offset = begin;
+    mappedRange.size = end - begin;
+    return mappedRange;
+}
+
+/**
+* Flush a range of a host visible allocation to make host writes visible to the device
+*
+* @note Only required for non-coherent memory
+*
+* @param allocation Allocation to flush
+* @param offset (Optional) Byte offset from the beginning of the allocation
+* @param size (Optional) Size of the range to flush. Pass VK_WHOLE_SIZE to flush the complete allocation.
+*
+* @return VkResult of the flush call
+*/
+VkResult MemoryAllocator::flush(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange mappedRange = getMappedRange(allocation, offset, size);
+    return vkFlushMappedMemoryRanges(device->logicalDevice, 1, &mappedRange);
+}
+
+/**
+* Invalidate a range of a host visible allocation to make device writes visible to the host
+*
+* @note Only required for non-coherent memory
+*
+* @param allocation Allocation to invalidate
+* @param offset (Optional) Byte offset from the beginning of the allocation
+* @param size (Optional) Size of the range to invalidate. Pass VK_WHOLE_SIZE to invalidate the complete allocation.
+*
+* @return VkResult of the invalidate call
+*/
+VkResult MemoryAllocator::invalidate(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange mappedRange = getMappedRange(allocation, offset, size);
+    return vkInvalidateMappedMemoryRanges(device->logicalDevice, 1, &mappedRange);
+}
+
+/**
+* Collect usage statistics over all pools
+*
+* @return Current block count, byte usage, waste and fragmentation of the allocator
+*/
+MemoryAllocator::Stats MemoryAllocator::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats stats;
+    VkDeviceSize totalFree = 0;
+    for (auto pool : pools) {
+        for (auto block : pool->blocks) {
+            stats.blockCount++;
+            stats.allocationCount += block->allocationCount;
+            stats.reservedBytes += block->size;
+            stats.usedBytes += block->usedBytes;
+            stats.wastedBytes += block->wastedBytes;
+            if (block->strategy == AllocationStrategy::Linear) {
+                totalFree += block->size - block->linearOffset;
+                stats.largestFreeRange = std::max(stats.largestFreeRange, block->size - block->linearOffset);
+            } else {
+                totalFree += block->tlsf.totalFree;
+                stats.largestFreeRange = std::max(stats.largestFreeRange, block->tlsf.largestFree());
+            }
+        }
+    }
+    for (auto block : dedicatedBlocks) {
+        stats.blockCount++;
+        stats.dedicatedBlockCount++;
+        stats.allocationCount += block->allocationCount;
+        stats.reservedBytes += block->size;
+        stats.usedBytes += block->usedBytes;
+        stats.wastedBytes += block->wastedBytes;
+    }
+    if (totalFree > 0) {
+        stats.fragmentation = 1.0f - static_cast<float>(static_cast<double>(stats.largestFreeRange) / static_cast<double>(totalFree));
+    }
+    return stats;
+}
+
+void MemoryAllocator::printStats()
+{
+    Stats stats = getStats();
+    const double MiB = 1024.0 * 1024.0;
+    std::cout << "Device memory: " << stats.blockCount << " blocks (" << stats.dedicatedBlockCount << " dedicated), "
+        << stats.allocationCount << " allocations, "
+        << stats.usedBytes / MiB << " / " << stats.reservedBytes / MiB << " MiB used, "
+        << stats.wastedBytes / 1024.0 << " KiB wasted, "
+        << "fragmentation " << stats.fragmentation << "\n";
+}
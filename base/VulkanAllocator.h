@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+struct VulkanDevice;
+class MemoryAllocator;
+struct MemoryBlock;
+struct MemoryPool;
+
+/** @brief Sub-allocation strategy used by a memory pool */
+enum class AllocationStrategy {
+    /** Bump allocation, a block is reclaimed as a whole once all of its allocations have been freed (staging, transient data) */
+    Linear,
+    /** Two-level segregated fit free lists with immediate coalescing, O(1) allocate and free (general purpose) */
+    TLSF
+};
+
+/** @brief Kind of resource bound to an allocation, linear and optimal resources are kept in separate pools to honour bufferImageGranularity */
+enum class ResourceType {
+    Linear,
+    Optimal
+};
+
+/** @brief Range of device memory handed out by the MemoryAllocator */
+struct Allocation {
+    /** @brief Memory object the range lives in (shared with other allocations) */
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    /** @brief Byte offset of the range inside memory, must be used when binding */
+    VkDeviceSize offset = 0;
+    /** @brief Usable size of the range in bytes */
+    VkDeviceSize size = 0;
+    /** @brief Host pointer to the start of the range for host visible memory (blocks stay mapped), nullptr otherwise */
+    void* mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    MemoryAllocator* allocator = nullptr;
+    /** @brief Allocator internal bookkeeping (owning block, range handle and bytes reserved including padding) */
+    MemoryBlock* block = nullptr;
+    uint32_t node = UINT32_MAX;
+    VkDeviceSize reservedSize = 0;
+};
+
+/**
+* Pooled device memory allocator
+*
+* Hands out offsets from large vkAllocateMemory blocks per memory type instead of allocating
+* memory for every resource, so scenes don't run into maxMemoryAllocationCount.
+* Requests larger than half a block get a dedicated memory object.
+*/
+class MemoryAllocator
+{
+public:
+    struct Stats {
+        /** @brief Number of vkAllocateMemory blocks (including dedicated ones) */
+        uint32_t blockCount = 0;
+        uint32_t dedicatedBlockCount = 0;
+        uint32_t allocationCount = 0;
+        /** @brief Bytes reserved through vkAllocateMemory */
+        VkDeviceSize reservedBytes = 0;
+        /** @brief Bytes handed out to allocations, including alignment padding */
+        VkDeviceSize usedBytes = 0;
+        /** @brief Bytes lost to alignment padding and size rounding */
+        VkDeviceSize wastedBytes = 0;
+        /** @brief Largest contiguous free range over all blocks */
+        VkDeviceSize largestFreeRange = 0;
+        /** @brief 0 when all free memory is contiguous, approaching 1 the more it is split into small ranges */
+        float fragmentation = 0.0f;
+    };
+
+    /** @brief Size of the memory blocks allocated for the pools (capped to an eighth of the memory heap) */
+    VkDeviceSize preferredBlockSize = 64 * 1024 * 1024;
+
+    explicit MemoryAllocator(VulkanDevice* device);
+    ~MemoryAllocator();
+
+    VkResult allocate(const VkMemoryRequirements& memReqs, VkMemoryPropertyFlags memoryPropertyFlags, ResourceType resourceType, Allocation* allocation, AllocationStrategy strategy = AllocationStrategy::TLSF, VkMemoryAllocateFlags allocateFlags = 0);
+    VkResult allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags memoryPropertyFlags, Allocation* allocation, AllocationStrategy strategy = AllocationStrategy::TLSF, VkMemoryAllocateFlags allocateFlags = 0);
+    VkResult allocateImageMemory(VkImage image, VkMemoryPropertyFlags memoryPropertyFlags, Allocation* allocation, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL, AllocationStrategy strategy = AllocationStrategy::TLSF);
+    void free(Allocation& allocation);
+    VkResult flush(const Allocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    VkResult invalidate(const Allocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+    Stats getStats();
+    void printStats();
+
+private:
+    VulkanDevice* device;
+    VkDeviceSize bufferImageGranularity;
+    VkDeviceSize nonCoherentAtomSize;
+    std::vector<MemoryPool*> pools;
+    std::vector<MemoryBlock*> dedicatedBlocks;
+    std::mutex mutex;
+
+    MemoryPool* getPool(uint32_t memoryTypeIndex, ResourceType resourceType, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags);
+    MemoryBlock* createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationStrategy strategy, VkMemoryAllocateFlags allocateFlags, bool dedicated);
+    void destroyBlock(MemoryBlock* block);
+    VkMappedMemoryRange getMappedRange(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+};
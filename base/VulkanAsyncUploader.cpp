@@ -0,0 +1,213 @@
+#include "VulkanAsyncUploader.h"
+
+/**
+* Create the uploader for a logical device
+*
+* @param device Device with a created logical device, the transfer queue family must have been requested on creation to get a dedicated queue
+*/
+AsyncUploader::AsyncUploader(VulkanDevice* device) : device(device)
+{
+    transferQueueFamilyIndex = device->queueFamilyIndices.transfer;
+    graphicsQueueFamilyIndex = device->queueFamilyIndices.graphics;
+    vkGetDeviceQueue(device->logicalDevice, transferQueueFamilyIndex, 0, &transferQueue);
+    vkGetDeviceQueue(device->logicalDevice, graphicsQueueFamilyIndex, 0, &graphicsQueue);
+    // Own pools, the device's default pool is used by the render thread
+    transferCommandPool = device->createCommandPool(transferQueueFamilyIndex);
+    if (hasDedicatedQueue())
+    {
+        graphicsCommandPool = device->createCommandPool(graphicsQueueFamilyIndex);
+    }
+}
+
+/**
+* Default destructor
+*
+* @note Waits for uploads in flight, batches that have not been submitted by update() yet are dropped
+*/
+AsyncUploader::~AsyncUploader()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& submission : inFlight)
+    {
+        VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &submission.fence, VK_TRUE, UINT64_MAX));
+        destroySubmission(submission);
+    }
+    for (auto& submission : queued)
+    {
+        destroySubmission(submission);
+    }
+    vkDestroyCommandPool(device->logicalDevice, transferCommandPool, nullptr);
+    if (graphicsCommandPool)
+    {
+        vkDestroyCommandPool(device->logicalDevice, graphicsCommandPool, nullptr);
+    }
+}
+
+bool AsyncUploader::hasDedicatedQueue() const
+{
+    return transferQueueFamilyIndex != graphicsQueueFamilyIndex;
+}
+
+uint32_t AsyncUploader::pendingCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<uint32_t>(queued.size() + inFlight.size());
+}
+
+/**
+* Stage and record a batch of uploads, it is submitted to the device by the next update()
+*
+* @param batch Batch with the uploads to execute, the data is copied to staging memory and the batch is empty after the call
+*
+* @note Can be called from any thread, the destination resources must not be used before the returned token has completed
+*
+* @return Token to check the uploads for completion with
+*/
+UploadToken AsyncUploader::submit(UploadBatch& batch)
+{
+    if (batch.empty())
+    {
+        batch = UploadBatch();
+        return 0;
+    }
+
+    Submission submission{};
+    submission.staging = device->stagingRing->allocate(batch.stagingSize);
+    batch.writeStaging(submission.staging.mapped);
+
+    VkFenceCreateInfo fenceCreateInfo = initializers::fenceCreateInfo(0);
+    VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCreateInfo, nullptr, &submission.fence));
+    if (hasDedicatedQueue())
+    {
+        VkSemaphoreCreateInfo semaphoreCreateInfo = initializers::semaphoreCreateInfo();
+        VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCreateInfo, nullptr, &submission.semaphore));
+    }
+
+    // Command pools are externally synchronized, so recording happens under the lock
+    std::lock_guard<std::mutex> lock(mutex);
+    submission.transferCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, transferCommandPool, true);
+    batch.recordTransfer(submission.transferCommandBuffer, submission.staging.buffer, submission.staging.offset, transferQueueFamilyIndex, graphicsQueueFamilyIndex);
+    if (hasDedicatedQueue())
+    {
+        VK_CHECK_RESULT(vkEndCommandBuffer(submission.transferCommandBuffer));
+        submission.graphicsCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool, true);
+        batch.recordAcquire(submission.graphicsCommandBuffer, transferQueueFamilyIndex, graphicsQueueFamilyIndex, *device->mipGenerator, submission.mipResources);
+        VK_CHECK_RESULT(vkEndCommandBuffer(submission.graphicsCommandBuffer));
+    }
+    else
+    {
+        batch.recordAcquire(submission.transferCommandBuffer, transferQueueFamilyIndex, graphicsQueueFamilyIndex, *device->mipGenerator, submission.mipResources);
+        VK_CHECK_RESULT(vkEndCommandBuffer(submission.transferCommandBuffer));
+    }
+
+    submission.token = nextToken++;
+    queued.push_back(submission);
+    batch = UploadBatch();
+    return submission.token;
+}
+
+/**
+* Submit recorded batches and release the staging memory of completed ones
+*
+* @note Must be called from the thread that submits to the graphics queue (the render loop calls it once per frame)
+*/
+void AsyncUploader::update()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& submission : queued)
+    {
+        VkSubmitInfo submitInfo = initializers::submitInfo();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &submission.transferCommandBuffer;
+        if (hasDedicatedQueue())
+        {
+            // The graphics queue acquires the resources once the transfer queue has released them
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &submission.semaphore;
+            VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+            const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            submitInfo = initializers::submitInfo();
+            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.pWaitSemaphores = &submission.semaphore;
+            submitInfo.pWaitDstStageMask = &waitStageMask;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &submission.graphicsCommandBuffer;
+            VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, submission.fence));
+        }
+        else
+        {
+            VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, submission.fence));
+        }
+        inFlight.push_back(submission);
+    }
+    queued.clear();
+    retire(false, 0);
+}
+
+/**
+* Check if the uploads of a submission have completed on the device
+*
+* @param token Token returned by submit
+*
+* @note Can be called from any thread, a batch only makes progress once update() has submitted it
+*/
+bool AsyncUploader::isComplete(UploadToken token)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (token > completedToken)
+    {
+        retire(false, 0);
+    }
+    return token <= completedToken;
+}
+
+/**
+* Block until the uploads of a submission have completed on the device
+*
+* @param token Token returned by submit
+*
+* @note Must be called from the thread that submits to the graphics queue, as queued batches are submitted first
+*/
+void AsyncUploader::wait(UploadToken token)
+{
+    update();
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(true, token);
+}
+
+// Retire completed submissions in token order, optionally waiting for all up to the given token
+void AsyncUploader::retire(bool waitForToken, UploadToken token)
+{
+    while (!inFlight.empty())
+    {
+        Submission& submission = inFlight.front();
+        if (waitForToken && submission.token <= token)
+        {
+            VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &submission.fence, VK_TRUE, UINT64_MAX));
+        }
+        else if (vkGetFenceStatus(device->logicalDevice, submission.fence) != VK_SUCCESS)
+        {
+            break;
+        }
+        completedToken = submission.token;
+        destroySubmission(submission);
+        inFlight.pop_front();
+    }
+}
+
+void AsyncUploader::destroySubmission(Submission& submission)
+{
+    vkFreeCommandBuffers(device->logicalDevice, transferCommandPool, 1, &submission.transferCommandBuffer);
+    if (submission.graphicsCommandBuffer)
+    {
+        vkFreeCommandBuffers(device->logicalDevice, graphicsCommandPool, 1, &submission.graphicsCommandBuffer);
+    }
+    if (submission.semaphore)
+    {
+        vkDestroySemaphore(device->logicalDevice, submission.semaphore, nullptr);
+    }
+    vkDestroyFence(device->logicalDevice, submission.fence, nullptr);
+    device->stagingRing->release(submission.staging);
+    device->mipGenerator->destroyResources(submission.mipResources);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+
+/** @brief Identifies a submission of the AsyncUploader, tokens increase with submission order and 0 is always complete */
+typedef uint64_t UploadToken;
+
+/**
+* Background uploads on the transfer queue
+*
+* Batches are staged and recorded on the calling thread (loader threads may submit), while all queue
+* submissions are issued from update() on the render thread, so uploads never race the frame loop for a queue.
+* If the device has a dedicated transfer queue family the copies run there and ownership of the resources
+* is transferred to the graphics queue family, which also generates the requested mip chains.
+* Completion is tracked with one fence per submission (timeline semaphores require Vulkan 1.2).
+*/
+class AsyncUploader
+{
+public:
+    explicit AsyncUploader(VulkanDevice* device);
+    ~AsyncUploader();
+
+    UploadToken submit(UploadBatch& batch);
+    void update();
+    bool isComplete(UploadToken token);
+    void wait(UploadToken token);
+
+    /** @brief True if uploads run on a queue family other than graphics */
+    bool hasDedicatedQueue() const;
+    /** @brief Number of submissions that have not completed yet */
+    uint32_t pendingCount();
+
+private:
+    struct Submission {
+        UploadToken token;
+        StagingRegion staging;
+        MipGenerationResources mipResources;
+        VkCommandBuffer transferCommandBuffer;
+        VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        VkFence fence;
+    };
+
+    VulkanDevice* device;
+    uint32_t transferQueueFamilyIndex;
+    uint32_t graphicsQueueFamilyIndex;
+    VkQueue transferQueue;
+    VkQueue graphicsQueue;
+    VkCommandPool transferCommandPool;
+    VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+    // Recorded submissions waiting for update() and submissions executing on the device, both in token order
+    std::deque<Submission> queued;
+    std::deque<Submission> inFlight;
+    UploadToken nextToken = 1;
+    UploadToken completedToken = 0;
+    std::mutex mutex;
+
+    void retire(bool waitForToken, UploadToken token);
+    void destroySubmission(Submission& submission);
+};
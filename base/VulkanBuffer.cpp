@@ -10,6 +10,16 @@
 */
 VkResult Buffer::map(VkDeviceSize size, VkDeviceSize offset)
 {
+    // Sub-allocated host visible memory stays mapped by the allocator
+    if (allocation.allocator)
+    {
+        if (!allocation.mapped)
+        {
+            return VK_ERROR_MEMORY_MAP_FAILED;
+        }
+        mapped = static_cast<uint8_t*>(allocation.mapped) + offset;
+        return VK_SUCCESS;
+    }
     return vkMapMemory(device, memory, offset, size, 0, &mapped);
 }
 
@@ -22,7 +32,10 @@ void Buffer::unmap()
 {
     if (mapped)
     {
-        vkUnmapMemory(device, memory);
+        if (!allocation.allocator)
+        {
+            vkUnmapMemory(device, memory);
+        }
         mapped = nullptr;
     }
 }
@@ -36,7 +49,7 @@ void Buffer::unmap()
 */
 VkResult Buffer::bind(VkDeviceSize offset)
 {
-    return vkBindBufferMemory(device, buffer, memory, offset);
+    return vkBindBufferMemory(device, buffer, memory, allocation.offset + offset);
 }
 
 /**
@@ -78,6 +91,10 @@ void Buffer::copyTo(void* data, VkDeviceSize size)
 */
 VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
 {
+    if (allocation.allocator)
+    {
+        return allocation.allocator->flush(allocation, offset, size);
+    }
     VkMappedMemoryRange mappedRange = {};
     mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
     mappedRange.memory = memory;
@@ -98,6 +115,10 @@ VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
 */
 VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset)
 {
+    if (allocation.allocator)
+    {
+        return allocation.allocator->invalidate(allocation, offset, size);
+    }
     VkMappedMemoryRange mappedRange = {};
     mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
     mappedRange.memory = memory;
@@ -114,9 +135,16 @@ void Buffer::destroy()
     if (buffer)
     {
         vkDestroyBuffer(device, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
+    }
+    if (allocation.allocator)
+    {
+        allocation.allocator->free(allocation);
     }
-    if (memory)
+    else if (memory)
     {
         vkFreeMemory(device, memory, nullptr);
     }
+    memory = VK_NULL_HANDLE;
+    mapped = nullptr;
 }
\ No newline at end of file
@@ -2,12 +2,15 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanAllocator.h"
 
 struct Buffer
 {
     VkDevice device;
     VkBuffer buffer = VK_NULL_HANDLE;
     VkDeviceMemory memory = VK_NULL_HANDLE;
+    /** @brief Sub-allocated memory range, memory is shared with other resources if allocation.allocator is set */
+    Allocation allocation;
     VkDescriptorBufferInfo descriptor;
     VkDeviceSize size = 0;
     VkDeviceSize alignment = 0;
@@ -1,6 +1,7 @@
 // SRS - Enable beta extensions and make VK_KHR_portability_subset visible
 #define VK_ENABLE_BETA_EXTENSIONS
 #include <VulkanDevice.h>
+#include <VulkanAsyncUploader.h>
 #include <unordered_set>
 
 
@@ -51,6 +52,22 @@ VulkanDevice::VulkanDevice(VkPhysicalDevice physicalDevice)
 */
 VulkanDevice::~VulkanDevice()
 {
+    if (uploader)
+    {
+        delete uploader;
+    }
+    if (mipGenerator)
+    {
+        delete mipGenerator;
+    }
+    if (stagingRing)
+    {
+        delete stagingRing;
+    }
+    if (allocator)
+    {
+        delete allocator;
+    }
     if (commandPool)
     {
         vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
@@ -293,6 +310,17 @@ VkResult VulkanDevice::createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatu
     // Create a default command pool for graphics command buffers
     commandPool = createCommandPool(queueFamilyIndices.graphics);
 
+    // Device memory for buffers and images is sub-allocated from pooled blocks
+    allocator = new MemoryAllocator(this);
+
+    // Staging memory for all uploads is taken from a single persistently mapped ring buffer
+    stagingRing = new StagingRing(this, 64 * 1024 * 1024);
+
+    mipGenerator = new MipGenerator(this);
+
+    // Uploads that don't need to block go through the transfer queue
+    uploader = new AsyncUploader(this);
+
     return result;
 }
 
@@ -306,6 +334,8 @@ VkResult VulkanDevice::createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatu
 * @param memory Pointer to the memory handle acquired by the function
 * @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
 *
+* @note Allocates dedicated memory that is owned by the caller, prefer the Allocation or Buffer overloads
+*
 * @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
 */
 VkResult VulkanDevice::createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory, void *data)
@@ -355,6 +385,45 @@ VkResult VulkanDevice::createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPrope
     return VK_SUCCESS;
 }
 
+/**
+* Create a buffer on the device with memory sub-allocated from the device's memory allocator
+*
+* @param usageFlags Usage flag bit mask for the buffer (i.e. index, vertex, uniform buffer)
+* @param memoryPropertyFlags Memory properties for this buffer (i.e. device local, host visible, coherent)
+* @param size Size of the buffer in byes
+* @param buffer Pointer to the buffer handle acquired by the function
+* @param allocation Pointer to the allocation that receives the memory range bound to the buffer
+* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
+*
+* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+*/
+VkResult VulkanDevice::createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, Allocation *allocation, void *data)
+{
+    // Create the buffer handle
+    VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo(usageFlags, size);
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, buffer));
+
+    // Sub-allocate the memory backing up the buffer handle and attach it to the buffer object
+    // If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
+    VkMemoryAllocateFlags allocateFlags = (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR : 0;
+    VK_CHECK_RESULT(allocator->allocateBufferMemory(*buffer, memoryPropertyFlags, allocation, AllocationStrategy::TLSF, allocateFlags));
+
+    // If a pointer to the buffer data has been passed, copy it over through the persistent mapping
+    if (data != nullptr)
+    {
+        assert(allocation->mapped);
+        memcpy(allocation->mapped, data, size);
+        // If host coherency hasn't been requested, do a manual flush to make writes visible
+        if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+        {
+            allocator->flush(*allocation);
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
 /**
 * Create a buffer on the device
 *
@@ -364,53 +433,28 @@ VkResult VulkanDevice::createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPrope
 * @param size Size of the buffer in bytes
 * @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
 *
+* @note The buffer memory is sub-allocated from the device's memory allocator and already bound on return
+*
 * @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
 */
 VkResult VulkanDevice::createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, Buffer *buffer, VkDeviceSize size, void *data)
 {
     buffer->device = logicalDevice;
 
-    // Create the buffer handle
-    VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo(usageFlags, size);
-    VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
-
-    // Create the memory backing up the buffer handle
     VkMemoryRequirements memReqs;
-    VkMemoryAllocateInfo memAlloc = initializers::memoryAllocateInfo();
+    VK_CHECK_RESULT(createBuffer(usageFlags, memoryPropertyFlags, size, &buffer->buffer, &buffer->allocation, data));
     vkGetBufferMemoryRequirements(logicalDevice, buffer->buffer, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    // Find a memory type index that fits the properties of the buffer
-    memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-    // If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-    VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
-    if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
-        allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-        memAlloc.pNext = &allocFlagsInfo;
-    }
-    VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &buffer->memory));
 
+    buffer->memory = buffer->allocation.memory;
     buffer->alignment = memReqs.alignment;
     buffer->size = size;
     buffer->usageFlags = usageFlags;
     buffer->memoryPropertyFlags = memoryPropertyFlags;
 
-    // If a pointer to the buffer data has been passed, map the buffer and copy over the data
-    if (data != nullptr)
-    {
-        VK_CHECK_RESULT(buffer->map());
-        memcpy(buffer->mapped, data, size);
-        if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
-            buffer->flush();
-
-        buffer->unmap();
-    }
-
     // Initialize a default descriptor that covers the whole buffer size
     buffer->setupDescriptor();
 
-    // Attach the memory to the buffer object
-    return buffer->bind();
+    return VK_SUCCESS;
 }
 
 /**
@@ -443,6 +487,301 @@ void VulkanDevice::copyBuffer(Buffer *src, Buffer *dst, VkQueue queue, VkBufferC
     flushCommandBuffer(copyCmd, queue);
 }
 
+namespace
+{
+    // Keeps staging regions aligned for buffer and image copies (covers texel and compressed block sizes)
+    const VkDeviceSize stagingAlignment = 16;
+
+    VkDeviceSize allocateStaging(VkDeviceSize& stagingSize, VkDeviceSize size)
+    {
+        VkDeviceSize offset = (stagingSize + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+        stagingSize = offset + size;
+        return offset;
+    }
+}
+
+/**
+* Queue a buffer upload
+*
+* @param dstBuffer Buffer to upload to (must have VK_BUFFER_USAGE_TRANSFER_DST_BIT set)
+* @param data Pointer to the data to upload, must stay valid until the batch has been flushed or submitted
+* @param size Size of the data in bytes
+* @param dstOffset (Optional) Byte offset into the destination buffer
+*/
+void UploadBatch::uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+    assert(data && size > 0);
+    BufferUpload upload{};
+    upload.dstBuffer = dstBuffer;
+    upload.dstOffset = dstOffset;
+    upload.size = size;
+    upload.data = data;
+    upload.stagingOffset = allocateStaging(stagingSize, size);
+    bufferUploads.push_back(upload);
+}
+
+/**
+* Queue an image upload, the image is transitioned from an undefined layout to finalLayout
+*
+* @param dstImage Image to upload to (must have VK_IMAGE_USAGE_TRANSFER_DST_BIT set, and the usage returned by MipGenerator::imageUsage for mip generation)
+* @param data Pointer to the data to upload, must stay valid until the batch has been flushed or submitted
+* @param size Size of the data in bytes
+* @param regions Copy regions with buffer offsets relative to data
+* @param subresourceRange Subresources of the image that are written by the upload
+* @param finalLayout (Optional) Layout the image is left in (Defaults to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+* @param generateMipmaps (Optional) Generate the remaining levels of subresourceRange from its first level (requires a graphics queue, defaults to false)
+* @param format (Optional) Format of the image, required for mip generation to pick between blits and compute downsampling
+*/
+void UploadBatch::uploadImage(VkImage dstImage, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, const VkImageSubresourceRange& subresourceRange, VkImageLayout finalLayout, bool generateMipmaps, VkFormat format)
+{
+    assert(data && size > 0 && !regions.empty());
+    assert(!generateMipmaps || (format != VK_FORMAT_UNDEFINED));
+    ImageUpload upload{};
+    upload.dstImage = dstImage;
+    upload.size = size;
+    upload.data = data;
+    upload.stagingOffset = allocateStaging(stagingSize, size);
+    upload.regions = regions;
+    upload.subresourceRange = subresourceRange;
+    upload.finalLayout = finalLayout;
+    upload.generateMipmaps = generateMipmaps && (subresourceRange.levelCount > 1);
+    upload.format = format;
+    imageUploads.push_back(upload);
+}
+
+/**
+* Keep host data alive for the lifetime of the batch
+*
+* @param data Owning pointer to data referenced by queued uploads
+*/
+void UploadBatch::retain(std::shared_ptr<void> data)
+{
+    retainedData.push_back(std::move(data));
+}
+
+bool UploadBatch::empty() const
+{
+    return bufferUploads.empty() && imageUploads.empty();
+}
+
+/**
+* Copy the data of all uploads into a mapped staging buffer of at least stagingSize bytes
+*/
+void UploadBatch::writeStaging(void* mapped) const
+{
+    uint8_t *dst = static_cast<uint8_t*>(mapped);
+    for (auto &upload : bufferUploads)
+    {
+        memcpy(dst + upload.stagingOffset, upload.data, upload.size);
+    }
+    for (auto &upload : imageUploads)
+    {
+        memcpy(dst + upload.stagingOffset, upload.data, upload.size);
+    }
+}
+
+/**
+* Record the copies from the staging buffer on the queue family doing the transfer
+*
+* @param commandBuffer Command buffer of srcQueueFamilyIndex to record into
+* @param stagingBuffer Buffer the batch has been written to with writeStaging
+* @param stagingOffset Offset of the batch's staging data in stagingBuffer
+* @param srcQueueFamilyIndex Queue family the command buffer is submitted to
+* @param dstQueueFamilyIndex Queue family the resources are used on afterwards, if it differs ownership is released to it
+*
+* @note Images are left in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, recordAcquire has to be recorded on dstQueueFamilyIndex afterwards
+*/
+void UploadBatch::recordTransfer(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex)
+{
+    const bool releaseOwnership = srcQueueFamilyIndex != dstQueueFamilyIndex;
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (auto &upload : imageUploads)
+    {
+        VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+        imageBarrier.srcAccessMask = 0;
+        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.image = upload.dstImage;
+        imageBarrier.subresourceRange = upload.subresourceRange;
+        imageBarriers.push_back(imageBarrier);
+    }
+    if (!imageBarriers.empty())
+    {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    // Uploads to the same destination are issued with a single copy command
+    std::stable_sort(bufferUploads.begin(), bufferUploads.end(), [](const BufferUpload &a, const BufferUpload &b) { return a.dstBuffer < b.dstBuffer; });
+    std::vector<VkBufferCopy> copyRegions;
+    for (size_t i = 0; i < bufferUploads.size(); i++)
+    {
+        const BufferUpload &upload = bufferUploads[i];
+        copyRegions.push_back({ stagingOffset + upload.stagingOffset, upload.dstOffset, upload.size });
+        if ((i + 1 == bufferUploads.size()) || (bufferUploads[i + 1].dstBuffer != upload.dstBuffer))
+        {
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, upload.dstBuffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+            copyRegions.clear();
+        }
+    }
+    for (auto &upload : imageUploads)
+    {
+        std::vector<VkBufferImageCopy> regions(upload.regions);
+        for (auto &region : regions)
+        {
+            region.bufferOffset += stagingOffset + upload.stagingOffset;
+        }
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, upload.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    }
+
+    if (!releaseOwnership)
+    {
+        return;
+    }
+
+    // Release the written resources to the queue family that uses them, the matching acquire is recorded by recordAcquire
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    for (auto &upload : bufferUploads)
+    {
+        VkBufferMemoryBarrier bufferBarrier = initializers::bufferMemoryBarrier();
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = 0;
+        bufferBarrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+        bufferBarrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+        bufferBarrier.buffer = upload.dstBuffer;
+        bufferBarrier.offset = upload.dstOffset;
+        bufferBarrier.size = upload.size;
+        bufferBarriers.push_back(bufferBarrier);
+    }
+    for (auto &imageBarrier : imageBarriers)
+    {
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.dstAccessMask = 0;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+        imageBarrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+/**
+* Record the commands that make the uploaded resources usable on the queue family that renders with them
+*
+* Acquires ownership if the transfer was done on another queue family, generates requested mip chains
+* and transitions images to their final layout.
+*
+* @param commandBuffer Command buffer of dstQueueFamilyIndex to record into (must be a graphics queue family if mip maps are generated)
+* @param srcQueueFamilyIndex Queue family recordTransfer was submitted to
+* @param dstQueueFamilyIndex Queue family the command buffer is submitted to
+* @param mipGenerator Generator recording the mip chains
+* @param mipResources Receives objects used by the mip generation, destroy them with MipGenerator::destroyResources once the command buffer has completed
+*/
+void UploadBatch::recordAcquire(VkCommandBuffer commandBuffer, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, MipGenerator& mipGenerator, MipGenerationResources& mipResources) const
+{
+    const VkAccessFlags bufferReadAccess = VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+    if (srcQueueFamilyIndex != dstQueueFamilyIndex)
+    {
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        for (auto &upload : bufferUploads)
+        {
+            VkBufferMemoryBarrier bufferBarrier = initializers::bufferMemoryBarrier();
+            bufferBarrier.srcAccessMask = 0;
+            bufferBarrier.dstAccessMask = bufferReadAccess;
+            bufferBarrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+            bufferBarrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+            bufferBarrier.buffer = upload.dstBuffer;
+            bufferBarrier.offset = upload.dstOffset;
+            bufferBarrier.size = upload.size;
+            bufferBarriers.push_back(bufferBarrier);
+        }
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+        for (auto &upload : imageUploads)
+        {
+            VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = 0;
+            imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+            imageBarrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+            imageBarrier.image = upload.dstImage;
+            imageBarrier.subresourceRange = upload.subresourceRange;
+            imageBarriers.push_back(imageBarrier);
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+    else if (!bufferUploads.empty())
+    {
+        VkMemoryBarrier memoryBarrier = initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = bufferReadAccess;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Mip chains of all images are generated together, the other images go to their final layout with a single barrier
+    std::vector<MipChainRequest> mipChainRequests;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (auto &upload : imageUploads)
+    {
+        if (upload.generateMipmaps)
+        {
+            mipChainRequests.push_back({ upload.dstImage, upload.format, upload.regions[0].imageExtent, upload.subresourceRange, upload.finalLayout });
+        }
+        else if (upload.finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+        {
+            VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.newLayout = upload.finalLayout;
+            imageBarrier.image = upload.dstImage;
+            imageBarrier.subresourceRange = upload.subresourceRange;
+            imageBarriers.push_back(imageBarrier);
+        }
+    }
+    if (!imageBarriers.empty())
+    {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+    if (!mipChainRequests.empty())
+    {
+        mipGenerator.record(commandBuffer, mipChainRequests, mipResources);
+    }
+}
+
+/**
+* Upload all data of a batch with a single staging buffer, command buffer and fence wait
+*
+* @param batch Batch with the uploads to execute, empty after the call
+* @param queue Queue to submit the upload commands to (must be of the graphics queue family)
+*
+* @note Blocks until the uploads have finished on the device, use AsyncUploader::submit to upload in the background
+*/
+void VulkanDevice::flushUploadBatch(UploadBatch &batch, VkQueue queue)
+{
+    if (batch.empty())
+    {
+        batch = UploadBatch();
+        return;
+    }
+
+    // One region of the staging ring holds the data of all uploads
+    StagingRegion staging = stagingRing->allocate(batch.stagingSize);
+    batch.writeStaging(staging.mapped);
+
+    VkCommandBuffer copyCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    batch.recordTransfer(copyCmd, staging.buffer, staging.offset, queueFamilyIndices.graphics, queueFamilyIndices.graphics);
+    MipGenerationResources mipResources;
+    batch.recordAcquire(copyCmd, queueFamilyIndices.graphics, queueFamilyIndices.graphics, *mipGenerator, mipResources);
+    flushCommandBuffer(copyCmd, queue, true);
+    mipGenerator->destroyResources(mipResources);
+
+    stagingRing->release(staging);
+    batch = UploadBatch();
+}
+
 /**
 * Create a command pool for allocation command buffers from
 *
@@ -1,11 +1,57 @@
 #pragma once
 
 #include "VulkanBuffer.h"
+#include "VulkanMipGenerator.h"
+#include "VulkanStagingRing.h"
 #include "VulkanTools.h"
 #include "vulkan/vulkan.h"
 #include <algorithm>
 #include <assert.h>
 #include <exception>
+#include <memory>
+
+/** @brief Buffer and image uploads that are staged and submitted together, either blocking by VulkanDevice::flushUploadBatch or in the background by AsyncUploader::submit */
+struct UploadBatch
+{
+    struct BufferUpload
+    {
+        VkBuffer dstBuffer;
+        VkDeviceSize dstOffset;
+        VkDeviceSize size;
+        const void* data;
+        VkDeviceSize stagingOffset;
+    };
+    struct ImageUpload
+    {
+        VkImage dstImage;
+        VkDeviceSize size;
+        const void* data;
+        VkDeviceSize stagingOffset;
+        /** @brief Copy regions, the buffer offsets are relative to data */
+        std::vector<VkBufferImageCopy> regions;
+        VkImageSubresourceRange subresourceRange;
+        VkImageLayout finalLayout;
+        /** @brief Fill all but the first mip level of subresourceRange by downsampling the uploaded level */
+        bool generateMipmaps;
+        VkFormat format;
+    };
+    std::vector<BufferUpload> bufferUploads;
+    std::vector<ImageUpload> imageUploads;
+    /** @brief Host data owned by the batch (e.g. decoded images), released together with the batch */
+    std::vector<std::shared_ptr<void>> retainedData;
+    /** @brief Size of the staging buffer required for all uploads of the batch */
+    VkDeviceSize stagingSize = 0;
+
+    void uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+    void uploadImage(VkImage dstImage, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, const VkImageSubresourceRange& subresourceRange, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, bool generateMipmaps = false, VkFormat format = VK_FORMAT_UNDEFINED);
+    void retain(std::shared_ptr<void> data);
+    bool empty() const;
+    void writeStaging(void* mapped) const;
+    void recordTransfer(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex);
+    void recordAcquire(VkCommandBuffer commandBuffer, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, MipGenerator& mipGenerator, MipGenerationResources& mipResources) const;
+};
+
+class AsyncUploader;
 
 struct VulkanDevice {
     /** @brief Physical device representation */
@@ -24,6 +70,14 @@ struct VulkanDevice {
     std::vector<VkQueueFamilyProperties> queueFamilyProperties;
     /** @brief List of extensions supported by the device */
     std::vector<std::string> supportedExtensions;
+    /** @brief Pooled allocator all device memory of the framework is sub-allocated from */
+    MemoryAllocator* allocator = nullptr;
+    /** @brief Persistently mapped staging memory shared by all uploads */
+    StagingRing* stagingRing = nullptr;
+    /** @brief Batched mip chain generation for uploaded images */
+    MipGenerator* mipGenerator = nullptr;
+    /** @brief Background uploads on the (dedicated if available) transfer queue */
+    AsyncUploader* uploader = nullptr;
     /** @brief Default command pool for the graphics queue family index */
     VkCommandPool commandPool = VK_NULL_HANDLE;
     /** @brief Set to true when the debug marker extension is detected */
@@ -45,8 +99,10 @@ struct VulkanDevice {
     uint32_t        getQueueFamilyIndex(VkQueueFlags queueFlags) const;
     VkResult        createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatures, std::vector<const char *> enabledExtensions, void *pNextChain, bool useSwapChain = true, VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
     VkResult        createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory, void *data = nullptr);
+    VkResult        createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, Allocation *allocation, void *data = nullptr);
     VkResult        createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, Buffer *buffer, VkDeviceSize size, void *data = nullptr);
     void            copyBuffer(Buffer *src, Buffer *dst, VkQueue queue, VkBufferCopy *copyRegion = nullptr);
+    void            flushUploadBatch(UploadBatch &batch, VkQueue queue);
     VkCommandPool   createCommandPool(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags createFlags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
     VkCommandBuffer createCommandBuffer(VkCommandBufferLevel level, VkCommandPool pool, bool begin = false);
     VkCommandBuffer createCommandBuffer(VkCommandBufferLevel level, bool begin = false);
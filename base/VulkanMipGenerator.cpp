@@ -0,0 +1,319 @@
+#include "VulkanMipGenerator.h"
+#include "VulkanDevice.h"
+
+/**
+* Create the mip generator, the compute pipeline is created on first use
+*
+* @param device Device the mip chains are generated on
+*/
+MipGenerator::MipGenerator(VulkanDevice* device) : device(device)
+{
+}
+
+MipGenerator::~MipGenerator()
+{
+    if (pipeline)
+    {
+        vkDestroyPipeline(device->logicalDevice, pipeline, nullptr);
+        vkDestroyPipelineLayout(device->logicalDevice, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
+    }
+}
+
+bool MipGenerator::supportsBlit(VkFormat format) const
+{
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (formatProperties.optimalTilingFeatures & required) == required;
+}
+
+bool MipGenerator::supportsCompute(VkFormat format) const
+{
+    // The downsample shader declares its images as rgba8
+    if (format != VK_FORMAT_R8G8B8A8_UNORM)
+    {
+        return false;
+    }
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
+    return (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0;
+}
+
+VkImageUsageFlags MipGenerator::imageUsage(VkFormat format) const
+{
+    if (!supportsBlit(format) && supportsCompute(format))
+    {
+        return VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+    return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+}
+
+/**
+* Record the generation of the mip chains of several images
+*
+* @param commandBuffer Command buffer on a queue family supporting graphics (blits) and compute
+* @param requests Images to generate the mip chains for, all levels of their subresource range must be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL with the first one written
+* @param resources Receives the objects used by compute downsampling, destroy them with destroyResources once the command buffer has completed
+*
+* @note Images are left in their requested final layout
+*/
+void MipGenerator::record(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests, MipGenerationResources& resources)
+{
+    std::vector<MipChainRequest> blitRequests;
+    std::vector<MipChainRequest> computeRequests;
+    std::vector<VkImageMemoryBarrier> unsupported;
+    for (auto& request : requests)
+    {
+        if (supportsBlit(request.format))
+        {
+            blitRequests.push_back(request);
+        }
+        else if (supportsCompute(request.format) && (request.subresourceRange.layerCount == 1))
+        {
+            computeRequests.push_back(request);
+        }
+        else
+        {
+            std::cerr << "MipGenerator: Can't generate mip levels for format " << request.format << ", only the first level is valid" << std::endl;
+            VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.newLayout = request.finalLayout;
+            imageBarrier.image = request.image;
+            imageBarrier.subresourceRange = request.subresourceRange;
+            unsupported.push_back(imageBarrier);
+        }
+    }
+    if (!unsupported.empty())
+    {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(unsupported.size()), unsupported.data());
+    }
+    if (!blitRequests.empty())
+    {
+        recordBlit(commandBuffer, blitRequests);
+    }
+    if (!computeRequests.empty())
+    {
+        recordCompute(commandBuffer, computeRequests, resources);
+    }
+}
+
+void MipGenerator::destroyResources(MipGenerationResources& resources)
+{
+    for (auto view : resources.views)
+    {
+        vkDestroyImageView(device->logicalDevice, view, nullptr);
+    }
+    if (resources.descriptorPool)
+    {
+        vkDestroyDescriptorPool(device->logicalDevice, resources.descriptorPool, nullptr);
+    }
+    resources = MipGenerationResources();
+}
+
+// Blit each level from the previous one, with one barrier per level covering all images
+void MipGenerator::recordBlit(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests)
+{
+    uint32_t maxLevels = 0;
+    for (auto& request : requests)
+    {
+        maxLevels = std::max(maxLevels, request.subresourceRange.levelCount);
+    }
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (uint32_t level = 1; level < maxLevels; level++)
+    {
+        // The previous level of every image that has this level becomes the blit source
+        imageBarriers.clear();
+        for (auto& request : requests)
+        {
+            if (level >= request.subresourceRange.levelCount)
+            {
+                continue;
+            }
+            VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            imageBarrier.image = request.image;
+            imageBarrier.subresourceRange = request.subresourceRange;
+            imageBarrier.subresourceRange.baseMipLevel = request.subresourceRange.baseMipLevel + level - 1;
+            imageBarrier.subresourceRange.levelCount = 1;
+            imageBarriers.push_back(imageBarrier);
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+        for (auto& request : requests)
+        {
+            if (level >= request.subresourceRange.levelCount)
+            {
+                continue;
+            }
+            const VkImageSubresourceRange& range = request.subresourceRange;
+            VkImageBlit imageBlit{};
+            imageBlit.srcSubresource = { range.aspectMask, range.baseMipLevel + level - 1, range.baseArrayLayer, range.layerCount };
+            imageBlit.srcOffsets[1] = { int32_t(std::max(1u, request.extent.width >> (level - 1))), int32_t(std::max(1u, request.extent.height >> (level - 1))), 1 };
+            imageBlit.dstSubresource = { range.aspectMask, range.baseMipLevel + level, range.baseArrayLayer, range.layerCount };
+            imageBlit.dstOffsets[1] = { int32_t(std::max(1u, request.extent.width >> level)), int32_t(std::max(1u, request.extent.height >> level)), 1 };
+            vkCmdBlitImage(commandBuffer, request.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, request.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
+        }
+    }
+
+    // All but the last level are blit sources now, move everything to the final layout at once
+    imageBarriers.clear();
+    for (auto& request : requests)
+    {
+        VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.newLayout = request.finalLayout;
+        imageBarrier.image = request.image;
+        imageBarrier.subresourceRange = request.subresourceRange;
+        imageBarrier.subresourceRange.levelCount = request.subresourceRange.levelCount - 1;
+        if (imageBarrier.subresourceRange.levelCount > 0)
+        {
+            imageBarriers.push_back(imageBarrier);
+        }
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.subresourceRange.baseMipLevel = request.subresourceRange.baseMipLevel + request.subresourceRange.levelCount - 1;
+        imageBarrier.subresourceRange.levelCount = 1;
+        imageBarriers.push_back(imageBarrier);
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void MipGenerator::preparePipeline()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pipeline)
+    {
+        return;
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+    };
+    VkDescriptorSetLayoutCreateInfo descriptorLayout = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayout, nullptr, &descriptorSetLayout));
+
+    // Source and destination level sizes
+    VkPushConstantRange pushConstantRange = initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(int32_t) * 4, 0);
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(device->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+    VkPipelineShaderStageCreateInfo shaderStage = {};
+    shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shaderStage.module = tools::loadShader((getBaseShaderPath() + "mipdownsample.comp.spv").c_str(), device->logicalDevice);
+    shaderStage.pName = "main";
+    assert(shaderStage.module != VK_NULL_HANDLE);
+    VkComputePipelineCreateInfo computePipelineCreateInfo = initializers::computePipelineCreateInfo(pipelineLayout);
+    computePipelineCreateInfo.stage = shaderStage;
+    VK_CHECK_RESULT(vkCreateComputePipelines(device->logicalDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &pipeline));
+    vkDestroyShaderModule(device->logicalDevice, shaderStage.module, nullptr);
+}
+
+// Downsample each level from the previous one in a compute shader, with one barrier per level covering all images
+void MipGenerator::recordCompute(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests, MipGenerationResources& resources)
+{
+    preparePipeline();
+
+    uint32_t maxLevels = 0;
+    uint32_t setCount = 0;
+    for (auto& request : requests)
+    {
+        maxLevels = std::max(maxLevels, request.subresourceRange.levelCount);
+        setCount += request.subresourceRange.levelCount - 1;
+    }
+
+    // One view per level and one set per generated level, reading the previous level's view
+    std::vector<VkDescriptorPoolSize> poolSizes = { initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount * 2) };
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = initializers::descriptorPoolCreateInfo(poolSizes, setCount);
+    VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolInfo, nullptr, &resources.descriptorPool));
+
+    std::vector<std::vector<VkDescriptorSet>> descriptorSets(requests.size());
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        const MipChainRequest& request = requests[i];
+        std::vector<VkImageView> levelViews(request.subresourceRange.levelCount);
+        for (uint32_t level = 0; level < request.subresourceRange.levelCount; level++)
+        {
+            VkImageViewCreateInfo viewInfo = initializers::imageViewCreateInfo();
+            viewInfo.image = request.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = request.format;
+            viewInfo.subresourceRange = request.subresourceRange;
+            viewInfo.subresourceRange.baseMipLevel = request.subresourceRange.baseMipLevel + level;
+            viewInfo.subresourceRange.levelCount = 1;
+            VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &levelViews[level]));
+            resources.views.push_back(levelViews[level]);
+        }
+        descriptorSets[i].resize(request.subresourceRange.levelCount - 1);
+        for (uint32_t level = 1; level < request.subresourceRange.levelCount; level++)
+        {
+            VkDescriptorSet& descriptorSet = descriptorSets[i][level - 1];
+            VkDescriptorSetAllocateInfo allocInfo = initializers::descriptorSetAllocateInfo(resources.descriptorPool, &descriptorSetLayout, 1);
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &allocInfo, &descriptorSet));
+            VkDescriptorImageInfo srcInfo = initializers::descriptorImageInfo(VK_NULL_HANDLE, levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+            VkDescriptorImageInfo dstInfo = initializers::descriptorImageInfo(VK_NULL_HANDLE, levelViews[level], VK_IMAGE_LAYOUT_GENERAL);
+            std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+                initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &srcInfo),
+                initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &dstInfo),
+            };
+            vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+        }
+
+        VkImageMemoryBarrier imageBarrier = initializers::imageMemoryBarrier();
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.image = request.image;
+        imageBarrier.subresourceRange = request.subresourceRange;
+        imageBarriers.push_back(imageBarrier);
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    for (uint32_t level = 1; level < maxLevels; level++)
+    {
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            const MipChainRequest& request = requests[i];
+            if (level >= request.subresourceRange.levelCount)
+            {
+                continue;
+            }
+            const int32_t sizes[4] = {
+                int32_t(std::max(1u, request.extent.width >> (level - 1))), int32_t(std::max(1u, request.extent.height >> (level - 1))),
+                int32_t(std::max(1u, request.extent.width >> level)), int32_t(std::max(1u, request.extent.height >> level))
+            };
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[i][level - 1], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+            vkCmdDispatch(commandBuffer, (sizes[2] + 7) / 8, (sizes[3] + 7) / 8, 1);
+        }
+        // The level written by all dispatches above is read by the next round
+        VkMemoryBarrier memoryBarrier = initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        imageBarriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageBarriers[i].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarriers[i].newLayout = requests[i].finalLayout;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
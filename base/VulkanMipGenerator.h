@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+struct VulkanDevice;
+
+/** @brief Image whose mip chain is generated from its first level */
+struct MipChainRequest {
+    VkImage image;
+    VkFormat format;
+    /** @brief Extent of the first level of subresourceRange */
+    VkExtent3D extent;
+    VkImageSubresourceRange subresourceRange;
+    VkImageLayout finalLayout;
+};
+
+/** @brief Objects referenced by recorded compute mip generation, destroyed by MipGenerator::destroyResources once the commands have completed */
+struct MipGenerationResources {
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkImageView> views;
+};
+
+/**
+* Batched mip chain generation
+*
+* Records the mip chains of all requested images into one command buffer, level by level, so each level
+* needs a single barrier for all images instead of one per image. Images with a format that can't be blitted
+* are downsampled by a compute shader (VK_FORMAT_R8G8B8A8_UNORM only) and have to be created with the usage
+* returned by imageUsage().
+*/
+class MipGenerator
+{
+public:
+    explicit MipGenerator(VulkanDevice* device);
+    ~MipGenerator();
+
+    /** @brief True if the format supports linear blits with optimal tiling */
+    bool supportsBlit(VkFormat format) const;
+    /** @brief Usage flags an image needs for its mip chain to be generated, in addition to VK_IMAGE_USAGE_TRANSFER_DST_BIT */
+    VkImageUsageFlags imageUsage(VkFormat format) const;
+
+    void record(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests, MipGenerationResources& resources);
+    void destroyResources(MipGenerationResources& resources);
+
+private:
+    VulkanDevice* device;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    // Guards the pipeline, which is only created once an image needs the compute path
+    std::mutex mutex;
+
+    bool supportsCompute(VkFormat format) const;
+    void preparePipeline();
+    void recordBlit(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests);
+    void recordCompute(VkCommandBuffer commandBuffer, const std::vector<MipChainRequest>& requests, MipGenerationResources& resources);
+};
@@ -3,20 +3,9 @@
 //
 
 #include "VulkanObjModel.h"
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-#include <unordered_map>
-
-namespace std {
-    // hash function for Vertex
-    template<> struct hash<Vertex>
-    {
-        size_t operator()(Vertex const& vertex) const
-        {
-            return vertex.hash();
-        }
-    };
-}
+#include "MeshOptimizer.h"
+#include "ObjParser.h"
+#include "threadpool.hpp"
 
 // uniform buffer object for model transformation
 struct MaterialUbo
@@ -29,6 +18,9 @@ struct MeshMaterialGroup // grouped by material
 {
     std::vector<Vertex> vertices = {};
     std::vector<Vertex::index_t> vertex_indices = {};
+    // 16-bit indices of the group, relative to the vertex offset of their range
+    std::vector<uint16_t> indices16 = {};
+    std::vector<IndexRange> index_ranges = {};
 
     std::string albedo_map_path = "";
     std::string normal_map_path = "";
@@ -36,91 +28,137 @@ struct MeshMaterialGroup // grouped by material
 
 std::vector<MeshMaterialGroup> LoadModel(const std::string path)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    ObjParser::ObjData obj;
     std::string err;
 
     std::string folder = path.substr(0, path.find_last_of("/\\")) + "/";
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str(), folder.c_str())) {
+    if (!ObjParser::load(path, obj, err)) {
         throw std::runtime_error(err);
     }
 
-    assert(attrib.normals.size() > 0);
+    assert(obj.normals.size() > 0);
 
     // Group parts of the same material together, +1 for unknown material
-    std::vector<MeshMaterialGroup> groups(materials.size() + 1);
+    std::vector<MeshMaterialGroup> groups(obj.materials.size() + 1);
 
-    for (size_t i = 0; i < materials.size(); i++)
+    for (size_t i = 0; i < obj.materials.size(); i++)
     {
-        if (materials[i].diffuse_texname != "")
+        if (obj.materials[i].diffuseTexture != "")
         {
-            groups[i + 1].albedo_map_path = folder + materials[i].diffuse_texname;
+            groups[i + 1].albedo_map_path = folder + obj.materials[i].diffuseTexture;
         }
-        if (materials[i].normal_texname != "")
+        if (obj.materials[i].normalTexture != "")
         {
-            groups[i + 1].normal_map_path = folder + materials[i].normal_texname;
+            groups[i + 1].normal_map_path = folder + obj.materials[i].normalTexture;
         }
-        else if (materials[i].bump_texname != "")
+        else if (obj.materials[i].bumpTexture != "")
         {
             // CryEngine sponza scene uses keyword "bump" to store normal
-            groups[i + 1].normal_map_path = folder + materials[i].bump_texname;
+            groups[i + 1].normal_map_path = folder + obj.materials[i].bumpTexture;
         }
     }
 
-    std::vector<std::unordered_map<Vertex, size_t>> unique_vertices_per_group(materials.size() + 1);
+    // Triangles are assigned to their group in file order, so the vertex order of every group is deterministic
+    std::vector<std::vector<uint32_t>> group_triangles(groups.size());
+    for (size_t t = 0; t < obj.materialIds.size(); t++)
+    {
+        group_triangles[obj.materialIds[t] + 1].push_back(static_cast<uint32_t>(t));
+    }
 
     // 逐顶点遍历，构建vertexBuffer和 indexBuffer
-    auto appendVertex = [&unique_vertices_per_group, &groups](const Vertex& vertex, int material_id) {
-        auto& unique_vertices = unique_vertices_per_group[material_id + 1]; // 顶点与其索引的键值对
-        auto& group = groups[material_id + 1];
-        if (unique_vertices.count(vertex) == 0) {
-            unique_vertices[vertex] = group.vertices.size(); // auto incrementing size;
-            group.vertices.push_back(vertex);
+    // Corners are deduplicated by their index triple, which identifies a vertex without hashing its attributes
+    auto buildGroup = [&obj, &groups, &group_triangles](size_t g, bool parallel) {
+        auto& group = groups[g];
+        std::vector<ObjParser::Index> corners;
+        corners.reserve(group_triangles[g].size() * 3);
+        for (uint32_t t : group_triangles[g])
+        {
+            corners.insert(corners.end(), obj.indices.begin() + t * 3, obj.indices.begin() + t * 3 + 3);
         }
-        group.vertex_indices.push_back(static_cast<Vertex::index_t>(unique_vertices[vertex])); // vertex_indices即为indexBuffer的值
-    };
+        ObjParser::Deduplication dedup;
+        ObjParser::deduplicate(corners.data(), corners.size(), dedup, parallel);
 
-    for (const auto& shape : shapes)
-    {
-        size_t indexOffset = 0;
-        for (size_t n = 0; n < shape.mesh.num_face_vertices.size(); n++)
+        group.vertex_indices.assign(dedup.cornerVertices.begin(), dedup.cornerVertices.end()); // vertex_indices即为indexBuffer的值
+        group.vertices.resize(dedup.vertexCorners.size());
+        for (size_t v = 0; v < dedup.vertexCorners.size(); v++)
         {
-            // per face
-            auto ngon = shape.mesh.num_face_vertices[n];
-            auto material_id = shape.mesh.material_ids[n];
-            for (size_t f = 0; f < ngon; f++)
-            {
-                const auto& index = shape.mesh.indices[indexOffset + f];
+            const auto& index = corners[dedup.vertexCorners[v]];
+            Vertex& vertex = group.vertices[v];
 
-                Vertex vertex;
+            vertex.pos = {
+                    obj.positions[3 * index.position + 0],
+                    obj.positions[3 * index.position + 1],
+                    obj.positions[3 * index.position + 2]
+            };
 
-                vertex.pos = {
-                        attrib.vertices[3 * index.vertex_index + 0],
-                        attrib.vertices[3 * index.vertex_index + 1],
-                        attrib.vertices[3 * index.vertex_index + 2]
-                };
+            vertex.color = glm::vec3(1.0f);
 
+            vertex.tex_coord = glm::vec2(0.0f);
+            if (index.texcoord >= 0)
+            {
                 vertex.tex_coord = {
-                        attrib.texcoords[2 * index.texcoord_index + 0],
-                        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+                        obj.texcoords[2 * index.texcoord + 0],
+                        1.0f - obj.texcoords[2 * index.texcoord + 1]
                 };
+            }
 
+            vertex.normal = glm::vec3(0.0f);
+            if (index.normal >= 0)
+            {
                 vertex.normal = {
-                        attrib.normals[3 * index.normal_index + 0],
-                        attrib.normals[3 * index.normal_index + 1],
-                        attrib.normals[3 * index.normal_index + 2]
+                        obj.normals[3 * index.normal + 0],
+                        obj.normals[3 * index.normal + 1],
+                        obj.normals[3 * index.normal + 2]
                 };
+            }
+        }
+    };
 
-                // flipY
-//                vertex.pos.y *= -1.0f;
-//                vertex.normal.y *= -1.0f;
-//                vertex.tex_coord.y = 1.0 - vertex.tex_coord.y;
-
-                appendVertex(vertex, material_id);
+    // Small groups are built side by side, large ones one after another with the table build spread over the workers
+    const size_t bulk_corner_count = 1 << 20;
+    std::vector<size_t> small_groups, large_groups;
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        (group_triangles[g].size() * 3 >= bulk_corner_count ? large_groups : small_groups).push_back(g);
+    }
+    ThreadPool::shared().parallelFor(small_groups.size(), [&](size_t i) {
+        buildGroup(small_groups[i], false);
+    });
+    for (size_t g : large_groups)
+    {
+        buildGroup(g, true);
+    }
 
+    // Faces are triangulated by the loader, so every group is a triangle list
+    for (size_t i = 0; i < groups.size(); i++) {
+        auto& group = groups[i];
+        if (group.vertex_indices.empty()) {
+            continue;
+        }
+        MeshOptimizer::optimize(group.vertices, group.vertex_indices, offsetof(Vertex, pos));
+
+        // Groups with more vertices than 16-bit indices can address are split into ranges drawn with their own vertex offset
+        if (group.vertices.size() <= MeshOptimizer::maxVertices16) {
+            group.indices16.assign(group.vertex_indices.begin(), group.vertex_indices.end());
+            IndexRange range;
+            range.index_count = static_cast<uint32_t>(group.vertex_indices.size());
+            group.index_ranges.push_back(range);
+            continue;
+        }
+        auto submeshes = MeshOptimizer::splitSubmeshes(group.vertices, group.vertex_indices);
+        group.vertices.clear();
+        group.vertex_indices.clear();
+        for (const auto& submesh : submeshes) {
+            IndexRange range;
+            range.first_index = static_cast<uint32_t>(group.indices16.size());
+            range.index_count = static_cast<uint32_t>(submesh.indices.size());
+            range.vertex_offset = static_cast<int32_t>(group.vertices.size());
+            for (auto index : submesh.indices) {
+                group.indices16.push_back(static_cast<uint16_t>(index));
+                group.vertex_indices.push_back(index + range.vertex_offset);
             }
-            indexOffset += ngon;
+            group.vertices.insert(group.vertices.end(), submesh.vertices.begin(), submesh.vertices.end());
+            group.index_ranges.push_back(range);
         }
     }
 
@@ -135,18 +173,12 @@ ObjModel::~ObjModel()
     {
         vkDestroyBuffer(device->logicalDevice, buffer, nullptr);
     }
-    if (buffer_memory)
-    {
-        vkFreeMemory(device->logicalDevice, buffer_memory, nullptr);
-    }
+    device->allocator->free(buffer_allocation);
     if (uniform_buffer)
     {
         vkDestroyBuffer(device->logicalDevice, uniform_buffer, nullptr);
     }
-    if (uniform_buffer_memory)
-    {
-        vkFreeMemory(device->logicalDevice, uniform_buffer_memory, nullptr);
-    }
+    device->allocator->free(uniform_buffer_allocation);
     if (material_descriptor_set_layout)
     {
         vkDestroyDescriptorSetLayout(device->logicalDevice, material_descriptor_set_layout, nullptr);
@@ -185,9 +217,10 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
             continue;
         }
         VkDeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-        VkDeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
+        VkDeviceSize index_section_size = sizeof(group.indices16[0]) * group.indices16.size();
         buffer_size += vertex_section_size;
-        buffer_size += index_section_size;
+        // 16-bit index sections are padded, so the following vertex section stays 4 byte aligned
+        buffer_size += (index_section_size + 3) & ~VkDeviceSize(3);
     }
 
     // Create a large device local buffer
@@ -195,10 +228,11 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             buffer_size,
-            &buffer, &buffer_memory
+            &buffer, &buffer_allocation
             ));
 
-    // Upload buffers using staging buffer
+    // Vertex and index data of all groups (and the material parameters below) are uploaded in one batch
+    UploadBatch uploadBatch;
     VkDeviceSize current_offset = 0;
     for (auto& group : groups) {
         if (group.vertex_indices.size() <= 0) {
@@ -206,59 +240,21 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
         }
 
         VkDeviceSize vertex_section_size = sizeof(group.vertices[0]) * group.vertices.size();
-        VkDeviceSize index_section_size = sizeof(group.vertex_indices[0]) * group.vertex_indices.size();
+        VkDeviceSize index_section_size = sizeof(group.indices16[0]) * group.indices16.size();
 
         // copy vertex data
         BufferSection vertex_buffer_section = {buffer, current_offset, vertex_section_size};
-        {
-            VkBuffer staging_buffer;
-            VkDeviceMemory staging_buffer_memory;
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    vertex_section_size,
-                    &staging_buffer, &staging_buffer_memory, group.vertices.data()
-                    ));
-
-            VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-            VkBufferCopy copyRegion = {};
-            copyRegion.size = vertex_section_size;
-            copyRegion.dstOffset = current_offset;
-            vkCmdCopyBuffer(copyCmd, staging_buffer, buffer, 1, &copyRegion);
-            device->flushCommandBuffer(copyCmd, transferQueue, true);
-
-            vkDestroyBuffer(device->logicalDevice, staging_buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, staging_buffer_memory, nullptr);
-
-            current_offset += vertex_section_size;
-        }
+        uploadBatch.uploadBuffer(buffer, group.vertices.data(), vertex_section_size, current_offset);
+        current_offset += vertex_section_size;
 
         // copy index data
         BufferSection index_buffer_section = { buffer, current_offset, index_section_size };
-        {
-            VkBuffer staging_buffer;
-            VkDeviceMemory staging_buffer_memory;
-            VK_CHECK_RESULT(device->createBuffer(
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    index_section_size,
-                    &staging_buffer, &staging_buffer_memory, group.vertex_indices.data()
-            ));
-
-            VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-            VkBufferCopy copyRegion = {};
-            copyRegion.size = index_section_size;
-            copyRegion.dstOffset = current_offset;
-            vkCmdCopyBuffer(copyCmd, staging_buffer, buffer, 1, &copyRegion);
-            device->flushCommandBuffer(copyCmd, transferQueue, true);
-
-            vkDestroyBuffer(device->logicalDevice, staging_buffer, nullptr);
-            vkFreeMemory(device->logicalDevice, staging_buffer_memory, nullptr);
-
-            current_offset += index_section_size;
-        }
+        uploadBatch.uploadBuffer(buffer, group.indices16.data(), index_section_size, current_offset);
+        current_offset += (index_section_size + 3) & ~VkDeviceSize(3);
 
         MeshPart part = { vertex_buffer_section, index_buffer_section, group.vertex_indices.size() };
+        part.index_type = VK_INDEX_TYPE_UINT16;
+        part.index_ranges = group.index_ranges;
 
         if (!group.albedo_map_path.empty()) {
             part.albedo_map = new Texture2D();
@@ -308,11 +304,15 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             uniform_buffer_size,
-            &uniform_buffer, &uniform_buffer_memory
+            &uniform_buffer, &uniform_buffer_allocation
             ));
 
+    // Kept alive until the upload batch has been flushed
+    std::vector<MaterialUbo> material_ubos(mesh_parts.size());
+
     VkDeviceSize uniform_buffer_total_offset = 0;
-    for (auto& part : mesh_parts) {
+    for (size_t i = 0; i < mesh_parts.size(); i++) {
+        auto& part = mesh_parts[i];
         VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
         descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         descriptorSetAllocInfo.descriptorPool = descriptorPool;
@@ -321,7 +321,7 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &part.material_descriptor_set));
 
         std::vector<VkWriteDescriptorSet> writes {};
-        MaterialUbo ubo {0, 0};
+        MaterialUbo& ubo = material_ubos[i];
 
         VkDescriptorBufferInfo bufferInfo {};
         bufferInfo.buffer = uniform_buffer;
@@ -368,40 +368,28 @@ void ObjModel::LoadModelFromFile(std::string filename, VulkanDevice* device, VkQ
         vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 
         // update unifrom buffer
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
-        VK_CHECK_RESULT(device->createBuffer(
-                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                sizeof(MaterialUbo),
-                &staging_buffer, &staging_memory, &ubo
-                ));
-        VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-        VkBufferCopy copyRegion = {};
-        copyRegion.size = sizeof(MaterialUbo);
-        copyRegion.dstOffset = uniform_buffer_total_offset;
-        vkCmdCopyBuffer(copyCmd, staging_buffer, uniform_buffer, 1, &copyRegion);
-        device->flushCommandBuffer(copyCmd, transferQueue, true);
-
-        vkDestroyBuffer(device->logicalDevice, staging_buffer, nullptr);
-        vkFreeMemory(device->logicalDevice, staging_memory, nullptr);
+        uploadBatch.uploadBuffer(uniform_buffer, &ubo, sizeof(MaterialUbo), uniform_buffer_total_offset);
 
         // update uniform buffer offset
         uniform_buffer_total_offset += alignment_offset;
     }
+
+    device->flushUploadBatch(uploadBatch, transferQueue);
 }
 
 void ObjModel::Draw(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout)
 {
     for (const auto& part : mesh_parts) {
         vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &part.vertex_buffer_section.buffer, &part.vertex_buffer_section.offset);
-        vkCmdBindIndexBuffer(cmdBuffer, part.index_buffer_section.buffer, part.index_buffer_section.offset, VK_INDEX_TYPE_UINT32);
+        vkCmdBindIndexBuffer(cmdBuffer, part.index_buffer_section.buffer, part.index_buffer_section.offset, part.index_type);
 
         // 前一个参数first set指的是当前绑定的descriptorSet数组，从第几个set开始（shader中的 set = n），在同一个renderPass里面可以调用多次
         // 比如说，第一次调用vkCmdBindDescriptorSets，绑定了四个descriptorSets，那么第二次调用vkCmdBindDescriptorSets则需要传入firstSet=4（set从0开始计数）
         vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
                                 1, 1, &part.material_descriptor_set,
                                 0, nullptr);
-        vkCmdDrawIndexed(cmdBuffer, part.index_count, 1, 0, 0, 0);
+        for (const auto& range : part.index_ranges) {
+            vkCmdDrawIndexed(cmdBuffer, range.index_count, 1, range.first_index, range.vertex_offset, 0);
+        }
     }
 }
@@ -26,11 +26,20 @@ struct BufferSection {
     {}
 };
 
+// Indices of a mesh part drawn with one call, relative to vertex_offset
+struct IndexRange {
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+    int32_t vertex_offset = 0;
+};
+
 struct MeshPart {
     BufferSection vertex_buffer_section = {};
     BufferSection index_buffer_section = {};
     BufferSection material_uniform_buffer_section = {};
     size_t index_count = 0;
+    VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+    std::vector<IndexRange> index_ranges = {};
     VkDescriptorSet material_descriptor_set = {};
 
     Texture2D* albedo_map = nullptr;
@@ -142,10 +151,10 @@ public:
 
 private:
     VulkanDevice* device;
-    VkBuffer buffer;
-    VkDeviceMemory buffer_memory;
-    VkBuffer uniform_buffer;
-    VkDeviceMemory uniform_buffer_memory;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation buffer_allocation;
+    VkBuffer uniform_buffer = VK_NULL_HANDLE;
+    Allocation uniform_buffer_allocation;
     VkDescriptorPool descriptorPool;
     VkDescriptorSetLayout material_descriptor_set_layout = VK_NULL_HANDLE;
 
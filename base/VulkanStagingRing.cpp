@@ -0,0 +1,230 @@
+#include "VulkanStagingRing.h"
+#include "VulkanDevice.h"
+
+/**
+* Create the ring buffer
+*
+* @param device Device to create the ring on
+* @param size Size of the ring in bytes, requests larger than half of it are served by temporary buffers
+*/
+StagingRing::StagingRing(VulkanDevice* device, VkDeviceSize size) : device(device), capacity(size)
+{
+    VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, capacity);
+    VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &buffer));
+    VK_CHECK_RESULT(device->allocator->allocateBufferMemory(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &allocation));
+    stats.capacity = capacity;
+}
+
+/**
+* Default destructor
+*
+* @note Waits for the fences of released regions, all regions must have been released
+*/
+StagingRing::~StagingRing()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    destroyTemporaryBuffers(true);
+    while (reclaim(true)) {}
+    if (!entries.empty())
+    {
+        std::cerr << "StagingRing: " << entries.size() << " staging regions have not been released" << std::endl;
+    }
+    vkDestroyBuffer(device->logicalDevice, buffer, nullptr);
+    device->allocator->free(allocation);
+}
+
+/**
+* Allocate a staging region
+*
+* @param size Size of the region in bytes
+* @param alignment (Optional) Alignment of the region's offset (Defaults to 16, which covers buffer and image copies)
+*
+* @note Can be called from any thread, the region has to be handed back with release() once the device no longer reads it
+*
+* @return Mapped region inside the ring, or inside a temporary buffer if the ring can't serve the request
+*/
+StagingRegion StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert(size > 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    destroyTemporaryBuffers(false);
+
+    StagingRegion region;
+    region.size = size;
+
+    // Requests that would occupy most of the ring stall everyone else, so they always get their own buffer
+    if (size + alignment <= capacity / 2)
+    {
+        reclaim(false);
+        VkDeviceSize offset;
+        bool found = tryAllocate(size, alignment, &offset);
+        // Wait for the device to finish with the oldest regions, unless they are still being filled on the host
+        while (!found && reclaim(true))
+        {
+            stats.stalls++;
+            found = tryAllocate(size, alignment, &offset);
+        }
+        if (found)
+        {
+            Entry entry{};
+            entry.id = nextId++;
+            entry.begin = offset;
+            entry.end = offset + size;
+            entries.push_back(entry);
+            head = entry.end;
+
+            region.buffer = buffer;
+            region.offset = offset;
+            region.mapped = static_cast<uint8_t*>(allocation.mapped) + offset;
+            region.id = entry.id;
+            stats.ringAllocations++;
+            return region;
+        }
+    }
+
+    VkBufferCreateInfo bufferCreateInfo = initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+    VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &region.buffer));
+    VK_CHECK_RESULT(device->allocator->allocateBufferMemory(region.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &region.temporaryAllocation, AllocationStrategy::Linear));
+    region.mapped = region.temporaryAllocation.mapped;
+    stats.temporaryAllocations++;
+    return region;
+}
+
+/**
+* Hand a region back to the ring
+*
+* @param region Region returned by allocate, reset on return
+* @param fence (Optional) Fence signaled once the device no longer reads the region (e.g. a frame's fence), VK_NULL_HANDLE if it has already finished
+*
+* @note The fence must not be destroyed before the region has been reclaimed
+*/
+void StagingRing::release(StagingRegion& region, VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (region.id == 0)
+    {
+        if (region.buffer)
+        {
+            temporaryBuffers.push_back({ region.buffer, region.temporaryAllocation, fence });
+        }
+        destroyTemporaryBuffers(false);
+    }
+    else
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.id == region.id)
+            {
+                entry.released = true;
+                entry.fence = fence;
+                break;
+            }
+        }
+        reclaim(false);
+    }
+    region = StagingRegion();
+}
+
+StagingRing::Stats StagingRing::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.usedBytes = 0;
+    if (!entries.empty())
+    {
+        const VkDeviceSize tail = entries.front().begin;
+        stats.usedBytes = (head > tail) ? head - tail : capacity - tail + head;
+    }
+    return stats;
+}
+
+void StagingRing::printStats()
+{
+    Stats stats = getStats();
+    const double MiB = 1024.0 * 1024.0;
+    std::cout << "Staging ring: " << stats.usedBytes / MiB << " / " << stats.capacity / MiB << " MiB used, "
+        << stats.ringAllocations << " ring allocations, "
+        << stats.temporaryAllocations << " temporary buffers, "
+        << stats.stalls << " stalls\n";
+}
+
+// Find room for a region between head and the oldest region in use, wrapping around to the start of the ring if required
+bool StagingRing::tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+    if (entries.empty())
+    {
+        head = 0;
+        *offset = 0;
+        return size <= capacity;
+    }
+    const VkDeviceSize tail = entries.front().begin;
+    const VkDeviceSize begin = (head + alignment - 1) / alignment * alignment;
+    // head must never catch up with tail while regions are in use, so a full ring can't be mistaken for an empty one
+    if (head > tail)
+    {
+        if (begin + size <= capacity)
+        {
+            *offset = begin;
+            return true;
+        }
+        if (size < tail)
+        {
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+    if (begin + size < tail)
+    {
+        *offset = begin;
+        return true;
+    }
+    return false;
+}
+
+// Drop released regions from the front of the ring, optionally waiting for the fence of the oldest one
+bool StagingRing::reclaim(bool wait)
+{
+    bool reclaimed = false;
+    while (!entries.empty())
+    {
+        Entry& entry = entries.front();
+        if (!entry.released)
+        {
+            break;
+        }
+        if (entry.fence && (vkGetFenceStatus(device->logicalDevice, entry.fence) != VK_SUCCESS))
+        {
+            if (!wait || reclaimed)
+            {
+                break;
+            }
+            VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &entry.fence, VK_TRUE, UINT64_MAX));
+        }
+        entries.pop_front();
+        reclaimed = true;
+    }
+    if (entries.empty())
+    {
+        head = 0;
+    }
+    return reclaimed;
+}
+
+void StagingRing::destroyTemporaryBuffers(bool wait)
+{
+    for (auto it = temporaryBuffers.begin(); it != temporaryBuffers.end();)
+    {
+        if (it->fence && (vkGetFenceStatus(device->logicalDevice, it->fence) != VK_SUCCESS))
+        {
+            if (!wait)
+            {
+                ++it;
+                continue;
+            }
+            VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &it->fence, VK_TRUE, UINT64_MAX));
+        }
+        vkDestroyBuffer(device->logicalDevice, it->buffer, nullptr);
+        device->allocator->free(it->allocation);
+        it = temporaryBuffers.erase(it);
+    }
+}
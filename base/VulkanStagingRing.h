@@ -0,0 +1,82 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include "vulkan/vulkan.h"
+#include "VulkanAllocator.h"
+
+struct VulkanDevice;
+
+/** @brief Range of staging memory handed out by the StagingRing */
+struct StagingRegion {
+    /** @brief Buffer to use as copy source, the data starts at offset */
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    /** @brief Host pointer to the start of the region */
+    void* mapped = nullptr;
+    /** @brief Ring bookkeeping, 0 for temporary buffers created for requests the ring can't serve */
+    uint64_t id = 0;
+    Allocation temporaryAllocation;
+};
+
+/**
+* Persistently mapped staging ring buffer
+*
+* Loaders take their staging memory from one host visible buffer instead of creating and destroying a
+* buffer per upload. Regions are handed out in ring order and reclaimed once they have been released and
+* the fence they were released with (if any) has signaled. Oversized requests, or requests the ring has no
+* room for because earlier regions are still being filled, fall back to a temporary buffer.
+*/
+class StagingRing
+{
+public:
+    struct Stats {
+        VkDeviceSize capacity = 0;
+        /** @brief Bytes of the ring currently allocated or waiting for reclamation */
+        VkDeviceSize usedBytes = 0;
+        uint64_t ringAllocations = 0;
+        uint64_t temporaryAllocations = 0;
+        /** @brief Number of times an allocation had to wait for the device to release ring space */
+        uint64_t stalls = 0;
+    };
+
+    StagingRing(VulkanDevice* device, VkDeviceSize size);
+    ~StagingRing();
+
+    StagingRegion allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+    void release(StagingRegion& region, VkFence fence = VK_NULL_HANDLE);
+
+    Stats getStats();
+    void printStats();
+
+private:
+    struct Entry {
+        uint64_t id;
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        bool released;
+        VkFence fence;
+    };
+    struct TemporaryBuffer {
+        VkBuffer buffer;
+        Allocation allocation;
+        VkFence fence;
+    };
+
+    VulkanDevice* device;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    VkDeviceSize capacity;
+    // Next free byte, regions in use always start at entries.front().begin
+    VkDeviceSize head = 0;
+    uint64_t nextId = 1;
+    std::deque<Entry> entries;
+    std::vector<TemporaryBuffer> temporaryBuffers;
+    Stats stats;
+    std::mutex mutex;
+
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+    bool reclaim(bool wait);
+    void destroyTemporaryBuffers(bool wait);
+};
@@ -19,6 +19,7 @@ public:
     VkImage               image;
     VkImageLayout         imageLayout;
     VkDeviceMemory        deviceMemory;
+    Allocation            allocation;
     VkImageView           view;
     uint32_t              width, height;
     uint32_t              mipLevels;
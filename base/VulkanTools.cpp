@@ -5,6 +5,11 @@ const std::string getAssetPath()
     return "../../../data/";
 }
 
+const std::string getBaseShaderPath()
+{
+    return BASE_SHADER_BINARY_DIR;
+}
+
 namespace tools
 {
     bool errorModeSilent = false;
@@ -33,6 +33,8 @@
 }
 
 const std::string getAssetPath();
+/** @brief Directory of the SPIR-V compiled from the compute shaders in data/shaders/base at build time */
+const std::string getBaseShaderPath();
 
 namespace tools
     {
@@ -66,13 +66,7 @@ void UIOverlay::prepareResources()
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageInfo, nullptr, &fontImage));
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(device->logicalDevice, fontImage, &memReqs);
-    VkMemoryAllocateInfo memAllocInfo = initializers::memoryAllocateInfo();
-    memAllocInfo.allocationSize = memReqs.size;
-    memAllocInfo.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAllocInfo, nullptr, &fontMemory));
-    VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, fontImage, fontMemory, 0));
+    VK_CHECK_RESULT(device->allocator->allocateImageMemory(fontImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &fontAllocation));
 
     // Image view
     VkImageViewCreateInfo viewInfo = initializers::imageViewCreateInfo();
@@ -84,33 +78,7 @@ void UIOverlay::prepareResources()
     viewInfo.subresourceRange.layerCount = 1;
     VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewInfo, nullptr, &fontView));
 
-    // staging buffers for font data upload
-    Buffer stagingBuffer;
-
-    VK_CHECK_RESULT(device->createBuffer(
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &stagingBuffer,
-            uploadSize));
-
-    stagingBuffer.map();
-    memcpy(stagingBuffer.mapped, fontData, uploadSize);
-    stagingBuffer.unmap();
-
-    // Copy buffer data to font image
-    VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-    // Prepare for transfer
-    tools::setImageLayout(
-            copyCmd,
-            fontImage,
-            VK_IMAGE_ASPECT_COLOR_BIT,
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_PIPELINE_STAGE_HOST_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-    // Copy
+    // Copy the font data to the image through the staging ring
     VkBufferImageCopy bufferCopyRegion = {};
     bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     bufferCopyRegion.imageSubresource.layerCount = 1;
@@ -118,27 +86,9 @@ void UIOverlay::prepareResources()
     bufferCopyRegion.imageExtent.height = texHeight;
     bufferCopyRegion.imageExtent.depth = 1;
 
-    vkCmdCopyBufferToImage(
-            copyCmd,
-            stagingBuffer.buffer,
-            fontImage,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &bufferCopyRegion
-    );
-
-    tools::setImageLayout(
-            copyCmd,
-            fontImage,
-            VK_IMAGE_ASPECT_COLOR_BIT,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-
-    device->flushCommandBuffer(copyCmd, queue, true);
-
-    stagingBuffer.destroy();
+    UploadBatch uploadBatch;
+    uploadBatch.uploadImage(fontImage, fontData, uploadSize, { bufferCopyRegion }, { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    device->flushUploadBatch(uploadBatch, queue);
 
     // Font texture Sampler
     VkSamplerCreateInfo samplerInfo = initializers::samplerCreateInfo();
@@ -290,8 +240,15 @@ bool UIOverlay::update()
         return false;
     }
 
+    // Buffers that are about to be recreated may still be referenced by frames in flight
+    bool recreateVertexBuffer = (vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount);
+    bool recreateIndexBuffer = (indexBuffer.buffer == VK_NULL_HANDLE) || (indexCount < imDrawData->TotalIdxCount);
+    if ((recreateVertexBuffer && vertexBuffer.buffer != VK_NULL_HANDLE) || (recreateIndexBuffer && indexBuffer.buffer != VK_NULL_HANDLE)) {
+        VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+    }
+
     // Vertex buffer
-    if ((vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount)) {
+    if (recreateVertexBuffer) {
         vertexBuffer.unmap();
         vertexBuffer.destroy();
         VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexBuffer, vertexBufferSize));
@@ -302,7 +259,7 @@ bool UIOverlay::update()
     }
 
     // Index buffer
-    if ((indexBuffer.buffer == VK_NULL_HANDLE) || (indexCount < imDrawData->TotalIdxCount)) {
+    if (recreateIndexBuffer) {
         indexBuffer.unmap();
         indexBuffer.destroy();
         VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &indexBuffer, indexBufferSize));
@@ -396,7 +353,7 @@ void UIOverlay::freeResources()
     indexBuffer.destroy();
     vkDestroyImageView(device->logicalDevice, fontView, nullptr);
     vkDestroyImage(device->logicalDevice, fontImage, nullptr);
-    vkFreeMemory(device->logicalDevice, fontMemory, nullptr);
+    device->allocator->free(fontAllocation);
     vkDestroySampler(device->logicalDevice, sampler, nullptr);
     vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
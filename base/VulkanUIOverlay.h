@@ -37,7 +37,7 @@ public:
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
 
-    VkDeviceMemory fontMemory = VK_NULL_HANDLE;
+    Allocation fontAllocation;
     VkImage fontImage = VK_NULL_HANDLE;
     VkImageView fontView = VK_NULL_HANDLE;
     VkSampler sampler;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+/**
+* Fixed size pool of worker threads executing queued jobs in submission order
+*
+* Jobs must not block on other jobs of the same pool, as all workers could end up waiting.
+*/
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex queueMutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable idle;
+    uint32_t activeJobs = 0;
+    bool destroying = false;
+
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                jobAvailable.wait(lock, [this] { return destroying || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                activeJobs++;
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                activeJobs--;
+                if (jobs.empty() && (activeJobs == 0))
+                {
+                    idle.notify_all();
+                }
+            }
+        }
+    }
+
+public:
+    /** @brief Create the pool, by default with one worker per hardware thread */
+    explicit ThreadPool(uint32_t threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back(&ThreadPool::run, this);
+        }
+    }
+
+    /** @brief Finishes all queued jobs before joining the workers */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            destroying = true;
+        }
+        jobAvailable.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** @brief Queue a job, can be called from any thread including the workers */
+    void enqueue(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    /** @brief Block until the queue is empty and no job is running */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        idle.wait(lock, [this] { return jobs.empty() && (activeJobs == 0); });
+    }
+
+    /**
+    * Run job(i) for every i in [0, count) on the pool and block until all of them returned
+    *
+    * Only waits for its own jobs, unlike wait(). Must not be called from a job of the same pool.
+    */
+    void parallelFor(size_t count, const std::function<void(size_t)>& job)
+    {
+        std::mutex doneMutex;
+        std::condition_variable done;
+        size_t remaining = count;
+        for (size_t i = 0; i < count; i++)
+        {
+            enqueue([&, i]() {
+                job(i);
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--remaining == 0)
+                {
+                    done.notify_one();
+                }
+            });
+        }
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+    uint32_t threadCount() const
+    {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    /** @brief Pool shared by the loaders, created on first use */
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+};
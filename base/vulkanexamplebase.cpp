@@ -1,4 +1,6 @@
 #include "vulkanexamplebase.h"
+#include "ModelParser.h"
+#include "TextureStreamer.h"
 
 std::vector<const char*> VulkanExampleBase::args;
 
@@ -36,6 +38,16 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
     if (commandLineParser.isSet("fullscreen")) {
         settings.fullscreen = true;
     }
+    if (commandLineParser.isSet("headless")) {
+        settings.headless = true;
+        settings.fullscreen = false;
+    }
+    if (commandLineParser.isSet("headlessframes")) {
+        settings.headlessFrames = commandLineParser.getValueAsInt("headlessframes", settings.headlessFrames);
+    }
+    if (commandLineParser.isSet("framesinflight")) {
+        settings.framesInFlight = commandLineParser.getValueAsInt("framesinflight", settings.framesInFlight);
+    }
     if (commandLineParser.isSet("benchmark")) {
         benchmark.active = true;
         tools::errorModeSilent = true;
@@ -60,6 +72,7 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 VulkanExampleBase::~VulkanExampleBase()
 {
     swapChain.cleanup();
+    destroyHeadlessTargets();
     if (descriptorPool != VK_NULL_HANDLE)
     {
         vkDestroyDescriptorPool(device, descriptorPool, nullptr);
@@ -82,14 +95,18 @@ VulkanExampleBase::~VulkanExampleBase()
     }
     vkDestroyImageView(device, depthStencil.view, nullptr);
     vkDestroyImage(device, depthStencil.image, nullptr);
-    vkFreeMemory(device, depthStencil.mem, nullptr);
+    vulkanDevice->allocator->free(depthStencil.allocation);
 
     vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
     vkDestroyCommandPool(device, cmdPool, nullptr);
 
-    vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
-    vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
+    for (auto& semaphore : presentCompleteSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    for (auto& semaphore : renderCompleteSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
     for (auto& fence : waitFences) {
         vkDestroyFence(device, fence, nullptr);
     }
@@ -107,8 +124,10 @@ VulkanExampleBase::~VulkanExampleBase()
 
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 std::string VulkanExampleBase::getWindowTitle()
@@ -190,7 +209,9 @@ bool VulkanExampleBase::initVulkan()
     // This is handled by a separate class that gets a logical device representation
     // and encapsulates functions related to a device
     vulkanDevice = new VulkanDevice(physicalDevice);
-    VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+    // Headless rendering doesn't present, so the swap chain device extension is not required
+    // A dedicated transfer queue is requested (if the device has one) for background uploads
+    VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, !settings.headless, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
     if (res != VK_SUCCESS) {
         tools::exitFatal("Could not create Vulkan device: \n" + tools::errorString(res), res);
         return false;
@@ -200,19 +221,12 @@ bool VulkanExampleBase::initVulkan()
 
     VkBool32 validDepthFormat = tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
     assert(validDepthFormat);
-    swapChain.connect(instance, physicalDevice, device);
-
-    // Create synchronization objects
-    VkSemaphoreCreateInfo semaphoreCreateInfo = initializers::semaphoreCreateInfo();
-    // Create a semaphore used to synchronize image presentation
-    // Ensures that the image is displayed before we start submitting new commands to the queue
-    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete));
-    // Create a semaphore used to synchronize command submission
-    // Ensures that the image is not presented until all commands have been submitted and executed
-    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete));
+    if (!settings.headless) {
+        swapChain.connect(instance, physicalDevice, device);
+    }
 
     // Set up submit info structure
-    // Semaphores will stay the same during application lifetime
+    // The semaphore handles are swapped per frame in flight by prepareFrame(), the pointers stay the same during application lifetime
     // Command buffer submission info is set by each example
     submitInfo = initializers::submitInfo();
     submitInfo.pWaitDstStageMask = &submitPipelineStages;
@@ -226,6 +240,11 @@ bool VulkanExampleBase::initVulkan()
 
 GLFWwindow* VulkanExampleBase::setupWindow()
 {
+    // No window (and no display connection) is needed when rendering headless
+    if (settings.headless) {
+        return nullptr;
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     
@@ -239,7 +258,7 @@ GLFWwindow* VulkanExampleBase::setupWindow()
     glfwSetCursorPosCallback(window, sCursorPosCallback);
     glfwSetMouseButtonCallback(window, sMouseButtonCallback);
 
-    glfwGetWindowUserPointer(window);
+    return window;
 }
 
 void VulkanExampleBase::prepare()
@@ -286,6 +305,26 @@ void VulkanExampleBase::renderLoop()
     lastTimestamp = std::chrono::high_resolution_clock::now();
     tPrevEnd = lastTimestamp;
 
+    if (settings.headless) {
+        // There are no window events to poll, run until the frame limit is reached or the example sets quit
+        uint32_t framesRendered = 0;
+        while (!quit) {
+            if (prepared) {
+                nextFrame();
+                framesRendered++;
+                if ((settings.headlessFrames > 0) && (framesRendered >= settings.headlessFrames)) {
+                    break;
+                }
+            }
+        }
+        vkDeviceWaitIdle(device);
+        vulkanDevice->allocator->printStats();
+        vulkanDevice->stagingRing->printStats();
+        MParser::textureCache.printStats();
+        MParser::textureStreamer.printStats();
+        return;
+    }
+
     while (!(glfwWindowShouldClose(window))) {
         if (prepared) {
 //            processInput()
@@ -413,6 +452,9 @@ void VulkanExampleBase::nextFrame()
 //        viewChanged();
 //    }
 
+    // Submit queued background uploads and release the staging memory of completed ones
+    vulkanDevice->uploader->update();
+
     viewChanged();
     render();
     frameCounter++;
@@ -470,6 +512,12 @@ void VulkanExampleBase::updateOverlay()
     ImGui::TextUnformatted(title.c_str());
     ImGui::TextUnformatted(deviceProperties.deviceName);
     ImGui::Text("%.2f ms/frame (%.1d fps)", (1000.0f / lastFPS), lastFPS);
+    MemoryAllocator::Stats memoryStats = vulkanDevice->allocator->getStats();
+    ImGui::Text("%.1f / %.1f MiB device memory (%d blocks)", memoryStats.usedBytes / (1024.0f * 1024.0f), memoryStats.reservedBytes / (1024.0f * 1024.0f), memoryStats.blockCount);
+    uint32_t pendingUploads = vulkanDevice->uploader->pendingCount();
+    if (pendingUploads > 0) {
+        ImGui::Text("%d uploads in flight", pendingUploads);
+    }
     ImGui::PushItemWidth(110.0f * overlay.scale);
     OnUpdateUIOverlay(&overlay);
     ImGui::PopItemWidth();
@@ -478,6 +526,8 @@ void VulkanExampleBase::updateOverlay()
     ImGui::Render();
 
     if (overlay.update() || overlay.updated) {
+        // Command buffers of frames still in flight can't be re-recorded
+        VK_CHECK_RESULT(vkQueueWaitIdle(queue));
         buildCommandBuffers();
         overlay.updated = false;
     }
@@ -493,11 +543,15 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
     appInfo.pEngineName = name.c_str();
     appInfo.apiVersion = apiVersion;
 
-    std::vector<const char*> instanceExtensions = {
-            VK_KHR_SURFACE_EXTENSION_NAME,
-            VK_MVK_MACOS_SURFACE_EXTENSION_NAME,
-            "VK_EXT_metal_surface"
-    };
+    std::vector<const char*> instanceExtensions;
+    // Surface extensions are only required when presenting to a window
+    if (!settings.headless) {
+        instanceExtensions = {
+                VK_KHR_SURFACE_EXTENSION_NAME,
+                VK_MVK_MACOS_SURFACE_EXTENSION_NAME,
+                "VK_EXT_metal_surface"
+        };
+    }
 
     // Get extensions supported by the instance and store for later use
     uint32_t extCount;
@@ -584,6 +638,11 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 
 void VulkanExampleBase::initSwapchain()
 {
+    if (settings.headless) {
+        // Command pool and presentation queue family without a surface to query
+        swapChain.queueNodeIndex = vulkanDevice->queueFamilyIndices.graphics;
+        return;
+    }
     swapChain.initSurface(window);
 }
 
@@ -598,17 +657,95 @@ void VulkanExampleBase::createCommandPool()
 
 void VulkanExampleBase::setupSwapChain()
 {
+    if (settings.headless) {
+        setupHeadlessTargets();
+        return;
+    }
     swapChain.create(&width, &height, settings.vsync, settings.fullscreen);
 }
 
+/**
+* Create a ring of offscreen color images that replace the swap chain images in headless mode
+*
+* @note The images are exposed through swapChain.buffers/imageCount/colorFormat, so render pass, frame buffer and
+* command buffer setup (including overrides in derived examples) work unchanged
+*/
+void VulkanExampleBase::setupHeadlessTargets()
+{
+    destroyHeadlessTargets();
+
+    headlessTargets.resize(headlessImageCount);
+    swapChain.colorFormat = headlessColorFormat;
+    swapChain.imageCount = headlessImageCount;
+    swapChain.images.resize(headlessImageCount);
+    swapChain.buffers.resize(headlessImageCount);
+
+    for (uint32_t i = 0; i < headlessImageCount; i++)
+    {
+        HeadlessTarget& target = headlessTargets[i];
+
+        VkImageCreateInfo imageCI = initializers::imageCreateInfo();
+        imageCI.imageType = VK_IMAGE_TYPE_2D;
+        imageCI.format = headlessColorFormat;
+        imageCI.extent = { width, height, 1 };
+        imageCI.mipLevels = 1;
+        imageCI.arrayLayers = 1;
+        imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+        // Transfer source so the rendered frames can be read back (e.g. for image comparisons)
+        imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &target.image));
+
+        VK_CHECK_RESULT(vulkanDevice->allocator->allocateImageMemory(target.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target.allocation));
+
+        VkImageViewCreateInfo imageViewCI = initializers::imageViewCreateInfo();
+        imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCI.image = target.image;
+        imageViewCI.format = headlessColorFormat;
+        imageViewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        VK_CHECK_RESULT(vkCreateImageView(device, &imageViewCI, nullptr, &target.view));
+
+        swapChain.images[i] = target.image;
+        swapChain.buffers[i].image = target.image;
+        swapChain.buffers[i].view = target.view;
+    }
+}
+
+void VulkanExampleBase::destroyHeadlessTargets()
+{
+    for (auto& target : headlessTargets)
+    {
+        vkDestroyImageView(device, target.view, nullptr);
+        vkDestroyImage(device, target.image, nullptr);
+        vulkanDevice->allocator->free(target.allocation);
+    }
+    headlessTargets.clear();
+}
+
 void VulkanExampleBase::createSynchronizationPrimitives()
 {
-    // Wait fences to sync command buffer access
+    settings.framesInFlight = std::max(settings.framesInFlight, 1u);
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = initializers::semaphoreCreateInfo();
+    presentCompleteSemaphores.resize(settings.framesInFlight);
+    renderCompleteSemaphores.resize(settings.framesInFlight);
+    for (uint32_t i = 0; i < settings.framesInFlight; i++) {
+        // Ensures that the image is displayed before we start submitting new commands to the queue
+        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &presentCompleteSemaphores[i]));
+        // Ensures that the image is not presented until all commands have been submitted and executed
+        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderCompleteSemaphores[i]));
+    }
+    currentFrame = 0;
+    semaphores.presentComplete = presentCompleteSemaphores[currentFrame];
+    semaphores.renderComplete = renderCompleteSemaphores[currentFrame];
+
+    // Wait fences to sync command buffer access, one per frame in flight
     VkFenceCreateInfo fenceCreateInfo = initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-    waitFences.resize(drawCmdBuffers.size());
+    waitFences.resize(settings.framesInFlight);
     for (auto& fence : waitFences) {
         VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
     }
+    imagesInFlight.assign(drawCmdBuffers.size(), VK_NULL_HANDLE);
 }
 
 void VulkanExampleBase::createCommandBuffers()
@@ -639,15 +776,7 @@ void VulkanExampleBase::setupDepthStencil()
     imageCI.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
     VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &depthStencil.image));
-    VkMemoryRequirements memReqs{};
-    vkGetImageMemoryRequirements(device, depthStencil.image, &memReqs);
-
-    VkMemoryAllocateInfo memAllloc{};
-    memAllloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memAllloc.allocationSize = memReqs.size;
-    memAllloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(device, &memAllloc, nullptr, &depthStencil.mem));
-    VK_CHECK_RESULT(vkBindImageMemory(device, depthStencil.image, depthStencil.mem, 0));
+    VK_CHECK_RESULT(vulkanDevice->allocator->allocateImageMemory(depthStencil.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthStencil.allocation));
 
     // Images aren't directly accessed in Vulkan, but rather through views described by a subresource range
     // This allows for multiple views of one image with differing ranges (e.g. for different layers)
@@ -688,6 +817,10 @@ void VulkanExampleBase::setupRenderPass()
     attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;                       // Layout at render pass start. Initial doesn't matter, so we use undefined
     attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;                   // Layout to which the attachment is transitioned when the render pass is finished
     // As we want to present the color buffer to the swapchain, we transition to PRESENT_KHR
+    // Headless targets are never presented, keep them ready for a readback copy instead
+    if (settings.headless) {
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
     // Depth attachment
     attachments[1].format = depthFormat;                                           // A proper depth format is selected in the example base
     attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -729,13 +862,14 @@ void VulkanExampleBase::setupRenderPass()
 
     // First dependency at the start of the renderpass
     // Does the transition from final to initial layout
+    // The depth attachment is shared by all frames in flight, so the depth clear also has to wait for the depth writes of the previous frame
     dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;                             // Producer of the dependency
     dependencies[0].dstSubpass = 0;                                               // Consumer is our single subpass that will wait for the execution dependency
-    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // Match our pWaitDstStageMask when we vkQueueSubmit
-    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // is a loadOp stage for color attachments
-    dependencies[0].srcAccessMask = 0;                                            // semaphore wait already does memory dependency for us
-    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;         // is a loadOp CLEAR access mask for color attachments
-    dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT; // semaphore wait already does the memory dependency for color
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    dependencies[0].dependencyFlags = 0;
 
     // Second dependency at the end the renderpass
     // Does the transition from the initial to the final layout
@@ -870,7 +1004,7 @@ void VulkanExampleBase::windowResize()
     // Recreate the frame buffers
     vkDestroyImageView(device, depthStencil.view, nullptr);
     vkDestroyImage(device, depthStencil.image, nullptr);
-    vkFreeMemory(device, depthStencil.mem, nullptr);
+    vulkanDevice->allocator->free(depthStencil.allocation);
     setupDepthStencil();
     for (uint32_t i = 0; i < frameBuffers.size(); i++) {
         vkDestroyFramebuffer(device, frameBuffers[i], nullptr);
@@ -887,22 +1021,20 @@ void VulkanExampleBase::windowResize()
     // references to the recreated frame buffer
     vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(drawCmdBuffers.size()), drawCmdBuffers.data());
     createCommandBuffers();
-    buildCommandBuffers();
-
-    // Recreate fences in case number of swapchain images has changed on resize
-    for (auto& fence : waitFences) {
-        vkDestroyFence(device, fence, nullptr);
-    }
-    createSynchronizationPrimitives();
 
-    vkDeviceWaitIdle(device);
+    // Per frame fences stay valid, only the image tracking depends on the number of swapchain images
+    imagesInFlight.assign(drawCmdBuffers.size(), VK_NULL_HANDLE);
 
     if ((width > 0.0f) && (height > 0.0f)) {
         camera.updateAspectRatio((float)width / (float)height);
     }
 
-    // Notify derived class
+    // Notify derived class before recording, resources duplicated per command buffer have to match the new image count
     windowResized();
+    buildCommandBuffers();
+
+    vkDeviceWaitIdle(device);
+
     viewChanged();
 
     prepared = true;
@@ -936,24 +1068,60 @@ void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
     }
 }
 
-void VulkanExampleBase::prepareFrame()
+bool VulkanExampleBase::prepareFrame()
 {
-    // Acquire the next image from the swap chain, and set the presentComplete signaled
-    VkResult res = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
+    // Wait until the GPU has finished the frame that last used this frame's fence and semaphores
+    VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX));
+    semaphores.presentComplete = presentCompleteSemaphores[currentFrame];
+    semaphores.renderComplete = renderCompleteSemaphores[currentFrame];
+
+    if (settings.headless) {
+        // Advance through the offscreen ring and signal presentComplete ourselves, so examples
+        // can keep waiting on it in their submits just like with a swap chain
+        currentBuffer = (currentBuffer + 1) % swapChain.imageCount;
+        VkSubmitInfo signalInfo = initializers::submitInfo();
+        signalInfo.signalSemaphoreCount = 1;
+        signalInfo.pSignalSemaphores = &semaphores.presentComplete;
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &signalInfo, VK_NULL_HANDLE));
+    } else {
+        // Acquire the next image from the swap chain, and set the presentComplete signaled
+        VkResult res = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
 
-    // Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE)
-    // If no longer optimal (VK_SUBOPTIMAL_KHR), wait until submitFrame() in case number of swapchain images will change on resize
-    if ((res == VK_ERROR_OUT_OF_DATE_KHR) || (res == VK_SUBOPTIMAL_KHR)) {
+        // Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE)
+        // If no longer optimal (VK_SUBOPTIMAL_KHR), wait until submitFrame() in case number of swapchain images will change on resize
+        // No image was acquired and presentComplete won't be signaled, so the frame is skipped with its fence left signaled
         if (res == VK_ERROR_OUT_OF_DATE_KHR) {
             windowResize();
+            return false;
         }
-        return;
     }
+
+    // The command buffer (and per image resources) of the acquired image may still be used by an older frame
+    if (imagesInFlight[currentBuffer] != VK_NULL_HANDLE && imagesInFlight[currentBuffer] != waitFences[currentFrame]) {
+        VK_CHECK_RESULT(vkWaitForFences(device, 1, &imagesInFlight[currentBuffer], VK_TRUE, UINT64_MAX));
+    }
+    imagesInFlight[currentBuffer] = waitFences[currentFrame];
+    VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentFrame]));
+    return true;
 }
 
 void VulkanExampleBase::presentFrame()
 {
+    if (settings.headless) {
+        // Consume renderComplete in place of the present operation
+        VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        VkSubmitInfo waitInfo = initializers::submitInfo();
+        waitInfo.waitSemaphoreCount = 1;
+        waitInfo.pWaitSemaphores = &semaphores.renderComplete;
+        waitInfo.pWaitDstStageMask = &waitStageMask;
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &waitInfo, VK_NULL_HANDLE));
+        currentFrame = (currentFrame + 1) % settings.framesInFlight;
+        return;
+    }
+
     VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete);
+    // No queue idle wait here, the CPU can record the next frame while the GPU is still busy with this one
+    currentFrame = (currentFrame + 1) % settings.framesInFlight;
     if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
         windowResize();
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -963,15 +1131,16 @@ void VulkanExampleBase::presentFrame()
     else {
         VK_CHECK_RESULT(result);
     }
-    VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 }
 
 void VulkanExampleBase::renderFrame()
 {
-    VulkanExampleBase::prepareFrame();
+    if (!VulkanExampleBase::prepareFrame()) {
+        return;
+    }
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
     VulkanExampleBase::presentFrame();
 }
 
@@ -998,6 +1167,9 @@ CommandLineParser::CommandLineParser()
     add("shaders", { "-s", "--shaders" }, 1, "Select shader type to use (glsl or hlsl)");
     add("gpuselection", { "-g", "--gpu" }, 1, "Select GPU to run on");
     add("gpulist", { "-gl", "--listgpus" }, 0, "Display a list of available Vulkan devices");
+    add("headless", { "-hl", "--headless" }, 0, "Render offscreen without a window or swap chain");
+    add("headlessframes", { "-hf", "--headlessframes" }, 1, "Number of frames to render in headless mode (default: until quit)");
+    add("framesinflight", { "-fif", "--framesinflight" }, 1, "Number of frames the CPU may record ahead of the GPU (default 2)");
     add("benchmark", { "-b", "--benchmark" }, 0, "Run example in benchmark mode");
     add("benchmarkwarmup", { "-bw", "--benchwarmup" }, 1, "Set warmup time for benchmark mode in seconds");
     add("benchmarkruntime", { "-br", "--benchruntime" }, 1, "Set duration time for benchmark mode in seconds");
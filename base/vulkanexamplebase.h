@@ -36,6 +36,7 @@
 #include "VulkanSwapChain.h"
 #include "VulkanBuffer.h"
 #include "VulkanDevice.h"
+#include "VulkanAsyncUploader.h"
 #include "VulkanTexture.h"
 #include "VulkanInitializers.hpp"
 #include "camera.hpp"
@@ -76,6 +77,8 @@ private:
     void createSynchronizationPrimitives();
     void initSwapchain();
     void setupSwapChain();
+    void setupHeadlessTargets();
+    void destroyHeadlessTargets();
     void createCommandBuffers();
 
     static void sKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -112,13 +115,31 @@ protected:
     std::vector<VkShaderModule> shaderModules; // stored for cleanup
     VkPipelineCache pipelineCache;
     VulkanSwapChain swapChain; // Wraps the swap chain to present images (framebuffers) to the windowing system
+    // Semaphores of the frame currently being recorded, switched by prepareFrame() for every frame in flight
     struct {
         // Swap chain image presentation
         VkSemaphore presentComplete;
         // Command buffer submission and execution
         VkSemaphore renderComplete;
     } semaphores;
+    // Per frame in flight semaphores, the current pair is mirrored in semaphores
+    std::vector<VkSemaphore> presentCompleteSemaphores;
+    std::vector<VkSemaphore> renderCompleteSemaphores;
+    // Per frame in flight fences, the frame's submission must signal waitFences[currentFrame]
     std::vector<VkFence> waitFences;
+    // Fence of the frame that last submitted the command buffer of each swap chain image
+    std::vector<VkFence> imagesInFlight;
+    // Index of the current frame in flight (0..settings.framesInFlight - 1)
+    uint32_t currentFrame = 0;
+    // Offscreen color targets that stand in for the swap chain images when running headless
+    struct HeadlessTarget {
+        VkImage image;
+        Allocation allocation;
+        VkImageView view;
+    };
+    std::vector<HeadlessTarget> headlessTargets;
+    uint32_t headlessImageCount = 3;
+    VkFormat headlessColorFormat = VK_FORMAT_R8G8B8A8_UNORM;
 
 public:
     bool prepared    = false;
@@ -151,11 +172,17 @@ public:
         bool fullscreen = false;
         bool vsync      = false;
         bool overlay    = true;
+        // Render into offscreen images without a window, surface or swap chain
+        bool headless   = false;
+        // Number of frames to render in headless mode (0 = until quit is set)
+        uint32_t headlessFrames = 0;
+        // Number of frames the CPU may record and submit ahead of the GPU
+        uint32_t framesInFlight = 2;
     } settings;
 
     struct {
         VkImage image;
-        VkDeviceMemory mem;
+        Allocation allocation;
         VkImageView view;
     } depthStencil;
 
@@ -170,7 +197,7 @@ public:
         bool middle = false;
     } mouseButtons;
 
-    GLFWwindow* window;
+    GLFWwindow* window = nullptr;
     bool quit = false;
 
     VulkanExampleBase(bool enableValidation = false);
@@ -193,6 +220,7 @@ public:
     virtual void viewChanged();
     virtual void keyPressed(uint32_t);
     virtual void mouseMoved(double x, double y, bool &handled);
+    /** Called after the swap chain and the command buffers have been recreated and before buildCommandBuffers(), the number of command buffers may have changed */
     virtual void windowResized();
     /**Called when resources have been recreated that require a rebuild of the command buffers (e.g. frame buffer), to be implemented by the sample application */
     virtual void buildCommandBuffers();
@@ -213,8 +241,11 @@ public:
     /**Adds the drawing commands for the ImGui overlay to the given command buffer */
     void drawUI(const VkCommandBuffer commandBuffer);
 
-    /** Prepare the next frame for workload submission by acquiring the next swap chain image */
-    void prepareFrame();
+    /** Prepare the next frame for workload submission by acquiring the next swap chain image (or the next offscreen target when headless)
+     *  Waits until the current frame in flight and the acquired image's command buffer are no longer in use by the GPU
+     *  Returns false if the swap chain was out of date and has been recreated, nothing may be submitted or presented for this frame */
+    bool prepareFrame();
+    /** Present the current swap chain image (headless: consume renderComplete instead) and advance to the next frame in flight */
     void presentFrame();
     /**Default image acquire + submission and command buffer submission function */
     virtual void renderFrame();
@@ -1,9 +1,7 @@
 #version 450
 
+// Fed from the position-only vertex stream of the models (RenderFlags::PositionsOnly)
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inColor;
-layout (location = 2) in vec2 inTexCoord;
-layout (location = 3) in vec3 inNormal;
 
 layout (binding = 0) uniform UBO
 {
@@ -0,0 +1,36 @@
+// Decoding of the vertex components stored by MParser::PackedVertexLayout (FileLoadingFlags::PackVertices)
+//
+// Attribute types for the packed formats:
+//	Position	vec4	R16G16B16A16_UNORM, quantized to the mesh bounding box
+//	Normal		vec2	R16G16_SNORM, octahedral
+//	Tangent		vec4	R16G16B16A16_SNORM, octahedral in xy, handedness in z
+//	UV			vec2	R16G16_SFLOAT, no decoding needed
+//	Color		vec4	R8G8B8A8_UNORM, no decoding needed
+//	Joint0		uvec4	R8G8B8A8_UINT
+//	Weight0		vec4	R8G8B8A8_UNORM, no decoding needed
+//
+// The dequantization of the positions is pushed per mesh with RenderFlags::PushQuantization:
+//
+//	layout (push_constant) uniform Quantization {
+//		vec4 offset;
+//		vec4 scale;
+//	} quantization;
+
+vec3 dequantizePosition(vec4 packedPos, vec4 offset, vec4 scale)
+{
+	return offset.xyz + scale.xyz * packedPos.xyz;
+}
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	// Unfold the lower hemisphere
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+vec4 decodeTangent(vec4 packedTangent)
+{
+	return vec4(octahedralDecode(packedTangent.xy), packedTangent.z < 0.0 ? -1.0 : 1.0);
+}
@@ -0,0 +1,245 @@
+/*
+* OBJ loading benchmark
+*
+* Parses OBJ files with ObjParser and deduplicates the corners of every material group three ways: with the
+* std::unordered_map keyed on the vertex attributes that ObjModel used before, with the flat index triple table,
+* and with the flat table built in parallel. A synthetic grid of several million triangles can be generated to
+* measure scans larger than the sample models.
+*
+* Usage: obj_benchmark [--synthetic <million triangles>] [-r repeats] files...
+* e.g.   obj_benchmark --synthetic 4 data/models/Shadow/Marry/Marry.obj
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
+
+#include "ObjParser.h"
+#include "threadpool.hpp"
+
+namespace
+{
+    struct Options {
+        double syntheticMillions = 0.0;
+        uint32_t repeats = 3;
+        std::vector<std::string> inputs;
+    };
+
+    // Attribute values of a vertex as ObjModel's Vertex stored them: position, color, uv, normal
+    struct VertexValue {
+        float values[11];
+
+        bool operator==(const VertexValue& other) const
+        {
+            for (int i = 0; i < 11; i++) {
+                if (values[i] != other.values[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Same combination as hash_combine over std::hash<glm::vec3> in VulkanObjModel.h
+    struct VertexValueHash {
+        size_t operator()(const VertexValue& vertex) const
+        {
+            size_t seed = 0;
+            for (int i = 0; i < 11; i++) {
+                seed ^= std::hash<float>()(vertex.values[i]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+
+    VertexValue vertexValue(const ObjParser::ObjData& obj, const ObjParser::Index& index)
+    {
+        VertexValue vertex = {};
+        for (int i = 0; i < 3; i++) {
+            vertex.values[i] = obj.positions[3 * index.position + i];
+            vertex.values[3 + i] = 1.0f;
+            vertex.values[8 + i] = (index.normal >= 0) ? obj.normals[3 * index.normal + i] : 0.0f;
+        }
+        if (index.texcoord >= 0) {
+            vertex.values[6] = obj.texcoords[2 * index.texcoord];
+            vertex.values[7] = 1.0f - obj.texcoords[2 * index.texcoord + 1];
+        }
+        return vertex;
+    }
+
+    // The previous dedup: count() followed by operator[], so two lookups per corner
+    size_t dedupUnorderedMap(const ObjParser::ObjData& obj, const std::vector<ObjParser::Index>& corners, std::vector<uint32_t>& indices)
+    {
+        std::unordered_map<VertexValue, size_t, VertexValueHash> uniqueVertices;
+        indices.clear();
+        for (const auto& corner : corners) {
+            const VertexValue vertex = vertexValue(obj, corner);
+            if (uniqueVertices.count(vertex) == 0) {
+                uniqueVertices[vertex] = uniqueVertices.size();
+            }
+            indices.push_back(static_cast<uint32_t>(uniqueVertices[vertex]));
+        }
+        return uniqueVertices.size();
+    }
+
+    double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Best of several runs, the first one also pays for page faults
+    double measure(uint32_t repeats, const std::function<void()>& run)
+    {
+        double best = 0.0;
+        for (uint32_t i = 0; i < repeats; i++) {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            run();
+            const double ms = elapsedMs(tStart);
+            best = (i == 0) ? ms : std::min(best, ms);
+        }
+        return best;
+    }
+
+    // Wavy grid with shared positions, uvs and normals, written the way exporters do
+    bool writeSynthetic(const std::string& path, double millionTriangles)
+    {
+        const uint32_t size = static_cast<uint32_t>(std::sqrt(millionTriangles * 1e6 / 2.0)) + 2;
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        char line[128];
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                const float fx = static_cast<float>(x) / size, fy = static_cast<float>(y) / size;
+                snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", fx * 100.0f, std::sin(fx * 40.0f) * std::cos(fy * 40.0f), fy * 100.0f);
+                file << line;
+                snprintf(line, sizeof(line), "vt %.6f %.6f\n", fx, fy);
+                file << line;
+                snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", 0.0f, 1.0f, 0.0f);
+                file << line;
+            }
+        }
+        for (uint32_t y = 0; y + 1 < size; y++) {
+            for (uint32_t x = 0; x + 1 < size; x++) {
+                const uint32_t a = y * size + x + 1, b = a + 1, c = a + size, d = c + 1;
+                snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, c, c, c, b, b, b);
+                file << line;
+                snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n", b, b, b, c, c, c, d, d, d);
+                file << line;
+            }
+        }
+        return true;
+    }
+
+    bool benchmark(const std::string& path, const Options& options)
+    {
+        ObjParser::ObjData obj;
+        std::string error;
+        double parseMs = 0.0;
+        parseMs = measure(options.repeats, [&]() {
+            if (!ObjParser::load(path, obj, error)) {
+                obj.indices.clear();
+            }
+        });
+        if (!error.empty()) {
+            std::cerr << error << "\n";
+            return false;
+        }
+
+        // Material groups as built by ObjModel's LoadModel
+        std::vector<std::vector<ObjParser::Index>> groups(obj.materials.size() + 1);
+        for (size_t t = 0; t < obj.materialIds.size(); t++) {
+            auto& group = groups[obj.materialIds[t] + 1];
+            group.insert(group.end(), obj.indices.begin() + t * 3, obj.indices.begin() + t * 3 + 3);
+        }
+
+        size_t mapVertices = 0, flatVertices = 0, parallelVertices = 0;
+        std::vector<uint32_t> indices;
+        const double mapMs = measure(options.repeats, [&]() {
+            mapVertices = 0;
+            for (auto& group : groups) {
+                mapVertices += dedupUnorderedMap(obj, group, indices);
+            }
+        });
+        ObjParser::Deduplication dedup;
+        const double flatMs = measure(options.repeats, [&]() {
+            flatVertices = 0;
+            for (auto& group : groups) {
+                ObjParser::deduplicate(group.data(), group.size(), dedup, false);
+                flatVertices += dedup.vertexCorners.size();
+            }
+        });
+        const double parallelMs = measure(options.repeats, [&]() {
+            parallelVertices = 0;
+            for (auto& group : groups) {
+                ObjParser::deduplicate(group.data(), group.size(), dedup, true);
+                parallelVertices += dedup.vertexCorners.size();
+            }
+        });
+
+        std::cout << path << ": " << obj.indices.size() / 3 << " triangles, " << groups.size() << " groups\n";
+        std::cout << "  parse                " << parseMs << " ms\n";
+        std::cout << "  unordered_map dedup  " << mapMs << " ms, " << mapVertices << " vertices\n";
+        std::cout << "  flat dedup           " << flatMs << " ms, " << flatVertices << " vertices (" << mapMs / flatMs << "x)\n";
+        std::cout << "  flat parallel dedup  " << parallelMs << " ms, " << parallelVertices << " vertices (" << mapMs / parallelMs << "x)\n";
+        if (flatVertices != parallelVertices) {
+            std::cerr << "  serial and parallel dedup disagree\n";
+            return false;
+        }
+        return true;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: obj_benchmark [--synthetic <million triangles>] [-r repeats] files...\n"
+            << "  --synthetic  Also benchmark a generated grid, written to synthetic.obj in the working directory\n"
+            << "  -r           Runs per measurement, the fastest one is reported (default 3)\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "--synthetic") && (i + 1 < argc)) {
+            options.syntheticMillions = std::atof(argv[++i]);
+        } else if ((arg == "-r") && (i + 1 < argc)) {
+            options.repeats = std::max(1, std::atoi(argv[++i]));
+        } else if ((arg == "-h") || (arg == "--help")) {
+            printUsage();
+            return 0;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.syntheticMillions > 0.0) {
+        const std::string path = "synthetic.obj";
+        std::cout << "Writing " << path << " with about " << options.syntheticMillions << " million triangles\n";
+        if (!writeSynthetic(path, options.syntheticMillions)) {
+            std::cerr << "Could not write " << path << "\n";
+            return 1;
+        }
+        options.inputs.push_back(path);
+    }
+    if (options.inputs.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    std::cout << "Running on " << ThreadPool::shared().threadCount() << " threads\n";
+    int failed = 0;
+    for (auto& input : options.inputs) {
+        if (!benchmark(input, options)) {
+            failed++;
+        }
+    }
+    return (failed == 0) ? 0 : 1;
+}
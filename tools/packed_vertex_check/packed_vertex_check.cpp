@@ -0,0 +1,262 @@
+/*
+* Packed vertex round trip check
+*
+* Packs random vertices with MParser::PackedVertexLayout (FileLoadingFlags::PackVertices), converts the packed
+* attributes the way the vertex fetch does for their formats and decodes them with the functions of
+* data/shaders/base/packedvertex.glsl, ported below. Reports the largest error of every component and fails if one
+* is above what the precision of its format allows.
+*
+* Usage: packed_vertex_check [-n vertices] [-s seed]
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ModelParser.h"
+
+namespace
+{
+    struct Options {
+        uint32_t vertexCount = 100000;
+        uint32_t seed = 1;
+    };
+
+    // Format conversions of the vertex input, as specified for UNORM, SNORM and SFLOAT attributes
+    float unorm16(const uint8_t* data, uint32_t component)
+    {
+        uint16_t value;
+        memcpy(&value, data + component * sizeof(uint16_t), sizeof(value));
+        return value / 65535.0f;
+    }
+
+    float snorm16(const uint8_t* data, uint32_t component)
+    {
+        int16_t value;
+        memcpy(&value, data + component * sizeof(int16_t), sizeof(value));
+        return std::max(value / 32767.0f, -1.0f);
+    }
+
+    float unorm8(const uint8_t* data, uint32_t component)
+    {
+        return data[component] / 255.0f;
+    }
+
+    // packedvertex.glsl
+    glm::vec3 dequantizePosition(glm::vec4 packedPos, glm::vec4 offset, glm::vec4 scale)
+    {
+        return glm::vec3(offset) + glm::vec3(scale) * glm::vec3(packedPos);
+    }
+
+    glm::vec3 octahedralDecode(glm::vec2 e)
+    {
+        glm::vec3 n = glm::vec3(e, 1.0f - std::abs(e.x) - std::abs(e.y));
+        const float t = std::max(-n.z, 0.0f);
+        n.x += (n.x >= 0.0f) ? -t : t;
+        n.y += (n.y >= 0.0f) ? -t : t;
+        return glm::normalize(n);
+    }
+
+    glm::vec4 decodeTangent(glm::vec4 packedTangent)
+    {
+        return glm::vec4(octahedralDecode(glm::vec2(packedTangent)), packedTangent.z < 0.0f ? -1.0f : 1.0f);
+    }
+
+    glm::vec3 randomDirection(std::mt19937& random)
+    {
+        std::normal_distribution<float> normal;
+        glm::vec3 direction;
+        do {
+            direction = glm::vec3(normal(random), normal(random), normal(random));
+        } while (glm::length(direction) < 1e-3f);
+        return glm::normalize(direction);
+    }
+
+    // atan2 in double, acos of a float dot product alone is off by hundredths of a degree for nearly equal directions
+    float angleDegrees(const glm::vec3& a, const glm::vec3& b)
+    {
+        const glm::dvec3 da(a), db(b);
+        return static_cast<float>(glm::degrees(std::atan2(glm::length(glm::cross(da, db)), glm::dot(da, db))));
+    }
+
+    struct Errors {
+        /** @brief Relative to the extent of the bounding box */
+        float position = 0.0f;
+        float normalDegrees = 0.0f;
+        float tangentDegrees = 0.0f;
+        uint32_t handednessMismatches = 0;
+        /** @brief Relative to the magnitude of the coordinate */
+        float uv = 0.0f;
+        float color = 0.0f;
+        uint32_t jointMismatches = 0;
+        float weight = 0.0f;
+        uint32_t weightSumMismatches = 0;
+        /** @brief Components whose offset does not follow the previous one, or a stride that is not the sum of the sizes */
+        uint32_t layoutMismatches = 0;
+    };
+
+    Errors check(const Options& options)
+    {
+        const std::vector<MParser::VertexComponent> components = {
+            MParser::VertexComponent::Position, MParser::VertexComponent::Normal, MParser::VertexComponent::Tangent, MParser::VertexComponent::UV,
+            MParser::VertexComponent::Color, MParser::VertexComponent::Joint0, MParser::VertexComponent::Weight0 };
+        const MParser::PackedVertexLayout layout(components);
+
+        Errors errors;
+        uint32_t offset = 0;
+        for (size_t c = 0; c < components.size(); c++) {
+            errors.layoutMismatches += (layout.offsets[c] != offset) ? 1 : 0;
+            offset += MParser::PackedVertexLayout::componentSize(components[c]);
+        }
+        errors.layoutMismatches += (layout.stride != offset) ? 1 : 0;
+
+        std::mt19937 random(options.seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<MParser::Vertex> vertices(options.vertexCount);
+        for (auto& vertex : vertices) {
+            vertex.pos = glm::vec4(unit(random) * 20.0f - 10.0f, unit(random) * 4.0f, unit(random) * 0.5f - 3.0f, 1.0f);
+            vertex.normal = randomDirection(random);
+            vertex.tangent = glm::vec4(randomDirection(random), unit(random) < 0.5f ? -1.0f : 1.0f);
+            vertex.uv = glm::vec2(unit(random) * 8.0f - 4.0f, unit(random));
+            vertex.color = glm::vec4(unit(random), unit(random), unit(random), unit(random));
+            vertex.joint0 = glm::vec4(std::floor(unit(random) * 255.0f), std::floor(unit(random) * 255.0f), std::floor(unit(random) * 255.0f), std::floor(unit(random) * 255.0f));
+            vertex.weight0 = glm::vec4(unit(random), unit(random), unit(random), unit(random));
+        }
+
+        // Quantization as Model::loadFromFile sets it up per mesh
+        glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+        for (auto& vertex : vertices) {
+            min = glm::min(min, glm::vec3(vertex.pos));
+            max = glm::max(max, glm::vec3(vertex.pos));
+        }
+        const glm::vec3 extent = glm::max(max - min, glm::vec3(1e-6f));
+        MParser::Mesh::Quantization quantization;
+        quantization.offset = glm::vec4(min, 0.0f);
+        quantization.scale = glm::vec4(extent, 0.0f);
+
+        std::vector<uint8_t> packed(vertices.size() * layout.stride);
+        for (size_t i = 0; i < vertices.size(); i++) {
+            layout.pack(vertices[i], min, 1.0f / extent, packed.data() + i * layout.stride);
+        }
+
+        for (size_t i = 0; i < vertices.size(); i++) {
+            const MParser::Vertex& vertex = vertices[i];
+            for (size_t c = 0; c < components.size(); c++) {
+                const uint8_t* data = packed.data() + i * layout.stride + layout.offsets[c];
+                switch (components[c]) {
+                    case MParser::VertexComponent::Position: {
+                        const glm::vec4 packedPos(unorm16(data, 0), unorm16(data, 1), unorm16(data, 2), unorm16(data, 3));
+                        const glm::vec3 error = glm::abs(dequantizePosition(packedPos, quantization.offset, quantization.scale) - glm::vec3(vertex.pos)) / extent;
+                        errors.position = std::max(errors.position, std::max(error.x, std::max(error.y, error.z)));
+                        break;
+                    }
+                    case MParser::VertexComponent::Normal: {
+                        const glm::vec3 normal = octahedralDecode(glm::vec2(snorm16(data, 0), snorm16(data, 1)));
+                        errors.normalDegrees = std::max(errors.normalDegrees, angleDegrees(normal, vertex.normal));
+                        break;
+                    }
+                    case MParser::VertexComponent::Tangent: {
+                        const glm::vec4 tangent = decodeTangent(glm::vec4(snorm16(data, 0), snorm16(data, 1), snorm16(data, 2), snorm16(data, 3)));
+                        errors.tangentDegrees = std::max(errors.tangentDegrees, angleDegrees(glm::vec3(tangent), glm::vec3(vertex.tangent)));
+                        errors.handednessMismatches += (tangent.w != vertex.tangent.w) ? 1 : 0;
+                        break;
+                    }
+                    case MParser::VertexComponent::UV: {
+                        uint32_t bits;
+                        memcpy(&bits, data, sizeof(bits));
+                        const glm::vec2 uv = glm::unpackHalf2x16(bits);
+                        for (uint32_t j = 0; j < 2; j++) {
+                            errors.uv = std::max(errors.uv, std::abs(uv[j] - vertex.uv[j]) / std::max(std::abs(vertex.uv[j]), 1.0f / 1024.0f));
+                        }
+                        break;
+                    }
+                    case MParser::VertexComponent::Color: {
+                        for (uint32_t j = 0; j < 4; j++) {
+                            errors.color = std::max(errors.color, std::abs(unorm8(data, j) - vertex.color[j]));
+                        }
+                        break;
+                    }
+                    case MParser::VertexComponent::Joint0: {
+                        for (uint32_t j = 0; j < 4; j++) {
+                            errors.jointMismatches += (data[j] != static_cast<uint8_t>(vertex.joint0[j])) ? 1 : 0;
+                        }
+                        break;
+                    }
+                    case MParser::VertexComponent::Weight0: {
+                        const float sum = vertex.weight0.x + vertex.weight0.y + vertex.weight0.z + vertex.weight0.w;
+                        uint32_t total = 0;
+                        for (uint32_t j = 0; j < 4; j++) {
+                            errors.weight = std::max(errors.weight, std::abs(unorm8(data, j) - vertex.weight0[j] / sum));
+                            total += data[j];
+                        }
+                        errors.weightSumMismatches += (total != 255) ? 1 : 0;
+                        break;
+                    }
+                }
+            }
+        }
+        return errors;
+    }
+
+    bool report(const char* name, float error, float limit)
+    {
+        const bool passed = error <= limit;
+        std::cout << "  " << name << std::string(12 - strlen(name), ' ') << error << " (limit " << limit << ")" << (passed ? "" : " FAILED") << "\n";
+        return passed;
+    }
+
+    bool report(const char* name, uint32_t mismatches)
+    {
+        std::cout << "  " << name << std::string(12 - strlen(name), ' ') << mismatches << " mismatches" << ((mismatches == 0) ? "" : " FAILED") << "\n";
+        return mismatches == 0;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: packed_vertex_check [-n vertices] [-s seed]\n"
+            << "  -n  Number of random vertices (default 100000)\n"
+            << "  -s  Seed of the random vertices (default 1)\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-n") && (i + 1 < argc)) {
+            options.vertexCount = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        } else if ((arg == "-s") && (i + 1 < argc)) {
+            options.seed = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if ((arg == "-h") || (arg == "--help")) {
+            printUsage();
+            return 0;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    const Errors errors = check(options);
+    // Limits: half a quantization step plus float rounding for the positions, the octahedral 16-bit encoding stays well
+    // below 0.01 degrees, half floats have an 11 bit significand, 8-bit channels round to half a step (weights are
+    // renormalized and the rounding remainder goes to the largest one)
+    std::cout << options.vertexCount << " vertices, largest errors:\n";
+    bool passed = true;
+    passed &= report("layout", errors.layoutMismatches);
+    passed &= report("position", errors.position, 0.5f / 65535.0f + 1e-6f);
+    passed &= report("normal", errors.normalDegrees, 0.01f);
+    passed &= report("tangent", errors.tangentDegrees, 0.01f);
+    passed &= report("handedness", errors.handednessMismatches);
+    passed &= report("uv", errors.uv, 1.0f / 2048.0f);
+    passed &= report("color", errors.color, 0.5f / 255.0f + 1e-6f);
+    passed &= report("joint0", errors.jointMismatches);
+    passed &= report("weight0", errors.weight, 2.0f / 255.0f);
+    passed &= report("weight sum", errors.weightSumMismatches);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/*
+* Offline scene baker
+*
+* Imports models with Assimp the way MParser::Model does, including mesh optimization, splitting for 16-bit indices
+* and LOD generation, and writes the result as a baked scene (SceneFormat). Loading a baked scene maps the file and
+* copies its blobs, so the startup of the examples is bound by I/O instead of Assimp and the per-vertex conversion.
+* MParser picks up a baked <name>.vlscene placed next to the model file automatically, as long as it is newer than the
+* model and was baked with the geometry flags the model is loaded with.
+*
+* Usage: scene_baker [--lods] [--pretransform] [--premultiply] [--flipy] [-o outputdir] models...
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "ModelParser.h"
+
+namespace
+{
+    struct Options {
+        uint32_t fileLoadingFlags = MParser::FileLoadingFlags::None;
+        std::string outputDir;
+        std::vector<std::string> inputs;
+    };
+
+    void printUsage()
+    {
+        std::cout << "Usage: scene_baker [--lods] [--pretransform] [--premultiply] [--flipy] [-o outputdir] models...\n"
+            << "  The flags have to match the FileLoadingFlags the model is loaded with, otherwise the baked scene is ignored\n"
+            << "  --lods         FileLoadingFlags::GenerateLods\n"
+            << "  --pretransform FileLoadingFlags::PreTransformVertices\n"
+            << "  --premultiply  FileLoadingFlags::PreMultiplyVertexColors\n"
+            << "  --flipy        FileLoadingFlags::FlipY\n"
+            << "  -o             Output directory, defaults to writing <name>.vlscene next to each model\n";
+    }
+
+    bool bake(const std::string& input, const Options& options)
+    {
+        auto tStart = std::chrono::high_resolution_clock::now();
+        MParser::Model model;
+        model.importScene(input, options.fileLoadingFlags);
+        const double importMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+        std::string output = MParser::Model::bakedSceneFile(input);
+        if (!options.outputDir.empty()) {
+            output = options.outputDir + "/" + output.substr(output.find_last_of("/\\") + 1);
+        }
+        std::string error;
+        if (!model.saveBakedScene(output, input, options.fileLoadingFlags, error)) {
+            std::cerr << error << "\n";
+            return false;
+        }
+
+        uint32_t meshCount = 0;
+        for (auto* node : model.linearNodes) {
+            if (node->geo) {
+                meshCount += static_cast<uint32_t>(node->geo->meshes.size());
+            }
+        }
+        std::cout << input << " -> " << output << ": " << model.linearNodes.size() << " nodes, " << meshCount << " meshes, " << model.materials.size() << " materials, "
+            << model.vertexBuffer.size() << " vertices, " << model.indexBuffer.size() << " indices (import " << importMs << " ms)\n";
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--lods") {
+            options.fileLoadingFlags |= MParser::FileLoadingFlags::GenerateLods;
+        } else if (arg == "--pretransform") {
+            options.fileLoadingFlags |= MParser::FileLoadingFlags::PreTransformVertices;
+        } else if (arg == "--premultiply") {
+            options.fileLoadingFlags |= MParser::FileLoadingFlags::PreMultiplyVertexColors;
+        } else if (arg == "--flipy") {
+            options.fileLoadingFlags |= MParser::FileLoadingFlags::FlipY;
+        } else if ((arg == "-o") && (i + 1 < argc)) {
+            options.outputDir = argv[++i];
+        } else if ((arg == "-h") || (arg == "--help")) {
+            printUsage();
+            return 0;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.inputs.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    int failed = 0;
+    for (auto& input : options.inputs) {
+        if (!bake(input, options)) {
+            failed++;
+        }
+    }
+    return (failed == 0) ? 0 : 1;
+}
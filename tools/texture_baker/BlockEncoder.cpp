@@ -0,0 +1,424 @@
+#include "BlockEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BLOCK_ENCODER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BLOCK_ENCODER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    // Four lane float vector used for processing four texels of a block at once
+#if defined(BLOCK_ENCODER_SSE2)
+    typedef __m128 f32x4;
+    inline f32x4 load4(const float* p) { return _mm_loadu_ps(p); }
+    inline f32x4 set4(float f) { return _mm_set1_ps(f); }
+    inline f32x4 add4(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+    inline f32x4 sub4(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+    inline f32x4 mul4(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+    inline f32x4 min4(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+    inline f32x4 max4(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+    inline void truncate4(f32x4 v, int32_t* out) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_cvttps_epi32(v)); }
+#elif defined(BLOCK_ENCODER_NEON)
+    typedef float32x4_t f32x4;
+    inline f32x4 load4(const float* p) { return vld1q_f32(p); }
+    inline f32x4 set4(float f) { return vdupq_n_f32(f); }
+    inline f32x4 add4(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+    inline f32x4 sub4(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+    inline f32x4 mul4(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+    inline f32x4 min4(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+    inline f32x4 max4(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+    inline void truncate4(f32x4 v, int32_t* out) { vst1q_s32(out, vcvtq_s32_f32(v)); }
+#else
+    struct f32x4 { float v[4]; };
+    inline f32x4 load4(const float* p) { f32x4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+    inline f32x4 set4(float f) { f32x4 r; for (int i = 0; i < 4; i++) r.v[i] = f; return r; }
+    inline f32x4 add4(f32x4 a, f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+    inline f32x4 sub4(f32x4 a, f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+    inline f32x4 mul4(f32x4 a, f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+    inline f32x4 min4(f32x4 a, f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] = std::min(a.v[i], b.v[i]); return a; }
+    inline f32x4 max4(f32x4 a, f32x4 b) { for (int i = 0; i < 4; i++) a.v[i] = std::max(a.v[i], b.v[i]); return a; }
+    inline void truncate4(f32x4 v, int32_t* out) { for (int i = 0; i < 4; i++) out[i] = static_cast<int32_t>(v.v[i]); }
+#endif
+
+    // Texels of a block split into channels, so four texels of a channel can be loaded at once
+    struct Block {
+        float channels[4][16];
+    };
+
+    void loadBlock(const uint8_t* texels, Block& block)
+    {
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 4; c++) {
+                block.channels[c][i] = texels[i * 4 + c];
+            }
+        }
+    }
+
+    inline float clamp255(float v)
+    {
+        return std::min(255.0f, std::max(0.0f, v));
+    }
+
+    // Project the texels onto the segment e0 -> e1 and round to one of steps evenly spaced positions (0 = e0, steps - 1 = e1)
+    void quantizeToLine(const float* const* channels, int channelCount, const float* e0, const float* e1, int steps, int32_t indices[16])
+    {
+        float dir[4];
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < channelCount; c++) {
+            dir[c] = e1[c] - e0[c];
+            lengthSquared += dir[c] * dir[c];
+        }
+        if (lengthSquared < 1e-6f) {
+            std::fill(indices, indices + 16, 0);
+            return;
+        }
+        const f32x4 scale = set4(float(steps - 1) / lengthSquared);
+        const f32x4 half = set4(0.5f);
+        const f32x4 zero = set4(0.0f);
+        const f32x4 maxStep = set4(float(steps - 1));
+        for (int i = 0; i < 16; i += 4) {
+            f32x4 dot = zero;
+            for (int c = 0; c < channelCount; c++) {
+                dot = add4(dot, mul4(sub4(load4(channels[c] + i), set4(e0[c])), set4(dir[c])));
+            }
+            f32x4 t = add4(mul4(dot, scale), half);
+            t = min4(max4(t, zero), maxStep);
+            truncate4(t, indices + i);
+        }
+    }
+
+    // Mean and direction of largest variance of the texels
+    void principalAxis(const float* const* channels, int channelCount, float mean[4], float axis[4])
+    {
+        float minValue[4], maxValue[4];
+        for (int c = 0; c < channelCount; c++) {
+            mean[c] = 0.0f;
+            minValue[c] = 255.0f;
+            maxValue[c] = 0.0f;
+            for (int i = 0; i < 16; i++) {
+                mean[c] += channels[c][i];
+                minValue[c] = std::min(minValue[c], channels[c][i]);
+                maxValue[c] = std::max(maxValue[c], channels[c][i]);
+            }
+            mean[c] /= 16.0f;
+        }
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int a = 0; a < channelCount; a++) {
+                for (int b = a; b < channelCount; b++) {
+                    covariance[a][b] += (channels[a][i] - mean[a]) * (channels[b][i] - mean[b]);
+                }
+            }
+        }
+        for (int a = 0; a < channelCount; a++) {
+            for (int b = 0; b < a; b++) {
+                covariance[a][b] = covariance[b][a];
+            }
+        }
+        // Power iteration, starting from the bounding box diagonal
+        for (int c = 0; c < channelCount; c++) {
+            axis[c] = maxValue[c] - minValue[c];
+        }
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4] = {};
+            float length = 0.0f;
+            for (int a = 0; a < channelCount; a++) {
+                for (int b = 0; b < channelCount; b++) {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length < 1e-6f) {
+                break;
+            }
+            for (int c = 0; c < channelCount; c++) {
+                axis[c] = next[c] / length;
+            }
+        }
+    }
+
+    // Endpoints spanning the projection of the texels onto the principal axis
+    void fitEndpoints(const float* const* channels, int channelCount, float e0[4], float e1[4])
+    {
+        float mean[4], axis[4];
+        principalAxis(channels, channelCount, mean, axis);
+        float axisLengthSquared = 0.0f;
+        for (int c = 0; c < channelCount; c++) {
+            axisLengthSquared += axis[c] * axis[c];
+        }
+        if (axisLengthSquared < 1e-6f) {
+            for (int c = 0; c < channelCount; c++) {
+                e0[c] = e1[c] = mean[c];
+            }
+            return;
+        }
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float t = 0.0f;
+            for (int c = 0; c < channelCount; c++) {
+                t += (channels[c][i] - mean[c]) * axis[c];
+            }
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        for (int c = 0; c < channelCount; c++) {
+            e0[c] = clamp255(mean[c] + axis[c] * minT / axisLengthSquared);
+            e1[c] = clamp255(mean[c] + axis[c] * maxT / axisLengthSquared);
+        }
+    }
+
+    // Least squares fit of the endpoints to the chosen texel weights (fraction of e1), keeps them if the system is singular
+    void refineEndpoints(const float* const* channels, int channelCount, const int32_t steps[16], int stepCount, float e0[4], float e1[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ap[4] = {}, bp[4] = {};
+        for (int i = 0; i < 16; i++) {
+            const float w = float(steps[i]) / float(stepCount - 1);
+            aa += (1.0f - w) * (1.0f - w);
+            ab += (1.0f - w) * w;
+            bb += w * w;
+            for (int c = 0; c < channelCount; c++) {
+                ap[c] += (1.0f - w) * channels[c][i];
+                bp[c] += w * channels[c][i];
+            }
+        }
+        const float det = aa * bb - ab * ab;
+        if (std::fabs(det) < 1e-6f) {
+            return;
+        }
+        for (int c = 0; c < channelCount; c++) {
+            e0[c] = clamp255((bb * ap[c] - ab * bp[c]) / det);
+            e1[c] = clamp255((aa * bp[c] - ab * ap[c]) / det);
+        }
+    }
+
+    uint16_t packRGB565(const float c[3])
+    {
+        const uint16_t r = static_cast<uint16_t>(std::lround(c[0] * 31.0f / 255.0f));
+        const uint16_t g = static_cast<uint16_t>(std::lround(c[1] * 63.0f / 255.0f));
+        const uint16_t b = static_cast<uint16_t>(std::lround(c[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void unpackRGB565(uint16_t v, float c[3])
+    {
+        const uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+        c[0] = float((r << 3) | (r >> 2));
+        c[1] = float((g << 2) | (g >> 4));
+        c[2] = float((b << 3) | (b >> 2));
+    }
+
+    // BC1 color block in 4 color mode, also used by BC3
+    void encodeColor(const Block& block, uint8_t* out)
+    {
+        const float* channels[3] = { block.channels[0], block.channels[1], block.channels[2] };
+        float e0[4], e1[4];
+        int32_t steps[16];
+        fitEndpoints(channels, 3, e0, e1);
+        quantizeToLine(channels, 3, e0, e1, 4, steps);
+        refineEndpoints(channels, 3, steps, 4, e0, e1);
+
+        uint16_t c0 = packRGB565(e0);
+        uint16_t c1 = packRGB565(e1);
+        uint32_t indices = 0;
+        if (c0 != c1) {
+            float q0[3], q1[3];
+            unpackRGB565(c0, q0);
+            unpackRGB565(c1, q1);
+            quantizeToLine(channels, 3, q0, q1, 4, steps);
+            // c0 > c1 selects the 4 color mode
+            if (c0 < c1) {
+                std::swap(c0, c1);
+                for (int i = 0; i < 16; i++) {
+                    steps[i] = 3 - steps[i];
+                }
+            }
+            // Steps from c0 to c1 map to palette entries 0, 2, 3, 1
+            static const uint32_t paletteIndex[4] = { 0, 2, 3, 1 };
+            for (int i = 0; i < 16; i++) {
+                indices |= paletteIndex[steps[i]] << (2 * i);
+            }
+        }
+        out[0] = c0 & 0xff;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xff;
+        out[3] = c1 >> 8;
+        for (int i = 0; i < 4; i++) {
+            out[4 + i] = (indices >> (8 * i)) & 0xff;
+        }
+    }
+
+    // BC4 block of a single channel in 8 value mode
+    void encodeChannel(const float* values, uint8_t* out)
+    {
+        float minValue = 255.0f, maxValue = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            minValue = std::min(minValue, values[i]);
+            maxValue = std::max(maxValue, values[i]);
+        }
+        const uint8_t a0 = static_cast<uint8_t>(std::lround(maxValue));
+        const uint8_t a1 = static_cast<uint8_t>(std::lround(minValue));
+        uint64_t indices = 0;
+        if (a0 != a1) {
+            const float e0 = a0, e1 = a1;
+            int32_t steps[16];
+            quantizeToLine(&values, 1, &e0, &e1, 8, steps);
+            // Steps from a0 to a1 map to palette entries 0, 2, 3, 4, 5, 6, 7, 1
+            for (int i = 0; i < 16; i++) {
+                const uint64_t index = (steps[i] == 0) ? 0 : (steps[i] == 7) ? 1 : steps[i] + 1;
+                indices |= index << (3 * i);
+            }
+        }
+        out[0] = a0;
+        out[1] = a1;
+        for (int i = 0; i < 6; i++) {
+            out[2 + i] = (indices >> (8 * i)) & 0xff;
+        }
+    }
+
+    // Writes bit fields LSB first, as BC7 blocks are laid out
+    struct BitWriter {
+        uint8_t* data;
+        uint32_t position = 0;
+        explicit BitWriter(uint8_t* data) : data(data) { std::memset(data, 0, 16); }
+        void write(uint32_t value, uint32_t bits)
+        {
+            for (uint32_t i = 0; i < bits; i++, position++) {
+                data[position / 8] |= ((value >> i) & 1) << (position % 8);
+            }
+        }
+    };
+
+    // Quantize an endpoint to 7 bits per channel plus a shared p-bit, picking the p-bit with the lower error
+    void quantizeBC7Endpoint(const float e[4], uint32_t q[4], uint32_t* pBit)
+    {
+        float bestError = 1e30f;
+        for (uint32_t p = 0; p < 2; p++) {
+            uint32_t candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++) {
+                const long v = std::lround((e[c] - float(p)) / 2.0f);
+                candidate[c] = static_cast<uint32_t>(std::min(127L, std::max(0L, v)));
+                const float d = float((candidate[c] << 1) | p) - e[c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                std::copy(candidate, candidate + 4, q);
+                *pBit = p;
+            }
+        }
+    }
+}
+
+namespace BlockEncoder
+{
+    void encodeBC1(const uint8_t texels[16 * 4], uint8_t* block)
+    {
+        Block b;
+        loadBlock(texels, b);
+        encodeColor(b, block);
+    }
+
+    void encodeBC3(const uint8_t texels[16 * 4], uint8_t* block)
+    {
+        Block b;
+        loadBlock(texels, b);
+        encodeChannel(b.channels[3], block);
+        encodeColor(b, block + 8);
+    }
+
+    void encodeBC5(const uint8_t texels[16 * 4], uint8_t* block)
+    {
+        Block b;
+        loadBlock(texels, b);
+        encodeChannel(b.channels[0], block);
+        encodeChannel(b.channels[1], block + 8);
+    }
+
+    void encodeBC7(const uint8_t texels[16 * 4], uint8_t* block)
+    {
+        static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        Block b;
+        loadBlock(texels, b);
+        const float* channels[4] = { b.channels[0], b.channels[1], b.channels[2], b.channels[3] };
+        float e0[4], e1[4];
+        int32_t indices[16];
+        fitEndpoints(channels, 4, e0, e1);
+        quantizeToLine(channels, 4, e0, e1, 16, indices);
+        refineEndpoints(channels, 4, indices, 16, e0, e1);
+
+        uint32_t q0[4], q1[4], p0, p1;
+        quantizeBC7Endpoint(e0, q0, &p0);
+        quantizeBC7Endpoint(e1, q1, &p1);
+        uint32_t v0[4], v1[4];
+        float f0[4], f1[4];
+        for (int c = 0; c < 4; c++) {
+            v0[c] = (q0[c] << 1) | p0;
+            v1[c] = (q1[c] << 1) | p1;
+            f0[c] = float(v0[c]);
+            f1[c] = float(v1[c]);
+        }
+
+        // The weights are close to evenly spaced, so the projection is only off by one at most
+        quantizeToLine(channels, 4, f0, f1, 16, indices);
+        for (int i = 0; i < 16; i++) {
+            int32_t best = indices[i];
+            uint32_t bestError = UINT32_MAX;
+            for (int32_t candidate = std::max(0, indices[i] - 1); candidate <= std::min(15, indices[i] + 1); candidate++) {
+                uint32_t error = 0;
+                for (int c = 0; c < 4; c++) {
+                    const int32_t value = static_cast<int32_t>(((64 - weights[candidate]) * v0[c] + weights[candidate] * v1[c] + 32) >> 6);
+                    const int32_t d = value - static_cast<int32_t>(b.channels[c][i]);
+                    error += static_cast<uint32_t>(d * d);
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = candidate;
+                }
+            }
+            indices[i] = best;
+        }
+
+        // The index of the first texel is stored without its most significant bit, which therefore has to be zero
+        if (indices[0] & 8) {
+            std::swap(q0, q1);
+            std::swap(p0, p1);
+            for (int i = 0; i < 16; i++) {
+                indices[i] = 15 - indices[i];
+            }
+        }
+
+        BitWriter writer(block);
+        writer.write(1 << 6, 7);
+        for (int c = 0; c < 4; c++) {
+            writer.write(q0[c], 7);
+            writer.write(q1[c], 7);
+        }
+        writer.write(p0, 1);
+        writer.write(p1, 1);
+        writer.write(indices[0], 3);
+        for (int i = 1; i < 16; i++) {
+            writer.write(indices[i], 4);
+        }
+    }
+
+    const char* simdPath()
+    {
+#if defined(BLOCK_ENCODER_SSE2)
+        return "SSE2";
+#elif defined(BLOCK_ENCODER_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+}
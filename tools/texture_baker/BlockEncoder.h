@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+* Block compression encoders for 4x4 texel blocks
+*
+* Endpoints are fitted along the principal axis of the block and refined with one least squares pass, the
+* index search of all 16 texels runs four at a time with SSE2 or NEON (scalar fallback otherwise).
+* All encoders take the block as 16 RGBA8 texels in row-major order.
+*/
+namespace BlockEncoder
+{
+    /** @brief 8 byte block, RGB with 2 bit indices (always 4 color mode, alpha is ignored) */
+    void encodeBC1(const uint8_t texels[16 * 4], uint8_t* block);
+    /** @brief 16 byte block, BC4 alpha followed by a BC1 color block */
+    void encodeBC3(const uint8_t texels[16 * 4], uint8_t* block);
+    /** @brief 16 byte block, two BC4 blocks for the red and green channels (e.g. tangent space normals) */
+    void encodeBC5(const uint8_t texels[16 * 4], uint8_t* block);
+    /** @brief 16 byte block, BC7 mode 6 (single subset RGBA, 7 bit endpoints with p-bits and 4 bit indices) */
+    void encodeBC7(const uint8_t texels[16 * 4], uint8_t* block);
+
+    /** @brief Name of the SIMD path the encoders were compiled with */
+    const char* simdPath();
+}
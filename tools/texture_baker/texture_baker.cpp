@@ -0,0 +1,319 @@
+/*
+* Offline texture baker
+*
+* Converts source images (png, jpg, tga, ...) to ktx files with a precomputed mip chain in a block compressed
+* format, so loading them at runtime is a plain copy instead of decoding, blitting and uploading uncompressed data.
+* MParser picks up a baked <name>.ktx placed next to the source image automatically.
+*
+* Usage: texture_baker [-f bc1|bc3|bc5|bc7|auto] [--srgb] [-o outputdir] images...
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#include <ktx.h>
+
+#include "threadpool.hpp"
+#include "BlockEncoder.h"
+
+namespace
+{
+    enum class Format { Auto, BC1, BC3, BC5, BC7 };
+
+    struct Options {
+        Format format = Format::Auto;
+        bool srgb = false;
+        std::string outputDir;
+        std::vector<std::string> inputs;
+    };
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> texels;
+    };
+
+    // OpenGL internal formats, ktx 1 stores those instead of Vulkan formats
+    const uint32_t GL_COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+    const uint32_t GL_COMPRESSED_SRGB_S3TC_DXT1 = 0x8C4C;
+    const uint32_t GL_COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+    const uint32_t GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5 = 0x8C4F;
+    const uint32_t GL_COMPRESSED_RG_RGTC2 = 0x8DBD;
+    const uint32_t GL_COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C;
+    const uint32_t GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM = 0x8E8D;
+
+    const char* formatName(Format format)
+    {
+        switch (format) {
+            case Format::BC1: return "BC1";
+            case Format::BC3: return "BC3";
+            case Format::BC5: return "BC5";
+            case Format::BC7: return "BC7";
+            default: return "auto";
+        }
+    }
+
+    uint32_t blockSize(Format format)
+    {
+        return (format == Format::BC1) ? 8 : 16;
+    }
+
+    uint32_t glInternalFormat(Format format, bool srgb)
+    {
+        switch (format) {
+            case Format::BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1 : GL_COMPRESSED_RGB_S3TC_DXT1;
+            case Format::BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5 : GL_COMPRESSED_RGBA_S3TC_DXT5;
+            case Format::BC5: return GL_COMPRESSED_RG_RGTC2;
+            default: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        }
+    }
+
+    float srgbToLinear(float c)
+    {
+        return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float linearToSrgb(float c)
+    {
+        return (c <= 0.0031308f) ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    }
+
+    /**
+    * Downsample a level with a 2x2 box filter
+    *
+    * @param srgb Average the color channels in linear space
+    * @note Odd sizes clamp the last row/column instead of filtering three texels
+    */
+    Level downsample(const Level& source, bool srgb)
+    {
+        Level level;
+        level.width = std::max(1u, source.width / 2);
+        level.height = std::max(1u, source.height / 2);
+        level.texels.resize(level.width * level.height * 4);
+        for (uint32_t y = 0; y < level.height; y++) {
+            for (uint32_t x = 0; x < level.width; x++) {
+                const uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                const uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+                const uint8_t* texels[4] = {
+                    &source.texels[(y0 * source.width + x0) * 4],
+                    &source.texels[(y0 * source.width + x1) * 4],
+                    &source.texels[(y1 * source.width + x0) * 4],
+                    &source.texels[(y1 * source.width + x1) * 4]
+                };
+                uint8_t* target = &level.texels[(y * level.width + x) * 4];
+                for (uint32_t c = 0; c < 4; c++) {
+                    float sum = 0.0f;
+                    for (uint32_t i = 0; i < 4; i++) {
+                        const float value = texels[i][c] / 255.0f;
+                        sum += (srgb && (c < 3)) ? srgbToLinear(value) : value;
+                    }
+                    float average = sum / 4.0f;
+                    if (srgb && (c < 3)) {
+                        average = linearToSrgb(average);
+                    }
+                    target[c] = static_cast<uint8_t>(std::lround(std::min(1.0f, std::max(0.0f, average)) * 255.0f));
+                }
+            }
+        }
+        return level;
+    }
+
+    /**
+    * Encode all blocks of a level, rows of blocks are distributed over the shared thread pool
+    *
+    * @return Compressed level in the row-major block order expected by ktx
+    */
+    std::vector<uint8_t> encodeLevel(const Level& level, Format format)
+    {
+        const uint32_t blocksX = (level.width + 3) / 4;
+        const uint32_t blocksY = (level.height + 3) / 4;
+        const uint32_t size = blockSize(format);
+        std::vector<uint8_t> blocks(blocksX * blocksY * size);
+
+        ThreadPool& pool = ThreadPool::shared();
+        for (uint32_t by = 0; by < blocksY; by++) {
+            pool.enqueue([&level, &blocks, format, blocksX, size, by] {
+                uint8_t texels[16 * 4];
+                for (uint32_t bx = 0; bx < blocksX; bx++) {
+                    // Blocks crossing the edge of the level repeat the last row/column
+                    for (uint32_t y = 0; y < 4; y++) {
+                        for (uint32_t x = 0; x < 4; x++) {
+                            const uint32_t sx = std::min(bx * 4 + x, level.width - 1);
+                            const uint32_t sy = std::min(by * 4 + y, level.height - 1);
+                            const uint8_t* texel = &level.texels[(sy * level.width + sx) * 4];
+                            std::copy(texel, texel + 4, &texels[(y * 4 + x) * 4]);
+                        }
+                    }
+                    uint8_t* block = &blocks[(by * blocksX + bx) * size];
+                    switch (format) {
+                        case Format::BC1: BlockEncoder::encodeBC1(texels, block); break;
+                        case Format::BC3: BlockEncoder::encodeBC3(texels, block); break;
+                        case Format::BC5: BlockEncoder::encodeBC5(texels, block); break;
+                        default: BlockEncoder::encodeBC7(texels, block); break;
+                    }
+                }
+            });
+        }
+        pool.wait();
+        return blocks;
+    }
+
+    bool hasAlpha(const Level& level)
+    {
+        for (size_t i = 3; i < level.texels.size(); i += 4) {
+            if (level.texels[i] != 255) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string outputPath(const std::string& input, const std::string& outputDir)
+    {
+        std::string stem = input.substr(0, input.find_last_of('.'));
+        if (outputDir.empty()) {
+            return stem + ".ktx";
+        }
+        const size_t separator = stem.find_last_of("/\\");
+        if (separator != std::string::npos) {
+            stem = stem.substr(separator + 1);
+        }
+        return outputDir + '/' + stem + ".ktx";
+    }
+
+    /**
+    * Bake a single image
+    *
+    * @return True if the ktx file was written
+    */
+    bool bake(const std::string& input, const Options& options)
+    {
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        int width, height, components;
+        stbi_uc* data = stbi_load(input.c_str(), &width, &height, &components, STBI_rgb_alpha);
+        if (!data) {
+            std::cerr << "Could not load " << input << ": " << stbi_failure_reason() << "\n";
+            return false;
+        }
+        std::vector<Level> levels(1);
+        levels[0].width = width;
+        levels[0].height = height;
+        levels[0].texels.assign(data, data + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(data);
+
+        while ((levels.back().width > 1) || (levels.back().height > 1)) {
+            levels.push_back(downsample(levels.back(), options.srgb));
+        }
+
+        Format format = options.format;
+        if (format == Format::Auto) {
+            format = hasAlpha(levels[0]) ? Format::BC7 : Format::BC1;
+        }
+
+        ktxTextureCreateInfo createInfo = {};
+        createInfo.glInternalformat = glInternalFormat(format, options.srgb);
+        createInfo.baseWidth = width;
+        createInfo.baseHeight = height;
+        createInfo.baseDepth = 1;
+        createInfo.numDimensions = 2;
+        createInfo.numLevels = static_cast<uint32_t>(levels.size());
+        createInfo.numLayers = 1;
+        createInfo.numFaces = 1;
+        createInfo.isArray = KTX_FALSE;
+        createInfo.generateMipmaps = KTX_FALSE;
+
+        ktxTexture* texture;
+        KTX_error_code result = ktxTexture_Create(&createInfo, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &texture);
+        if (result != KTX_SUCCESS) {
+            std::cerr << "Could not create ktx texture for " << input << ": " << ktxErrorString(result) << "\n";
+            return false;
+        }
+        size_t compressedSize = 0;
+        for (uint32_t i = 0; i < levels.size(); i++) {
+            std::vector<uint8_t> blocks = encodeLevel(levels[i], format);
+            compressedSize += blocks.size();
+            result = ktxTexture_SetImageFromMemory(texture, i, 0, 0, blocks.data(), blocks.size());
+            if (result != KTX_SUCCESS) {
+                break;
+            }
+        }
+        const std::string output = outputPath(input, options.outputDir);
+        if (result == KTX_SUCCESS) {
+            result = ktxTexture_WriteToNamedFile(texture, output.c_str());
+        }
+        ktxTexture_Destroy(texture);
+        if (result != KTX_SUCCESS) {
+            std::cerr << "Could not write " << output << ": " << ktxErrorString(result) << "\n";
+            return false;
+        }
+
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        std::cout << input << " -> " << output << " (" << width << "x" << height << ", " << levels.size() << " levels, "
+            << formatName(format) << (options.srgb ? " sRGB" : "") << ", " << compressedSize / 1024 << " KiB, " << tDiff << " ms)\n";
+        return true;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: texture_baker [-f bc1|bc3|bc5|bc7|auto] [--srgb] [-o outputdir] images...\n"
+            << "  -f      Block compression format, auto (default) uses BC1 for opaque images and BC7 otherwise\n"
+            << "          BC5 only keeps the red and green channels\n"
+            << "  --srgb  Color data is sRGB, mips are filtered in linear space and the sRGB format variant is stored\n"
+            << "  -o      Output directory, defaults to writing <name>.ktx next to each image\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-f") && (i + 1 < argc)) {
+            const std::string value = argv[++i];
+            if (value == "bc1") {
+                options.format = Format::BC1;
+            } else if (value == "bc3") {
+                options.format = Format::BC3;
+            } else if (value == "bc5") {
+                options.format = Format::BC5;
+            } else if (value == "bc7") {
+                options.format = Format::BC7;
+            } else if (value == "auto") {
+                options.format = Format::Auto;
+            } else {
+                std::cerr << "Unknown format " << value << "\n";
+                return 1;
+            }
+        } else if (arg == "--srgb") {
+            options.srgb = true;
+        } else if ((arg == "-o") && (i + 1 < argc)) {
+            options.outputDir = argv[++i];
+        } else if ((arg == "-h") || (arg == "--help")) {
+            printUsage();
+            return 0;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.inputs.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    std::cout << "Encoding with " << BlockEncoder::simdPath() << " on " << ThreadPool::shared().threadCount() << " threads\n";
+    int failed = 0;
+    for (auto& input : options.inputs) {
+        if (!bake(input, options)) {
+            failed++;
+        }
+    }
+    return (failed == 0) ? 0 : 1;
+}
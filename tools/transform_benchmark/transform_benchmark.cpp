@@ -0,0 +1,184 @@
+/*
+* Node transform benchmark
+*
+* Builds a synthetic node hierarchy with random translations, rotations, scales and node matrices, and recomputes the
+* world matrix of every node, as after an animation update that touched all of them:
+* - with Node::localMatrix and glm, parents first, as Model::updateTransforms did node by node
+* - with the scalar kernel of TransformBatch
+* - with the SIMD kernel of TransformBatch the build selected (AVX2 needs BASE_AVX2)
+* - with the SIMD kernel, including copying the transforms from the nodes and the world matrices back, which is what
+*   Model::updateTransforms does when every node changed
+*
+* Usage: transform_benchmark [-b branching] [-r repeats] [node counts...]
+* e.g.   transform_benchmark -b 4 1000 10000 100000
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+
+#include "ModelParser.h"
+#include "TransformBatch.h"
+
+namespace
+{
+    struct Options {
+        uint32_t branching = 4;
+        uint32_t repeats = 5;
+        std::vector<uint32_t> nodeCounts;
+    };
+
+    double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Best of several runs, the first one also pays for page faults
+    double measure(uint32_t repeats, const std::function<void()>& run)
+    {
+        double best = 0.0;
+        for (uint32_t i = 0; i < repeats; i++) {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            run();
+            const double ms = elapsedMs(tStart);
+            best = (i == 0) ? ms : std::min(best, ms);
+        }
+        return best;
+    }
+
+    // Tree in breadth first order, node i > 0 is a child of (i - 1) / branching so parents come first
+    void buildHierarchy(std::vector<MParser::Node>& nodes, std::vector<int32_t>& parents, uint32_t branching)
+    {
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            MParser::Node& node = nodes[i];
+            parents[i] = (i == 0) ? -1 : static_cast<int32_t>((i - 1) / branching);
+            node.parent = (i == 0) ? nullptr : &nodes[parents[i]];
+            node.geo = nullptr;
+            node.skin = nullptr;
+            node.translation = glm::vec3(unit(random), unit(random), unit(random));
+            node.rotation = glm::normalize(glm::quat(unit(random), unit(random), unit(random), unit(random)));
+            node.scale = glm::vec3(1.0f + 0.1f * unit(random));
+            node.matrix = glm::translate(glm::mat4(1.0f), glm::vec3(unit(random), unit(random), unit(random)));
+        }
+    }
+
+    void copyToBatch(const std::vector<MParser::Node>& nodes, TransformBatch& batch)
+    {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const MParser::Node& node = nodes[i];
+            const float rotation[4] = { node.rotation.x, node.rotation.y, node.rotation.z, node.rotation.w };
+            batch.setTransform(i, glm::value_ptr(node.translation), rotation, glm::value_ptr(node.scale));
+            batch.setMatrix(i, glm::value_ptr(node.matrix));
+        }
+    }
+
+    // Largest difference of a world matrix element relative to the magnitude of the matrix
+    float maxDifference(const std::vector<MParser::Node>& nodes, const TransformBatch& batch)
+    {
+        float difference = 0.0f;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            glm::mat4 world;
+            batch.getWorldMatrix(i, glm::value_ptr(world));
+            const float* expected = glm::value_ptr(nodes[i].worldMatrix);
+            const float* actual = glm::value_ptr(world);
+            float magnitude = 1.0f;
+            for (int e = 0; e < 16; e++) {
+                magnitude = std::max(magnitude, std::abs(expected[e]));
+            }
+            for (int e = 0; e < 16; e++) {
+                difference = std::max(difference, std::abs(expected[e] - actual[e]) / magnitude);
+            }
+        }
+        return difference;
+    }
+
+    void benchmark(uint32_t nodeCount, const Options& options)
+    {
+        std::vector<MParser::Node> nodes(nodeCount);
+        std::vector<int32_t> parents(nodeCount);
+        buildHierarchy(nodes, parents, options.branching);
+
+        TransformBatch batch;
+        batch.build(parents);
+        copyToBatch(nodes, batch);
+
+        const double glmMs = measure(options.repeats, [&]() {
+            for (auto& node : nodes) {
+                const glm::mat4 localMatrix = node.localMatrix();
+                node.worldMatrix = node.parent ? node.parent->worldMatrix * localMatrix : localMatrix;
+            }
+        });
+        const double scalarMs = measure(options.repeats, [&]() {
+            batch.update(false);
+        });
+        const float scalarDifference = maxDifference(nodes, batch);
+        const double simdMs = measure(options.repeats, [&]() {
+            batch.update(true);
+        });
+        const float simdDifference = maxDifference(nodes, batch);
+        const double copyMs = measure(options.repeats, [&]() {
+            copyToBatch(nodes, batch);
+            batch.update(true);
+            for (size_t i = 0; i < nodes.size(); i++) {
+                batch.getWorldMatrix(i, glm::value_ptr(nodes[i].worldMatrix));
+            }
+        });
+
+        uint32_t depth = 0;
+        for (const MParser::Node* node = &nodes.back(); node->parent; node = node->parent) {
+            depth++;
+        }
+        const std::string simd = std::string("batch ") + TransformBatch::simdPath();
+        std::cout << nodeCount << " nodes, depth " << depth << "\n";
+        std::cout << "  Node::localMatrix       " << glmMs << " ms, " << glmMs * 1e6 / nodeCount << " ns/node\n";
+        std::cout << "  batch scalar            " << scalarMs << " ms (" << glmMs / scalarMs << "x), max difference " << scalarDifference << "\n";
+        std::cout << "  " << simd << std::string(24 - simd.size(), ' ') << simdMs << " ms (" << glmMs / simdMs << "x), max difference " << simdDifference << "\n";
+        std::cout << "  with node copies        " << copyMs << " ms (" << glmMs / copyMs << "x)\n";
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: transform_benchmark [-b branching] [-r repeats] [node counts...]\n"
+            << "  -b  Children per node of the synthetic hierarchy (default 4)\n"
+            << "  -r  Runs per measurement, the fastest one is reported (default 5)\n"
+            << "  Node counts default to 1000 10000 100000\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-b") && (i + 1 < argc)) {
+            options.branching = std::max(1, std::atoi(argv[++i]));
+        } else if ((arg == "-r") && (i + 1 < argc)) {
+            options.repeats = std::max(1, std::atoi(argv[++i]));
+        } else if ((arg == "-h") || (arg == "--help")) {
+            printUsage();
+            return 0;
+        } else if (std::atoi(arg.c_str()) > 0) {
+            options.nodeCounts.push_back(static_cast<uint32_t>(std::atoi(arg.c_str())));
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (options.nodeCounts.empty()) {
+        options.nodeCounts = { 1000, 10000, 100000 };
+    }
+
+    std::cout << "Transform batch compiled for " << TransformBatch::simdPath() << "\n";
+    for (uint32_t nodeCount : options.nodeCounts) {
+        benchmark(nodeCount, options);
+    }
+    return 0;
+}